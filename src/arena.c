@@ -0,0 +1,76 @@
+/* arena.c
+ * Allocate lots of small objects of the same size efficiently
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "arena.h"
+
+/* Each block starts with this header (padded to keep the objects after it
+ * aligned). */
+struct arena_block {
+   arena_block *next;
+};
+
+#define HEADER_SIZE ARENA_ROUND(sizeof(arena_block))
+
+/* The first block for each arena holds this many objects, and each block
+ * after that is twice the size of the one before, up to a limit.  This
+ * keeps the overhead low for small surveys without needing lots of blocks
+ * for large ones.
+ */
+#define FIRST_BLOCK_OBJECTS 64
+#define MAX_BLOCK_OBJECTS 65536
+
+void
+arena_grow(arena *a)
+{
+   unsigned long n = FIRST_BLOCK_OBJECTS;
+   OSSIZE_T len;
+   arena_block *block;
+   if (a->n_blocks) {
+      n <<= (a->n_blocks < 10 ? a->n_blocks : 10);
+      if (n > MAX_BLOCK_OBJECTS) n = MAX_BLOCK_OBJECTS;
+   }
+   len = HEADER_SIZE + n * a->size;
+   block = osmalloc(len);
+   block->next = a->blocks;
+   a->blocks = block;
+   a->next = (char *)block + HEADER_SIZE;
+   a->end = a->next + n * a->size;
+   a->n_blocks++;
+   a->bytes += len;
+}
+
+void
+arena_release(arena *a)
+{
+   arena_block *block = a->blocks;
+   while (block) {
+      arena_block *next = block->next;
+      osfree(block);
+      block = next;
+   }
+   a->blocks = NULL;
+   a->next = a->end = NULL;
+   a->free_list = NULL;
+   a->n_live = a->n_blocks = 0;
+   a->bytes = 0;
+}
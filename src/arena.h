@@ -0,0 +1,100 @@
+/* arena.h
+ * Allocate lots of small objects of the same size efficiently
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "osalloc.h"
+
+/* An arena hands out objects of one size from large blocks obtained with
+ * osmalloc(), which is much cheaper than calling osmalloc() for each object
+ * and keeps objects allocated together close together in memory.  Freed
+ * objects go on a free list for reuse - the blocks are only released by
+ * arena_release().
+ *
+ * Arenas aren't thread-safe.
+ */
+
+typedef struct arena_block arena_block;
+
+typedef struct {
+   const char *name;
+   /* Size of each object, rounded up so objects are suitably aligned. */
+   OSSIZE_T size;
+   /* Unused space at the end of the current block. */
+   char *next, *end;
+   void *free_list;
+   arena_block *blocks;
+   /* Statistics */
+   unsigned long n_live, n_peak, n_blocks;
+   OSSIZE_T bytes;
+} arena;
+
+/* Alignment needed for any object we might put in an arena. */
+typedef union { void *p; double d; long l; } arena_align;
+
+#define ARENA_ROUND(S) \
+   (((S) + sizeof(arena_align) - 1) / sizeof(arena_align) * sizeof(arena_align))
+
+/* Initialiser for an arena of objects of type T, e.g.:
+ *
+ * arena node_arena = ARENA_INIT("node", node);
+ */
+#define ARENA_INIT(NAME, T) \
+   { (NAME), ARENA_ROUND(sizeof(T)), NULL, NULL, NULL, NULL, 0, 0, 0, 0 }
+
+/* Get a new block for arena a (used by arena_alloc()). */
+void arena_grow(arena *a);
+
+/* Release all the memory used by arena a, including objects which haven't
+ * been freed. */
+void arena_release(arena *a);
+
+/* Allocate an object from arena a. */
+static inline void *
+arena_alloc(arena *a)
+{
+   void *p = a->free_list;
+   if (p) {
+      a->free_list = *(void **)p;
+   } else {
+      if (a->next == a->end) arena_grow(a);
+      p = a->next;
+      a->next += a->size;
+   }
+   if (++a->n_live > a->n_peak) a->n_peak = a->n_live;
+   return p;
+}
+
+/* Return object p to arena a. */
+static inline void
+arena_free(arena *a, void *p)
+{
+   *(void **)p = a->free_list;
+   a->free_list = p;
+   --a->n_live;
+}
+
+/* Allocate like osnew(T), from the arena T##_arena */
+#define arena_new(T) ((T *)arena_alloc(&T##_arena))
+
+/* Free P which was allocated by arena_new(T) */
+#define arena_delete(T, P) arena_free(&T##_arena, (P))
+
+#endif
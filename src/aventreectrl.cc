@@ -160,7 +160,7 @@ void AvenTreeCtrl::FillTree(const wxString& root_name)
     wxString current_prefix;
     wxTreeItemId current_id = treeroot;
 
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
 
@@ -487,7 +487,7 @@ void AvenTreeCtrl::OnHide(wxCommandEvent&)
     }
     Thaw();
 #endif
-    m_Parent->ForceFullRedraw();
+    m_Parent->FilterChanged();
 }
 
 void AvenTreeCtrl::OnShow(wxCommandEvent&)
@@ -518,7 +518,7 @@ void AvenTreeCtrl::OnShow(wxCommandEvent&)
 	}
     }
     Thaw();
-    m_Parent->ForceFullRedraw();
+    m_Parent->FilterChanged();
 }
 
 void AvenTreeCtrl::OnHideSiblings(wxCommandEvent&)
@@ -542,7 +542,7 @@ void AvenTreeCtrl::OnHideSiblings(wxCommandEvent&)
 	SetItemState(i, data->IsStation() ? STATE_BLANK : STATE_OFF);
     }
     Thaw();
-    m_Parent->ForceFullRedraw();
+    m_Parent->FilterChanged();
 }
 
 void AvenTreeCtrl::OnStateClick(wxTreeEvent& e)
@@ -564,5 +564,5 @@ void AvenTreeCtrl::OnStateClick(wxTreeEvent& e)
 	    break;
     }
     e.Skip();
-    m_Parent->ForceFullRedraw();
+    m_Parent->FilterChanged();
 }
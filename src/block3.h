@@ -0,0 +1,199 @@
+/* block3.h
+ * Inline arithmetic on 3x3 matrices, shared by the network reduction code
+ * and the block sparse matrix solver
+ * Copyright (C) 1992-2003 Olly Betts
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef BLOCK3_H
+#define BLOCK3_H
+
+/* These take plain pointers rather than pointers to array types so that
+ * const works as expected.  Vectors have 3 elements, and results mustn't
+ * overlap arguments unless noted otherwise.
+ */
+
+/* A general 3x3 matrix, stored by rows. */
+typedef real block3[9];
+
+/* A symmetric 3x3 matrix is stored as its 6 unique elements, in the same
+ * order as svar:
+ *
+ * 0 3 4
+ * 3 1 5
+ * 4 5 2
+ */
+#define SYM3(V, A, B) ((V)[(A) == (B) ? (A) : 2 + (A) + (B)])
+
+/* inv = v^-1 ; inv,v symmetric.  Returns 0 if v is singular. */
+static inline int
+sym3_invert(real *inv, const real *v)
+{
+   real det, a, b, c, d, e, f, bcff, efcd, dfbe;
+
+   /* a d e
+    * d b f
+    * e f c
+    */
+   a = v[0], b = v[1], c = v[2];
+   d = v[3], e = v[4], f = v[5];
+   bcff = b * c - f * f;
+   efcd = e * f - c * d;
+   dfbe = d * f - b * e;
+   det = a * bcff + d * efcd + e * dfbe;
+
+   if (det == 0.0) return 0; /* matrix is singular */
+
+   det = 1 / det;
+
+   inv[0] = det * bcff;
+   inv[1] = det * (c * a - e * e);
+   inv[2] = det * (a * b - d * d);
+   inv[3] = det * efcd;
+   inv[4] = det * dfbe;
+   inv[5] = det * (e * d - a * f);
+   return 1;
+}
+
+/* r = sx ; s symmetric */
+static inline void
+sym3_mul_vec(real *r, const real *s, const real *x)
+{
+   r[0] = s[0] * x[0] + s[3] * x[1] + s[4] * x[2];
+   r[1] = s[3] * x[0] + s[1] * x[1] + s[5] * x[2];
+   r[2] = s[4] * x[0] + s[5] * x[1] + s[2] * x[2];
+}
+
+/* r = ab ; a,b symmetric */
+static inline void
+sym3_mul(real *r, const real *a, const real *b)
+{
+   int i, j;
+   for (i = 0; i < 3; i++) {
+      for (j = 0; j < 3; j++) {
+	 r[i * 3 + j] = SYM3(a, i, 0) * SYM3(b, 0, j) +
+			SYM3(a, i, 1) * SYM3(b, 1, j) +
+			SYM3(a, i, 2) * SYM3(b, 2, j);
+      }
+   }
+}
+
+static inline void
+block3_zero(real *r)
+{
+   int i;
+   for (i = 0; i < 9; i++) r[i] = (real)0.0;
+}
+
+/* r += a (r and a may be the same) */
+static inline void
+block3_add(real *r, const real *a)
+{
+   int i;
+   for (i = 0; i < 9; i++) r[i] += a[i];
+}
+
+/* r += s ; s symmetric */
+static inline void
+block3_add_sym3(real *r, const real *s)
+{
+   r[0] += s[0]; r[1] += s[3]; r[2] += s[4];
+   r[3] += s[3]; r[4] += s[1]; r[5] += s[5];
+   r[6] += s[4]; r[7] += s[5]; r[8] += s[2];
+}
+
+/* r -= s ; s symmetric */
+static inline void
+block3_sub_sym3(real *r, const real *s)
+{
+   r[0] -= s[0]; r[1] -= s[3]; r[2] -= s[4];
+   r[3] -= s[3]; r[4] -= s[1]; r[5] -= s[5];
+   r[6] -= s[4]; r[7] -= s[5]; r[8] -= s[2];
+}
+
+/* r = ab */
+static inline void
+block3_mul(real *r, const real *a, const real *b)
+{
+   int i;
+   for (i = 0; i < 9; i += 3) {
+      r[i] = a[i] * b[0] + a[i + 1] * b[3] + a[i + 2] * b[6];
+      r[i + 1] = a[i] * b[1] + a[i + 1] * b[4] + a[i + 2] * b[7];
+      r[i + 2] = a[i] * b[2] + a[i + 1] * b[5] + a[i + 2] * b[8];
+   }
+}
+
+/* r -= ab' */
+static inline void
+block3_sub_mul_t(real *r, const real *a, const real *b)
+{
+   int i;
+   for (i = 0; i < 9; i += 3) {
+      r[i] -= a[i] * b[0] + a[i + 1] * b[1] + a[i + 2] * b[2];
+      r[i + 1] -= a[i] * b[3] + a[i + 1] * b[4] + a[i + 2] * b[5];
+      r[i + 2] -= a[i] * b[6] + a[i + 1] * b[7] + a[i + 2] * b[8];
+   }
+}
+
+/* r = ax */
+static inline void
+block3_mul_vec(real *r, const real *a, const real *x)
+{
+   r[0] = a[0] * x[0] + a[1] * x[1] + a[2] * x[2];
+   r[1] = a[3] * x[0] + a[4] * x[1] + a[5] * x[2];
+   r[2] = a[6] * x[0] + a[7] * x[1] + a[8] * x[2];
+}
+
+/* r -= ax */
+static inline void
+block3_sub_mul_vec(real *r, const real *a, const real *x)
+{
+   r[0] -= a[0] * x[0] + a[1] * x[1] + a[2] * x[2];
+   r[1] -= a[3] * x[0] + a[4] * x[1] + a[5] * x[2];
+   r[2] -= a[6] * x[0] + a[7] * x[1] + a[8] * x[2];
+}
+
+/* r -= a'x */
+static inline void
+block3_sub_mul_t_vec(real *r, const real *a, const real *x)
+{
+   r[0] -= a[0] * x[0] + a[3] * x[1] + a[6] * x[2];
+   r[1] -= a[1] * x[0] + a[4] * x[1] + a[7] * x[2];
+   r[2] -= a[2] * x[0] + a[5] * x[1] + a[8] * x[2];
+}
+
+/* inv = a^-1, using the lower triangle of a, which is assumed to be
+ * symmetric.  Returns 0 if a is singular.
+ */
+static inline int
+block3_invert_sym(real *inv, const real *a)
+{
+   real s[6], t[6];
+   s[0] = a[0];
+   s[1] = a[4];
+   s[2] = a[8];
+   s[3] = a[3];
+   s[4] = a[6];
+   s[5] = a[7];
+   if (!sym3_invert(t, s)) return 0;
+   inv[0] = t[0]; inv[1] = t[3]; inv[2] = t[4];
+   inv[3] = t[3]; inv[4] = t[1]; inv[5] = t[5];
+   inv[6] = t[4]; inv[7] = t[5]; inv[8] = t[2];
+   return 1;
+}
+
+#endif
@@ -38,6 +38,7 @@
 #include "filelist.h"
 #include "img_hosted.h"
 #include "listpos.h"
+#include "matrix.h"
 #include "netbits.h"
 #include "netskel.h"
 #include "osdepend.h"
@@ -74,6 +75,8 @@ bool fMute = fFalse; /* just show errors */
 bool fSuppress = fFalse; /* only output 3d file */
 static bool fLog = fFalse; /* stdout to .log file */
 static bool f_warnings_are_errors = fFalse; /* turn warnings into errors */
+static bool f_memory_stats = fFalse; /* report memory used by the network */
+bool f_compress_3d = fFalse; /* write a compressed 3d file */
 
 nosurveylink *nosurveyhead;
 
@@ -105,6 +108,11 @@ static const struct option long_opts[] = {
    {"warnings-are-errors", no_argument, 0, 'w'},
    {"log", no_argument, 0, 1},
    {"3d-version", required_argument, 0, 'v'},
+   {"solver", required_argument, 0, 3},
+   {"jobs", required_argument, 0, 4},
+   {"pcg-tolerance", required_argument, 0, 5},
+   {"memory-stats", no_argument, 0, 6},
+   {"compress-3d", no_argument, 0, 7},
 #if OS_WIN32
    {"pause", no_argument, 0, 2},
 #endif
@@ -129,6 +137,16 @@ static struct help_msg help[] = {
    {HLP_ENCODELONG(6),	      /*log output to .log file*/170, 0},
    /* TRANSLATORS: --help output for cavern --3d-version option */
    {HLP_ENCODELONG(7),	      /*specify the 3d file format version to output*/171, 0},
+   /* TRANSLATORS: --help output for cavern --solver option */
+   {HLP_ENCODELONG(8),	      /*method for solving the network: auto, dense, sparse, block, pcg or pcg-jacobi*/523, 0},
+   /* TRANSLATORS: --help output for cavern --jobs option */
+   {HLP_ENCODELONG(9),	      /*maximum number of threads to use for solving the network*/525, 0},
+   /* TRANSLATORS: --help output for cavern --pcg-tolerance option */
+   {HLP_ENCODELONG(10),	      /*relative residual at which the iterative solvers stop*/526, 0},
+   /* TRANSLATORS: --help output for cavern --memory-stats option */
+   {HLP_ENCODELONG(11),	      /*report memory used for the survey network at the end*/530, 0},
+   /* TRANSLATORS: --help output for cavern --compress-3d option */
+   {HLP_ENCODELONG(12),	      /*write a compressed 3d file*/535, 0},
  /*{'z',			"set optimizations for network reduction"},*/
    {0, 0, 0}
 };
@@ -179,11 +197,13 @@ main(int argc, char **argv)
    pcs->convergence = 0.0;
 
    /* Set up root of prefix hierarchy */
-   root = osnew(prefix);
+   root = arena_new(prefix);
    root->up = root->right = root->down = NULL;
+   root->children = NULL;
    root->stn = NULL;
    root->pos = NULL;
    root->ident = NULL;
+   root->full_name = NULL;
    root->min_export = root->max_export = 0;
    root->sflags = BIT(SFLAGS_SURVEY);
    root->filename = NULL;
@@ -256,6 +276,45 @@ main(int argc, char **argv)
        case 1:
 	 fLog = fTrue;
 	 break;
+       case 3:
+	 if (strcmp(optarg, "auto") == 0) {
+	    solver = SOLVER_AUTO;
+	 } else if (strcmp(optarg, "dense") == 0) {
+	    solver = SOLVER_DENSE;
+	 } else if (strcmp(optarg, "sparse") == 0) {
+	    solver = SOLVER_SPARSE;
+	 } else if (strcmp(optarg, "block") == 0) {
+	    solver = SOLVER_BLOCK;
+	 } else if (strcmp(optarg, "pcg") == 0) {
+	    solver = SOLVER_PCG;
+	 } else if (strcmp(optarg, "pcg-jacobi") == 0) {
+	    solver = SOLVER_PCG_JACOBI;
+	 } else {
+	    /* TRANSLATORS: %s is replaced by the argument passed to cavern's
+	     * --solver option. */
+	    fatalerror(/*Unknown solver “%s”*/524, optarg);
+	 }
+	 break;
+       case 4: {
+	 int j = cmdline_int_arg();
+	 if (j < 1)
+	    fatalerror(/*numeric argument “%s” out of range*/185, optarg);
+	 solver_jobs = j;
+	 break;
+       }
+       case 5: {
+	 double tol = cmdline_double_arg();
+	 if (tol <= 0.0 || tol >= 1.0)
+	    fatalerror(/*numeric argument “%s” out of range*/185, optarg);
+	 pcg_tolerance = tol;
+	 break;
+       }
+       case 6:
+	 f_memory_stats = fTrue;
+	 break;
+       case 7:
+	 f_compress_3d = fTrue;
+	 break;
 #if OS_WIN32
        case 2:
 	 atexit(pause_on_exit);
@@ -372,6 +431,7 @@ main(int argc, char **argv)
       }
       putnl();
    }
+   if (f_memory_stats) print_arena_stats();
    if (msg_warnings || msg_errors) {
       if (msg_errors || (f_warnings_are_errors && msg_warnings)) {
 	 printf(msg(/*There were %d warning(s) and %d error(s) - no output files produced.*/113),
@@ -388,15 +448,11 @@ main(int argc, char **argv)
 static void
 do_range(int d, int msgno, real length_factor, const char * units)
 {
-   /* sprint_prefix uses a single buffer, so to report two stations in one
-    * message we need to make a temporary copy of the string for one of them.
-    */
-   char * pfx_hi = osstrdup(sprint_prefix(pfxHi[d]));
-   char * pfx_lo = sprint_prefix(pfxLo[d]);
+   const char * pfx_hi = sprint_prefix(pfxHi[d]);
+   const char * pfx_lo = sprint_prefix(pfxLo[d]);
    real hi = max[d] * length_factor;
    real lo = min[d] * length_factor;
    printf(msg(msgno), hi - lo, units, pfx_hi, hi, units, pfx_lo, lo, units);
-   osfree(pfx_hi);
    putnl();
 }
 
@@ -213,9 +213,14 @@ typedef real svar[6];
 /* station name */
 typedef struct Prefix {
    struct Prefix *up, *down, *right;
+   /* Index of the children (down, down->right, ...) if there are many -
+    * see read_prefix() */
+   struct Prefix_index *children;
    struct Node *stn;
    struct Pos *pos;
    const char *ident;
+   /* Cached result of sprint_prefix(), or NULL if not yet needed */
+   const char *full_name;
    const char *filename;
    unsigned int line;
    /* If (min_export == 0) then max_export is max # levels above is this
@@ -370,6 +375,7 @@ extern prefix *pfxHi[3], *pfxLo[3];
 extern bool fQuiet; /* just show brief summary + errors */
 extern bool fMute; /* just show errors */
 extern bool fSuppress; /* only output 3d file */
+extern bool f_compress_3d; /* write a compressed 3d file */
 
 /* macros */
 
@@ -943,11 +943,12 @@ cmd_fix(void)
 	 }
 	 stn = StnFromPfx(fix_name);
 	 if (!fixed(stn)) {
-	    node *fixpt = osnew(node);
+	    node *fixpt = arena_new(node);
 	    prefix *name;
-	    name = osnew(prefix);
-	    name->pos = osnew(pos);
+	    name = arena_new(prefix);
+	    name->pos = arena_new(pos);
 	    name->ident = NULL;
+	    name->full_name = NULL;
 	    name->shape = 0;
 	    fixpt->name = name;
 	    name->stn = fixpt;
@@ -1089,7 +1090,7 @@ cmd_equate(void)
 static void
 report_missing_export(prefix *pfx, int depth)
 {
-   char *s;
+   const char *s;
    const char *p;
    prefix *survey = pfx;
    int i;
@@ -1097,7 +1098,7 @@ report_missing_export(prefix *pfx, int depth)
       survey = survey->up;
       SVX_ASSERT(survey);
    }
-   s = osstrdup(sprint_prefix(survey));
+   s = sprint_prefix(survey);
    p = sprint_prefix(pfx);
    if (survey->filename) {
       /* TRANSLATORS: A station must be exported out of each level it is in, so
@@ -1120,7 +1121,6 @@ report_missing_export(prefix *pfx, int depth)
    } else {
       compile_diagnostic(DIAG_ERR, /*Station “%s” not exported from survey “%s”*/26, p, s);
    }
-   osfree(s);
 }
 
 static void
@@ -24,6 +24,11 @@
 
 #include <limits.h>
 #include <stdarg.h>
+#ifdef HAVE_MMAP
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
 
 #include "debug.h"
 #include "cavern.h"
@@ -56,7 +61,7 @@ typedef enum {
 
 /* Don't explicitly initialise as we can't set the jmp_buf - this has
  * static scope so will be initialised like this anyway */
-parse file /* = { NULL, NULL, 0, fFalse, NULL } */ ;
+parse file /* = { NULL, NULL, NULL, fFalse, NULL, 0, 0, fFalse, NULL } */ ;
 
 bool f_export_ok;
 
@@ -80,17 +85,14 @@ void
 get_pos(filepos *fp)
 {
    fp->ch = ch;
-   fp->offset = ftell(file.fh);
-   if (fp->offset == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   fp->offset = file_offset();
 }
 
 void
 set_pos(const filepos *fp)
 {
    ch = fp->ch;
-   if (fseek(file.fh, fp->offset, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   file.next = file.buf + fp->offset;
 }
 
 static void
@@ -121,16 +123,15 @@ error_list_parent_files(void)
 static void
 show_line(int col, int width)
 {
-   /* Rewind to beginning of line. */
-   long cur_pos = ftell(file.fh);
+   /* Start of line. */
+   const unsigned char *line = file.buf + file.lpos;
+   const unsigned char *p = line;
    int tabs = 0;
-   if (cur_pos < 0 || fseek(file.fh, file.lpos, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
 
-   /* Read the whole line and write it out. */
+   /* Write out the whole line. */
    PUTC(' ', STDERR);
    while (1) {
-      int c = GETC(file.fh);
+      int c = (p < file.end ? *p++ : EOF);
       /* Note: isEol() is true for EOF */
       if (isEol(c)) break;
       if (c == '\t') ++tabs;
@@ -146,10 +147,9 @@ show_line(int col, int width)
       } else {
 	 /* Copy tabs from line, replacing other characters with spaces - this
 	  * means that the caret should line up correctly. */
-	 if (fseek(file.fh, file.lpos, SEEK_SET) == -1)
-	    fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+	 p = line;
 	 while (--col) {
-	    int c = GETC(file.fh);
+	    int c = (p < file.end ? *p++ : EOF);
 	    if (c != '\t') c = ' ';
 	    PUTC(c, STDERR);
 	 }
@@ -161,10 +161,6 @@ show_line(int col, int width)
       }
       fputnl(STDERR);
    }
-
-   /* Revert to where we were. */
-   if (fseek(file.fh, cur_pos, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
 }
 
 static int caret_width = 0;
@@ -177,7 +173,7 @@ compile_v_report_fpos(int severity, long fpos, int en, va_list ap)
    if (fpos >= file.lpos)
       col = fpos - file.lpos - caret_width;
    v_report(severity, file.filename, file.line, col, en, ap);
-   if (file.fh) show_line(col, caret_width);
+   if (file.buf) show_line(col, caret_width);
 }
 
 static void
@@ -185,9 +181,9 @@ compile_v_report(int diag_flags, int en, va_list ap)
 {
    int severity = (diag_flags & DIAG_SEVERITY_MASK);
    if (diag_flags & (DIAG_COL|DIAG_BUF)) {
-      if (file.fh) {
+      if (file.buf) {
 	 if (diag_flags & DIAG_BUF) caret_width = strlen(buffer);
-	 compile_v_report_fpos(severity, ftell(file.fh), en, ap);
+	 compile_v_report_fpos(severity, file_offset(), en, ap);
 	 if (diag_flags & DIAG_BUF) caret_width = 0;
 	 if (diag_flags & DIAG_SKIP) skipline();
 	 return;
@@ -195,7 +191,7 @@ compile_v_report(int diag_flags, int en, va_list ap)
    }
    error_list_parent_files();
    v_report(severity, file.filename, file.line, 0, en, ap);
-   if (file.fh) {
+   if (file.buf) {
       if (diag_flags & DIAG_BUF) {
 	 show_line(0, strlen(buffer));
       } else {
@@ -396,7 +392,7 @@ process_eol(void)
       }
       if (ch == '\n') eolchar = ch;
    }
-   file.lpos = ftell(file.fh) - 1;
+   file.lpos = file_offset() - 1;
 }
 
 static bool
@@ -441,9 +437,9 @@ read_reading(reading r, bool f_optional)
 	q = Q_NULL; /* Suppress compiler warning */;
 	BUG("Unexpected case");
    }
-   LOC(r) = ftell(file.fh);
+   LOC(r) = file_offset();
    VAL(r) = read_numeric_multi(f_optional, &n_readings);
-   WID(r) = ftell(file.fh) - LOC(r);
+   WID(r) = file_offset() - LOC(r);
    VAR(r) = var(q);
    if (n_readings > 1) VAR(r) /= sqrt(n_readings);
 }
@@ -453,9 +449,9 @@ read_bearing_or_omit(reading r)
 {
    int n_readings;
    q_quantity q = Q_NULL;
-   LOC(r) = ftell(file.fh);
+   LOC(r) = file_offset();
    VAL(r) = read_numeric_multi_or_omit(&n_readings);
-   WID(r) = ftell(file.fh) - LOC(r);
+   WID(r) = file_offset() - LOC(r);
    switch (r) {
       case Comp: q = Q_BEARING; break;
       case BackComp: q = Q_BACKBEARING; break;
@@ -477,6 +473,61 @@ nextch_handling_eol(void)
    }
 }
 
+/* Read the file fh is open on into memory for parsing, and close fh.  We
+ * map the file if we can, otherwise read it in large blocks.
+ */
+static void
+load_file(FILE *fh)
+{
+   unsigned char *buf;
+   size_t len = 0, size = 65536, n;
+#ifdef HAVE_MMAP
+   struct stat st;
+   if (fstat(fileno(fh), &st) == 0 && S_ISREG(st.st_mode) &&
+       st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size) {
+      void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		     fileno(fh), 0);
+      if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+	 (void)madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+	 (void)fclose(fh);
+	 file.buf = file.next = p;
+	 file.end = file.buf + st.st_size;
+	 file.mapped = fTrue;
+	 return;
+      }
+   }
+#endif
+   buf = osmalloc(size);
+   while ((n = fread(buf + len, 1, size - len, fh)) > 0) {
+      len += n;
+      if (len == size) {
+	 size *= 2;
+	 buf = osrealloc(buf, size);
+      }
+   }
+   if (ferror(fh))
+      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   (void)fclose(fh);
+   file.buf = file.next = buf;
+   file.end = buf + len;
+   file.mapped = fFalse;
+}
+
+/* Release the memory holding the current file. */
+static void
+release_file(void)
+{
+#ifdef HAVE_MMAP
+   if (file.mapped) {
+      (void)munmap((void *)file.buf, file.end - file.buf);
+      return;
+   }
+#endif
+   osfree((void *)file.buf);
+}
+
 #define LITLEN(S) (sizeof(S"") - 1)
 #define has_ext(F,L,E) ((L) > LITLEN(E) + 1 &&\
 			(F)[(L) - LITLEN(E) - 1] == FNM_SEP_EXT &&\
@@ -513,9 +564,9 @@ data_file(const char *pth, const char *fnm)
       }
 
       file_store = file;
-      if (file.fh) file.parent = &file_store;
-      file.fh = fh;
+      if (file.buf) file.parent = &file_store;
       file.filename = filename;
+      load_file(fh);
       file.line = 1;
       file.lpos = 0;
       file.reported_where = fFalse;
@@ -526,7 +577,7 @@ data_file(const char *pth, const char *fnm)
 	    nextch();
 	    file.lpos = 3;
 	 } else {
-	    rewind(fh);
+	    file.next = file.buf;
 	    ch = 0xef;
 	 }
       }
@@ -612,7 +663,7 @@ data_file(const char *pth, const char *fnm)
 #endif
 
    if (fmt == FMT_DAT) {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 static const reading compass_order[] = {
 	    Fr, To, Tape, CompassDATComp, CompassDATClino,
 	    CompassDATLeft, CompassDATRight, CompassDATUp, CompassDATDown,
@@ -722,7 +773,7 @@ data_file(const char *pth, const char *fnm)
 	 pcs = pcsParent;
       }
    } else if (fmt == FMT_MAK) {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 if (ch == '#') {
 	    /* include a file */
 	    int ch_store;
@@ -821,7 +872,7 @@ data_file(const char *pth, const char *fnm)
 	 pcs = pcsParent;
       }
    } else {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 if (!process_non_data_line()) {
 	    f_export_ok = fFalse;
 	    switch (pcs->style) {
@@ -868,10 +919,7 @@ data_file(const char *pth, const char *fnm)
 
    pcs->begin_lineno = begin_lineno_store;
 
-   if (ferror(file.fh))
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
-
-   (void)fclose(file.fh);
+   release_file();
 
    file = file_store;
 
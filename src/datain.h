@@ -22,10 +22,13 @@
 # include <setjmp.h>
 #endif
 
-#include <stdio.h> /* for FILE */
-
 typedef struct parse {
-   FILE *fh;
+   /* The contents of the file, and the next character to read.  The whole
+    * file is mapped or read into memory when it's opened, so we can just
+    * step through it, and saving and restoring the position is trivial. */
+   const unsigned char *buf, *next, *end;
+   /* True if buf is mapped, false if it was allocated with osmalloc(). */
+   bool mapped;
    const char *filename;
    unsigned int line;
    long lpos;
@@ -40,7 +43,10 @@ extern int ch;
 extern parse file;
 extern bool f_export_ok;
 
-#define nextch() (ch = GETC(file.fh))
+#define nextch() (ch = (file.next < file.end ? *file.next++ : EOF))
+
+/* Offset of the next character to read from the start of the file. */
+#define file_offset() ((long)(file.next - file.buf))
 
 typedef struct {
    long offset;
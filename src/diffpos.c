@@ -45,6 +45,7 @@ static double threshold = DFLT_MAX_THRESHOLD;
 static const struct option long_opts[] = {
    /* const char *name; int has_arg (0 no_argument, 1 required_*, 2 optional_*); int *flag; int val; */
    {"survey", required_argument, 0, 's'},
+   {"sorted", no_argument, 0, 1},
    {"help", no_argument, 0, HLP_HELP},
    {"version", no_argument, 0, HLP_VERSION},
    {0, 0, 0, 0}
@@ -55,16 +56,14 @@ static const struct option long_opts[] = {
 static struct help_msg help[] = {
 /*				<-- */
    {HLP_ENCODELONG(0),        /*only load the sub-survey with this prefix*/199, 0},
+   /* TRANSLATORS: --help output for diffpos --sorted option */
+   {HLP_ENCODELONG(1),        /*compare files sorted by station name in one pass*/536, 0},
    {0, 0, 0}
 };
 
-/* We use a hashtable with linked list buckets - this is how many hash table
- * entries we have.  0x2000 with sizeof(void *) == 4 uses 32K. */
-#define TREE_SIZE 0x2000
-
+/* The stations with a particular name (usually just one). */
 typedef struct station {
    struct station *next;
-   char *name;
    img_point pt;
 } station;
 
@@ -81,7 +80,8 @@ cmp_pname(const void *a, const void *b)
    return name_cmp(*(const char **)a, *(const char **)b, sort_separator);
 }
 
-static station **htab;
+/* Map each name to a list of the stations with that name. */
+static hash_table htab;
 static bool fChanged = fFalse;
 
 static added *added_list = NULL;
@@ -90,20 +90,17 @@ static OSSIZE_T c_added = 0;
 static void
 tree_init(void)
 {
-   size_t i;
-   htab = osmalloc(TREE_SIZE * ossizeof(station *));
-   for (i = 0; i < TREE_SIZE; i++) htab[i] = NULL;
+   hash_table_init(&htab);
 }
 
 static void
 tree_insert(const char *name, const img_point *pt)
 {
-   int v = hash_string(name) & (TREE_SIZE - 1);
+   hash_slot *slot = hash_table_insert(&htab, name, strlen(name));
    station * stn = osnew(station);
-   stn->name = osstrdup(name);
    stn->pt = *pt;
-   stn->next = htab[v];
-   htab[v] = stn;
+   stn->next = slot->value;
+   slot->value = stn;
 }
 
 static int
@@ -122,14 +119,14 @@ tree_remove(const char *name, const img_point *pt)
     * Survex) but extended .3d files repeat the label where a loop is broken,
     * and data read from foreign formats might repeat labels.
     */
-   int v = hash_string(name) & (TREE_SIZE - 1);
+   hash_slot *slot = hash_table_find(&htab, name, strlen(name));
    station **prev;
    station *p;
    station **found = NULL;
    bool was_close_enough = fFalse;
 
-   for (prev = &htab[v]; *prev; prev = &((*prev)->next)) {
-      if (strcmp((*prev)->name, name) == 0) {
+   if (slot) {
+      for (prev = (station **)&slot->value; *prev; prev = &((*prev)->next)) {
 	 /* Handle stations with the same name.  Stations are inserted at the
 	  * start of the linked list, so pick the *last* matching station in
 	  * the list as then we match the first stations with the same name in
@@ -165,10 +162,10 @@ tree_remove(const char *name, const img_point *pt)
       fChanged = fTrue;
    }
 
-   osfree((*found)->name);
    p = *found;
    *found = p->next;
    osfree(p);
+   if (!slot->value) hash_table_remove(&htab, slot);
 }
 
 static int
@@ -200,17 +197,19 @@ tree_check(void)
       osfree(names);
    }
 
-   for (i = 0; i < TREE_SIZE; i++) {
+   for (i = 0; i < htab.size; i++) {
       station *p;
-      for (p = htab[i]; p; p = p->next) c++;
+      for (p = htab.slots[i].key ? htab.slots[i].value : NULL; p; p = p->next)
+	 c++;
    }
    if (c == 0) return fChanged;
 
    names = osmalloc(c * ossizeof(char *));
    c = 0;
-   for (i = 0; i < TREE_SIZE; i++) {
+   for (i = 0; i < htab.size; i++) {
       station *p;
-      for (p = htab[i]; p; p = p->next) names[c++] = p->name;
+      for (p = htab.slots[i].key ? htab.slots[i].value : NULL; p; p = p->next)
+	 names[c++] = htab.slots[i].key;
    }
    sort_separator = old_separator;
    qsort(names, c, sizeof(char *), cmp_pname);
@@ -222,17 +221,14 @@ tree_check(void)
    return fTrue;
 }
 
+/* Read the stations from pimg (which was opened from fnm), and close it. */
 static int
-parse_file(const char *fnm, const char *survey,
+parse_file(img *pimg, const char *fnm,
 	   void (*tree_func)(const char *, const img_point *))
 {
    img_point pt;
    int result;
-   int separator;
-
-   img *pimg = img_open_survey(fnm, survey);
-   if (!pimg) fatalerror(img_error2msg(img_error()), fnm);
-   separator = pimg->separator;
+   int separator = pimg->separator;
 
    do {
       result = img_read_item(pimg, &pt);
@@ -253,11 +249,251 @@ parse_file(const char *fnm, const char *survey,
    return separator;
 }
 
+/* A file being read by merge_sorted(). */
+typedef struct {
+   const char *fnm;
+   img *pimg;
+   /* The name and position of the station we've read ahead. */
+   char *name;
+   size_t name_size;
+   img_point pt;
+   bool at_end;
+} sorted_file;
+
+/* Read the next station from f.  Returns fFalse if it's out of order, unless
+ * forced is true in which case that's an error. */
+static bool
+sorted_next(sorted_file *f, bool forced)
+{
+   size_t len;
+   int result;
+   do {
+      result = img_read_item(f->pimg, &f->pt);
+      if (result == img_BAD) {
+	 img_close(f->pimg);
+	 fatalerror(img_error2msg(img_error()), f->fnm);
+      }
+      if (result == img_STOP) {
+	 f->at_end = fTrue;
+	 return fTrue;
+      }
+   } while (result != img_LABEL);
+
+   if (f->name_size &&
+       name_cmp(f->pimg->label, f->name, f->pimg->separator) < 0) {
+      /* TRANSLATORS: for diffpos --sorted: the stations in file %s aren't
+       * in order of station name. */
+      if (forced) fatalerror(/*“%s” isn’t sorted by station name*/537, f->fnm);
+      return fFalse;
+   }
+
+   len = strlen(f->pimg->label) + 1;
+   if (len > f->name_size) {
+      f->name_size = len * 2;
+      f->name = osrealloc(f->name, f->name_size);
+   }
+   memcpy(f->name, f->pimg->label, len);
+   return fTrue;
+}
+
+static void
+copy_to_stdout(FILE *fh)
+{
+   char buf[4096];
+   size_t n;
+   rewind(fh);
+   while ((n = fread(buf, 1, sizeof(buf), fh)) > 0) {
+      fwrite(buf, 1, n, stdout);
+   }
+   fclose(fh);
+}
+
+/* Compare two files which are both sorted by name_cmp() (as .pos files are)
+ * in a single merge pass, so we only need to hold a few stations in memory.
+ *
+ * The output is the same as from the hash table code: first the stations
+ * which have moved, then those added, then those deleted.  To get that order
+ * we write each to a temporary file as we go.  That also means we can give up
+ * if we find a file isn't sorted after all without having written anything.
+ *
+ * pimg1 and pimg2 are the files opened from fnm1 and fnm2.  They are closed
+ * unless we give up.
+ *
+ * Returns 0 or 1 for whether there were differences, or -1 if we gave up
+ * (which only happens if forced is false).
+ */
+static int
+merge_sorted(img *pimg1, const char *fnm1, img *pimg2, const char *fnm2,
+	     bool forced)
+{
+   sorted_file f[2];
+   FILE *moved_fh, *added_fh, *deleted_fh;
+   /* The stations in the first file with the name we're currently looking
+    * at.  Usually there's only one, but we need to handle duplicate names in
+    * the same way tree_remove() does.
+    */
+   struct { img_point pt; bool used; } *run = NULL;
+   size_t run_size = 0;
+   char *run_name = NULL;
+   size_t run_name_size = 0;
+   bool changed = fFalse;
+   int i;
+
+   f[0].fnm = fnm1;
+   f[0].pimg = pimg1;
+   f[1].fnm = fnm2;
+   f[1].pimg = pimg2;
+   for (i = 0; i < 2; i++) {
+      f[i].name = NULL;
+      f[i].name_size = 0;
+      f[i].at_end = fFalse;
+   }
+
+   if (!forced &&
+       (f[0].pimg->version != -1 || f[1].pimg->version != -1 ||
+	f[0].pimg->separator != f[1].pimg->separator)) {
+      /* Only .pos files (version -1) are usually sorted, and we need both
+       * files to be sorted the same way. */
+      return -1;
+   }
+
+   moved_fh = tmpfile();
+   added_fh = tmpfile();
+   deleted_fh = tmpfile();
+   if (!moved_fh || !added_fh || !deleted_fh) {
+      /* TRANSLATORS: for diffpos --sorted */
+      if (forced) fatalerror(/*Couldn’t create temporary file*/538);
+      if (moved_fh) fclose(moved_fh);
+      if (added_fh) fclose(added_fh);
+      if (deleted_fh) fclose(deleted_fh);
+      return -1;
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (!sorted_next(&f[i], forced)) goto unsorted;
+   }
+
+   while (!f[0].at_end || !f[1].at_end) {
+      int cmp;
+      size_t len, run_len, j;
+      if (f[0].at_end) {
+	 cmp = 1;
+      } else if (f[1].at_end) {
+	 cmp = -1;
+      } else {
+	 cmp = name_cmp(f[0].name, f[1].name, f[0].pimg->separator);
+      }
+
+      if (cmp < 0) {
+	 fprintf(deleted_fh, msg(/*Deleted: %s*/502), f[0].name);
+	 fputnl(deleted_fh);
+	 changed = fTrue;
+	 if (!sorted_next(&f[0], forced)) goto unsorted;
+	 continue;
+      }
+
+      if (cmp > 0) {
+	 fprintf(added_fh, msg(/*Added: %s*/501), f[1].name);
+	 fputnl(added_fh);
+	 changed = fTrue;
+	 if (!sorted_next(&f[1], forced)) goto unsorted;
+	 continue;
+      }
+
+      /* Both files have stations with this name, so collect those in the
+       * first file. */
+      len = strlen(f[0].name) + 1;
+      if (len > run_name_size) {
+	 run_name_size = len * 2;
+	 run_name = osrealloc(run_name, run_name_size);
+      }
+      memcpy(run_name, f[0].name, len);
+      run_len = 0;
+      do {
+	 if (run_len == run_size) {
+	    run_size = (run_size ? run_size * 2 : 8);
+	    run = osrealloc(run, run_size * ossizeof(*run));
+	 }
+	 run[run_len].pt = f[0].pt;
+	 run[run_len].used = fFalse;
+	 ++run_len;
+	 if (!sorted_next(&f[0], forced)) goto unsorted;
+      } while (!f[0].at_end && strcmp(f[0].name, run_name) == 0);
+
+      /* Match each station in the second file with this name to the first
+       * unused one in the first file which is close enough, or else to the
+       * first unused one.
+       */
+      do {
+	 size_t found = run_len;
+	 bool was_close_enough = fFalse;
+	 for (j = 0; j < run_len; j++) {
+	    if (run[j].used) continue;
+	    if (close_enough(&f[1].pt, &run[j].pt)) {
+	       found = j;
+	       was_close_enough = fTrue;
+	       break;
+	    }
+	    if (found == run_len) found = j;
+	 }
+	 if (found == run_len) {
+	    fprintf(added_fh, msg(/*Added: %s*/501), run_name);
+	    fputnl(added_fh);
+	    changed = fTrue;
+	 } else {
+	    if (!was_close_enough) {
+	       fprintf(moved_fh, msg(/*Moved by (%3.2f,%3.2f,%3.2f): %s*/500),
+		       f[1].pt.x - run[found].pt.x,
+		       f[1].pt.y - run[found].pt.y,
+		       f[1].pt.z - run[found].pt.z,
+		       run_name);
+	       fputnl(moved_fh);
+	       changed = fTrue;
+	    }
+	    run[found].used = fTrue;
+	 }
+	 if (!sorted_next(&f[1], forced)) goto unsorted;
+      } while (!f[1].at_end && strcmp(f[1].name, run_name) == 0);
+
+      for (j = 0; j < run_len; j++) {
+	 if (run[j].used) continue;
+	 fprintf(deleted_fh, msg(/*Deleted: %s*/502), run_name);
+	 fputnl(deleted_fh);
+	 changed = fTrue;
+      }
+   }
+
+   copy_to_stdout(moved_fh);
+   copy_to_stdout(added_fh);
+   copy_to_stdout(deleted_fh);
+   osfree(run);
+   osfree(run_name);
+   for (i = 0; i < 2; i++) {
+      img_close(f[i].pimg);
+      osfree(f[i].name);
+   }
+   return changed;
+
+unsorted:
+   fclose(moved_fh);
+   fclose(added_fh);
+   fclose(deleted_fh);
+   osfree(run);
+   osfree(run_name);
+   for (i = 0; i < 2; i++) {
+      osfree(f[i].name);
+   }
+   return -1;
+}
+
 int
 main(int argc, char **argv)
 {
    char *fnm1, *fnm2;
+   img *pimg1, *pimg2;
    const char *survey = NULL;
+   bool sorted = fFalse;
+   int changed;
 
    msg_init(argv);
 
@@ -271,6 +507,7 @@ main(int argc, char **argv)
       int opt = cmdline_getopt();
       if (opt == EOF) break;
       if (opt == 's') survey = optarg;
+      if (opt == 1) sorted = fTrue;
    }
    fnm1 = argv[optind++];
    fnm2 = argv[optind++];
@@ -279,11 +516,29 @@ main(int argc, char **argv)
       threshold = cmdline_double_arg();
    }
 
+   pimg1 = img_open_survey(fnm1, survey);
+   if (!pimg1) fatalerror(img_error2msg(img_error()), fnm1);
+   pimg2 = img_open_survey(fnm2, survey);
+   if (!pimg2) {
+      img_close(pimg1);
+      fatalerror(img_error2msg(img_error()), fnm2);
+   }
+
+   /* If both files are sorted, we can compare them without loading either
+    * into memory. */
+   changed = merge_sorted(pimg1, fnm1, pimg2, fnm2, sorted);
+   if (changed >= 0) return changed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+   /* Otherwise go back to the start of each file and load the first into a
+    * hash table. */
+   if (!img_rewind(pimg1)) fatalerror(img_error2msg(img_error()), fnm1);
+   if (!img_rewind(pimg2)) fatalerror(img_error2msg(img_error()), fnm2);
+
    tree_init();
 
-   old_separator = parse_file(fnm1, survey, tree_insert);
+   old_separator = parse_file(pimg1, fnm1, tree_insert);
 
-   new_separator = parse_file(fnm2, survey, tree_remove);
+   new_separator = parse_file(pimg2, fnm2, tree_remove);
 
    return tree_check() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -536,67 +536,37 @@ Skencil::footer(void)
    }
 }
 
-typedef struct point {
-   img_point p;
-   const char *label;
-   struct point *next;
-} point;
+// Maps the coordinates of each station to its name.
+static hash_table htab;
 
-#define HTAB_SIZE 0x2000
-
-static point **htab;
+// Set key to the hash table key for p.  Coordinates which compare equal must
+// give the same key, so map -0 to 0.
+static void
+point_key(const img_point *p, double key[3])
+{
+   key[0] = (p->x == 0 ? 0.0 : p->x);
+   key[1] = (p->y == 0 ? 0.0 : p->y);
+   key[2] = (p->z == 0 ? 0.0 : p->z);
+}
 
 static void
 set_name(const img_point *p, const char *s)
 {
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z) {
-	 /* already got name for these coordinates */
-	 /* FIXME: what about multiple names for the same station? */
-	 return;
-      }
-   }
-
-   pt = osnew(point);
-   pt->label = osstrdup(s);
-   pt->p = *p;
-   pt->next = htab[hash];
-   htab[hash] = pt;
-
-   return;
+   double key[3];
+   point_key(p, key);
+   hash_slot *slot = hash_table_insert(&htab, (const char *)key, sizeof(key));
+   /* FIXME: what about multiple names for the same station? */
+   if (!slot->value) slot->value = osstrdup(s);
 }
 
 static const char *
 find_name(const img_point *p)
 {
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
    wxASSERT(p);
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z)
-	 return pt->label;
-   }
-   return "?";
+   double key[3];
+   point_key(p, key);
+   hash_slot *slot = hash_table_find(&htab, (const char *)key, sizeof(key));
+   return slot ? (const char *)slot->value : "?";
 }
 
 class SVG : public ExportFilter {
@@ -646,8 +616,7 @@ SVG::header(const char * title, const char *, time_t,
 {
    const char *unit = "mm";
    const double SVG_MARGIN = 5.0; // In units of "unit".
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
+   hash_table_init(&htab);
    fprintf(fh, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
    double width = (max_x - min_x) * factor + SVG_MARGIN * 2;
    double height = (max_y - min_y) * factor + SVG_MARGIN * 2;
@@ -833,8 +802,7 @@ PLT::header(const char *title, const char *, time_t,
 {
    // FIXME: allow survey to be set from aven somehow!
    const char *survey = NULL;
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
+   hash_table_init(&htab);
    /* Survex is E, N, Alt - PLT file is N, E, Alt */
    min_N = min_y / METRES_PER_FOOT;
    max_N = max_y / METRES_PER_FOOT;
@@ -1336,6 +1304,8 @@ Export(const wxString &fnm_out, const wxString &title,
    grid = (show_mask & GRID) ? grid_ : 0.0;
    marker_size = marker_size_;
 
+   if (filter) filter->Resolve(model);
+
    // Do we need to calculate min and max for each dimension?
    bool need_bounds = true;
    ExportFilter * filt;
@@ -1415,8 +1385,8 @@ Export(const wxString &fnm_out, const wxString &title,
 		// Not showing because it's a splay.
 		continue;
 	    }
-	    list<traverse>::const_iterator trav = model.traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = model.traverses_end(f);
+	    vector<traverse>::const_iterator trav = model.traverses_begin(f, filter);
+	    vector<traverse>::const_iterator tend = model.traverses_end(f);
 	    for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
 		vector<PointInfo>::const_iterator pos = trav->begin();
 		vector<PointInfo>::const_iterator end = trav->end();
@@ -1432,10 +1402,10 @@ Export(const wxString &fnm_out, const wxString &title,
 		}
 	    }
 	}
-	list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+	vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+	vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
 	for ( ; pos != end; ++pos) {
-	    if (filter && !filter->CheckVisible((*pos)->GetText()))
+	    if (filter && !filter->CheckVisible((*pos)->get_survey()))
 		continue;
 
 	    transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
@@ -1510,8 +1480,8 @@ Export(const wxString &fnm_out, const wxString &title,
 		  continue;
 	      }
 	      if (f & img_FLAG_SPLAY) flags |= SPLAYS;
-	      list<traverse>::const_iterator trav = model.traverses_begin(f, filter);
-	      list<traverse>::const_iterator tend = model.traverses_end(f);
+	      vector<traverse>::const_iterator trav = model.traverses_begin(f, filter);
+	      vector<traverse>::const_iterator tend = model.traverses_end(f);
 	      for ( ; trav != tend; trav = model.traverses_next(f, filter, trav)) {
 		  assert(trav->size() > 1);
 		  vector<PointInfo>::const_iterator pos = trav->begin();
@@ -1535,10 +1505,10 @@ Export(const wxString &fnm_out, const wxString &title,
 	  }
       }
       if (pass_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS)) {
-	  list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	  list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+	  vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+	  vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
 	  for ( ; pos != end; ++pos) {
-	      if (filter && !filter->CheckVisible((*pos)->GetText()))
+	      if (filter && !filter->CheckVisible((*pos)->get_survey()))
 		  continue;
 
 	      transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
@@ -1570,8 +1540,8 @@ Export(const wxString &fnm_out, const wxString &title,
       }
       if (pass_mask & (XSECT|WALLS|PASG)) {
 	  bool elevation = (tilt == 0.0);
-	  list<vector<XSect>>::const_iterator tube = model.tubes_begin();
-	  list<vector<XSect>>::const_iterator tube_end = model.tubes_end();
+	  vector<vector<XSect>>::const_iterator tube = model.tubes_begin();
+	  vector<vector<XSect>>::const_iterator tube_end = model.tubes_end();
 	  for ( ; tube != tube_end; ++tube) {
 	      vector<XSect>::const_iterator pos = tube->begin();
 	      vector<XSect>::const_iterator end = tube->end();
@@ -1584,7 +1554,7 @@ Export(const wxString &fnm_out, const wxString &title,
 		  // should just always include these - a single set of LRUD
 		  // measurements is useful even if a single cross-section
 		  // 3D tube perhaps isn't.
-		  if (filter && !filter->CheckVisible(xs.GetLabel())) {
+		  if (filter && !filter->CheckVisible(xs.GetSurvey())) {
 		      // Close any active tube.
 		      if (active_tube_len > 0) {
 			  active_tube_len = 0;
@@ -1629,7 +1599,9 @@ Export(const wxString &fnm_out, const wxString &title,
    }
    filt->footer();
    delete filt;
-   osfree(htab);
-   htab = NULL;
+   for (size_t i = 0; i < htab.size; ++i) {
+      if (htab.slots[i].key) osfree(htab.slots[i].value);
+   }
+   hash_table_free(&htab);
    return true;
 }
@@ -59,6 +59,8 @@ typedef struct POINT {
    char fDone;
    char fBroken;
    splay *splays;
+   /* Legs at this point - see next_leg(). */
+   struct LEG *legs;
    struct POINT *next;
 } point;
 
@@ -70,6 +72,8 @@ typedef struct LEG {
    char broken;
    int flags;
    struct LEG *next;
+   /* Next leg in fr->legs and to->legs respectively. */
+   struct LEG *fr_next, *to_next;
 } leg;
 
 /* Values for leg.broken: */
@@ -81,9 +85,9 @@ typedef struct LEG {
 #define ERIGHT 0x02
 #define ESWAP  0x04
 
-static point headpoint = {{0, 0, 0}, 0, NULL, 0, 0, 0, 0, NULL, NULL};
+static point headpoint = {{0, 0, 0}, 0, NULL, 0, 0, 0, 0, NULL, NULL, NULL};
 
-static leg headleg = {NULL, NULL, NULL, 0, 0, 0, 0, NULL};
+static leg headleg = {NULL, NULL, NULL, 0, 0, 0, 0, NULL, NULL, NULL};
 
 static img *pimg_out;
 
@@ -91,45 +95,35 @@ static int show_breaks = 0;
 
 static void do_stn(point *, double, const char *, int, int, double, double);
 
-typedef struct pfx {
-   const char *label;
-   struct pfx *next;
-} pfx;
-
-static pfx **htab;
-
-#define HTAB_SIZE 0x2000
+/* The keys of this table are the prefixes we've seen (the values aren't
+ * used), so each prefix is only stored once and prefixes can be compared by
+ * pointer. */
+static hash_table prefixes;
 
 static const char *
 find_prefix(const char *prefix)
 {
-   pfx *p;
-   int hash;
-
    SVX_ASSERT(prefix);
 
-   hash = hash_string(prefix) & (HTAB_SIZE - 1);
-   for (p = htab[hash]; p; p = p->next) {
-      if (strcmp(prefix, p->label) == 0) return p->label;
-   }
-
-   p = osnew(pfx);
-   p->label = osstrdup(prefix);
-   p->next = htab[hash];
-   htab[hash] = p;
-
-   return p->label;
+   return hash_table_insert(&prefixes, prefix, strlen(prefix))->key;
 }
 
+/* Maps coordinates to the point there. */
+static hash_table points;
+
 static point *
 find_point(const img_point *pt)
 {
    point *p;
-   for (p = headpoint.next; p != NULL; p = p->next) {
-      if (pt->x == p->p.x && pt->y == p->p.y && pt->z == p->p.z) {
-	 return p;
-      }
-   }
+   hash_slot *slot;
+   /* Coordinates which compare equal must give the same key, so map -0 to
+    * 0. */
+   double c[3];
+   c[0] = (pt->x == 0 ? 0.0 : pt->x);
+   c[1] = (pt->y == 0 ? 0.0 : pt->y);
+   c[2] = (pt->z == 0 ? 0.0 : pt->z);
+   slot = hash_table_insert(&points, (const char *)c, sizeof(c));
+   if (slot->value) return slot->value;
 
    p = osmalloc(ossizeof(point));
    p->p = *pt;
@@ -140,11 +134,23 @@ find_point(const img_point *pt)
    p->fDone = 0;
    p->fBroken = 0;
    p->splays = NULL;
+   p->legs = NULL;
    p->next = headpoint.next;
    headpoint.next = p;
+   slot->value = p;
    return p;
 }
 
+/* Each leg is on the legs list of both of its ends (but only once if they're
+ * the same point), newest first like headleg.  Return the leg after l in the
+ * list for point p.
+ */
+static leg *
+next_leg(const leg *l, const point *p)
+{
+   return (l->fr == p ? l->fr_next : l->to_next);
+}
+
 static void
 add_leg(point *fr, point *to, const char *prefix, int flags)
 {
@@ -164,6 +170,14 @@ add_leg(point *fr, point *to, const char *prefix, int flags)
    l->broken = 0;
    l->flags = flags;
    headleg.next = l;
+   l->fr_next = fr->legs;
+   fr->legs = l;
+   if (to != fr) {
+      l->to_next = to->legs;
+      to->legs = l;
+   } else {
+      l->to_next = NULL;
+   }
 }
 
 static void
@@ -587,11 +601,8 @@ main(int argc, char **argv)
    putnl();
    puts(msg(/*Reading in data - please wait…*/105));
 
-   htab = osmalloc(ossizeof(pfx*) * HTAB_SIZE);
-   {
-       int i;
-       for (i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
-   }
+   hash_table_init(&prefixes);
+   hash_table_init(&points);
 
    do {
       result = img_read_item(pimg, &pt);
@@ -798,97 +809,147 @@ do_splays(point *p, double X, int dir, double tdx, double tdy)
    p->splays = NULL;
 }
 
+/* A station we're part way through following legs from. */
+typedef struct {
+   point *p;
+   double X;
+   const char *prefix;
+   int dir;
+   /* Legs at p which we've still to follow. */
+   int order;
+   int try_all;
+   /* The leg to look at next. */
+   leg *l;
+   double odx, ody;
+} frame;
+
 static void
 do_stn(point *p, double X, const char *prefix, int dir, int labOnly,
        double odx, double ody)
 {
-   leg *l, *lp;
-   double dX;
-   const stn *s;
-   int odir = dir;
-   int try_all;
-   int order = p->order;
-
-   for (s = p->stns; s; s = s->next) {
-      img_write_item(pimg_out, img_LABEL, s->flags, s->label, X, 0, p->p.z);
-   }
-
-   if (show_breaks && p->X != HUGE_VAL && p->X != X) {
-      /* Draw "surface" leg between broken stations. */
-      img_write_item(pimg_out, img_MOVE, 0, NULL, p->X, 0, p->p.z);
-      img_write_item(pimg_out, img_LINE, img_FLAG_SURFACE, NULL, X, 0, p->p.z);
-   }
-   p->X = X;
-   if (labOnly || p->fBroken) {
-      return;
-   }
+   /* We keep our own stack of stations rather than recursing for each leg
+    * we follow, since a long passage could otherwise overflow the C stack.
+    */
+   frame *stack = NULL;
+   size_t stack_size = 0;
+   size_t depth = 0;
 
+   while (p) {
+      const stn *s;
 
-   if (order == 0) {
-      /* We've reached a dead end. */
-      do_splays(p, X, dir, odx, ody);
-      return;
-   }
+      for (s = p->stns; s; s = s->next) {
+	 img_write_item(pimg_out, img_LABEL, s->flags, s->label, X, 0, p->p.z);
+      }
 
-   /* It's better to follow legs along a survey, so make two passes and only
-    * follow legs in the same survey for the first pass.
-    */
-   for (try_all = 0; try_all != 2; ++try_all) {
-      lp = &headleg;
-      for (l = lp->next; l; lp = l, l = lp->next) {
-	 dir = odir;
-	 if (l->fDone) {
-	    /* this case happens iff a recursive call causes the next leg to be
-	     * removed, leaving our next pointing to a leg which has been dealt
-	     * with... */
-	    continue;
+      if (show_breaks && p->X != HUGE_VAL && p->X != X) {
+	 /* Draw "surface" leg between broken stations. */
+	 img_write_item(pimg_out, img_MOVE, 0, NULL, p->X, 0, p->p.z);
+	 img_write_item(pimg_out, img_LINE, img_FLAG_SURFACE, NULL, X, 0, p->p.z);
+      }
+      p->X = X;
+      if (labOnly || p->fBroken) {
+	 /* Nothing more to do here. */
+      } else if (p->order == 0) {
+	 /* We've reached a dead end. */
+	 do_splays(p, X, dir, odx, ody);
+      } else {
+	 frame *f;
+	 if (depth == stack_size) {
+	    stack_size = (stack_size ? stack_size * 2 : 256);
+	    stack = osrealloc(stack, ossizeof(frame) * stack_size);
 	 }
-	 if (!try_all && l->prefix != prefix) {
-	    continue;
+	 f = &stack[depth++];
+	 f->p = p;
+	 f->X = X;
+	 f->prefix = prefix;
+	 f->dir = dir;
+	 f->order = p->order;
+	 f->try_all = 0;
+	 f->l = p->legs;
+	 f->odx = odx;
+	 f->ody = ody;
+      }
+
+      /* Find the next leg to follow from the station on the top of the
+       * stack.  It's better to follow legs along a survey, so make two passes
+       * over the legs at each station and only follow legs in the same survey
+       * for the first pass.
+       */
+      p = NULL;
+      while (depth) {
+	 frame *f = &stack[depth - 1];
+	 leg *l = f->l;
+	 int break_flag = 0;
+	 point *p2 = NULL;
+	 for ( ; l; l = next_leg(l, f->p)) {
+	    if (l->fDone) {
+	       /* Either we followed this leg on the first pass, or we've dealt
+		* with it since from another station. */
+	       continue;
+	    }
+	    if (!f->try_all && l->prefix != f->prefix) {
+	       continue;
+	    }
+	    if (l->to == f->p) {
+	       break_flag = BREAK_TO;
+	       p2 = l->fr;
+	    } else {
+	       SVX_ASSERT(l->fr == f->p);
+	       break_flag = BREAK_FR;
+	       p2 = l->to;
+	    }
+	    if (!(l->broken & break_flag)) break;
 	 }
-	 int break_flag;
-	 point *p2;
-	 if (l->to == p) {
-	    break_flag = BREAK_TO;
-	    p2 = l->fr;
-	 } else if (l->fr == p) {
-	    break_flag = BREAK_FR;
-	    p2 = l->to;
-	 } else {
+	 if (!l) {
+	    if (++f->try_all == 2) {
+	       --depth;
+	    } else {
+	       f->l = f->p->legs;
+	    }
 	    continue;
 	 }
-	 if (l->broken & break_flag) continue;
-	 lp->next = l->next;
+	 f->l = next_leg(l, f->p);
+
 	 /* adjust direction of extension if necessary */
-	 dir = adjust_direction(dir, p->dir);
+	 dir = adjust_direction(f->dir, f->p->dir);
 	 dir = adjust_direction(dir, l->dir);
 
-	 double dx = p2->p.x - p->p.x;
-	 double dy = p2->p.y - p->p.y;
-	 dX = hypot(dx, dy);
-	 double X2 = X;
+	 double dx = p2->p.x - f->p->p.x;
+	 double dy = p2->p.y - f->p->p.y;
+	 double dX = hypot(dx, dy);
+	 X = f->X;
 	 if (dir == ELEFT) {
-	    X2 -= dX;
+	    X -= dX;
 	 } else {
-	    X2 += dX;
+	    X += dX;
 	 }
 
-	 if (p->splays) {
-	    do_splays(p, X, dir, odx + dx, ody + dy);
+	 if (f->p->splays) {
+	    do_splays(f->p, f->X, dir, f->odx + dx, f->ody + dy);
 	 }
 
-	 img_write_item(pimg_out, img_MOVE, 0, NULL, X, 0, p->p.z);
+	 img_write_item(pimg_out, img_MOVE, 0, NULL, f->X, 0, f->p->p.z);
 	 img_write_item(pimg_out, img_LINE, l->flags, l->prefix,
-			X2, 0, p2->p.z);
+			X, 0, p2->p.z);
 
 	 /* We arrive at p2 via a leg, so that's one down right away. */
 	 --p2->order;
 
 	 l->fDone = 1;
-	 /* l->broken doesn't have break_flag set as we checked that above. */
-	 do_stn(p2, X2, l->prefix, dir, l->broken, dx, dy);
-	 l = lp;
-	 if (--order == 0) return;
+	 /* Once all the legs at a station have been followed there's nothing
+	  * more to do there, so we can drop it from the stack now. */
+	 if (--f->order == 0) --depth;
+
+	 /* Now continue from p2.  l->broken doesn't have break_flag set as we
+	  * checked that above. */
+	 p = p2;
+	 prefix = l->prefix;
+	 labOnly = l->broken;
+	 odx = dx;
+	 ody = dy;
+	 break;
       }
    }
+
+   osfree(stack);
 }
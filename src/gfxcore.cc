@@ -287,7 +287,7 @@ void GfxCore::FirstShow()
     GLACanvas::FirstShow();
 
     const unsigned int quantise(GetFontSize() / QUANTISE_FACTOR);
-    list<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
+    vector<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
     while (pos != m_Parent->GetLabelsNCEnd()) {
 	LabelInfo* label = *pos++;
 	// Calculate and set the label width for use when plotting
@@ -404,12 +404,12 @@ void GfxCore::OnPaint(wxPaintEvent&)
 	    // Draw the underground legs.  Do this last so that anti-aliasing
 	    // works over polygons.
 	    SetColour(col_GREEN);
-	    DrawList(LIST_UNDERGROUND_LEGS);
+	    DrawSurveyList(LIST_UNDERGROUND_LEGS);
 	}
 
 	if (m_Surface) {
 	    // Draw the surface legs.
-	    DrawList(LIST_SURFACE_LEGS);
+	    DrawSurveyList(LIST_SURFACE_LEGS);
 	}
 
 	if (m_BoundingBox) {
@@ -612,7 +612,7 @@ void GfxCore::DrawShadowedBoundingBox()
     EndQuadrilaterals();
     PolygonOffset(false);
 
-    DrawList(LIST_SHADOW);
+    DrawSurveyList(LIST_SHADOW);
 }
 
 void GfxCore::DrawGrid()
@@ -943,7 +943,7 @@ void GfxCore::NattyDrawNames()
     memset((void*) m_LabelGrid, 0, buffer_size);
 
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
     for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
 	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
 	    continue;
@@ -955,7 +955,7 @@ void GfxCore::NattyDrawNames()
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
+	if (filter && !filter->CheckVisible((*label)->get_survey()))
 	    continue;
 
 	double x, y, z;
@@ -1005,7 +1005,7 @@ void GfxCore::SimpleDrawNames()
 {
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     // Draw all station names, without worrying about overlaps
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
     for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
 	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
 	    continue;
@@ -1017,7 +1017,7 @@ void GfxCore::SimpleDrawNames()
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
+	if (filter && !filter->CheckVisible((*label)->get_survey()))
 	    continue;
 
 	double x, y, z;
@@ -1454,7 +1454,7 @@ bool GfxCore::CheckHitTestGrid(const wxPoint& point, bool centre)
     LabelInfo *best = NULL;
     int dist_sqrd = sqrd_measure_threshold;
     int square = grid_x + grid_y * HITTEST_SIZE;
-    list<LabelInfo*>::iterator iter = m_PointGrid[square].begin();
+    vector<LabelInfo*>::iterator iter = m_PointGrid[square].begin();
 
     while (iter != m_PointGrid[square].end()) {
 	LabelInfo *pt = *iter++;
@@ -1834,17 +1834,18 @@ void GfxCore::HighlightSurvey()
     SurveyFilter filter;
     filter.add(highlighted_survey);
     filter.SetSeparator(m_Parent->GetSeparator());
+    filter.Resolve(*m_Parent);
 
     double x_min = HUGE_VAL, x_max = -HUGE_VAL;
     double y_min = HUGE_VAL, y_max = -HUGE_VAL;
     double xpy_min = HUGE_VAL, xpy_max = -HUGE_VAL;
     double xmy_min = HUGE_VAL, xmy_max = -HUGE_VAL;
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     double x_tot = 0, y_tot = 0;
     size_t c = 0;
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(label->get_survey()))
 	    continue;
 
 	double x, y, z;
@@ -1864,8 +1865,8 @@ void GfxCore::HighlightSurvey()
 	++c;
     }
     for (int f = 0; f != 8; ++f) {
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, &filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
+	vector<traverse>::const_iterator trav = m_Parent->traverses_begin(f, &filter);
+	vector<traverse>::const_iterator tend = m_Parent->traverses_end(f);
 	while (trav != tend) {
 	    for (auto&& p : *trav) {
 		double x, y, z;
@@ -1920,6 +1921,7 @@ void GfxCore::ZoomToSurvey(const wxString& survey) {
     SurveyFilter filter;
     filter.add(survey);
     filter.SetSeparator(m_Parent->GetSeparator());
+    filter.Resolve(*m_Parent);
 
     Double xmin = DBL_MAX;
     Double xmax = -DBL_MAX;
@@ -1928,11 +1930,11 @@ void GfxCore::ZoomToSurvey(const wxString& survey) {
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
 
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(label->get_survey()))
 	    continue;
 
 	if (label->GetX() < xmin) xmin = label->GetX();
@@ -1975,7 +1977,7 @@ void GfxCore::CreateHitTestGrid()
 {
     if (!m_PointGrid) {
 	// Initialise hit-test grid.
-	m_PointGrid = new list<LabelInfo*>[HITTEST_SIZE * HITTEST_SIZE];
+	m_PointGrid = new vector<LabelInfo*>[HITTEST_SIZE * HITTEST_SIZE];
     } else {
 	// Clear hit-test grid.
 	for (int i = 0; i < HITTEST_SIZE * HITTEST_SIZE; i++) {
@@ -1985,8 +1987,8 @@ void GfxCore::CreateHitTestGrid()
 
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     // Fill the grid.
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
-    list<LabelInfo*>::const_iterator end = m_Parent->GetLabelsEnd();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator end = m_Parent->GetLabelsEnd();
     while (pos != end) {
 	LabelInfo* label = *pos++;
 
@@ -2001,7 +2003,7 @@ void GfxCore::CreateHitTestGrid()
 	    continue;
 	}
 
-	if (filter && !filter->CheckVisible(label->GetText()))
+	if (filter && !filter->CheckVisible(label->get_survey()))
 	    continue;
 
 	// Calculate screen coordinates.
@@ -2581,15 +2583,9 @@ void GfxCore::GenerateList(unsigned int l)
 	case LIST_STYLE_KEY:
 	    DrawStyleKey();
 	    break;
-	case LIST_UNDERGROUND_LEGS:
-	    GenerateDisplayList(false);
-	    break;
 	case LIST_TUBES:
 	    GenerateDisplayListTubes();
 	    break;
-	case LIST_SURFACE_LEGS:
-	    GenerateDisplayList(true);
-	    break;
 	case LIST_BLOBS:
 	    GenerateBlobsDisplayList();
 	    break;
@@ -2597,7 +2593,7 @@ void GfxCore::GenerateList(unsigned int l)
 	    BeginCrosses();
 	    SetColour(col_LIGHT_GREY);
 	    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+	    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
 	    while (pos != m_Parent->GetLabelsEnd()) {
 		const LabelInfo* label = *pos++;
 
@@ -2609,7 +2605,7 @@ void GfxCore::GenerateList(unsigned int l)
 		    (!label->IsSurface() && !label->IsUnderground())) {
 		    // Check if this station should be displayed
 		    // (last case above is for stns with no legs attached)
-		    if (filter && !filter->CheckVisible(label->GetText()))
+		    if (filter && !filter->CheckVisible(label->get_survey()))
 			continue;
 		    DrawCross(label->GetX(), label->GetY(), label->GetZ());
 		}
@@ -2620,9 +2616,6 @@ void GfxCore::GenerateList(unsigned int l)
 	case LIST_GRID:
 	    DrawGrid();
 	    break;
-	case LIST_SHADOW:
-	    GenerateDisplayListShadow();
-	    break;
 	case LIST_TERRAIN:
 	    DrawTerrain();
 	    break;
@@ -2632,6 +2625,41 @@ void GfxCore::GenerateList(unsigned int l)
     }
 }
 
+void GfxCore::GenerateListGroup(unsigned int l, unsigned int survey)
+{
+    assert(m_HaveData);
+
+    switch (l) {
+	case LIST_UNDERGROUND_LEGS:
+	    GenerateDisplayList(false, survey);
+	    break;
+	case LIST_SURFACE_LEGS:
+	    GenerateDisplayList(true, survey);
+	    break;
+	case LIST_SHADOW:
+	    GenerateDisplayListShadow(survey);
+	    break;
+	default:
+	    assert(false);
+	    break;
+    }
+}
+
+void GfxCore::DrawSurveyList(unsigned int l)
+{
+    // These lists have a group for each survey, and we just draw the groups
+    // for the surveys which the tree shows - so showing or hiding a survey
+    // doesn't require the legs to be regenerated.
+    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    size_t n_surveys = m_Parent->GetNumSurveys();
+    m_VisibleSurveys.clear();
+    for (unsigned survey = 0; survey != n_surveys; ++survey) {
+	if (!filter || filter->CheckVisible(survey))
+	    m_VisibleSurveys.push_back(survey);
+    }
+    DrawListGroups(l, GLsizei(n_surveys), m_VisibleSurveys);
+}
+
 void GfxCore::ToggleSmoothShading()
 {
     GLACanvas::ToggleSmoothShading();
@@ -2639,12 +2667,17 @@ void GfxCore::ToggleSmoothShading()
     ForceRefresh();
 }
 
-void GfxCore::GenerateDisplayList(bool surface)
+void GfxCore::GenerateDisplayList(bool surface, unsigned survey)
 {
     unsigned surf_or_not = surface ? img_FLAG_SURFACE : 0;
-    // Generate the display list for the surface or underground legs.
+    // Generate the display list for the surface or underground legs in
+    // survey.
+    StartPolylineBatch();
     for (int f = 0; f != 8; ++f) {
 	if ((f & img_FLAG_SURFACE) != surf_or_not) continue;
+	auto trav = m_Parent->survey_traverses_begin(f, survey);
+	auto tend = m_Parent->survey_traverses_end(f, survey);
+	if (trav == tend) continue;
 	const unsigned SHOW_DASHED_AND_FADED = unsigned(-1);
 	unsigned style = SHOW_NORMAL;
 	if ((f & img_FLAG_SPLAY) && m_Splays != SHOW_NORMAL) {
@@ -2693,12 +2726,8 @@ void GfxCore::GenerateDisplayList(bool surface)
 	    add_poly = AddPoly;
 	}
 
-	const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
 	while (trav != tend) {
-	    (this->*add_poly)(*trav);
-	    trav = m_Parent->traverses_next(f, filter, trav);
+	    (this->*add_poly)(m_Parent->GetTraverse(f, *trav++));
 	}
 
 	switch (style) {
@@ -2714,33 +2743,34 @@ void GfxCore::GenerateDisplayList(bool surface)
 		break;
 	}
     }
+    FinishPolylineBatch();
 }
 
 void GfxCore::GenerateDisplayListTubes()
 {
     // Generate the display list for the tubes.
-    list<vector<XSect>>::iterator trav = m_Parent->tubes_begin();
-    list<vector<XSect>>::iterator tend = m_Parent->tubes_end();
+    vector<vector<XSect>>::iterator trav = m_Parent->tubes_begin();
+    vector<vector<XSect>>::iterator tend = m_Parent->tubes_end();
     while (trav != tend) {
 	SkinPassage(*trav);
 	++trav;
     }
 }
 
-void GfxCore::GenerateDisplayListShadow()
+void GfxCore::GenerateDisplayListShadow(unsigned survey)
 {
-    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    StartPolylineBatch();
     SetColour(col_BLACK);
     for (int f = 0; f != 8; ++f) {
 	// Only include underground legs in the shadow.
 	if ((f & img_FLAG_SURFACE) != 0) continue;
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
+	auto trav = m_Parent->survey_traverses_begin(f, survey);
+	auto tend = m_Parent->survey_traverses_end(f, survey);
 	while (trav != tend) {
-	    AddPolylineShadow(*trav);
-	    trav = m_Parent->traverses_next(f, filter, trav);
+	    AddPolylineShadow(m_Parent->GetTraverse(f, *trav++));
 	}
     }
+    FinishPolylineBatch();
 }
 
 void
@@ -3175,7 +3205,7 @@ void GfxCore::GenerateBlobsDisplayList()
     // Plot blobs.
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     gla_colour prev_col = col_BLACK; // not a colour used for blobs
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     BeginBlobs();
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
@@ -3196,7 +3226,7 @@ void GfxCore::GenerateBlobsDisplayList()
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible(label->GetText()))
+	if (filter && !filter->CheckVisible(label->get_survey()))
 	    continue;
 
 	gla_colour col;
@@ -3775,7 +3805,7 @@ void GfxCore::AddQuadrilateralLength(const Vector3 &a, const Vector3 &b,
 void GfxCore::AddPolylineSurvey(const traverse & centreline)
 {
     BeginPolyline();
-    SetColourFromSurvey(centreline.name);
+    SetColourFromSurvey(centreline.GetName());
     for (auto i = centreline.begin(); i != centreline.end(); ++i) {
 	PlaceVertex(*i);
     }
@@ -4016,8 +4046,8 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 	v[3] = pt_v.GetPoint() - right * l - up * d;
 
 	if (segment > 0) {
-	    if (!filter || (filter->CheckVisible(pt_v.GetLabel()) &&
-			    filter->CheckVisible(prev_pt_v->GetLabel()))) {
+	    if (!filter || (filter->CheckVisible(pt_v.GetSurvey()) &&
+			    filter->CheckVisible(prev_pt_v->GetSurvey()))) {
 		const Vector3 & delta = pt_v - *prev_pt_v;
 		static_length_hack = delta.magnitude();
 		static_gradient_hack = delta.gradient();
@@ -4029,7 +4059,7 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 	}
 
 	if (cover_end) {
-	    if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
+	    if (!filter || filter->CheckVisible(pt_v.GetSurvey())) {
 		if (segment == 0) {
 		    (this->*AddQuad)(v[0], v[1], v[2], v[3]);
 		} else {
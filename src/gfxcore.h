@@ -37,7 +37,6 @@
 #include "wx.h"
 #include "gla.h"
 
-#include <list>
 #include <utility>
 #include <vector>
 
@@ -224,7 +223,9 @@ private:
     bool m_HitTestDebug;
     bool m_RenderStats;
 
-    list<LabelInfo*> *m_PointGrid;
+    vector<LabelInfo*> *m_PointGrid;
+    // The ids of the surveys which the survey tree shows.
+    vector<GLuint> m_VisibleSurveys;
     bool m_HitTestGridValid;
 
     LabelInfo temp_here;
@@ -300,11 +301,13 @@ private:
     void SkinPassage(vector<XSect> & centreline);
 
     virtual void GenerateList(unsigned int l);
-    void GenerateDisplayList(bool surface);
+    virtual void GenerateListGroup(unsigned int l, unsigned int survey);
+    void DrawSurveyList(unsigned int l);
+    void GenerateDisplayList(bool surface, unsigned survey);
     void GenerateDisplayListTubes();
     void DrawTerrainTriangle(const Vector3 & a, const Vector3 & b, const Vector3 & c);
     void DrawTerrain();
-    void GenerateDisplayListShadow();
+    void GenerateDisplayListShadow(unsigned survey);
     void GenerateBlobsDisplayList();
 
     void DrawIndicators();
@@ -644,6 +647,19 @@ public:
 	}
     }
 
+    // Only the lists which show survey data depend on the survey filter -
+    // there's no need to regenerate the terrain (which can be slow), the
+    // grid, or the indicators and keys.  The legs and shadow are drawn a
+    // survey at a time by DrawSurveyList(), so they don't need regenerating
+    // either.  The tubes are filtered by SkinPassage().
+    void FilterChanged() {
+	UpdateBlobs();
+	InvalidateList(LIST_TUBES);
+	InvalidateList(LIST_CROSSES);
+	m_HitTestGridValid = false;
+	ForceRefresh();
+    }
+
     void SetZoomBox(wxPoint p1, wxPoint p2, bool centred, bool aspect);
 
     void UnsetZoomBox() {
@@ -388,6 +388,76 @@ bool GLAList::DrawList() const {
     return true;
 }
 
+bool GLAListGroups::need_to_generate(GLsizei n_groups_) {
+    // Bail out if the groups are already cached, or can't usefully be cached.
+    if (flags & GLACanvas::NEVER_CACHE)
+	return false;
+    if ((flags & GLACanvas::CACHED) && n_groups_ == n_groups)
+	return false;
+
+    if (n_groups_ != n_groups) {
+	if (gl_list_base) {
+	    glDeleteLists(gl_list_base, n_groups);
+	    CHECK_GL_ERROR("GLAListGroups::need_to_generate", "glDeleteLists");
+	    gl_list_base = 0;
+	}
+	n_groups = n_groups_;
+	if (n_groups == 0) {
+	    // Nothing to draw.
+	    flags = GLACanvas::CACHED;
+	    return false;
+	}
+	// Create a contiguous range of OpenGL lists, one for each group.
+	gl_list_base = glGenLists(n_groups);
+	CHECK_GL_ERROR("GLAListGroups::need_to_generate", "glGenLists");
+	if (gl_list_base == 0) {
+	    // If we can't create the lists for any reason, fall back to just
+	    // drawing directly, as for GLAList.
+	    n_groups = 0;
+	    flags = GLACanvas::NEVER_CACHE;
+	    return false;
+	}
+    }
+    return true;
+}
+
+void GLAListGroups::start_group(GLsizei group)
+{
+    glNewList(gl_list_base + group, GL_COMPILE);
+    CHECK_GL_ERROR("GLAListGroups::start_group", "glNewList");
+}
+
+void GLAListGroups::end_group()
+{
+    glEndList();
+    CHECK_GL_ERROR("GLAListGroups::end_group", "glEndList");
+}
+
+void GLAListGroups::finalise(unsigned int list_flags)
+{
+    if (list_flags & GLACanvas::NEVER_CACHE) {
+	glDeleteLists(gl_list_base, n_groups);
+	CHECK_GL_ERROR("GLAListGroups::finalise", "glDeleteLists");
+	gl_list_base = 0;
+	n_groups = 0;
+	flags = GLACanvas::NEVER_CACHE;
+    } else {
+	flags = list_flags | GLACanvas::CACHED;
+    }
+}
+
+bool GLAListGroups::DrawGroups(const vector<GLuint>& groups) const {
+    if ((flags & GLACanvas::CACHED) == 0)
+	return false;
+    if (groups.empty() || n_groups == 0)
+	return true;
+    glListBase(gl_list_base);
+    CHECK_GL_ERROR("GLAListGroups::DrawGroups", "glListBase");
+    glCallLists(GLsizei(groups.size()), GL_UNSIGNED_INT, &groups[0]);
+    CHECK_GL_ERROR("GLAListGroups::DrawGroups", "glCallLists");
+    return true;
+}
+
 //
 //  GLACanvas
 //
@@ -418,6 +488,7 @@ GLACanvas::GLACanvas(wxWindow* parent, int id)
     m_AntiAlias = false;
     list_flags = 0;
     alpha = 1.0;
+    batching = false;
 }
 
 GLACanvas::~GLACanvas()
@@ -626,6 +697,9 @@ void GLACanvas::SetScale(Double scale)
 	for (i = drawing_lists.begin(); i != drawing_lists.end(); ++i) {
 	    i->invalidate_if(INVALIDATE_ON_SCALE);
 	}
+	for (auto&& groups : grouped_lists) {
+	    groups.invalidate_if(INVALIDATE_ON_SCALE);
+	}
 
 	m_Scale = scale;
     }
@@ -643,6 +717,9 @@ void GLACanvas::OnSize(wxSizeEvent & event)
 	for (i = drawing_lists.begin(); i != drawing_lists.end(); ++i) {
 	    i->invalidate_if(mask);
 	}
+	for (auto&& groups : grouped_lists) {
+	    groups.invalidate_if(mask);
+	}
 
 	// The width and height go to zero when the panel is dragged right
 	// across so we clamp them to be at least 1 to avoid problems.
@@ -1005,6 +1082,44 @@ void GLACanvas::DrawList(unsigned int l)
     }
 }
 
+void GLACanvas::DrawListGroups(unsigned int l, GLsizei n_groups,
+			       const vector<GLuint>& groups)
+{
+    if (l >= grouped_lists.size()) grouped_lists.resize(l + 1);
+
+    // As with DrawList(), the OpenGL lists are generated lazily - and all
+    // the groups are generated together, so that just changing which groups
+    // are drawn doesn't require any to be generated.
+    GLAListGroups& lists = grouped_lists[l];
+    if (lists.need_to_generate(n_groups)) {
+	// Clear list_flags so that we can note what conditions to invalidate
+	// the cached OpenGL lists on.
+	list_flags = 0;
+
+#ifdef GLA_DEBUG
+	printf("generating %d groups for list #%u... ", int(n_groups), l);
+	m_Vertices = 0;
+#endif
+	for (GLsizei group = 0; group != n_groups; ++group) {
+	    lists.start_group(group);
+	    GenerateListGroup(l, group);
+	    lists.end_group();
+	}
+#ifdef GLA_DEBUG
+	printf("done (%d vertices)\n", m_Vertices);
+#endif
+	lists.finalise(list_flags);
+    }
+
+    if (!lists.DrawGroups(groups)) {
+	// The groups aren't cached (which means they probably can't usefully
+	// be cached).
+	for (GLuint group : groups) {
+	    GenerateListGroup(l, group);
+	}
+    }
+}
+
 void GLACanvas::DrawListZPrepass(unsigned int l)
 {
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
@@ -1039,6 +1154,11 @@ void GLACanvas::DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotati
 void GLACanvas::SetColour(const GLAPen& pen, double rgb_scale)
 {
     // Set the colour for subsequent operations.
+    if (batching) {
+	SetBatchColour(pen.GetRed() * rgb_scale, pen.GetGreen() * rgb_scale,
+		       pen.GetBlue() * rgb_scale, alpha);
+	return;
+    }
     glColor4f(pen.GetRed() * rgb_scale, pen.GetGreen() * rgb_scale,
 	      pen.GetBlue() * rgb_scale, alpha);
 }
@@ -1046,6 +1166,11 @@ void GLACanvas::SetColour(const GLAPen& pen, double rgb_scale)
 void GLACanvas::SetColour(const GLAPen& pen)
 {
     // Set the colour for subsequent operations.
+    if (batching) {
+	SetBatchColour(pen.components[0], pen.components[1],
+		       pen.components[2], alpha);
+	return;
+    }
     glColor4d(pen.components[0], pen.components[1], pen.components[2], alpha);
 }
 
@@ -1053,6 +1178,13 @@ void GLACanvas::SetColour(gla_colour colour, double rgb_scale)
 {
     // Set the colour for subsequent operations.
     rgb_scale /= 255.0;
+    if (batching) {
+	SetBatchColour(COLOURS[colour].r * rgb_scale,
+		       COLOURS[colour].g * rgb_scale,
+		       COLOURS[colour].b * rgb_scale,
+		       alpha);
+	return;
+    }
     glColor4f(COLOURS[colour].r * rgb_scale,
 	      COLOURS[colour].g * rgb_scale,
 	      COLOURS[colour].b * rgb_scale,
@@ -1062,6 +1194,15 @@ void GLACanvas::SetColour(gla_colour colour, double rgb_scale)
 void GLACanvas::SetColour(gla_colour colour)
 {
     // Set the colour for subsequent operations.
+    if (batching) {
+	// Convert to floats in the same way glColor4ub() would.
+	GLubyte a = (alpha == 1.0) ? 255 : (unsigned char)(255 * alpha);
+	SetBatchColour(COLOURS[colour].r / 255.0f,
+		       COLOURS[colour].g / 255.0f,
+		       COLOURS[colour].b / 255.0f,
+		       a / 255.0f);
+	return;
+    }
     if (alpha == 1.0) {
 	glColor3ubv(&COLOURS[colour].r);
     } else {
@@ -1156,6 +1297,10 @@ void GLACanvas::BeginPolyline()
 {
     // Commence drawing of a polyline.
 
+    if (batching) {
+	batch_polyline_start = GLint(batch_vertices.size() / 3);
+	return;
+    }
     glBegin(GL_LINE_STRIP);
 }
 
@@ -1163,10 +1308,67 @@ void GLACanvas::EndPolyline()
 {
     // Finish drawing of a polyline.
 
+    if (batching) {
+	GLint n = GLint(batch_vertices.size() / 3) - batch_polyline_start;
+	batch_polylines.push_back(make_pair(batch_polyline_start, n));
+	// Draw what we have once the batch gets large to limit how much
+	// memory it needs.
+	if (batch_vertices.size() >= 3 * 65536) FlushPolylineBatch();
+	return;
+    }
     glEnd();
     CHECK_GL_ERROR("EndPolyline", "glEnd GL_LINE_STRIP");
 }
 
+void GLACanvas::StartPolylineBatch()
+{
+    assert(!batching);
+    batching = true;
+    SetBatchColour(1.0f, 1.0f, 1.0f, alpha);
+}
+
+void GLACanvas::FlushPolylineBatch()
+{
+    if (!batch_polylines.empty()) {
+	// When compiling a display list, the vertex array calls are executed
+	// immediately, while glDrawArrays() copies the array data it uses into
+	// the list.
+	glEnableClientState(GL_VERTEX_ARRAY);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glEnableClientState GL_VERTEX_ARRAY");
+	glEnableClientState(GL_COLOR_ARRAY);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glEnableClientState GL_COLOR_ARRAY");
+	glVertexPointer(3, GL_DOUBLE, 0, &batch_vertices[0]);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glVertexPointer");
+	glColorPointer(4, GL_FLOAT, 0, &batch_colours[0]);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glColorPointer");
+	for (auto&& polyline : batch_polylines) {
+	    glDrawArrays(GL_LINE_STRIP, polyline.first, polyline.second);
+	}
+	CHECK_GL_ERROR("FlushPolylineBatch", "glDrawArrays");
+	glDisableClientState(GL_COLOR_ARRAY);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glDisableClientState GL_COLOR_ARRAY");
+	glDisableClientState(GL_VERTEX_ARRAY);
+	CHECK_GL_ERROR("FlushPolylineBatch", "glDisableClientState GL_VERTEX_ARRAY");
+    }
+    batch_vertices.clear();
+    batch_colours.clear();
+    batch_polylines.clear();
+}
+
+void GLACanvas::FinishPolylineBatch()
+{
+    assert(batching);
+    FlushPolylineBatch();
+    batching = false;
+    // The current colour is undefined after drawing with a colour array, so
+    // set it to the last colour set during the batch.
+    glColor4fv(batch_colour);
+    // Release the memory used by the batch.
+    vector<GLdouble>().swap(batch_vertices);
+    vector<GLfloat>().swap(batch_colours);
+    vector<pair<GLint, GLsizei>>().swap(batch_polylines);
+}
+
 void GLACanvas::BeginPolyloop()
 {
     // Commence drawing of a polyloop.
@@ -1204,6 +1406,14 @@ void GLACanvas::PlaceVertex(glaCoord x, glaCoord y, glaCoord z)
 #ifdef GLA_DEBUG
     m_Vertices++;
 #endif
+    if (batching) {
+	batch_vertices.push_back(x);
+	batch_vertices.push_back(y);
+	batch_vertices.push_back(z);
+	batch_colours.insert(batch_colours.end(),
+			     batch_colour, batch_colour + 4);
+	return;
+    }
     glVertex3d(x, y, z);
 }
 
@@ -1215,6 +1425,7 @@ void GLACanvas::PlaceVertex(glaCoord x, glaCoord y, glaCoord z,
 #ifdef GLA_DEBUG
     m_Vertices++;
 #endif
+    assert(!batching);
     glTexCoord2f(tex_x, tex_y);
     glVertex3d(x, y, z);
 }
@@ -1557,6 +1768,7 @@ void GLACanvas::EnableDashedLines()
 {
     // Enable dashed lines, and start drawing in them.
 
+    if (batching) FlushPolylineBatch();
     glLineStipple(1, 0x3333);
     CHECK_GL_ERROR("EnableDashedLines", "glLineStipple");
     glEnable(GL_LINE_STIPPLE);
@@ -1565,6 +1777,7 @@ void GLACanvas::EnableDashedLines()
 
 void GLACanvas::DisableDashedLines()
 {
+    if (batching) FlushPolylineBatch();
     glDisable(GL_LINE_STIPPLE);
     CHECK_GL_ERROR("DisableDashedLines", "glDisable GL_LINE_STIPPLE");
 }
@@ -25,6 +25,7 @@
 #define gla_h
 
 #include <string>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -99,8 +100,31 @@ class GLAList {
     }
 };
 
+// A list which is divided into groups, each compiled into its own OpenGL
+// list, so that which of the groups are drawn can be changed without
+// regenerating any of them.
+class GLAListGroups {
+    GLuint gl_list_base;
+    GLsizei n_groups;
+    unsigned int flags;
+  public:
+    GLAListGroups() : gl_list_base(0), n_groups(0), flags(0) { }
+    bool need_to_generate(GLsizei n_groups_);
+    void start_group(GLsizei group);
+    void end_group();
+    void finalise(unsigned int list_flags);
+    bool DrawGroups(const vector<GLuint>& groups) const;
+    void invalidate_if(unsigned int mask) {
+	// If flags == NEVER_CACHE, the groups won't be invalidated (unless
+	// mask is 0, which isn't a normal thing to pass).
+	if (flags & mask)
+	    flags = 0;
+    }
+};
+
 class GLACanvas : public wxGLCanvas {
     friend class GLAList; // For flag values.
+    friend class GLAListGroups; // For flag values.
 
     wxGLContext ctx;
 
@@ -144,6 +168,7 @@ class GLACanvas : public wxGLCanvas {
     int y_size;
 
     vector<GLAList> drawing_lists;
+    vector<GLAListGroups> grouped_lists;
 
     enum {
 	INVALIDATE_ON_SCALE = 1,
@@ -156,6 +181,29 @@ class GLACanvas : public wxGLCanvas {
 
     wxString vendor, renderer;
 
+    // While batching polylines, the vertices and their colours are collected
+    // in these arrays and passed to OpenGL using vertex arrays, rather than
+    // with several calls per vertex.  This only makes generating a display
+    // list quicker - the list still holds the same vertices and colours, so
+    // drawing it isn't any quicker, and changing the colouring still means
+    // regenerating it.
+    bool batching;
+    vector<GLdouble> batch_vertices;
+    vector<GLfloat> batch_colours;
+    // First vertex and vertex count for each polyline in the batch.
+    vector<pair<GLint, GLsizei>> batch_polylines;
+    GLint batch_polyline_start;
+    GLfloat batch_colour[4];
+
+    void SetBatchColour(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+	batch_colour[0] = r;
+	batch_colour[1] = g;
+	batch_colour[2] = b;
+	batch_colour[3] = a;
+    }
+
+    void FlushPolylineBatch();
+
     bool CheckVisualFidelity(const unsigned char * target) const;
 
 public:
@@ -177,14 +225,22 @@ public:
     void DrawList(unsigned int l);
     void DrawListZPrepass(unsigned int l);
     void DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotation);
+    // Draw list l, which is divided into n_groups groups, but only the groups
+    // listed in groups.
+    void DrawListGroups(unsigned int l, GLsizei n_groups,
+			const vector<GLuint>& groups);
     void InvalidateList(unsigned int l) {
 	if (l < drawing_lists.size()) {
 	    // Invalidate any existing cached list.
 	    drawing_lists[l].invalidate_if(CACHED);
 	}
+	if (l < grouped_lists.size()) {
+	    grouped_lists[l].invalidate_if(CACHED);
+	}
     }
 
     virtual void GenerateList(unsigned int l) = 0;
+    virtual void GenerateListGroup(unsigned int l, unsigned int group) = 0;
 
     void SetColour(const GLAPen& pen, double rgb_scale);
     void SetColour(const GLAPen& pen);
@@ -206,6 +262,11 @@ public:
     void EndTriangles();
     void BeginPolyline();
     void EndPolyline();
+    // Collect polylines and draw them together using vertex arrays.  Between
+    // these calls only polylines may be drawn, but the colour may be set and
+    // dashed lines enabled and disabled.
+    void StartPolylineBatch();
+    void FinishPolylineBatch();
     void BeginPolyloop();
     void EndPolyloop();
     void BeginPolygon();
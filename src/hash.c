@@ -1,6 +1,7 @@
 /* hash.c */
-/* String hashing function */
+/* String hashing functions and hash table */
 /* Copyright (C) 1995-2002 Olly Betts
+ * Copyright (C) 2026 The Survex Project
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -18,9 +19,11 @@
  */
 
 #include <ctype.h>
+#include <string.h>
 
 #include "debug.h"
 #include "hash.h"
+#include "osalloc.h"
 
 /* some (preferably prime) number for the hashing function */
 #define HASH_PRIME 29363
@@ -54,3 +57,144 @@ hash_data(const char *p, size_t len)
       hash = (hash * HASH_PRIME + *(const unsigned char*)p) & 0x7fff;
    return hash;
 }
+
+uint64_t
+hash64_data(const char *p, size_t len)
+{
+   /* FNV-1a. */
+   uint64_t hash = UINT64_C(0xcbf29ce484222325);
+   SVX_ASSERT(p || len == 0);
+   while (len--) {
+      hash ^= *(const unsigned char*)p++;
+      hash *= UINT64_C(0x100000001b3);
+   }
+   /* The table uses the low bits to pick a slot, but in FNV-1a these don't
+    * depend on the high bits of the input bytes, so finish off with the
+    * MurmurHash3 finaliser to mix all the bits in.
+    */
+   hash ^= hash >> 33;
+   hash *= UINT64_C(0xff51afd7ed558ccd);
+   hash ^= hash >> 33;
+   hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+   hash ^= hash >> 33;
+   return hash;
+}
+
+void
+hash_table_init(hash_table *table)
+{
+   table->size = 0;
+   table->count = 0;
+   table->slots = NULL;
+}
+
+void
+hash_table_free(hash_table *table)
+{
+   size_t i;
+   for (i = 0; i < table->size; i++) {
+      osfree(table->slots[i].key);
+   }
+   osfree(table->slots);
+   hash_table_init(table);
+}
+
+/* Return the slot where key is, or the empty slot where it would go. */
+static hash_slot *
+probe(const hash_table *table, uint64_t hash, const char *key, size_t key_len)
+{
+   size_t mask = table->size - 1;
+   size_t i = (size_t)hash & mask;
+   while (1) {
+      hash_slot *slot = &table->slots[i];
+      if (!slot->key) return slot;
+      if (slot->hash == hash && slot->key_len == key_len &&
+	  memcmp(slot->key, key, key_len) == 0) {
+	 return slot;
+      }
+      i = (i + 1) & mask;
+   }
+}
+
+hash_slot *
+hash_table_find(const hash_table *table, const char *key, size_t key_len)
+{
+   hash_slot *slot;
+   if (table->count == 0) return NULL;
+   slot = probe(table, hash64_data(key, key_len), key, key_len);
+   return slot->key ? slot : NULL;
+}
+
+/* Make the table twice as big (or give it its initial slots). */
+static void
+grow(hash_table *table)
+{
+   size_t old_size = table->size;
+   hash_slot *old_slots = table->slots;
+   size_t i;
+
+   table->size = old_size ? old_size * 2 : 64;
+   table->slots = osmalloc(table->size * ossizeof(hash_slot));
+   for (i = 0; i < table->size; i++) {
+      table->slots[i].key = NULL;
+   }
+   for (i = 0; i < old_size; i++) {
+      const hash_slot *old = &old_slots[i];
+      if (old->key) {
+	 *probe(table, old->hash, old->key, old->key_len) = *old;
+      }
+   }
+   osfree(old_slots);
+}
+
+hash_slot *
+hash_table_insert(hash_table *table, const char *key, size_t key_len)
+{
+   uint64_t hash = hash64_data(key, key_len);
+   hash_slot *slot;
+
+   /* Keep the table no more than half full so probe sequences stay short. */
+   if ((table->count + 1) * 2 > table->size) grow(table);
+
+   slot = probe(table, hash, key, key_len);
+   if (!slot->key) {
+      slot->hash = hash;
+      slot->key = osmalloc(key_len + 1);
+      memcpy(slot->key, key, key_len);
+      slot->key[key_len] = '\0';
+      slot->key_len = key_len;
+      slot->value = NULL;
+      ++table->count;
+   }
+   return slot;
+}
+
+void
+hash_table_remove(hash_table *table, hash_slot *slot)
+{
+   size_t mask = table->size - 1;
+   size_t i = slot - table->slots;
+   size_t j = i;
+
+   SVX_ASSERT(slot->key);
+   osfree(slot->key);
+   --table->count;
+
+   /* We use linear probing, so rather than leaving a marker in the slot we
+    * can move back any later entries in the same run which would otherwise
+    * no longer be found.
+    */
+   while (1) {
+      size_t home;
+      j = (j + 1) & mask;
+      if (!table->slots[j].key) break;
+      home = (size_t)table->slots[j].hash & mask;
+      /* Leave the entry at j alone if its home slot is cyclically in (i, j].
+       */
+      if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+	 continue;
+      table->slots[i] = table->slots[j];
+      i = j;
+   }
+   table->slots[i].key = NULL;
+}
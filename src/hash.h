@@ -1,6 +1,7 @@
 /* hash.h */
-/* String hashing function */
+/* String hashing functions and hash table */
 /* Copyright (C) 1995-2002 Olly Betts
+ * Copyright (C) 2026 The Survex Project
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -17,14 +18,68 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* These return a 15 bit hash value. */
 int hash_string(const char *p);
 int hash_lc_string(const char *p);
 int hash_data(const char *p, size_t len);
 
+/* Return a 64 bit hash of len bytes at p. */
+uint64_t hash64_data(const char *p, size_t len);
+
+/* A hash table mapping keys (arbitrary byte strings) to pointers.  It uses
+ * open addressing and grows as needed.
+ */
+typedef struct {
+   uint64_t hash;
+   /* NULL for an empty slot.  The table owns a copy of each key, with a zero
+    * byte appended so string keys can be used as C strings.
+    */
+   char *key;
+   size_t key_len;
+   void *value;
+} hash_slot;
+
+typedef struct {
+   /* The number of slots - always 0 or a power of 2. */
+   size_t size;
+   /* The number of slots in use. */
+   size_t count;
+   hash_slot *slots;
+} hash_table;
+
+void hash_table_init(hash_table *table);
+
+/* Free the table and its copies of the keys (but not the values). */
+void hash_table_free(hash_table *table);
+
+/* Return the slot for key, or NULL if it isn't in the table. */
+hash_slot *hash_table_find(const hash_table *table,
+			   const char *key, size_t key_len);
+
+/* Return the slot for key, adding it with value NULL if it isn't already in
+ * the table.  This may move the other slots, so any pointers to slots
+ * previously returned are no longer valid.
+ */
+hash_slot *hash_table_insert(hash_table *table,
+			     const char *key, size_t key_len);
+
+/* Remove slot (which must be in use) from the table.  This may move other
+ * slots, so any pointers to slots are no longer valid.
+ */
+void hash_table_remove(hash_table *table, hash_slot *slot);
+
 #ifdef __cplusplus
 }
 #endif
+
+#endif
@@ -30,6 +30,20 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef HAVE_MMAP
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
 #include "img.h"
 
 #define TIMENA "?"
@@ -121,13 +135,6 @@ get16(FILE *fh)
    return w;
 }
 
-static void
-put16(short w, FILE *fh)
-{
-   PUTC((char)(w), fh);
-   PUTC((char)(w >> 8l), fh);
-}
-
 static char *
 baseleaf_from_fnm(const char *fnm)
 {
@@ -232,10 +239,197 @@ mktime_with_tz(struct tm * tm, const char * tz)
     return r;
 }
 
+/* When reading a binary .3d file, we map it into memory if we can and
+ * decode directly from there, which is much faster than reading each byte
+ * using stdio.  These functions read from the mapping if there is one, or
+ * else from pimg->fh.
+ */
+static int
+img_getc(img *pimg)
+{
+   if (pimg->data) {
+      if (pimg->data_next < pimg->data_end) return *pimg->data_next++;
+      pimg->data_eof = 1;
+      return EOF;
+   }
+   return GETC(pimg->fh);
+}
+
+/* Read len bytes into buf.  Returns 1 if successful, 0 if not. */
+static int
+img_read(img *pimg, void *buf, size_t len)
+{
+   if (pimg->data) {
+      if ((size_t)(pimg->data_end - pimg->data_next) < len) {
+	 pimg->data_next = pimg->data_end;
+	 pimg->data_eof = 1;
+	 return 0;
+      }
+      memcpy(buf, pimg->data_next, len);
+      pimg->data_next += len;
+      return 1;
+   }
+   return fread(buf, len, 1, pimg->fh) == 1;
+}
+
+static int
+img_feof(img *pimg)
+{
+   return pimg->data ? pimg->data_eof : feof(pimg->fh);
+}
+
+static int
+img_ferror(img *pimg)
+{
+   return pimg->data ? 0 : ferror(pimg->fh);
+}
+
+static INT32_T
+img_get32(img *pimg)
+{
+   if (pimg->data) {
+      const unsigned char *p = pimg->data_next;
+      if (pimg->data_end - p < 4) {
+	 pimg->data_next = pimg->data_end;
+	 pimg->data_eof = 1;
+	 return 0;
+      }
+      pimg->data_next = p + 4;
+      return (INT32_T)(p[0] | ((unsigned long)p[1] << 8) |
+		       ((unsigned long)p[2] << 16) |
+		       ((unsigned long)p[3] << 24));
+   }
+   return get32(pimg->fh);
+}
+
+static short
+img_get16(img *pimg)
+{
+   short w;
+   if (pimg->data) {
+      const unsigned char *p = pimg->data_next;
+      if (pimg->data_end - p < 2) {
+	 pimg->data_next = pimg->data_end;
+	 pimg->data_eof = 1;
+	 return 0;
+      }
+      pimg->data_next = p + 2;
+      w = p[0];
+      w |= (short)p[1] << 8l;
+      return w;
+   }
+   return get16(pimg->fh);
+}
+
 static unsigned short
-getu16(FILE *fh)
+img_getu16(img *pimg)
+{
+   return (unsigned short)img_get16(pimg);
+}
+
+/* When writing, we collect the output in pimg->wbuf and write it to
+ * pimg->fh in large blocks, which is much faster than writing each byte
+ * using stdio.  If pimg->fh is NULL, we're writing to memory and the buffer
+ * grows to hold all the output instead.
+ */
+#define WBUF_SIZE 0x40000
+
+/* Write out the buffered data.  Returns 0 on error. */
+static int
+img_flush(img *pimg)
+{
+   if (pimg->fh && pimg->wbuf_len) {
+      if (fwrite(pimg->wbuf, pimg->wbuf_len, 1, pimg->fh) != 1)
+	 pimg->wbuf_failed = 1;
+      if (pimg->wbuf_offset >= 0) pimg->wbuf_offset += pimg->wbuf_len;
+      pimg->wbuf_len = 0;
+   }
+   return !pimg->wbuf_failed;
+}
+
+/* Make room in the buffer for at least len more bytes.  Returns 0 if we
+ * can't. */
+static int
+img_wbuf_reserve(img *pimg, size_t len)
+{
+   size_t size;
+   unsigned char *p;
+   if (pimg->wbuf_size - pimg->wbuf_len >= len) return 1;
+   if (pimg->wbuf_failed) return 0;
+   if (pimg->fh) {
+      img_flush(pimg);
+      if (pimg->wbuf_size >= len) return !pimg->wbuf_failed;
+   }
+   size = pimg->wbuf_size ? pimg->wbuf_size : WBUF_SIZE;
+   while (size - pimg->wbuf_len < len) size *= 2;
+   p = (unsigned char *)xosrealloc(pimg->wbuf, size);
+   if (!p) {
+      pimg->wbuf_failed = 1;
+      return 0;
+   }
+   pimg->wbuf = p;
+   pimg->wbuf_size = size;
+   return 1;
+}
+
+static void
+img_putc(img *pimg, int ch)
+{
+   if (pimg->wbuf_len == pimg->wbuf_size && !img_wbuf_reserve(pimg, 1))
+      return;
+   pimg->wbuf[pimg->wbuf_len++] = (unsigned char)ch;
+}
+
+static void
+img_write(img *pimg, const void *buf, size_t len)
+{
+   if (!img_wbuf_reserve(pimg, len)) return;
+   memcpy(pimg->wbuf + pimg->wbuf_len, buf, len);
+   pimg->wbuf_len += len;
+}
+
+static void
+img_puts(img *pimg, const char *s)
+{
+   img_write(pimg, s, strlen(s));
+}
+
+static void
+img_put32(img *pimg, long w)
+{
+   unsigned char *p;
+   if (!img_wbuf_reserve(pimg, 4)) return;
+   p = pimg->wbuf + pimg->wbuf_len;
+   p[0] = (unsigned char)w;
+   p[1] = (unsigned char)(w >> 8);
+   p[2] = (unsigned char)(w >> 16);
+   p[3] = (unsigned char)(w >> 24);
+   pimg->wbuf_len += 4;
+}
+
+static void
+img_put16(img *pimg, short w)
+{
+   unsigned char *p;
+   if (!img_wbuf_reserve(pimg, 2)) return;
+   p = pimg->wbuf + pimg->wbuf_len;
+   p[0] = (unsigned char)w;
+   p[1] = (unsigned char)(w >> 8);
+   pimg->wbuf_len += 2;
+}
+
+/* The offset in the output we've written up to, or -1 if unknown. */
+static long
+img_write_tell(img *pimg)
 {
-   return (unsigned short)get16(fh);
+   if (pimg->wbuf_offset < 0) return -1;
+   return pimg->wbuf_offset + (long)pimg->wbuf_len;
+}
+
+static int
+img_write_error(img *pimg)
+{
+   return pimg->wbuf_failed || (pimg->fh && ferror(pimg->fh));
 }
 
 #include <math.h>
@@ -279,7 +473,7 @@ static int my_strcasecmp(const char *s1, const char *s2) {
 }
 #endif
 
-unsigned int img_output_version = IMG_VERSION_MAX;
+unsigned int img_output_version = IMG_VERSION_DEFAULT;
 
 static img_errcode img_errno = IMG_NONE;
 
@@ -350,6 +544,17 @@ img_error(void)
    return img_errno;
 }
 
+/* Report an error reading an item from pimg. */
+static void
+set_read_error(img *pimg, img_errcode code)
+{
+   if (pimg->read_error) {
+      *pimg->read_error = code;
+   } else {
+      img_errno = code;
+   }
+}
+
 static int
 check_label_space(img *pimg, size_t len)
 {
@@ -421,7 +626,10 @@ img_open_survey(const char *fnm, const char *survey)
    }
 
    fh = fopenWithPthAndExt("", fnm, EXT_SVX_3D, "rb", &filename_opened);
-   pimg = img_read_stream_survey(fh, fclose, filename_opened, survey);
+   /* In non-hosted mode, filename_opened isn't set. */
+   pimg = img_read_stream_survey(fh, fclose,
+				 filename_opened ? filename_opened : fnm,
+				 survey);
    if (pimg) {
        pimg->filename_opened = filename_opened;
    } else {
@@ -430,6 +638,641 @@ img_open_survey(const char *fnm, const char *survey)
    return pimg;
 }
 
+#ifdef HAVE_MMAP
+/* Map the rest of the file into memory for reading, if it's a regular file
+ * and mmap() works.  Otherwise we just carry on reading from pimg->fh.
+ */
+static void
+map_3d_file(img *pimg)
+{
+   struct stat st;
+   void *p;
+   int fd = fileno(pimg->fh);
+   if (pimg->start < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+       st.st_size <= pimg->start || (off_t)(size_t)st.st_size != st.st_size)
+      return;
+   p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (p == MAP_FAILED) return;
+#ifdef MADV_SEQUENTIAL
+   (void)madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+   pimg->data = (const unsigned char *)p;
+   pimg->data_next = pimg->data + pimg->start;
+   pimg->data_end = pimg->data + st.st_size;
+   pimg->data_eof = 0;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/* A compressed .3d file starts with ZFILEID and a linefeed (which together
+ * are the same length as the longest header we check for when looking for
+ * FILEID, so we can detect it without needing to seek).  This is followed
+ * by the bytes of an ordinary .3d file in blocks, each of which is the
+ * length of the data uncompressed and compressed (as 4 byte little-endian
+ * integers) followed by the data compressed with zlib.  A block with
+ * uncompressed length 0 marks the end.
+ */
+#define ZFILEID "Survex 3D Compressed File v1"
+
+/* Size of the blocks we compress the data in. */
+#define ZBLOCK_SIZE 0x40000
+
+/* Reject blocks larger than this when reading, as the file must be
+ * damaged. */
+#define ZBLOCK_MAX 0x1000000
+
+/* Decompress the rest of pimg->fh into a temporary file, which replaces it.
+ * Returns 0 on error, with img_errno set.
+ */
+static int
+inflate_3d_file(img *pimg)
+{
+   unsigned char *in = NULL, *out = NULL;
+   size_t in_size = 0, out_size = 0;
+   FILE *tmp = tmpfile();
+   if (!tmp) {
+      img_errno = IMG_READERROR;
+      return 0;
+   }
+   while (1) {
+      unsigned long len = (unsigned long)get32(pimg->fh) & 0xfffffffful;
+      unsigned long zlen;
+      uLongf out_len;
+      if (len == 0) {
+	 if (ferror(pimg->fh) || feof(pimg->fh)) goto bad_format;
+	 break;
+      }
+      zlen = (unsigned long)get32(pimg->fh) & 0xfffffffful;
+      if (ferror(pimg->fh) || feof(pimg->fh) ||
+	  len > ZBLOCK_MAX || zlen > compressBound(len))
+	 goto bad_format;
+      if (zlen > in_size) {
+	 osfree(in);
+	 in = (unsigned char *)xosmalloc(zlen);
+	 if (!in) goto out_of_memory;
+	 in_size = zlen;
+      }
+      if (len > out_size) {
+	 osfree(out);
+	 out = (unsigned char *)xosmalloc(len);
+	 if (!out) goto out_of_memory;
+	 out_size = len;
+      }
+      if (fread(in, zlen, 1, pimg->fh) != 1) goto bad_format;
+      out_len = len;
+      if (uncompress(out, &out_len, in, zlen) != Z_OK || out_len != len)
+	 goto bad_format;
+      if (fwrite(out, len, 1, tmp) != 1) {
+	 img_errno = IMG_READERROR;
+	 goto error;
+      }
+   }
+   osfree(in);
+   osfree(out);
+   if (fflush(tmp) != 0 || fseek(tmp, 0, SEEK_SET) != 0) {
+      img_errno = IMG_READERROR;
+      fclose(tmp);
+      return 0;
+   }
+   if (pimg->close_func) pimg->close_func(pimg->fh);
+   pimg->fh = tmp;
+   pimg->close_func = fclose;
+   return 1;
+
+bad_format:
+   img_errno = IMG_BADFORMAT;
+   goto error;
+out_of_memory:
+   img_errno = IMG_OUTOFMEMORY;
+error:
+   osfree(in);
+   osfree(out);
+   fclose(tmp);
+   return 0;
+}
+
+/* Compress the data collected in pimg->wbuf into pimg->zfh.  Returns 0 on
+ * error.
+ */
+static int
+deflate_3d_data(img *pimg)
+{
+   unsigned char *out;
+   uLong out_size = compressBound(ZBLOCK_SIZE);
+   size_t pos;
+   int result = 1;
+   out = (unsigned char *)xosmalloc(out_size);
+   if (!out) return 0;
+   fputs(ZFILEID"\n", pimg->zfh);
+   for (pos = 0; pos < pimg->wbuf_len; pos += ZBLOCK_SIZE) {
+      size_t len = min(pimg->wbuf_len - pos, (size_t)ZBLOCK_SIZE);
+      uLongf out_len = out_size;
+      if (compress2(out, &out_len, pimg->wbuf + pos, len,
+		    Z_BEST_SPEED) != Z_OK) {
+	 result = 0;
+	 break;
+      }
+      put32((long)len, pimg->zfh);
+      put32((long)out_len, pimg->zfh);
+      fwrite(out, out_len, 1, pimg->zfh);
+   }
+   put32(0, pimg->zfh);
+   osfree(out);
+   return result;
+}
+#endif
+
+/* Format version 8 files can have an index after the end of the data which
+ * records where each run of items for the same survey starts, and the
+ * state needed to start decoding there.  When a survey filter is in use,
+ * this allows us to skip straight to the parts of the file we need rather
+ * than decoding everything and discarding most of it.  Readers which don't
+ * know about the index just stop at the end of the data marker so don't
+ * see it.  See doc/3dformat.htm for the details of the format.
+ *
+ * The "key" of an item is the survey it belongs to - for a leg this is the
+ * survey name, and for a station or cross-section it's the station name
+ * with the last component removed.
+ */
+
+#define INDEX_MAGIC "Svx3DIdx"
+
+/* In format version 9, we start a new chunk before the next move or label
+ * once the current chunk has this many items (or before any item once it
+ * has twice as many). */
+#define CHUNK_ITEMS 32768
+
+/* Each run of items with the same key in the file. */
+typedef struct {
+   unsigned long offset;
+   size_t key; /* Offset of the key in keys. */
+   size_t label_len;
+   int style;
+   INT32_T days1, days2;
+   INT32_T x, y, z;
+} index_run;
+
+/* Each range of the file which we need to read when filtering. */
+typedef struct {
+   long start, end;
+   size_t label_len;
+   int style;
+   INT32_T days1, days2;
+   img_point pt;
+} index_range;
+
+struct img_index {
+   /* When writing: */
+   index_run *runs;
+   size_t n_runs, runs_size;
+   char *keys;
+   size_t keys_len, keys_size;
+   /* The last point written (in cm). */
+   INT32_T x, y, z;
+   /* Write the next label in full. */
+   int reset_label;
+   /* Set if we failed to allocate memory, so can't write an index. */
+   int failed;
+   /* Offset of the start of each chunk (format version 9). */
+   unsigned long *chunks;
+   size_t n_chunks, chunks_size;
+   /* Set if we can't write a chunk table. */
+   int chunks_failed;
+   unsigned long chunk_items;
+   /* Set if a leg must be preceded by a move because a new chunk has
+    * started since the last move. */
+   int need_move;
+
+   /* When reading: */
+   index_range *ranges;
+   size_t n_ranges, ranges_size, next_range;
+   long range_end;
+   /* Set if we've returned an img_XSECT and no img_XSECT_END since. */
+   int xsect_open;
+};
+
+static void
+free_index(img *pimg)
+{
+   if (pimg->index) {
+      osfree(pimg->index->runs);
+      osfree(pimg->index->keys);
+      osfree(pimg->index->chunks);
+      osfree(pimg->index->ranges);
+      osfree(pimg->index);
+      pimg->index = NULL;
+   }
+}
+
+static struct img_index *
+new_index(void)
+{
+   struct img_index *idx = osnew(struct img_index);
+   if (idx) memset(idx, 0, sizeof(struct img_index));
+   return idx;
+}
+
+/* Start a new run in the index if key differs from the current run's. */
+static void
+index_note_key(img *pimg, const char *key, size_t key_len)
+{
+   struct img_index *idx = pimg->index;
+   index_run *run;
+   long offset;
+   if (!idx || idx->failed) return;
+   if (idx->n_runs) {
+      const char *cur = idx->keys + idx->runs[idx->n_runs - 1].key;
+      if (strncmp(cur, key, key_len) == 0 && cur[key_len] == '\0') return;
+   }
+
+   offset = img_write_tell(pimg);
+   if (offset < 0 || (unsigned long)offset > 0xfffffffful) {
+      idx->failed = 1;
+      return;
+   }
+   if (idx->n_runs == idx->runs_size) {
+      size_t n = idx->runs_size ? idx->runs_size * 2 : 256;
+      index_run *runs = (index_run *)xosrealloc(idx->runs,
+						n * sizeof(index_run));
+      if (!runs) {
+	 idx->failed = 1;
+	 return;
+      }
+      idx->runs = runs;
+      idx->runs_size = n;
+   }
+   if (idx->keys_len + key_len + 1 > idx->keys_size) {
+      size_t n = idx->keys_size ? idx->keys_size * 2 : 4096;
+      char *keys;
+      while (idx->keys_len + key_len + 1 > n) n *= 2;
+      keys = (char *)xosrealloc(idx->keys, n);
+      if (!keys) {
+	 idx->failed = 1;
+	 return;
+      }
+      idx->keys = keys;
+      idx->keys_size = n;
+   }
+
+   run = &idx->runs[idx->n_runs++];
+   run->offset = (unsigned long)offset;
+   run->key = idx->keys_len;
+   memcpy(idx->keys + idx->keys_len, key, key_len);
+   idx->keys[idx->keys_len + key_len] = '\0';
+   idx->keys_len += key_len + 1;
+   run->label_len = pimg->label_len;
+   run->style = pimg->oldstyle;
+#if IMG_API_VERSION == 0
+   run->days1 = pimg->olddate1 ? pimg->olddate1 / 86400 + 25567 : -1;
+   run->days2 = pimg->olddate2 ? pimg->olddate2 / 86400 + 25567 : -1;
+#else /* IMG_API_VERSION == 1 */
+   run->days1 = pimg->olddays1;
+   run->days2 = pimg->olddays2;
+#endif
+   run->x = idx->x;
+   run->y = idx->y;
+   run->z = idx->z;
+   /* The first label in the run mustn't depend on the label before. */
+   idx->reset_label = 1;
+}
+
+typedef struct {
+   const char *key;
+   size_t run;
+} index_key_ref;
+
+static int
+cmp_index_key_ref(const void *a, const void *b)
+{
+   const index_key_ref *p = (const index_key_ref *)a;
+   const index_key_ref *q = (const index_key_ref *)b;
+   int r = strcmp(p->key, q->key);
+   if (r) return r;
+   return (p->run > q->run) - (p->run < q->run);
+}
+
+/* Record that a new chunk starts here (format version 9). */
+static void
+add_chunk(img *pimg)
+{
+   struct img_index *idx = pimg->index;
+   long offset;
+   if (idx->chunks_failed) return;
+   offset = img_write_tell(pimg);
+   if (offset < 0 || (unsigned long)offset > 0xfffffffful) {
+      idx->chunks_failed = 1;
+      return;
+   }
+   if (idx->n_chunks == idx->chunks_size) {
+      size_t n = idx->chunks_size ? idx->chunks_size * 2 : 64;
+      unsigned long *chunks;
+      chunks = (unsigned long *)xosrealloc(idx->chunks,
+					   n * sizeof(unsigned long));
+      if (!chunks) {
+	 idx->chunks_failed = 1;
+	 return;
+      }
+      idx->chunks = chunks;
+      idx->chunks_size = n;
+   }
+   idx->chunks[idx->n_chunks++] = (unsigned long)offset;
+   idx->chunk_items = 0;
+}
+
+/* Start a new chunk, and reset the encoder state so the chunk can be decoded
+ * without decoding the chunks before it. */
+static void
+start_chunk(img *pimg)
+{
+   add_chunk(pimg);
+   img_putc(pimg, 0x05);
+   pimg->label_len = 0;
+   pimg->label_buf[0] = '\0';
+   pimg->oldstyle = img_STYLE_UNKNOWN;
+#if IMG_API_VERSION == 0
+   pimg->olddate1 = pimg->olddate2 = 0;
+#else /* IMG_API_VERSION == 1 */
+   pimg->olddays1 = pimg->olddays2 = -1;
+#endif
+   pimg->index->need_move = 1;
+}
+
+/* Write the chunk table.  Returns its offset, or -1 if we can't write it. */
+static long
+write_chunk_table(img *pimg)
+{
+   struct img_index *idx = pimg->index;
+   long offset;
+   size_t i;
+   if (idx->chunks_failed || idx->n_chunks == 0) return -1;
+   offset = img_write_tell(pimg);
+   if (offset < 0 || (unsigned long)offset > 0xfffffffful) return -1;
+   img_put32(pimg, idx->n_chunks);
+   for (i = 0; i < idx->n_chunks; i++) img_put32(pimg, idx->chunks[i]);
+   return offset;
+}
+
+/* Write the survey index.  data_end is the offset of the end of the data
+ * marker.  Returns the offset of the index, or -1 if we can't write it. */
+static long
+write_survey_index(img *pimg, long data_end)
+{
+   struct img_index *idx = pimg->index;
+   index_key_ref *refs;
+   unsigned long *key_no;
+   unsigned long n_keys = 0;
+   long index_start;
+   size_t i;
+
+   if (idx->failed || idx->n_runs == 0 || data_end < 0 ||
+       (unsigned long)data_end > 0xfffffffful) return -1;
+   index_start = img_write_tell(pimg);
+   if (index_start < 0 || (unsigned long)index_start > 0xfffffffful)
+      return -1;
+
+   /* Write each different key once, in sorted order. */
+   refs = (index_key_ref *)xosmalloc(idx->n_runs * sizeof(index_key_ref));
+   key_no = (unsigned long *)xosmalloc(idx->n_runs * sizeof(unsigned long));
+   if (!refs || !key_no) {
+      osfree(refs);
+      osfree(key_no);
+      return -1;
+   }
+   for (i = 0; i < idx->n_runs; i++) {
+      refs[i].key = idx->keys + idx->runs[i].key;
+      refs[i].run = i;
+   }
+   qsort(refs, idx->n_runs, sizeof(index_key_ref), cmp_index_key_ref);
+   for (i = 0; i < idx->n_runs; i++) {
+      if (i == 0 || strcmp(refs[i].key, refs[i - 1].key) != 0) ++n_keys;
+      key_no[refs[i].run] = n_keys - 1;
+   }
+
+   img_put32(pimg, data_end);
+   img_put32(pimg, n_keys);
+   for (i = 0; i < idx->n_runs; i++) {
+      if (i == 0 || strcmp(refs[i].key, refs[i - 1].key) != 0) {
+	 size_t len = strlen(refs[i].key);
+	 img_put32(pimg, len);
+	 img_write(pimg, refs[i].key, len);
+      }
+   }
+   img_put32(pimg, idx->n_runs);
+   for (i = 0; i < idx->n_runs; i++) {
+      const index_run *run = &idx->runs[i];
+      img_put32(pimg, run->offset);
+      img_put32(pimg, key_no[i]);
+      img_put32(pimg, run->label_len);
+      img_putc(pimg, run->style);
+      img_put32(pimg, run->days1);
+      img_put32(pimg, run->days2);
+      img_put32(pimg, run->x);
+      img_put32(pimg, run->y);
+      img_put32(pimg, run->z);
+   }
+
+   osfree(refs);
+   osfree(key_no);
+   return index_start;
+}
+
+/* Write what follows the end of the data marker (at offset data_end): the
+ * chunk table for format version 9, then the survey index, and then the
+ * trailer which says where to find them. */
+static void
+write_index(img *pimg, long data_end)
+{
+   long chunk_table = -1, index_start;
+   if (pimg->version >= 9) chunk_table = write_chunk_table(pimg);
+   index_start = write_survey_index(pimg, data_end);
+   if (pimg->version >= 9) {
+      img_put32(pimg, chunk_table < 0 ? 0xfffffffful : (unsigned long)chunk_table);
+   } else if (index_start < 0) {
+      return;
+   }
+   img_put32(pimg, index_start < 0 ? 0xfffffffful : (unsigned long)index_start);
+   img_puts(pimg, INDEX_MAGIC);
+}
+
+static long
+img_tell(img *pimg)
+{
+   if (pimg->data) return (long)(pimg->data_next - pimg->data);
+   return ftell(pimg->fh);
+}
+
+/* Returns 1 if successful, 0 if not. */
+static int
+img_seek(img *pimg, long offset)
+{
+   if (pimg->data) {
+      if (offset < 0 || offset > pimg->data_end - pimg->data) return 0;
+      pimg->data_next = pimg->data + offset;
+      pimg->data_eof = 0;
+      return 1;
+   }
+   if (fseek(pimg->fh, offset, SEEK_SET) != 0) return 0;
+   clearerr(pimg->fh);
+   return 1;
+}
+
+/* Does an item with key key (of length len) match the survey filter? */
+static int
+index_key_included(const img *pimg, const char *key, size_t len)
+{
+   size_t l = pimg->survey_len;
+   if (len == l) return memcmp(key, pimg->survey, l) == 0;
+   /* pimg->survey has a '.' appended. */
+   return len > l && memcmp(key, pimg->survey, l + 1) == 0;
+}
+
+/* Try to load the index from a format version 8 file opened with a survey
+ * filter.  If there's no index, or it's damaged, or we run out of memory,
+ * we just read the whole file as we would without one.
+ */
+static void
+load_index(img *pimg)
+{
+   const size_t trailer_len = 4 + LITLEN(INDEX_MAGIC);
+   struct img_index *idx;
+   char magic[LITLEN(INDEX_MAGIC)];
+   unsigned char *included = NULL;
+   unsigned long index_start, data_end, n_keys, n_runs, i;
+   unsigned long prev_offset;
+   long size;
+   int prev_included = 0;
+
+   pimg->label = pimg->label_buf;
+   if (pimg->data) {
+      size = (long)(pimg->data_end - pimg->data);
+   } else {
+      if (fseek(pimg->fh, 0, SEEK_END) != 0) goto done;
+      size = ftell(pimg->fh);
+   }
+   if (size < 0 || (unsigned long)size < pimg->start + trailer_len) goto done;
+   if (!img_seek(pimg, size - (long)trailer_len)) goto done;
+   index_start = (unsigned long)img_get32(pimg) & 0xfffffffful;
+   if (!img_read(pimg, magic, sizeof(magic)) ||
+       memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) goto done;
+   if (index_start < (unsigned long)pimg->start ||
+       index_start > size - trailer_len) goto done;
+
+   idx = new_index();
+   if (!idx) goto done;
+   pimg->index = idx;
+
+   if (!img_seek(pimg, (long)index_start)) goto bad;
+   data_end = (unsigned long)img_get32(pimg) & 0xfffffffful;
+   n_keys = (unsigned long)img_get32(pimg) & 0xfffffffful;
+   if (data_end < (unsigned long)pimg->start || data_end > index_start ||
+       n_keys > index_start) goto bad;
+
+   /* Work out which keys match the survey filter. */
+   if (n_keys) {
+      included = (unsigned char *)xosmalloc(n_keys);
+      if (!included) goto bad;
+   }
+   for (i = 0; i < n_keys; i++) {
+      unsigned long len = (unsigned long)img_get32(pimg) & 0xfffffffful;
+      if (len > index_start || !check_label_space(pimg, len + 1) ||
+	  (len && !img_read(pimg, pimg->label_buf, len))) goto bad;
+      included[i] = index_key_included(pimg, pimg->label_buf, len);
+   }
+
+   /* Build the list of ranges to read, merging adjacent runs. */
+   n_runs = (unsigned long)img_get32(pimg) & 0xfffffffful;
+   prev_offset = pimg->start;
+   for (i = 0; i < n_runs; i++) {
+      unsigned long offset = (unsigned long)img_get32(pimg) & 0xfffffffful;
+      unsigned long key = (unsigned long)img_get32(pimg) & 0xfffffffful;
+      unsigned long label_len = (unsigned long)img_get32(pimg) & 0xfffffffful;
+      int style = img_getc(pimg);
+      INT32_T days1 = img_get32(pimg);
+      INT32_T days2 = img_get32(pimg);
+      INT32_T x = img_get32(pimg);
+      INT32_T y = img_get32(pimg);
+      INT32_T z = img_get32(pimg);
+      index_range *range;
+      if (img_feof(pimg) || img_ferror(pimg) ||
+	  offset < prev_offset || offset > data_end || key >= n_keys) goto bad;
+      prev_offset = offset;
+      if (prev_included) idx->ranges[idx->n_ranges - 1].end = (long)offset;
+      prev_included = included[key];
+      if (!prev_included || (idx->n_ranges &&
+	  idx->ranges[idx->n_ranges - 1].end == (long)offset)) {
+	 /* Not wanted, or continues the previous range. */
+	 continue;
+      }
+      if (idx->n_ranges == idx->ranges_size) {
+	 size_t n = idx->ranges_size ? idx->ranges_size * 2 : 16;
+	 index_range *ranges = (index_range *)xosrealloc(idx->ranges,
+							n * sizeof(index_range));
+	 if (!ranges) goto bad;
+	 idx->ranges = ranges;
+	 idx->ranges_size = n;
+      }
+      range = &idx->ranges[idx->n_ranges++];
+      range->start = (long)offset;
+      range->end = (long)data_end;
+      range->label_len = label_len;
+      range->style = (style == 0xff ? img_STYLE_UNKNOWN : style);
+      range->days1 = days1;
+      range->days2 = days2;
+      range->pt.x = x / 100.0;
+      range->pt.y = y / 100.0;
+      range->pt.z = z / 100.0;
+   }
+   if (img_feof(pimg) || img_ferror(pimg)) goto bad;
+   if (prev_included) idx->ranges[idx->n_ranges - 1].end = (long)data_end;
+   goto done;
+
+bad:
+   free_index(pimg);
+done:
+   osfree(included);
+   pimg->label_len = 0;
+   if (!img_seek(pimg, pimg->start)) free_index(pimg);
+   if (pimg->data) pimg->data_eof = 0;
+}
+
+/* Move on to the next range to read from the index, restoring the state of
+ * the decoder as it would be at that point in the file.  Returns 0 if
+ * successful, img_STOP if there are no more ranges, or img_BAD on error.
+ */
+static int
+index_next_range(img *pimg)
+{
+   struct img_index *idx = pimg->index;
+   const index_range *range;
+   if (idx->next_range == idx->n_ranges) return img_STOP;
+   range = &idx->ranges[idx->next_range++];
+   if (!img_seek(pimg, range->start)) {
+      set_read_error(pimg, IMG_READERROR);
+      return img_BAD;
+   }
+   idx->range_end = range->end;
+   /* The first label in the range is stored in full, but we need the
+    * length of the label before it. */
+   if (!check_label_space(pimg, range->label_len + 1)) {
+      set_read_error(pimg, IMG_OUTOFMEMORY);
+      return img_BAD;
+   }
+   pimg->label_len = range->label_len;
+   memset(pimg->label_buf, 0, range->label_len + 1);
+   pimg->style = range->style;
+#if IMG_API_VERSION == 0
+   pimg->date1 = range->days1 < 0 ? 0 : (time_t)(range->days1 - 25567) * 86400;
+   pimg->date2 = range->days2 < 0 ? 0 : (time_t)(range->days2 - 25567) * 86400;
+#else /* IMG_API_VERSION == 1 */
+   pimg->days1 = range->days1;
+   pimg->days2 = range->days2;
+#endif
+   /* Legs continuing from the point before the range start there. */
+   pimg->mv = range->pt;
+   pimg->pending = 15;
+   return 0;
+}
+
 img *
 img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
 		       const char *fnm,
@@ -454,6 +1297,11 @@ img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
 
    pimg->fh = stream;
    pimg->close_func = close_func;
+   pimg->data = NULL;
+   pimg->index = NULL;
+   pimg->read_error = NULL;
+   pimg->zfh = NULL;
+   pimg->wbuf = NULL;
 
    pimg->buf_len = 257;
    pimg->label_buf = (char *)xosmalloc(pimg->buf_len);
@@ -757,13 +1605,24 @@ bad_cmap_date:
       return pimg;
    }
 
+#ifdef HAVE_ZLIB
+read_fileid:
+#endif
    if (fread(buf, LITLEN(FILEID) + 1, 1, pimg->fh) != 1 ||
        memcmp(buf, FILEID"\n", LITLEN(FILEID) + 1) != 0) {
-      if (fread(buf + LITLEN(FILEID) + 1, 8, 1, pimg->fh) == 1 &&
-	  memcmp(buf, FILEID"\r\nv0.01\r\n", LITLEN(FILEID) + 9) == 0) {
-	 /* v0 3d file with DOS EOLs */
-	 pimg->version = 0;
-	 goto v03d;
+      if (fread(buf + LITLEN(FILEID) + 1, 8, 1, pimg->fh) == 1) {
+	 if (memcmp(buf, FILEID"\r\nv0.01\r\n", LITLEN(FILEID) + 9) == 0) {
+	    /* v0 3d file with DOS EOLs */
+	    pimg->version = 0;
+	    goto v03d;
+	 }
+#ifdef HAVE_ZLIB
+	 if (memcmp(buf, ZFILEID"\n", LITLEN(ZFILEID) + 1) == 0) {
+	    /* Compressed 3d file - decompress it and start again. */
+	    if (!inflate_3d_file(pimg)) goto error;
+	    goto read_fileid;
+	 }
+#endif
       }
       rewind(pimg->fh);
       if (buf[1] == ' ') {
@@ -818,7 +1677,7 @@ v03d:
    {
        size_t title_len;
        char * title = getline_alloc_len(pimg->fh, &title_len);
-       if (pimg->version == 8 && title) {
+       if (pimg->version >= 8 && title) {
 	   /* We sneak in an extra field after a zero byte here, containing the
 	    * specified coordinate system (if any).  Older readers will just
 	    * not see it (which is fine), and this trick avoids us having to
@@ -917,6 +1776,11 @@ bad_3d_date:
 
    pimg->start = ftell(pimg->fh);
 
+#ifdef HAVE_MMAP
+   if (pimg->version >= 3) map_3d_file(pimg);
+#endif
+   if (pimg->version >= 8 && pimg->survey_len) load_index(pimg);
+
    return pimg;
 }
 
@@ -927,11 +1791,16 @@ img_rewind(img *pimg)
       img_errno = IMG_WRITEERROR;
       return 0;
    }
-   if (fseek(pimg->fh, pimg->start, SEEK_SET) != 0) {
-      img_errno = IMG_READERROR;
-      return 0;
+   if (pimg->data) {
+      pimg->data_next = pimg->data + pimg->start;
+      pimg->data_eof = 0;
+   } else {
+      if (fseek(pimg->fh, pimg->start, SEEK_SET) != 0) {
+	 img_errno = IMG_READERROR;
+	 return 0;
+      }
+      clearerr(pimg->fh);
    }
-   clearerr(pimg->fh);
    /* [VERSION_SURVEX_POS] already skipped heading line, or there wasn't one
     * [version 0] not in the middle of a 'LINE' command
     * [version >= 3] not in the middle of turning a LINE into a MOVE */
@@ -945,7 +1814,19 @@ img_rewind(img *pimg)
    /* for VERSION_CMAP_SHOT, we store the last station here to detect whether
     * we MOVE or LINE */
    pimg->label_len = 0;
+   pimg->label_buf[0] = '\0';
    pimg->style = img_STYLE_UNKNOWN;
+#if IMG_API_VERSION == 0
+   pimg->date1 = pimg->date2 = 0;
+#else /* IMG_API_VERSION == 1 */
+   pimg->days1 = pimg->days2 = -1;
+#endif
+   if (pimg->index) {
+      /* Start again from the first range in the index. */
+      pimg->index->next_range = 0;
+      pimg->index->range_end = 0;
+      pimg->index->xsect_open = 0;
+   }
    return 1;
 }
 
@@ -960,83 +1841,113 @@ img_open_write_cs(const char *fnm, const char *title, const char *cs, int flags)
    return img_write_stream(fopen(fnm, "wb"), fclose, title, cs, flags);
 }
 
-img *
-img_write_stream(FILE *stream, int (*close_func)(FILE*),
-		 const char *title, const char *cs, int flags)
+/* Start writing to stream, or to memory if stream is NULL. */
+static img *
+write_stream(FILE *stream, int (*close_func)(FILE*),
+	     const char *title, const char *cs, int flags)
 {
    time_t tm;
    img *pimg;
 
-   if (stream == NULL) {
-      img_errno = IMG_FILENOTFOUND;
-      return NULL;
-   }
-
    pimg = osnew(img);
    if (pimg == NULL) {
       img_errno = IMG_OUTOFMEMORY;
-      if (close_func) close_func(stream);
+      if (stream && close_func) close_func(stream);
       return NULL;
    }
 
    pimg->fh = stream;
+   pimg->data = NULL;
+   pimg->index = NULL;
+   pimg->read_error = NULL;
    pimg->close_func = close_func;
+   pimg->zfh = NULL;
+   pimg->wbuf = NULL;
+   pimg->wbuf_len = pimg->wbuf_size = 0;
+   pimg->wbuf_failed = 0;
+   /* If we can't tell where we are in stream (e.g. it's a pipe), then we
+    * can't write an index. */
+   pimg->wbuf_offset = stream ? ftell(stream) : 0;
    pimg->buf_len = 257;
    pimg->label_buf = (char *)xosmalloc(pimg->buf_len);
    if (!pimg->label_buf) {
-      if (pimg->close_func) pimg->close_func(pimg->fh);
+      if (pimg->fh && pimg->close_func) pimg->close_func(pimg->fh);
       osfree(pimg);
       img_errno = IMG_OUTOFMEMORY;
       return NULL;
    }
 
+#ifdef HAVE_ZLIB
+   if (stream && (flags & img_FFLAG_COMPRESSED)) {
+      /* Collect the data in memory, and compress it into stream when we
+       * close. */
+      pimg->zfh = stream;
+      pimg->zclose_func = close_func;
+      pimg->fh = NULL;
+      pimg->close_func = NULL;
+      pimg->wbuf_offset = 0;
+   }
+#endif
+
    pimg->filename_opened = NULL;
 
    /* Output image file header */
-   fputs("Survex 3D Image File\n", pimg->fh); /* file identifier string */
+   img_puts(pimg, "Survex 3D Image File\n"); /* file identifier string */
    if (img_output_version < 2) {
       pimg->version = 1;
-      fputs("Bv0.01\n", pimg->fh); /* binary file format version number */
+      img_puts(pimg, "Bv0.01\n"); /* binary file format version number */
    } else {
+      char buf[16];
       pimg->version = (img_output_version > IMG_VERSION_MAX) ? IMG_VERSION_MAX : img_output_version;
-      fprintf(pimg->fh, "v%d\n", pimg->version); /* file format version no. */
+      sprintf(buf, "v%d\n", pimg->version); /* file format version no. */
+      img_puts(pimg, buf);
    }
 
-   fputs(title, pimg->fh);
+   img_puts(pimg, title);
    if (pimg->version < 8 && (flags & img_FFLAG_EXTENDED)) {
       /* Older format versions append " (extended)" to the title to mark
        * extended elevations. */
       size_t len = strlen(title);
       if (len < 11 || strcmp(title + len - 11, " (extended)") != 0)
-	 fputs(" (extended)", pimg->fh);
+	 img_puts(pimg, " (extended)");
    }
-   if (pimg->version == 8 && cs && *cs) {
+   if (pimg->version >= 8 && cs && *cs) {
       /* We sneak in an extra field after a zero byte here, containing the
        * specified coordinate system (if any).  Older readers will just not
        * see it (which is fine), and this trick avoids us having to bump the
        * 3d format version.
        */
-      PUTC('\0', pimg->fh);
-      fputs(cs, pimg->fh);
+      img_putc(pimg, '\0');
+      img_puts(pimg, cs);
    }
-   PUTC('\n', pimg->fh);
+   img_putc(pimg, '\n');
 
    tm = time(NULL);
    if (tm == (time_t)-1) {
-      fputsnl(TIMENA, pimg->fh);
+      img_puts(pimg, TIMENA);
+      img_putc(pimg, '\n');
    } else if (pimg->version <= 7) {
       char date[256];
       /* output current date and time in format specified */
       strftime(date, 256, TIMEFMT, localtime(&tm));
-      fputsnl(date, pimg->fh);
+      img_puts(pimg, date);
+      img_putc(pimg, '\n');
    } else {
-      fprintf(pimg->fh, "@%ld\n", (long)tm);
+      char date[32];
+      sprintf(date, "@%ld\n", (long)tm);
+      img_puts(pimg, date);
    }
 
    if (pimg->version >= 8) {
       /* Clear bit one in case anyone has been passing true for fBinary. */
       flags &=~ 1;
-      PUTC(flags, pimg->fh);
+      /* Whether the file is compressed isn't recorded in the flags. */
+      flags &=~ img_FFLAG_COMPRESSED;
+      img_putc(pimg, flags);
+      /* If we fail to allocate this, we just don't write an index (or for
+       * format version 9, divide the data into chunks). */
+      pimg->index = new_index();
+      if (pimg->index && pimg->version >= 9) add_chunk(pimg);
    }
 
 #if 0
@@ -1045,7 +1956,7 @@ img_write_stream(FILE *stream, int (*close_func)(FILE*),
 	   4,  8,  8,  16, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
 	   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
        };
-       fwrite(codelengths, 32, 1, pimg->fh);
+       img_write(pimg, codelengths, 32);
    }
 #endif
    pimg->fRead = 0; /* writing to this file */
@@ -1074,6 +1985,25 @@ img_write_stream(FILE *stream, int (*close_func)(FILE*),
    return pimg;
 }
 
+img *
+img_write_stream(FILE *stream, int (*close_func)(FILE*),
+		 const char *title, const char *cs, int flags)
+{
+   if (stream == NULL) {
+      img_errno = IMG_FILENOTFOUND;
+      return NULL;
+   }
+
+   return write_stream(stream, close_func, title, cs, flags);
+}
+
+img *
+img_write_memory(const char *title, const char *cs, int flags)
+{
+   /* We don't support compressing data written to memory. */
+   return write_stream(NULL, NULL, title, cs, flags &~ img_FFLAG_COMPRESSED);
+}
+
 static void
 read_xyz_station_coords(img_point *pt, const char *line)
 {
@@ -1117,65 +2047,74 @@ subtract_xyz_shot_deltas(img_point *pt, const char *line)
 }
 
 static int
-read_coord(FILE *fh, img_point *pt)
+read_coord(img *pimg, img_point *pt)
 {
-   SVX_ASSERT(fh);
+   SVX_ASSERT(pimg);
    SVX_ASSERT(pt);
-   pt->x = get32(fh) / 100.0;
-   pt->y = get32(fh) / 100.0;
-   pt->z = get32(fh) / 100.0;
-   if (ferror(fh) || feof(fh)) {
-      img_errno = feof(fh) ? IMG_BADFORMAT : IMG_READERROR;
+   pt->x = img_get32(pimg) / 100.0;
+   pt->y = img_get32(pimg) / 100.0;
+   pt->z = img_get32(pimg) / 100.0;
+   if (img_ferror(pimg) || img_feof(pimg)) {
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return 0;
    }
    return 1;
 }
 
 static int
-skip_coord(FILE *fh)
+skip_coord(img *pimg)
 {
-    return (fseek(fh, 12, SEEK_CUR) == 0);
+    if (pimg->data) {
+	if (pimg->data_end - pimg->data_next < 12) {
+	    pimg->data_next = pimg->data_end;
+	    pimg->data_eof = 1;
+	    return 0;
+	}
+	pimg->data_next += 12;
+	return 1;
+    }
+    return (fseek(pimg->fh, 12, SEEK_CUR) == 0);
 }
 
 static int
 read_v3label(img *pimg)
 {
    char *q;
-   long len = GETC(pimg->fh);
+   long len = img_getc(pimg);
    if (len == EOF) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return img_BAD;
    }
    if (len == 0xfe) {
-      len += get16(pimg->fh);
-      if (feof(pimg->fh)) {
-	 img_errno = IMG_BADFORMAT;
+      len += img_get16(pimg);
+      if (img_feof(pimg)) {
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
-      if (ferror(pimg->fh)) {
-	 img_errno = IMG_READERROR;
+      if (img_ferror(pimg)) {
+	 set_read_error(pimg, IMG_READERROR);
 	 return img_BAD;
       }
    } else if (len == 0xff) {
-      len = get32(pimg->fh);
-      if (ferror(pimg->fh)) {
-	 img_errno = IMG_READERROR;
+      len = img_get32(pimg);
+      if (img_ferror(pimg)) {
+	 set_read_error(pimg, IMG_READERROR);
 	 return img_BAD;
       }
-      if (feof(pimg->fh) || len < 0xfe + 0xffff) {
-	 img_errno = IMG_BADFORMAT;
+      if (img_feof(pimg) || len < 0xfe + 0xffff) {
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
    }
 
    if (!check_label_space(pimg, pimg->label_len + len + 1)) {
-      img_errno = IMG_OUTOFMEMORY;
+      set_read_error(pimg, IMG_OUTOFMEMORY);
       return img_BAD;
    }
    q = pimg->label_buf + pimg->label_len;
    pimg->label_len += len;
-   if (len && fread(q, len, 1, pimg->fh) != 1) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+   if (len && !img_read(pimg, q, len)) {
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return img_BAD;
    }
    q[len] = '\0';
@@ -1191,59 +2130,59 @@ read_v8label(img *pimg, int common_flag, size_t common_val)
       if (common_val == 0) return 0;
       add = del = common_val;
    } else {
-      int ch = GETC(pimg->fh);
+      int ch = img_getc(pimg);
       if (ch == EOF) {
-	 img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	 set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	 return img_BAD;
       }
       if (ch != 0x00) {
 	 del = ch >> 4;
 	 add = ch & 0x0f;
       } else {
-	 ch = GETC(pimg->fh);
+	 ch = img_getc(pimg);
 	 if (ch == EOF) {
-	    img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	    set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	    return img_BAD;
 	 }
 	 if (ch != 0xff) {
 	    del = ch;
 	 } else {
-	    del = get32(pimg->fh);
-	    if (ferror(pimg->fh)) {
-	       img_errno = IMG_READERROR;
+	    del = img_get32(pimg);
+	    if (img_ferror(pimg)) {
+	       set_read_error(pimg, IMG_READERROR);
 	       return img_BAD;
 	    }
 	 }
-	 ch = GETC(pimg->fh);
+	 ch = img_getc(pimg);
 	 if (ch == EOF) {
-	    img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	    set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	    return img_BAD;
 	 }
 	 if (ch != 0xff) {
 	    add = ch;
 	 } else {
-	    add = get32(pimg->fh);
-	    if (ferror(pimg->fh)) {
-	       img_errno = IMG_READERROR;
+	    add = img_get32(pimg);
+	    if (img_ferror(pimg)) {
+	       set_read_error(pimg, IMG_READERROR);
 	       return img_BAD;
 	    }
 	 }
       }
 
       if (add > del && !check_label_space(pimg, pimg->label_len + add - del + 1)) {
-	 img_errno = IMG_OUTOFMEMORY;
+	 set_read_error(pimg, IMG_OUTOFMEMORY);
 	 return img_BAD;
       }
    }
    if (del > pimg->label_len) {
-      img_errno = IMG_BADFORMAT;
+      set_read_error(pimg, IMG_BADFORMAT);
       return img_BAD;
    }
    pimg->label_len -= del;
    q = pimg->label_buf + pimg->label_len;
    pimg->label_len += add;
-   if (add && fread(q, add, 1, pimg->fh) != 1) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+   if (add && !img_read(pimg, q, add)) {
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return img_BAD;
    }
    q[add] = '\0';
@@ -1272,6 +2211,682 @@ img_read_item(img *pimg, img_point *p)
    }
 }
 
+void
+img_columns_init(img_columns *cols)
+{
+   memset(cols, 0, sizeof(img_columns));
+}
+
+void
+img_columns_free(img_columns *cols)
+{
+   osfree(cols->points);
+   osfree(cols->leg_to);
+   osfree(cols->leg_flags);
+   osfree(cols->leg_style);
+#if IMG_API_VERSION == 0
+   osfree(cols->leg_date1);
+   osfree(cols->leg_date2);
+#else /* IMG_API_VERSION == 1 */
+   osfree(cols->leg_days1);
+   osfree(cols->leg_days2);
+#endif
+   osfree(cols->leg_survey);
+   osfree(cols->stn_point);
+   osfree(cols->stn_flags);
+   osfree(cols->stn_label);
+   osfree(cols->xsect_label);
+   osfree(cols->xsect_l);
+   osfree(cols->xsect_r);
+   osfree(cols->xsect_u);
+   osfree(cols->xsect_d);
+   osfree(cols->xsect_flags);
+#if IMG_API_VERSION == 0
+   osfree(cols->xsect_date1);
+   osfree(cols->xsect_date2);
+#else /* IMG_API_VERSION == 1 */
+   osfree(cols->xsect_days1);
+   osfree(cols->xsect_days2);
+#endif
+   osfree(cols->error_leg);
+   osfree(cols->error_n_legs);
+   osfree(cols->error_length);
+   osfree(cols->error_E);
+   osfree(cols->error_H);
+   osfree(cols->error_V);
+   osfree(cols->labels);
+   osfree(cols->label_hash);
+   img_columns_init(cols);
+}
+
+/* Resize column P of type T to hold N entries - on failure, P is left
+ * unchanged and the enclosing function returns 0. */
+#define GROW_COLUMN(P, T, N) \
+   do { \
+      T *grow_tmp_ = (T *)xosrealloc((P), (N) * sizeof(T)); \
+      if (!grow_tmp_) return 0; \
+      (P) = grow_tmp_; \
+   } while (0)
+
+#define COLUMN_INITIAL_SIZE 1024
+
+static int
+grow_points(img_columns *cols)
+{
+   size_t n = cols->points_size ? cols->points_size * 2 : COLUMN_INITIAL_SIZE;
+   GROW_COLUMN(cols->points, img_point, n);
+   cols->points_size = n;
+   return 1;
+}
+
+static int
+grow_legs(img_columns *cols)
+{
+   size_t n = cols->legs_size ? cols->legs_size * 2 : COLUMN_INITIAL_SIZE;
+   GROW_COLUMN(cols->leg_to, size_t, n);
+   GROW_COLUMN(cols->leg_flags, int, n);
+   GROW_COLUMN(cols->leg_style, int, n);
+#if IMG_API_VERSION == 0
+   GROW_COLUMN(cols->leg_date1, time_t, n);
+   GROW_COLUMN(cols->leg_date2, time_t, n);
+#else /* IMG_API_VERSION == 1 */
+   GROW_COLUMN(cols->leg_days1, int, n);
+   GROW_COLUMN(cols->leg_days2, int, n);
+#endif
+   GROW_COLUMN(cols->leg_survey, size_t, n);
+   cols->legs_size = n;
+   return 1;
+}
+
+static int
+grow_stations(img_columns *cols)
+{
+   size_t n = cols->stations_size ? cols->stations_size * 2 : COLUMN_INITIAL_SIZE;
+   GROW_COLUMN(cols->stn_point, img_point, n);
+   GROW_COLUMN(cols->stn_flags, int, n);
+   GROW_COLUMN(cols->stn_label, size_t, n);
+   cols->stations_size = n;
+   return 1;
+}
+
+static int
+grow_xsects(img_columns *cols)
+{
+   size_t n = cols->xsects_size ? cols->xsects_size * 2 : COLUMN_INITIAL_SIZE;
+   GROW_COLUMN(cols->xsect_label, size_t, n);
+   GROW_COLUMN(cols->xsect_l, double, n);
+   GROW_COLUMN(cols->xsect_r, double, n);
+   GROW_COLUMN(cols->xsect_u, double, n);
+   GROW_COLUMN(cols->xsect_d, double, n);
+   GROW_COLUMN(cols->xsect_flags, int, n);
+#if IMG_API_VERSION == 0
+   GROW_COLUMN(cols->xsect_date1, time_t, n);
+   GROW_COLUMN(cols->xsect_date2, time_t, n);
+#else /* IMG_API_VERSION == 1 */
+   GROW_COLUMN(cols->xsect_days1, int, n);
+   GROW_COLUMN(cols->xsect_days2, int, n);
+#endif
+   cols->xsects_size = n;
+   return 1;
+}
+
+static int
+grow_errors(img_columns *cols)
+{
+   size_t n = cols->errors_size ? cols->errors_size * 2 : COLUMN_INITIAL_SIZE;
+   GROW_COLUMN(cols->error_leg, size_t, n);
+   GROW_COLUMN(cols->error_n_legs, int, n);
+   GROW_COLUMN(cols->error_length, double, n);
+   GROW_COLUMN(cols->error_E, double, n);
+   GROW_COLUMN(cols->error_H, double, n);
+   GROW_COLUMN(cols->error_V, double, n);
+   cols->errors_size = n;
+   return 1;
+}
+
+/* Double the size of the label hash table and reinsert the labels. */
+static int
+grow_label_hash(img_columns *cols)
+{
+   size_t n = cols->label_hash_size ? cols->label_hash_size * 2 : 256;
+   size_t *table = (size_t *)xosmalloc(n * sizeof(size_t));
+   size_t i;
+   if (!table) return 0;
+   memset(table, 0, n * sizeof(size_t));
+   for (i = 0; i < cols->label_hash_size; i++) {
+      size_t off = cols->label_hash[i];
+      unsigned long h = 2166136261ul;
+      const unsigned char *s;
+      size_t j;
+      if (!off) continue;
+      for (s = (const unsigned char *)cols->labels + off - 1; *s; s++) {
+	 h = ((h ^ *s) * 16777619ul) & 0xfffffffful;
+      }
+      j = h & (n - 1);
+      while (table[j]) j = (j + 1) & (n - 1);
+      table[j] = off;
+   }
+   osfree(cols->label_hash);
+   cols->label_hash = table;
+   cols->label_hash_size = n;
+   return 1;
+}
+
+/* Find label s in the labels buffer, adding it if it isn't there already.
+ * Returns 0 if we run out of memory, otherwise the offset of the label
+ * plus one.
+ */
+static size_t
+intern_label(img_columns *cols, const char *s)
+{
+   unsigned long h = 2166136261ul;
+   size_t len, i;
+   const unsigned char *p;
+   for (p = (const unsigned char *)s; *p; p++) {
+      h = ((h ^ *p) * 16777619ul) & 0xfffffffful;
+   }
+   len = (const char *)p - s;
+   if (cols->n_labels * 2 >= cols->label_hash_size) {
+      if (!grow_label_hash(cols)) return 0;
+   }
+   i = h & (cols->label_hash_size - 1);
+   while (cols->label_hash[i]) {
+      size_t off = cols->label_hash[i] - 1;
+      if (strcmp(cols->labels + off, s) == 0) return off + 1;
+      i = (i + 1) & (cols->label_hash_size - 1);
+   }
+   if (cols->labels_len + len + 1 > cols->labels_size) {
+      size_t n = cols->labels_size ? cols->labels_size * 2 : 65536;
+      char *labels;
+      while (cols->labels_len + len + 1 > n) n *= 2;
+      labels = (char *)xosrealloc(cols->labels, n);
+      if (!labels) return 0;
+      cols->labels = labels;
+      cols->labels_size = n;
+   }
+   memcpy(cols->labels + cols->labels_len, s, len + 1);
+   cols->label_hash[i] = cols->labels_len + 1;
+   cols->labels_len += len + 1;
+   ++cols->n_labels;
+   return cols->label_hash[i];
+}
+
+static int
+add_point(img_columns *cols, const img_point *p)
+{
+   if (cols->n_points == cols->points_size && !grow_points(cols)) return 0;
+   cols->points[cols->n_points++] = *p;
+   return 1;
+}
+
+/* Decode the next item into cols.  Returns the item type, or img_BAD with
+ * img_errno set to IMG_OUTOFMEMORY if we run out of memory.
+ */
+static int
+read_column_item(img *pimg, img_columns *cols)
+{
+   img_point pt;
+   size_t label, i;
+   int result = img_read_item(pimg, &pt);
+   switch (result) {
+      case img_MOVE:
+	 if (!add_point(cols, &pt)) goto out_of_memory;
+	 break;
+      case img_LINE:
+	 if (cols->n_points == 0) {
+	    /* No preceding move - treat as one. */
+	    if (!add_point(cols, &pt)) goto out_of_memory;
+	    break;
+	 }
+	 label = intern_label(cols, pimg->label);
+	 if (!label) goto out_of_memory;
+	 if (!add_point(cols, &pt)) goto out_of_memory;
+	 if (cols->n_legs == cols->legs_size && !grow_legs(cols))
+	    goto out_of_memory;
+	 i = cols->n_legs++;
+	 cols->leg_to[i] = cols->n_points - 1;
+	 cols->leg_flags[i] = pimg->flags;
+	 cols->leg_style[i] = pimg->style;
+#if IMG_API_VERSION == 0
+	 cols->leg_date1[i] = pimg->date1;
+	 cols->leg_date2[i] = pimg->date2;
+#else /* IMG_API_VERSION == 1 */
+	 cols->leg_days1[i] = pimg->days1;
+	 cols->leg_days2[i] = pimg->days2;
+#endif
+	 cols->leg_survey[i] = label - 1;
+	 break;
+      case img_LABEL:
+	 label = intern_label(cols, pimg->label);
+	 if (!label) goto out_of_memory;
+	 if (cols->n_stations == cols->stations_size && !grow_stations(cols))
+	    goto out_of_memory;
+	 i = cols->n_stations++;
+	 cols->stn_point[i] = pt;
+	 cols->stn_flags[i] = pimg->flags;
+	 cols->stn_label[i] = label - 1;
+	 break;
+      case img_XSECT:
+	 label = intern_label(cols, pimg->label);
+	 if (!label) goto out_of_memory;
+	 if (cols->n_xsects == cols->xsects_size && !grow_xsects(cols))
+	    goto out_of_memory;
+	 i = cols->n_xsects++;
+	 cols->xsect_label[i] = label - 1;
+	 cols->xsect_l[i] = pimg->l;
+	 cols->xsect_r[i] = pimg->r;
+	 cols->xsect_u[i] = pimg->u;
+	 cols->xsect_d[i] = pimg->d;
+	 cols->xsect_flags[i] = 0;
+#if IMG_API_VERSION == 0
+	 cols->xsect_date1[i] = pimg->date1;
+	 cols->xsect_date2[i] = pimg->date2;
+#else /* IMG_API_VERSION == 1 */
+	 cols->xsect_days1[i] = pimg->days1;
+	 cols->xsect_days2[i] = pimg->days2;
+#endif
+	 break;
+      case img_XSECT_END:
+	 if (cols->n_xsects)
+	    cols->xsect_flags[cols->n_xsects - 1] |= img_XFLAG_END;
+	 break;
+      case img_ERROR_INFO:
+	 if (cols->n_errors == cols->errors_size && !grow_errors(cols))
+	    goto out_of_memory;
+	 i = cols->n_errors++;
+	 cols->error_leg[i] = cols->n_legs;
+	 cols->error_n_legs[i] = pimg->n_legs;
+	 cols->error_length[i] = pimg->length;
+	 cols->error_E[i] = pimg->E;
+	 cols->error_H[i] = pimg->H;
+	 cols->error_V[i] = pimg->V;
+	 break;
+   }
+   return result;
+
+out_of_memory:
+   set_read_error(pimg, IMG_OUTOFMEMORY);
+   return img_BAD;
+}
+
+int
+img_read_columns(img *pimg, img_columns *cols, size_t max_items)
+{
+   size_t n_items = 0;
+   int have_last = (cols->n_points > 0);
+   img_point last;
+   if (have_last) last = cols->points[cols->n_points - 1];
+
+   cols->n_points = cols->n_legs = cols->n_stations = 0;
+   cols->n_xsects = cols->n_errors = 0;
+   cols->labels_len = 0;
+   cols->n_labels = 0;
+   if (cols->label_hash)
+      memset(cols->label_hash, 0, cols->label_hash_size * sizeof(size_t));
+
+   /* Start with the last point from the previous chunk so legs which
+    * continue from it have somewhere to start from. */
+   if (have_last && !add_point(cols, &last)) {
+      img_errno = IMG_OUTOFMEMORY;
+      return img_BAD;
+   }
+
+   while (max_items == 0 || n_items < max_items) {
+      int result = read_column_item(pimg, cols);
+      if (result == img_STOP || result == img_BAD) return result;
+      ++n_items;
+   }
+   return 0;
+}
+
+#if defined HAVE_MMAP && defined HAVE_PTHREAD
+static unsigned long
+mapped_u32(const unsigned char *p)
+{
+   return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) |
+	  ((unsigned long)p[3] << 24);
+}
+
+/* Read the chunk table of a mapped format version 9 file.  Returns the
+ * number of chunks and sets *p_offsets to an array of the offset of each
+ * chunk, followed by the offset at which the data must have ended (which
+ * the caller should osfree()).  Returns 0 if there's no usable chunk table.
+ */
+static size_t
+read_chunk_table(const img *pimg, unsigned long **p_offsets)
+{
+   const size_t trailer_len = 8 + LITLEN(INDEX_MAGIC);
+   size_t size = pimg->data_end - pimg->data;
+   unsigned long table, n, i;
+   unsigned long *offsets;
+   const unsigned char *p;
+   if (size < (size_t)pimg->start + trailer_len ||
+       size > 0xfffffffful ||
+       memcmp(pimg->data_end - LITLEN(INDEX_MAGIC), INDEX_MAGIC,
+	      LITLEN(INDEX_MAGIC)) != 0)
+      return 0;
+   table = mapped_u32(pimg->data_end - trailer_len);
+   if (table < (unsigned long)pimg->start || table > size - trailer_len)
+      return 0;
+   p = pimg->data + table;
+   n = mapped_u32(p);
+   if (n == 0 || n > (size - trailer_len - table - 4) / 4) return 0;
+   offsets = (unsigned long *)xosmalloc((n + 1) * sizeof(unsigned long));
+   if (!offsets) return 0;
+   for (i = 0; i < n; i++) {
+      offsets[i] = mapped_u32(p + 4 + i * 4);
+      if (offsets[i] < (i ? offsets[i - 1] : (unsigned long)pimg->start) ||
+	  offsets[i] > table) {
+	 osfree(offsets);
+	 return 0;
+      }
+   }
+   offsets[n] = table;
+   *p_offsets = offsets;
+   return n;
+}
+
+/* Decode the items in the chunk between offsets start and end into cols,
+ * using a private copy of the decoder state so that chunks can be decoded
+ * in parallel.  Returns img_STOP if successful, or img_BAD on error with
+ * the error code in *p_error (we can't set img_errno from another thread).
+ */
+static int
+decode_chunk(const img *pimg, unsigned long start, unsigned long end,
+	     img_columns *cols, int *p_error)
+{
+   img dec = *pimg;
+   int result = img_STOP;
+   dec.read_error = p_error;
+   dec.buf_len = 257;
+   dec.label_buf = (char *)xosmalloc(dec.buf_len);
+   if (!dec.label_buf) {
+      *p_error = IMG_OUTOFMEMORY;
+      return img_BAD;
+   }
+   dec.label_buf[0] = '\0';
+   dec.label = dec.label_buf;
+   dec.label_len = 0;
+   dec.data_next = pimg->data + start;
+   dec.data_end = pimg->data + end;
+   dec.data_eof = 0;
+   dec.survey = NULL;
+   dec.survey_len = 0;
+   dec.index = NULL;
+   dec.pending = 0;
+   dec.style = img_STYLE_UNKNOWN;
+#if IMG_API_VERSION == 0
+   dec.date1 = dec.date2 = 0;
+#else /* IMG_API_VERSION == 1 */
+   dec.days1 = dec.days2 = -1;
+#endif
+   /* Items never span chunks, but we may have an img_XSECT_END pending. */
+   while (dec.data_next < dec.data_end || dec.pending >= 0x40) {
+      result = read_column_item(&dec, cols);
+      if (result == img_STOP || result == img_BAD) break;
+      result = img_STOP;
+   }
+   osfree(dec.label_buf);
+   return result;
+}
+
+/* The chunks waiting to be decoded, which threads take in turn.  The error
+ * from decoding chunk i is stored in errors[i]. */
+typedef struct {
+   const img *pimg;
+   const unsigned long *offsets;
+   img_columns *parts;
+   int *errors;
+   size_t n_chunks, next_chunk;
+   int result;
+   pthread_mutex_t mutex;
+} chunk_queue;
+
+static void *
+decode_worker(void *arg)
+{
+   chunk_queue *q = (chunk_queue *)arg;
+   while (1) {
+      size_t i;
+      int result;
+      pthread_mutex_lock(&q->mutex);
+      if (q->next_chunk == q->n_chunks || q->result == img_BAD) {
+	 pthread_mutex_unlock(&q->mutex);
+	 return NULL;
+      }
+      i = q->next_chunk++;
+      pthread_mutex_unlock(&q->mutex);
+      result = decode_chunk(q->pimg, q->offsets[i], q->offsets[i + 1],
+			    &q->parts[i], &q->errors[i]);
+      if (result == img_BAD) {
+	 pthread_mutex_lock(&q->mutex);
+	 q->result = img_BAD;
+	 pthread_mutex_unlock(&q->mutex);
+      }
+   }
+}
+
+/* Append the columns decoded from each chunk to cols.  Returns 0 if we run
+ * out of memory. */
+static int
+merge_columns(img_columns *cols, const img_columns *parts, size_t n_parts)
+{
+   size_t n_points = 0, n_legs = 0, n_stations = 0, n_xsects = 0;
+   size_t n_errors = 0, labels_len = 0;
+   size_t i, j;
+   for (i = 0; i < n_parts; i++) {
+      n_points += parts[i].n_points;
+      n_legs += parts[i].n_legs;
+      n_stations += parts[i].n_stations;
+      n_xsects += parts[i].n_xsects;
+      n_errors += parts[i].n_errors;
+      labels_len += parts[i].labels_len;
+   }
+   while (cols->points_size < n_points)
+      if (!grow_points(cols)) return 0;
+   while (cols->legs_size < n_legs)
+      if (!grow_legs(cols)) return 0;
+   while (cols->stations_size < n_stations)
+      if (!grow_stations(cols)) return 0;
+   while (cols->xsects_size < n_xsects)
+      if (!grow_xsects(cols)) return 0;
+   while (cols->errors_size < n_errors)
+      if (!grow_errors(cols)) return 0;
+   if (cols->labels_size < labels_len) {
+      char *labels = (char *)xosrealloc(cols->labels, labels_len);
+      if (!labels) return 0;
+      cols->labels = labels;
+      cols->labels_size = labels_len;
+   }
+
+   for (i = 0; i < n_parts; i++) {
+      const img_columns *part = &parts[i];
+      size_t point0 = cols->n_points, leg0 = cols->n_legs;
+      size_t stn0 = cols->n_stations, xsect0 = cols->n_xsects;
+      size_t error0 = cols->n_errors, label0 = cols->labels_len;
+
+      /* Skip empty columns, which may not have been allocated. */
+      if (part->n_points)
+	 memcpy(cols->points + point0, part->points,
+		part->n_points * sizeof(img_point));
+      if (part->labels_len)
+	 memcpy(cols->labels + label0, part->labels, part->labels_len);
+
+      if (part->n_legs) {
+	 for (j = 0; j < part->n_legs; j++) {
+	    cols->leg_to[leg0 + j] = part->leg_to[j] + point0;
+	    cols->leg_survey[leg0 + j] = part->leg_survey[j] + label0;
+	 }
+	 memcpy(cols->leg_flags + leg0, part->leg_flags,
+		part->n_legs * sizeof(int));
+	 memcpy(cols->leg_style + leg0, part->leg_style,
+		part->n_legs * sizeof(int));
+#if IMG_API_VERSION == 0
+	 memcpy(cols->leg_date1 + leg0, part->leg_date1,
+		part->n_legs * sizeof(time_t));
+	 memcpy(cols->leg_date2 + leg0, part->leg_date2,
+		part->n_legs * sizeof(time_t));
+#else /* IMG_API_VERSION == 1 */
+	 memcpy(cols->leg_days1 + leg0, part->leg_days1,
+		part->n_legs * sizeof(int));
+	 memcpy(cols->leg_days2 + leg0, part->leg_days2,
+		part->n_legs * sizeof(int));
+#endif
+      }
+
+      if (part->n_stations) {
+	 for (j = 0; j < part->n_stations; j++)
+	    cols->stn_label[stn0 + j] = part->stn_label[j] + label0;
+	 memcpy(cols->stn_point + stn0, part->stn_point,
+		part->n_stations * sizeof(img_point));
+	 memcpy(cols->stn_flags + stn0, part->stn_flags,
+		part->n_stations * sizeof(int));
+      }
+
+      if (part->n_xsects) {
+	 for (j = 0; j < part->n_xsects; j++)
+	    cols->xsect_label[xsect0 + j] = part->xsect_label[j] + label0;
+	 memcpy(cols->xsect_l + xsect0, part->xsect_l,
+		part->n_xsects * sizeof(double));
+	 memcpy(cols->xsect_r + xsect0, part->xsect_r,
+		part->n_xsects * sizeof(double));
+	 memcpy(cols->xsect_u + xsect0, part->xsect_u,
+		part->n_xsects * sizeof(double));
+	 memcpy(cols->xsect_d + xsect0, part->xsect_d,
+		part->n_xsects * sizeof(double));
+	 memcpy(cols->xsect_flags + xsect0, part->xsect_flags,
+		part->n_xsects * sizeof(int));
+#if IMG_API_VERSION == 0
+	 memcpy(cols->xsect_date1 + xsect0, part->xsect_date1,
+		part->n_xsects * sizeof(time_t));
+	 memcpy(cols->xsect_date2 + xsect0, part->xsect_date2,
+		part->n_xsects * sizeof(time_t));
+#else /* IMG_API_VERSION == 1 */
+	 memcpy(cols->xsect_days1 + xsect0, part->xsect_days1,
+		part->n_xsects * sizeof(int));
+	 memcpy(cols->xsect_days2 + xsect0, part->xsect_days2,
+		part->n_xsects * sizeof(int));
+#endif
+      }
+
+      if (part->n_errors) {
+	 for (j = 0; j < part->n_errors; j++)
+	    cols->error_leg[error0 + j] = part->error_leg[j] + leg0;
+	 memcpy(cols->error_n_legs + error0, part->error_n_legs,
+		part->n_errors * sizeof(int));
+	 memcpy(cols->error_length + error0, part->error_length,
+		part->n_errors * sizeof(double));
+	 memcpy(cols->error_E + error0, part->error_E,
+		part->n_errors * sizeof(double));
+	 memcpy(cols->error_H + error0, part->error_H,
+		part->n_errors * sizeof(double));
+	 memcpy(cols->error_V + error0, part->error_V,
+		part->n_errors * sizeof(double));
+      }
+
+      cols->n_points += part->n_points;
+      cols->n_legs += part->n_legs;
+      cols->n_stations += part->n_stations;
+      cols->n_xsects += part->n_xsects;
+      cols->n_errors += part->n_errors;
+      cols->labels_len += part->labels_len;
+   }
+   return 1;
+}
+#endif
+
+int
+img_read_columns_parallel(img *pimg, img_columns *cols, int n_threads)
+{
+   int result;
+#if defined HAVE_MMAP && defined HAVE_PTHREAD
+   unsigned long *offsets = NULL;
+   size_t n_chunks = 0;
+   if (pimg->version >= 9 && pimg->data && !pimg->survey_len &&
+       n_threads > 1)
+      n_chunks = read_chunk_table(pimg, &offsets);
+   if (n_chunks > 1) {
+      chunk_queue q;
+      pthread_t *threads;
+      size_t i, n;
+
+      q.parts = (img_columns *)xosmalloc(n_chunks * sizeof(img_columns));
+      q.errors = (int *)xosmalloc(n_chunks * sizeof(int));
+      threads = (pthread_t *)xosmalloc(n_threads * sizeof(pthread_t));
+      if (!q.parts || !q.errors || !threads) {
+	 osfree(q.parts);
+	 osfree(q.errors);
+	 osfree(threads);
+	 osfree(offsets);
+	 img_errno = IMG_OUTOFMEMORY;
+	 return img_BAD;
+      }
+      for (i = 0; i < n_chunks; i++) {
+	 img_columns_init(&q.parts[i]);
+	 q.errors[i] = IMG_NONE;
+      }
+      q.pimg = pimg;
+      q.offsets = offsets;
+      q.n_chunks = n_chunks;
+      q.next_chunk = 0;
+      q.result = img_STOP;
+      pthread_mutex_init(&q.mutex, NULL);
+
+      /* This thread decodes chunks too. */
+      n = (size_t)n_threads - 1;
+      if (n > n_chunks - 1) n = n_chunks - 1;
+      for (i = 0; i < n; i++) {
+	 /* If we can't start another thread, make do with those we have. */
+	 if (pthread_create(&threads[i], NULL, decode_worker, &q) != 0) break;
+      }
+      n = i;
+      decode_worker(&q);
+      for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+      pthread_mutex_destroy(&q.mutex);
+
+      cols->n_points = cols->n_legs = cols->n_stations = 0;
+      cols->n_xsects = cols->n_errors = 0;
+      cols->labels_len = 0;
+      cols->n_labels = 0;
+      if (cols->label_hash)
+	 memset(cols->label_hash, 0, cols->label_hash_size * sizeof(size_t));
+      result = q.result;
+      if (result == img_BAD) {
+	 /* Chunks are taken in order and any taken are finished, so the
+	  * first chunk which failed doesn't depend on thread timing.  Any
+	  * error other than running out of memory means the file is damaged.
+	  */
+	 img_errno = IMG_BADFORMAT;
+	 for (i = 0; i < n_chunks; i++) {
+	    if (q.errors[i] != IMG_NONE) {
+	       if (q.errors[i] == IMG_OUTOFMEMORY) img_errno = IMG_OUTOFMEMORY;
+	       break;
+	    }
+	 }
+      } else if (!merge_columns(cols, q.parts, n_chunks)) {
+	 img_errno = IMG_OUTOFMEMORY;
+	 result = img_BAD;
+      }
+
+      for (i = 0; i < n_chunks; i++) img_columns_free(&q.parts[i]);
+      osfree(q.parts);
+      osfree(q.errors);
+      osfree(threads);
+      osfree(offsets);
+      return result;
+   }
+   osfree(offsets);
+#else
+   (void)n_threads;
+#endif
+   if (!img_rewind(pimg)) return img_BAD;
+   /* Don't continue from the last point of any data already in cols. */
+   cols->n_points = 0;
+   result = img_read_columns(pimg, cols, 0);
+   if (result == img_STOP && !img_rewind(pimg)) result = img_BAD;
+   return result;
+}
+
 static int
 img_read_item_new(img *pimg, img_point *p)
 {
@@ -1281,6 +2896,7 @@ img_read_item_new(img *pimg, img_point *p)
    if (pimg->pending >= 0x40) {
       if (pimg->pending == 256) {
 	 pimg->pending = 0;
+	 if (pimg->index) pimg->index->xsect_open = 0;
 	 return img_XSECT_END;
       }
       *p = pimg->mv;
@@ -1290,9 +2906,19 @@ img_read_item_new(img *pimg, img_point *p)
    }
    again3: /* label to goto if we get a prefix, date, or lrud */
    pimg->label = pimg->label_buf;
-   opt = GETC(pimg->fh);
+   if (pimg->index && img_tell(pimg) >= pimg->index->range_end) {
+      /* We've reached the end of a range we want - skip to the next. */
+      result = index_next_range(pimg);
+      if (result != 0) return result;
+      if (pimg->index->xsect_open) {
+	 /* End any passage which continues outside the ranges we want. */
+	 pimg->index->xsect_open = 0;
+	 return img_XSECT_END;
+      }
+   }
+   opt = img_getc(pimg);
    if (opt == EOF) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return img_BAD;
    }
    if (opt >> 6 == 0) {
@@ -1314,7 +2940,7 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x11: { /* Single date */
-		  int days1 = (int)getu16(pimg->fh);
+		  int days1 = (int)img_getu16(pimg);
 #if IMG_API_VERSION == 0
 		  pimg->date2 = pimg->date1 = (days1 - 25567) * 86400;
 #else /* IMG_API_VERSION == 1 */
@@ -1323,8 +2949,8 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x12: { /* Date range (short) */
-		  int days1 = (int)getu16(pimg->fh);
-		  int days2 = days1 + GETC(pimg->fh) + 1;
+		  int days1 = (int)img_getu16(pimg);
+		  int days2 = days1 + img_getc(pimg) + 1;
 #if IMG_API_VERSION == 0
 		  pimg->date1 = (days1 - 25567) * 86400;
 		  pimg->date2 = (days2 - 25567) * 86400;
@@ -1335,8 +2961,8 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x13: { /* Date range (long) */
-		  int days1 = (int)getu16(pimg->fh);
-		  int days2 = (int)getu16(pimg->fh);
+		  int days1 = (int)img_getu16(pimg);
+		  int days2 = (int)img_getu16(pimg);
 #if IMG_API_VERSION == 0
 		  pimg->date1 = (days1 - 25567) * 86400;
 		  pimg->date2 = (days2 - 25567) * 86400;
@@ -1347,26 +2973,26 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x1f: /* Error info */
-		  pimg->n_legs = get32(pimg->fh);
-		  pimg->length = get32(pimg->fh) / 100.0;
-		  pimg->E = get32(pimg->fh) / 100.0;
-		  pimg->H = get32(pimg->fh) / 100.0;
-		  pimg->V = get32(pimg->fh) / 100.0;
+		  pimg->n_legs = img_get32(pimg);
+		  pimg->length = img_get32(pimg) / 100.0;
+		  pimg->E = img_get32(pimg) / 100.0;
+		  pimg->H = img_get32(pimg) / 100.0;
+		  pimg->V = img_get32(pimg) / 100.0;
 		  return img_ERROR_INFO;
 	      case 0x30: case 0x31: /* LRUD */
 	      case 0x32: case 0x33: /* Big LRUD! */
 		  if (read_v8label(pimg, 0, 0) == img_BAD) return img_BAD;
 		  pimg->flags = (int)opt & 0x01;
 		  if (opt < 0x32) {
-		      pimg->l = get16(pimg->fh) / 100.0;
-		      pimg->r = get16(pimg->fh) / 100.0;
-		      pimg->u = get16(pimg->fh) / 100.0;
-		      pimg->d = get16(pimg->fh) / 100.0;
+		      pimg->l = img_get16(pimg) / 100.0;
+		      pimg->r = img_get16(pimg) / 100.0;
+		      pimg->u = img_get16(pimg) / 100.0;
+		      pimg->d = img_get16(pimg) / 100.0;
 		  } else {
-		      pimg->l = get32(pimg->fh) / 100.0;
-		      pimg->r = get32(pimg->fh) / 100.0;
-		      pimg->u = get32(pimg->fh) / 100.0;
-		      pimg->d = get32(pimg->fh) / 100.0;
+		      pimg->l = img_get32(pimg) / 100.0;
+		      pimg->r = img_get32(pimg) / 100.0;
+		      pimg->u = img_get32(pimg) / 100.0;
+		      pimg->d = img_get32(pimg) / 100.0;
 		  }
 		  if (!stn_included(pimg)) {
 		      return img_XSECT_END;
@@ -1377,16 +3003,29 @@ img_read_item_new(img *pimg, img_point *p)
 		      pimg->pending = 256;
 		      pimg->flags &= ~0x01;
 		  }
+		  if (pimg->index) pimg->index->xsect_open = 1;
 		  return img_XSECT;
 	      default: /* 0x25 - 0x2f and 0x34 - 0x3f are currently unallocated. */
-		  img_errno = IMG_BADFORMAT;
+		  set_read_error(pimg, IMG_BADFORMAT);
 		  return img_BAD;
 	  }
 	  goto again3;
       }
+      if (opt == 0x05 && pimg->version >= 9) {
+	 /* CHUNK - the decoder state is reset at the start of each chunk. */
+	 pimg->label_len = 0;
+	 pimg->label_buf[0] = '\0';
+	 pimg->style = img_STYLE_UNKNOWN;
+#if IMG_API_VERSION == 0
+	 pimg->date1 = pimg->date2 = 0;
+#else /* IMG_API_VERSION == 1 */
+	 pimg->days1 = pimg->days2 = -1;
+#endif
+	 goto again3;
+      }
       if (opt != 15) {
 	 /* 1-14 and 16-31 reserved */
-	 img_errno = IMG_BADFORMAT;
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
       result = img_MOVE;
@@ -1396,7 +3035,7 @@ img_read_item_new(img *pimg, img_point *p)
       result = img_LABEL;
 
       if (!stn_included(pimg)) {
-	 if (!skip_coord(pimg->fh)) return img_BAD;
+	 if (!skip_coord(pimg)) return img_BAD;
 	 pimg->pending = 0;
 	 goto again3;
       }
@@ -1408,24 +3047,26 @@ img_read_item_new(img *pimg, img_point *p)
       result = img_LINE;
 
       if (!survey_included(pimg)) {
-	 if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	 if (!read_coord(pimg, &(pimg->mv))) return img_BAD;
 	 pimg->pending = 15;
 	 goto again3;
       }
 
       if (pimg->pending) {
 	 *p = pimg->mv;
-	 if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	 if (!read_coord(pimg, &(pimg->mv))) return img_BAD;
 	 pimg->pending = opt;
 	 return img_MOVE;
       }
       pimg->flags = (int)opt & 0x1f;
    } else {
-      img_errno = IMG_BADFORMAT;
+      set_read_error(pimg, IMG_BADFORMAT);
       return img_BAD;
    }
-   if (!read_coord(pimg->fh, p)) return img_BAD;
-   pimg->pending = 0;
+   if (!read_coord(pimg, p)) return img_BAD;
+   /* If we're skipping legs, a label doesn't affect the need for a move
+    * before the next leg we return. */
+   if (result != img_LABEL) pimg->pending = 0;
    return result;
 }
 
@@ -1447,9 +3088,9 @@ img_read_item_v3to7(img *pimg, img_point *p)
    }
    again3: /* label to goto if we get a prefix, date, or lrud */
    pimg->label = pimg->label_buf;
-   opt = GETC(pimg->fh);
+   opt = img_getc(pimg);
    if (opt == EOF) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+      set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
       return img_BAD;
    }
    switch (opt >> 6) {
@@ -1464,7 +3105,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
 	 int c;
 	 if (pimg->label_len <= 17) {
 	    /* zero prefix using "0" */
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD;
 	 }
 	 /* extra - 1 because label_len points to one past the end */
@@ -1472,7 +3113,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
 	 while (pimg->label_buf[c] != '.' || --opt > 0) {
 	    if (--c < 0) {
 	       /* zero prefix using "0" */
-	       img_errno = IMG_BADFORMAT;
+	       set_read_error(pimg, IMG_BADFORMAT);
 	       return img_BAD;
 	    }
 	 }
@@ -1488,7 +3129,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
 	  switch (opt) {
 	      case 0x20: /* Single date */
 		  if (pimg->version < 7) {
-		      int date1 = get32(pimg->fh);
+		      int date1 = img_get32(pimg);
 #if IMG_API_VERSION == 0
 		      pimg->date2 = pimg->date1 = date1;
 #else /* IMG_API_VERSION == 1 */
@@ -1499,7 +3140,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		      }
 #endif
 		  } else {
-		      int days1 = (int)getu16(pimg->fh);
+		      int days1 = (int)img_getu16(pimg);
 #if IMG_API_VERSION == 0
 		      pimg->date2 = pimg->date1 = (days1 - 25567) * 86400;
 #else /* IMG_API_VERSION == 1 */
@@ -1509,8 +3150,8 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		  break;
 	      case 0x21: /* Date range (short for v7+) */
 		  if (pimg->version < 7) {
-		      INT32_T date1 = get32(pimg->fh);
-		      INT32_T date2 = get32(pimg->fh);
+		      INT32_T date1 = img_get32(pimg);
+		      INT32_T date2 = img_get32(pimg);
 #if IMG_API_VERSION == 0
 		      pimg->date1 = date1;
 		      pimg->date2 = date2;
@@ -1519,8 +3160,8 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		      pimg->days2 = (date2 / 86400) + 25567;
 #endif
 		  } else {
-		      int days1 = (int)getu16(pimg->fh);
-		      int days2 = days1 + GETC(pimg->fh) + 1;
+		      int days1 = (int)img_getu16(pimg);
+		      int days2 = days1 + img_getc(pimg) + 1;
 #if IMG_API_VERSION == 0
 		      pimg->date1 = (days1 - 25567) * 86400;
 		      pimg->date2 = (days2 - 25567) * 86400;
@@ -1531,33 +3172,33 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		  }
 		  break;
 	      case 0x22: /* Error info */
-		  pimg->n_legs = get32(pimg->fh);
-		  pimg->length = get32(pimg->fh) / 100.0;
-		  pimg->E = get32(pimg->fh) / 100.0;
-		  pimg->H = get32(pimg->fh) / 100.0;
-		  pimg->V = get32(pimg->fh) / 100.0;
-		  if (feof(pimg->fh)) {
-		      img_errno = IMG_BADFORMAT;
+		  pimg->n_legs = img_get32(pimg);
+		  pimg->length = img_get32(pimg) / 100.0;
+		  pimg->E = img_get32(pimg) / 100.0;
+		  pimg->H = img_get32(pimg) / 100.0;
+		  pimg->V = img_get32(pimg) / 100.0;
+		  if (img_feof(pimg)) {
+		      set_read_error(pimg, IMG_BADFORMAT);
 		      return img_BAD;
 		  }
-		  if (ferror(pimg->fh)) {
-		      img_errno = IMG_READERROR;
+		  if (img_ferror(pimg)) {
+		      set_read_error(pimg, IMG_READERROR);
 		      return img_BAD;
 		  }
 		  return img_ERROR_INFO;
 	      case 0x23: { /* v7+: Date range (long) */
 		  if (pimg->version < 7) {
-		      img_errno = IMG_BADFORMAT;
+		      set_read_error(pimg, IMG_BADFORMAT);
 		      return img_BAD;
 		  }
-		  int days1 = (int)getu16(pimg->fh);
-		  int days2 = (int)getu16(pimg->fh);
-		  if (feof(pimg->fh)) {
-		      img_errno = IMG_BADFORMAT;
+		  int days1 = (int)img_getu16(pimg);
+		  int days2 = (int)img_getu16(pimg);
+		  if (img_feof(pimg)) {
+		      set_read_error(pimg, IMG_BADFORMAT);
 		      return img_BAD;
 		  }
-		  if (ferror(pimg->fh)) {
-		      img_errno = IMG_READERROR;
+		  if (img_ferror(pimg)) {
+		      set_read_error(pimg, IMG_READERROR);
 		      return img_BAD;
 		  }
 #if IMG_API_VERSION == 0
@@ -1582,22 +3223,22 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		  if (read_v3label(pimg) == img_BAD) return img_BAD;
 		  pimg->flags = (int)opt & 0x01;
 		  if (opt < 0x32) {
-		      pimg->l = get16(pimg->fh) / 100.0;
-		      pimg->r = get16(pimg->fh) / 100.0;
-		      pimg->u = get16(pimg->fh) / 100.0;
-		      pimg->d = get16(pimg->fh) / 100.0;
+		      pimg->l = img_get16(pimg) / 100.0;
+		      pimg->r = img_get16(pimg) / 100.0;
+		      pimg->u = img_get16(pimg) / 100.0;
+		      pimg->d = img_get16(pimg) / 100.0;
 		  } else {
-		      pimg->l = get32(pimg->fh) / 100.0;
-		      pimg->r = get32(pimg->fh) / 100.0;
-		      pimg->u = get32(pimg->fh) / 100.0;
-		      pimg->d = get32(pimg->fh) / 100.0;
+		      pimg->l = img_get32(pimg) / 100.0;
+		      pimg->r = img_get32(pimg) / 100.0;
+		      pimg->u = img_get32(pimg) / 100.0;
+		      pimg->d = img_get32(pimg) / 100.0;
 		  }
-		  if (feof(pimg->fh)) {
-		      img_errno = IMG_BADFORMAT;
+		  if (img_feof(pimg)) {
+		      set_read_error(pimg, IMG_BADFORMAT);
 		      return img_BAD;
 		  }
-		  if (ferror(pimg->fh)) {
-		      img_errno = IMG_READERROR;
+		  if (img_ferror(pimg)) {
+		      set_read_error(pimg, IMG_READERROR);
 		      return img_BAD;
 		  }
 		  if (!stn_included(pimg)) {
@@ -1611,15 +3252,15 @@ img_read_item_v3to7(img *pimg, img_point *p)
 		  }
 		  return img_XSECT;
 	      default: /* 0x25 - 0x2f and 0x34 - 0x3f are currently unallocated. */
-		  img_errno = IMG_BADFORMAT;
+		  set_read_error(pimg, IMG_BADFORMAT);
 		  return img_BAD;
 	  }
-	  if (feof(pimg->fh)) {
-	      img_errno = IMG_BADFORMAT;
+	  if (img_feof(pimg)) {
+	      set_read_error(pimg, IMG_BADFORMAT);
 	      return img_BAD;
 	  }
-	  if (ferror(pimg->fh)) {
-	      img_errno = IMG_READERROR;
+	  if (img_ferror(pimg)) {
+	      set_read_error(pimg, IMG_READERROR);
 	      return img_BAD;
 	  }
 	  goto again3;
@@ -1627,7 +3268,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
       /* 16-31 mean remove (n - 15) characters from the prefix */
       /* zero prefix using 0 */
       if (pimg->label_len <= (size_t)(opt - 15)) {
-	 img_errno = IMG_BADFORMAT;
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
       pimg->label_len -= (opt - 15);
@@ -1638,7 +3279,7 @@ img_read_item_v3to7(img *pimg, img_point *p)
       result = img_LABEL;
 
       if (!stn_included(pimg)) {
-	  if (!skip_coord(pimg->fh)) return img_BAD;
+	  if (!skip_coord(pimg)) return img_BAD;
 	  pimg->pending = 0;
 	  goto again3;
       }
@@ -1651,24 +3292,24 @@ img_read_item_v3to7(img *pimg, img_point *p)
       result = img_LINE;
 
       if (!survey_included(pimg)) {
-	  if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	  if (!read_coord(pimg, &(pimg->mv))) return img_BAD;
 	  pimg->pending = 15;
 	  goto again3;
       }
 
       if (pimg->pending) {
 	 *p = pimg->mv;
-	 if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	 if (!read_coord(pimg, &(pimg->mv))) return img_BAD;
 	 pimg->pending = opt;
 	 return img_MOVE;
       }
       pimg->flags = (int)opt & 0x3f;
       break;
     default:
-      img_errno = IMG_BADFORMAT;
+      set_read_error(pimg, IMG_BADFORMAT);
       return img_BAD;
    }
-   if (!read_coord(pimg->fh, p)) return img_BAD;
+   if (!read_coord(pimg, p)) return img_BAD;
    pimg->pending = 0;
    return result;
 }
@@ -1690,18 +3331,18 @@ img_read_item_ancient(img *pimg, img_point *p)
 	 opt = opt_lookahead;
 	 opt_lookahead = 0;
       } else {
-	 opt = get32(pimg->fh);
+	 opt = img_get32(pimg);
       }
    } else {
-      opt = GETC(pimg->fh);
+      opt = img_getc(pimg);
    }
 
-   if (feof(pimg->fh)) {
-      img_errno = IMG_BADFORMAT;
+   if (img_feof(pimg)) {
+      set_read_error(pimg, IMG_BADFORMAT);
       return img_BAD;
    }
-   if (ferror(pimg->fh)) {
-      img_errno = IMG_READERROR;
+   if (img_ferror(pimg)) {
+      set_read_error(pimg, IMG_READERROR);
       return img_BAD;
    }
 
@@ -1710,8 +3351,8 @@ img_read_item_ancient(img *pimg, img_point *p)
       return img_STOP; /* end of data marker */
     case 1:
       /* skip coordinates */
-      if (!skip_coord(pimg->fh)) {
-	 img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+      if (!skip_coord(pimg)) {
+	 set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	 return img_BAD;
       }
       goto again;
@@ -1719,13 +3360,13 @@ img_read_item_ancient(img *pimg, img_point *p)
       size_t len;
       result = img_LABEL;
       if (!fgets(pimg->label_buf, pimg->buf_len, pimg->fh)) {
-	 img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	 set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	 return img_BAD;
       }
       if (pimg->label[0] == '\\') pimg->label++;
       len = strlen(pimg->label);
       if (len == 0 || pimg->label[len - 1] != '\n') {
-	 img_errno = IMG_BADFORMAT;
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
       /* Ignore empty labels in some .3d files (caused by a bug) */
@@ -1740,29 +3381,29 @@ img_read_item_ancient(img *pimg, img_point *p)
       result = img_LABEL;
 
       if (opt == 7)
-	 pimg->flags = GETC(pimg->fh);
+	 pimg->flags = img_getc(pimg);
       else
 	 pimg->flags = img_SFLAG_UNDERGROUND; /* no flags given... */
 
-      len = get32(pimg->fh);
+      len = img_get32(pimg);
 
-      if (feof(pimg->fh)) {
-	 img_errno = IMG_BADFORMAT;
+      if (img_feof(pimg)) {
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
-      if (ferror(pimg->fh)) {
-	 img_errno = IMG_READERROR;
+      if (img_ferror(pimg)) {
+	 set_read_error(pimg, IMG_READERROR);
 	 return img_BAD;
       }
 
       /* Ignore empty labels in some .3d files (caused by a bug) */
       if (len == 0) goto again;
       if (!check_label_space(pimg, len + 1)) {
-	 img_errno = IMG_OUTOFMEMORY;
+	 set_read_error(pimg, IMG_OUTOFMEMORY);
 	 return img_BAD;
       }
       if (fread(pimg->label_buf, len, 1, pimg->fh) != 1) {
-	 img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	 set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	 return img_BAD;
       }
       pimg->label_buf[len] = '\0';
@@ -1785,27 +3426,27 @@ img_read_item_ancient(img *pimg, img_point *p)
 	 pimg->flags = (int)opt & 0x3f;
 	 result = img_LABEL;
 	 if (!fgets(pimg->label_buf, pimg->buf_len, pimg->fh)) {
-	    img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	    set_read_error(pimg, img_feof(pimg) ? IMG_BADFORMAT : IMG_READERROR);
 	    return img_BAD;
 	 }
 	 q = pimg->label_buf + strlen(pimg->label_buf) - 1;
 	 /* Ignore empty-labels in some .3d files (caused by a bug) */
 	 if (q == pimg->label_buf) goto again;
 	 if (*q != '\n') {
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD;
 	 }
 	 *q = '\0';
 	 break;
        }
        default:
-	 img_errno = IMG_BADFORMAT;
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
       break;
    }
 
-   if (!read_coord(pimg->fh, &pt)) return img_BAD;
+   if (!read_coord(pimg, &pt)) return img_BAD;
 
    if (result == img_LABEL && !stn_included(pimg)) {
        goto again;
@@ -1816,14 +3457,14 @@ img_read_item_ancient(img *pimg, img_point *p)
 
    if (result == img_MOVE && pimg->version == 1) {
       /* peek at next code and see if it's an old-style label */
-      opt_lookahead = get32(pimg->fh);
+      opt_lookahead = img_get32(pimg);
 
-      if (feof(pimg->fh)) {
-	 img_errno = IMG_BADFORMAT;
+      if (img_feof(pimg)) {
+	 set_read_error(pimg, IMG_BADFORMAT);
 	 return img_BAD;
       }
-      if (ferror(pimg->fh)) {
-	 img_errno = IMG_READERROR;
+      if (img_ferror(pimg)) {
+	 set_read_error(pimg, IMG_READERROR);
 	 return img_BAD;
       }
 
@@ -1874,7 +3515,7 @@ img_read_item_ascii(img *pimg, img_point *p)
 	    result = img_MOVE;
 	 } else if (strcmp(cmd, "cross") == 0) {
 	    if (fscanf(pimg->fh, "%lf%lf%lf", &p->x, &p->y, &p->z) < 3) {
-	       img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
+	       set_read_error(pimg, feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR);
 	       return img_BAD;
 	    }
 	    goto ascii_again;
@@ -1884,12 +3525,12 @@ img_read_item_ascii(img *pimg, img_point *p)
 	    if (ch == ' ') ch = GETC(pimg->fh);
 	    while (ch != ' ') {
 	       if (ch == '\n' || ch == EOF) {
-		  img_errno = ferror(pimg->fh) ? IMG_READERROR : IMG_BADFORMAT;
+		  set_read_error(pimg, ferror(pimg->fh) ? IMG_READERROR : IMG_BADFORMAT);
 		  return img_BAD;
 	       }
 	       if (off == pimg->buf_len) {
 		  if (!check_label_space(pimg, pimg->buf_len * 2)) {
-		     img_errno = IMG_OUTOFMEMORY;
+		     set_read_error(pimg, IMG_OUTOFMEMORY);
 		     return img_BAD;
 		  }
 	       }
@@ -1905,13 +3546,13 @@ img_read_item_ascii(img *pimg, img_point *p)
 
 	    result = img_LABEL;
 	 } else {
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD; /* unknown keyword */
 	 }
       }
 
       if (fscanf(pimg->fh, "%lf%lf%lf", &p->x, &p->y, &p->z) < 3) {
-	 img_errno = ferror(pimg->fh) ? IMG_READERROR : IMG_BADFORMAT;
+	 set_read_error(pimg, ferror(pimg->fh) ? IMG_READERROR : IMG_BADFORMAT);
 	 return img_BAD;
       }
 
@@ -1928,12 +3569,12 @@ img_read_item_ascii(img *pimg, img_point *p)
       againpos:
       while (fscanf(pimg->fh, "(%lf,%lf,%lf )", &p->x, &p->y, &p->z) != 3) {
 	 if (ferror(pimg->fh)) {
-	    img_errno = IMG_READERROR;
+	    set_read_error(pimg, IMG_READERROR);
 	    return img_BAD;
 	 }
 	 if (feof(pimg->fh)) return img_STOP;
 	 if (pimg->pending) {
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD;
 	 }
 	 pimg->pending = 1;
@@ -1956,7 +3597,7 @@ img_read_item_ascii(img *pimg, img_point *p)
       off = 1;
       while (!feof(pimg->fh)) {
 	 if (!fgets(pimg->label_buf + off, pimg->buf_len - off, pimg->fh)) {
-	    img_errno = IMG_READERROR;
+	    set_read_error(pimg, IMG_READERROR);
 	    return img_BAD;
 	 }
 
@@ -1966,7 +3607,7 @@ img_read_item_ascii(img *pimg, img_point *p)
 	    break;
 	 }
 	 if (!check_label_space(pimg, pimg->buf_len * 2)) {
-	    img_errno = IMG_OUTOFMEMORY;
+	    set_read_error(pimg, IMG_OUTOFMEMORY);
 	    return img_BAD;
 	 }
       }
@@ -2018,14 +3659,14 @@ skip_to_N:
 	    case 'N':
 	       line = getline_alloc(pimg->fh);
 	       if (!line) {
-		  img_errno = IMG_OUTOFMEMORY;
+		  set_read_error(pimg, IMG_OUTOFMEMORY);
 		  return img_BAD;
 	       }
 	       while (line[len] > 32) ++len;
 	       if (pimg->label_len == 0) pimg->pending = -1;
 	       if (!check_label_space(pimg, len + 1)) {
 		  osfree(line);
-		  img_errno = IMG_OUTOFMEMORY;
+		  set_read_error(pimg, IMG_OUTOFMEMORY);
 		  return img_BAD;
 	       }
 	       pimg->label_len = len;
@@ -2058,16 +3699,16 @@ skip_to_N:
 	       }
 	       line = getline_alloc(pimg->fh);
 	       if (!line) {
-		  img_errno = IMG_OUTOFMEMORY;
+		  set_read_error(pimg, IMG_OUTOFMEMORY);
 		  return img_BAD;
 	       }
 	       /* Compass stores coordinates as North, East, Up = (y,x,z)! */
 	       if (sscanf(line, "%lf%lf%lf", &p->y, &p->x, &p->z) != 3) {
 		  osfree(line);
 		  if (ferror(pimg->fh)) {
-		     img_errno = IMG_READERROR;
+		     set_read_error(pimg, IMG_READERROR);
 		  } else {
-		     img_errno = IMG_BADFORMAT;
+		     set_read_error(pimg, IMG_BADFORMAT);
 		  }
 		  return img_BAD;
 	       }
@@ -2077,7 +3718,7 @@ skip_to_N:
 	       q = strchr(line, 'S');
 	       if (!q) {
 		  osfree(line);
-		  img_errno = IMG_BADFORMAT;
+		  set_read_error(pimg, IMG_BADFORMAT);
 		  return img_BAD;
 	       }
 	       ++q;
@@ -2086,7 +3727,7 @@ skip_to_N:
 	       q[len] = '\0';
 	       len += 2; /* ' ' and '\0' */
 	       if (!check_label_space(pimg, pimg->label_len + len)) {
-		  img_errno = IMG_OUTOFMEMORY;
+		  set_read_error(pimg, IMG_OUTOFMEMORY);
 		  return img_BAD;
 	       }
 	       pimg->label = pimg->label_buf;
@@ -2108,9 +3749,9 @@ skip_to_N:
 			      &pimg->l, &pimg->r, &pimg->u, &pimg->d) != 4) {
 		       osfree(line);
 		       if (ferror(pimg->fh)) {
-			   img_errno = IMG_READERROR;
+			   set_read_error(pimg, IMG_READERROR);
 		       } else {
-			   img_errno = IMG_BADFORMAT;
+			   set_read_error(pimg, IMG_BADFORMAT);
 		       }
 		       return img_BAD;
 		   }
@@ -2131,7 +3772,7 @@ skip_to_N:
 	       return img_LABEL;
 	    }
 	    default:
-	       img_errno = IMG_BADFORMAT;
+	       set_read_error(pimg, IMG_BADFORMAT);
 	       return img_BAD;
 	 }
       }
@@ -2173,7 +3814,7 @@ skip_to_N:
 	 if (feof(pimg->fh)) return img_STOP;
 	 line = getline_alloc(pimg->fh);
 	 if (!line) {
-	    img_errno = IMG_OUTOFMEMORY;
+	    set_read_error(pimg, IMG_OUTOFMEMORY);
 	    return img_BAD;
 	 }
       } while (line[0] == ' ' || line[0] == '\0');
@@ -2184,7 +3825,7 @@ skip_to_N:
 	 /* station variant */
 	 if (len < 37) {
 	    osfree(line);
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD;
 	 }
 	 memcpy(pimg->label, line, 6);
@@ -2202,7 +3843,7 @@ skip_to_N:
 	 char old[8], new_[8];
 	 if (len < 61) {
 	    osfree(line);
-	    img_errno = IMG_BADFORMAT;
+	    set_read_error(pimg, IMG_BADFORMAT);
 	    return img_BAD;
 	 }
 
@@ -2246,9 +3887,9 @@ skip_to_N:
 }
 
 static void
-write_coord(FILE *fh, double x, double y, double z)
+write_coord(img *pimg, double x, double y, double z)
 {
-   SVX_ASSERT(fh);
+   SVX_ASSERT(pimg);
    /* Output in cm */
    static INT32_T X_, Y_, Z_;
    INT32_T X = my_lround(x * 100.0);
@@ -2258,9 +3899,9 @@ write_coord(FILE *fh, double x, double y, double z)
    X_ -= X;
    Y_ -= Y;
    Z_ -= Z;
-   put32(X, fh);
-   put32(Y, fh);
-   put32(Z, fh);
+   img_put32(pimg, X);
+   img_put32(pimg, Y);
+   img_put32(pimg, Z);
    X_ = X; Y_ = Y; Z_ = Z;
 }
 
@@ -2278,11 +3919,11 @@ write_v3label(img *pimg, int opt, const char *s)
    SVX_ASSERT(len <= pimg->label_len);
    n = pimg->label_len - len;
    if (len == 0) {
-      if (pimg->label_len) PUTC(0, pimg->fh);
+      if (pimg->label_len) img_putc(pimg, 0);
    } else if (n <= 16) {
-      if (n) PUTC(n + 15, pimg->fh);
+      if (n) img_putc(pimg, n + 15);
    } else if (dot == 0) {
-      if (pimg->label_len) PUTC(0, pimg->fh);
+      if (pimg->label_len) img_putc(pimg, 0);
       len = 0;
    } else {
       const char *p = pimg->label_buf + dot;
@@ -2291,26 +3932,26 @@ write_v3label(img *pimg, int opt, const char *s)
 	 if (*p++ == '.') n++;
       }
       if (n <= 14) {
-	 PUTC(n, pimg->fh);
+	 img_putc(pimg, n);
 	 len = dot;
       } else {
-	 if (pimg->label_len) PUTC(0, pimg->fh);
+	 if (pimg->label_len) img_putc(pimg, 0);
 	 len = 0;
       }
    }
 
    n = strlen(s + len);
-   PUTC(opt, pimg->fh);
+   img_putc(pimg, opt);
    if (n < 0xfe) {
-      PUTC(n, pimg->fh);
+      img_putc(pimg, n);
    } else if (n < 0xffff + 0xfe) {
-      PUTC(0xfe, pimg->fh);
-      put16((short)(n - 0xfe), pimg->fh);
+      img_putc(pimg, 0xfe);
+      img_put16(pimg, (short)(n - 0xfe));
    } else {
-      PUTC(0xff, pimg->fh);
-      put32(n, pimg->fh);
+      img_putc(pimg, 0xff);
+      img_put32(pimg, n);
    }
-   fwrite(s + len, n, 1, pimg->fh);
+   img_write(pimg, s + len, n);
 
    n += len;
    pimg->label_len = n;
@@ -2318,7 +3959,7 @@ write_v3label(img *pimg, int opt, const char *s)
       return 0; /* FIXME: distinguish out of memory... */
    memcpy(pimg->label_buf + len, s + len, n - len + 1);
 
-   return !ferror(pimg->fh);
+   return !img_write_error(pimg);
 }
 
 static int
@@ -2327,8 +3968,14 @@ write_v8label(img *pimg, int opt, int common_flag, size_t common_val,
 {
    size_t len, del, add;
 
-   /* find length of common prefix */
-   for (len = 0; s[len] == pimg->label_buf[len] && s[len] != '\0'; len++) {
+   if (pimg->index && pimg->index->reset_label) {
+      /* This label starts a run in the index, so write it in full. */
+      len = 0;
+      pimg->index->reset_label = 0;
+   } else {
+      /* find length of common prefix */
+      for (len = 0; s[len] == pimg->label_buf[len] && s[len] != '\0'; len++) {
+      }
    }
 
    SVX_ASSERT(len <= pimg->label_len);
@@ -2336,30 +3983,30 @@ write_v8label(img *pimg, int opt, int common_flag, size_t common_val,
    add = strlen(s + len);
 
    if (add == common_val && del == common_val) {
-      PUTC(opt | common_flag, pimg->fh);
+      img_putc(pimg, opt | common_flag);
    } else {
-      PUTC(opt, pimg->fh);
+      img_putc(pimg, opt);
       if (del <= 15 && add <= 15 && (del || add)) {
-	 PUTC((del << 4) | add, pimg->fh);
+	 img_putc(pimg, (del << 4) | add);
       } else {
-	 PUTC(0x00, pimg->fh);
+	 img_putc(pimg, 0x00);
 	 if (del < 0xff) {
-	    PUTC(del, pimg->fh);
+	    img_putc(pimg, del);
 	 } else {
-	    PUTC(0xff, pimg->fh);
-	    put32(del, pimg->fh);
+	    img_putc(pimg, 0xff);
+	    img_put32(pimg, del);
 	 }
 	 if (add < 0xff) {
-	    PUTC(add, pimg->fh);
+	    img_putc(pimg, add);
 	 } else {
-	    PUTC(0xff, pimg->fh);
-	    put32(add, pimg->fh);
+	    img_putc(pimg, 0xff);
+	    img_put32(pimg, add);
 	 }
       }
    }
 
    if (add)
-      fwrite(s + len, add, 1, pimg->fh);
+      img_write(pimg, s + len, add);
 
    pimg->label_len = len + add;
    if (add > del && !check_label_space(pimg, pimg->label_len + 1))
@@ -2367,7 +4014,7 @@ write_v8label(img *pimg, int opt, int common_flag, size_t common_val,
 
    memcpy(pimg->label_buf + len, s + len, add + 1);
 
-   return !ferror(pimg->fh);
+   return !img_write_error(pimg);
 }
 
 static void
@@ -2391,37 +4038,37 @@ img_write_item_date_new(img *pimg)
 
     if (same) {
 	if (unset) {
-	    PUTC(0x10, pimg->fh);
+	    img_putc(pimg, 0x10);
 	} else {
-	    PUTC(0x11, pimg->fh);
+	    img_putc(pimg, 0x11);
 #if IMG_API_VERSION == 0
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
+	    img_put16(pimg, pimg->date1 / 86400 + 25567);
 #else /* IMG_API_VERSION == 1 */
-	    put16(pimg->days1, pimg->fh);
+	    img_put16(pimg, pimg->days1);
 #endif
 	}
     } else {
 #if IMG_API_VERSION == 0
 	int diff = (pimg->date2 - pimg->date1) / 86400;
 	if (diff > 0 && diff <= 256) {
-	    PUTC(0x12, pimg->fh);
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
-	    PUTC(diff - 1, pimg->fh);
+	    img_putc(pimg, 0x12);
+	    img_put16(pimg, pimg->date1 / 86400 + 25567);
+	    img_putc(pimg, diff - 1);
 	} else {
-	    PUTC(0x13, pimg->fh);
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
-	    put16(pimg->date2 / 86400 + 25567, pimg->fh);
+	    img_putc(pimg, 0x13);
+	    img_put16(pimg, pimg->date1 / 86400 + 25567);
+	    img_put16(pimg, pimg->date2 / 86400 + 25567);
 	}
 #else /* IMG_API_VERSION == 1 */
 	int diff = pimg->days2 - pimg->days1;
 	if (diff > 0 && diff <= 256) {
-	    PUTC(0x12, pimg->fh);
-	    put16(pimg->days1, pimg->fh);
-	    PUTC(diff - 1, pimg->fh);
+	    img_putc(pimg, 0x12);
+	    img_put16(pimg, pimg->days1);
+	    img_putc(pimg, diff - 1);
 	} else {
-	    PUTC(0x13, pimg->fh);
-	    put16(pimg->days1, pimg->fh);
-	    put16(pimg->days2, pimg->fh);
+	    img_putc(pimg, 0x13);
+	    img_put16(pimg, pimg->days1);
+	    img_put16(pimg, pimg->days2);
 	}
 #endif
     }
@@ -2455,56 +4102,56 @@ img_write_item_date(img *pimg)
 
     if (same) {
 	if (img_output_version < 7) {
-	    PUTC(0x20, pimg->fh);
+	    img_putc(pimg, 0x20);
 #if IMG_API_VERSION == 0
-	    put32(pimg->date1, pimg->fh);
+	    img_put32(pimg, pimg->date1);
 #else /* IMG_API_VERSION == 1 */
-	    put32((pimg->days1 - 25567) * 86400, pimg->fh);
+	    img_put32(pimg, (pimg->days1 - 25567) * 86400);
 #endif
 	} else {
 	    if (unset) {
-		PUTC(0x24, pimg->fh);
+		img_putc(pimg, 0x24);
 	    } else {
-		PUTC(0x20, pimg->fh);
+		img_putc(pimg, 0x20);
 #if IMG_API_VERSION == 0
-		put16(pimg->date1 / 86400 + 25567, pimg->fh);
+		img_put16(pimg, pimg->date1 / 86400 + 25567);
 #else /* IMG_API_VERSION == 1 */
-		put16(pimg->days1, pimg->fh);
+		img_put16(pimg, pimg->days1);
 #endif
 	    }
 	}
     } else {
 	if (img_output_version < 7) {
-	    PUTC(0x21, pimg->fh);
+	    img_putc(pimg, 0x21);
 #if IMG_API_VERSION == 0
-	    put32(pimg->date1, pimg->fh);
-	    put32(pimg->date2, pimg->fh);
+	    img_put32(pimg, pimg->date1);
+	    img_put32(pimg, pimg->date2);
 #else /* IMG_API_VERSION == 1 */
-	    put32((pimg->days1 - 25567) * 86400, pimg->fh);
-	    put32((pimg->days2 - 25567) * 86400, pimg->fh);
+	    img_put32(pimg, (pimg->days1 - 25567) * 86400);
+	    img_put32(pimg, (pimg->days2 - 25567) * 86400);
 #endif
 	} else {
 #if IMG_API_VERSION == 0
 	    int diff = (pimg->date2 - pimg->date1) / 86400;
 	    if (diff > 0 && diff <= 256) {
-		PUTC(0x21, pimg->fh);
-		put16(pimg->date1 / 86400 + 25567, pimg->fh);
-		PUTC(diff - 1, pimg->fh);
+		img_putc(pimg, 0x21);
+		img_put16(pimg, pimg->date1 / 86400 + 25567);
+		img_putc(pimg, diff - 1);
 	    } else {
-		PUTC(0x23, pimg->fh);
-		put16(pimg->date1 / 86400 + 25567, pimg->fh);
-		put16(pimg->date2 / 86400 + 25567, pimg->fh);
+		img_putc(pimg, 0x23);
+		img_put16(pimg, pimg->date1 / 86400 + 25567);
+		img_put16(pimg, pimg->date2 / 86400 + 25567);
 	    }
 #else /* IMG_API_VERSION == 1 */
 	    int diff = pimg->days2 - pimg->days1;
 	    if (diff > 0 && diff <= 256) {
-		PUTC(0x21, pimg->fh);
-		put16(pimg->days1, pimg->fh);
-		PUTC(diff - 1, pimg->fh);
+		img_putc(pimg, 0x21);
+		img_put16(pimg, pimg->days1);
+		img_putc(pimg, diff - 1);
 	    } else {
-		PUTC(0x23, pimg->fh);
-		put16(pimg->days1, pimg->fh);
-		put16(pimg->days2, pimg->fh);
+		img_putc(pimg, 0x23);
+		img_put16(pimg, pimg->days1);
+		img_put16(pimg, pimg->days2);
 	    }
 #endif
 	}
@@ -2546,6 +4193,41 @@ static void
 img_write_item_new(img *pimg, int code, int flags, const char *s,
 		   double x, double y, double z)
 {
+   if (pimg->index && pimg->version >= 9) {
+      /* Prefer to start a chunk before a move or label, but split a long
+       * traverse rather than let the chunk grow without limit. */
+      unsigned long n = pimg->index->chunk_items;
+      if (n >= CHUNK_ITEMS * 2 ||
+	  (n >= CHUNK_ITEMS && (code == img_MOVE || code == img_LABEL))) {
+	 start_chunk(pimg);
+      }
+      ++pimg->index->chunk_items;
+   }
+   if (pimg->index) {
+      const char *key = s ? s : "";
+      size_t key_len;
+      if (code == img_LABEL || code == img_XSECT) {
+	 /* The survey a station is in. */
+	 const char *dot = strrchr(key, '.');
+	 key_len = dot ? (size_t)(dot - key) : 0;
+	 index_note_key(pimg, key, key_len);
+      } else if (code == img_LINE) {
+	 index_note_key(pimg, key, strlen(key));
+      }
+      if (code == img_LINE && pimg->index->need_move) {
+	 /* This leg continues from a point before the start of the chunk. */
+	 img_putc(pimg, 15);
+	 img_put32(pimg, pimg->index->x);
+	 img_put32(pimg, pimg->index->y);
+	 img_put32(pimg, pimg->index->z);
+      }
+      if (code == img_MOVE || code == img_LINE) {
+	 pimg->index->need_move = 0;
+	 pimg->index->x = (INT32_T)my_lround(x * 100.0);
+	 pimg->index->y = (INT32_T)my_lround(y * 100.0);
+	 pimg->index->z = (INT32_T)my_lround(z * 100.0);
+      }
+   }
    switch (code) {
     case img_LABEL:
       write_v8label(pimg, 0x80 | flags, 0, -1, s);
@@ -2567,20 +4249,20 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
       write_v8label(pimg, 0x30 | flags, 0, -1, s);
       if (flags & 2) {
 	 /* Big passage!  Need to use 4 bytes. */
-	 put32(l, pimg->fh);
-	 put32(r, pimg->fh);
-	 put32(u, pimg->fh);
-	 put32(d, pimg->fh);
+	 img_put32(pimg, l);
+	 img_put32(pimg, r);
+	 img_put32(pimg, u);
+	 img_put32(pimg, d);
       } else {
-	 put16(l, pimg->fh);
-	 put16(r, pimg->fh);
-	 put16(u, pimg->fh);
-	 put16(d, pimg->fh);
+	 img_put16(pimg, l);
+	 img_put16(pimg, r);
+	 img_put16(pimg, u);
+	 img_put16(pimg, d);
       }
       return;
     }
     case img_MOVE:
-      PUTC(15, pimg->fh);
+      img_putc(pimg, 15);
       break;
     case img_LINE:
       img_write_item_date_new(pimg);
@@ -2591,7 +4273,7 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
 	    case img_STYLE_CARTESIAN:
 	    case img_STYLE_CYLPOLAR:
 	    case img_STYLE_NOSURVEY:
-	       PUTC(pimg->style, pimg->fh);
+	       img_putc(pimg, pimg->style);
 	       break;
 	  }
 	  pimg->oldstyle = pimg->style;
@@ -2601,7 +4283,7 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
     default: /* ignore for now */
       return;
    }
-   write_coord(pimg->fh, x, y, z);
+   write_coord(pimg, x, y, z);
 }
 
 static void
@@ -2631,20 +4313,20 @@ img_write_item_v3to7(img *pimg, int code, int flags, const char *s,
       write_v3label(pimg, 0x30 | flags, s);
       if (flags & 2) {
 	 /* Big passage!  Need to use 4 bytes. */
-	 put32(l, pimg->fh);
-	 put32(r, pimg->fh);
-	 put32(u, pimg->fh);
-	 put32(d, pimg->fh);
+	 img_put32(pimg, l);
+	 img_put32(pimg, r);
+	 img_put32(pimg, u);
+	 img_put32(pimg, d);
       } else {
-	 put16(l, pimg->fh);
-	 put16(r, pimg->fh);
-	 put16(u, pimg->fh);
-	 put16(d, pimg->fh);
+	 img_put16(pimg, l);
+	 img_put16(pimg, r);
+	 img_put16(pimg, u);
+	 img_put16(pimg, d);
       }
       return;
     }
     case img_MOVE:
-      PUTC(15, pimg->fh);
+      img_putc(pimg, 15);
       break;
     case img_LINE:
       if (pimg->version >= 4) {
@@ -2655,7 +4337,7 @@ img_write_item_v3to7(img *pimg, int code, int flags, const char *s,
     default: /* ignore for now */
       return;
    }
-   write_coord(pimg->fh, x, y, z);
+   write_coord(pimg, x, y, z);
 }
 
 static void
@@ -2670,8 +4352,9 @@ img_write_item_ancient(img *pimg, int code, int flags, const char *s,
       if (pimg->version == 1) {
 	 /* put a move before each label */
 	 img_write_item_ancient(pimg, img_MOVE, 0, NULL, x, y, z);
-	 put32(2, pimg->fh);
-	 fputsnl(s, pimg->fh);
+	 img_put32(pimg, 2);
+	 img_puts(pimg, s);
+	 img_putc(pimg, '\n');
 	 return;
       }
       len = strlen(s);
@@ -2679,13 +4362,14 @@ img_write_item_ancient(img *pimg, int code, int flags, const char *s,
 	 /* long label - not in early incarnations of v2 format, but few
 	  * 3d files will need these, so better not to force incompatibility
 	  * with a new version I think... */
-	 PUTC(7, pimg->fh);
-	 PUTC(flags, pimg->fh);
-	 put32(len, pimg->fh);
-	 fputs(s, pimg->fh);
+	 img_putc(pimg, 7);
+	 img_putc(pimg, flags);
+	 img_put32(pimg, len);
+	 img_puts(pimg, s);
       } else {
-	 PUTC(0x40 | (flags & 0x3f), pimg->fh);
-	 fputsnl(s, pimg->fh);
+	 img_putc(pimg, 0x40 | (flags & 0x3f));
+	 img_puts(pimg, s);
+	 img_putc(pimg, '\n');
       }
       opt = 0;
       break;
@@ -2703,11 +4387,11 @@ img_write_item_ancient(img *pimg, int code, int flags, const char *s,
       return;
    }
    if (pimg->version == 1) {
-      put32(opt, pimg->fh);
+      img_put32(pimg, opt);
    } else {
-      if (opt) PUTC(opt, pimg->fh);
+      if (opt) img_putc(pimg, opt);
    }
-   write_coord(pimg->fh, x, y, z);
+   write_coord(pimg, x, y, z);
 }
 
 /* Write error information for the current traverse
@@ -2721,12 +4405,55 @@ void
 img_write_errors(img *pimg, int n_legs, double length,
 		 double E, double H, double V)
 {
-    PUTC((pimg->version >= 8 ? 0x1f : 0x22), pimg->fh);
-    put32(n_legs, pimg->fh);
-    put32((INT32_T)my_lround(length * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(E * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(H * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(V * 100.0), pimg->fh);
+    img_putc(pimg, (pimg->version >= 8 ? 0x1f : 0x22));
+    img_put32(pimg, n_legs);
+    img_put32(pimg, (INT32_T)my_lround(length * 100.0));
+    img_put32(pimg, (INT32_T)my_lround(E * 100.0));
+    img_put32(pimg, (INT32_T)my_lround(H * 100.0));
+    img_put32(pimg, (INT32_T)my_lround(V * 100.0));
+}
+
+/* Write the end of data marker and anything which follows it, then write
+ * out all the buffered data.  Returns 0 on error.
+ */
+static int
+finish_writing(img *pimg)
+{
+   long data_end = pimg->index ? img_write_tell(pimg) : -1;
+   /* write end of data marker */
+   switch (pimg->version) {
+    case 1:
+      img_put32(pimg, (INT32_T)-1);
+      break;
+    default:
+      /* In format version 9 the style is reset at the start of each
+       * chunk, so check the style the reader will have. */
+      if (pimg->version <= 7 ?
+	  (pimg->label_len != 0) :
+	  ((pimg->version >= 9 ? pimg->oldstyle : pimg->style) !=
+	   img_STYLE_NORMAL)) {
+	 img_putc(pimg, 0);
+      }
+      /* FALL THROUGH */
+    case 2:
+      img_putc(pimg, 0);
+      break;
+   }
+   if (pimg->index) write_index(pimg, data_end);
+#ifdef HAVE_ZLIB
+   if (pimg->zfh) return !pimg->wbuf_failed && deflate_3d_data(pimg);
+#endif
+   return img_flush(pimg);
+}
+
+static void
+free_img(img *pimg)
+{
+   free_index(pimg);
+   osfree(pimg->wbuf);
+   osfree(pimg->label_buf);
+   osfree(pimg->filename_opened);
+   osfree(pimg);
 }
 
 int
@@ -2734,38 +4461,53 @@ img_close(img *pimg)
 {
    int result = 1;
    if (pimg) {
-      if (pimg->fh) {
-	 if (pimg->fRead) {
-	    osfree(pimg->survey);
-	    osfree(pimg->title);
-	    osfree(pimg->cs);
-	    osfree(pimg->datestamp);
-	 } else {
-	    /* write end of data marker */
-	    switch (pimg->version) {
-	     case 1:
-	       put32((INT32_T)-1, pimg->fh);
-	       break;
-	     default:
-	       if (pimg->version <= 7 ?
-		   (pimg->label_len != 0) :
-		   (pimg->style != img_STYLE_NORMAL)) {
-		  PUTC(0, pimg->fh);
-	       }
-	       /* FALL THROUGH */
-	     case 2:
-	       PUTC(0, pimg->fh);
-	       break;
-	    }
-	 }
+      if (pimg->fRead) {
+#ifdef HAVE_MMAP
+	 if (pimg->data)
+	    munmap((void *)pimg->data, pimg->data_end - pimg->data);
+#endif
+	 osfree(pimg->survey);
+	 osfree(pimg->title);
+	 osfree(pimg->cs);
+	 osfree(pimg->datestamp);
 	 if (ferror(pimg->fh)) result = 0;
 	 if (pimg->close_func && pimg->close_func(pimg->fh))
-	     result = 0;
-	 if (!result) img_errno = pimg->fRead ? IMG_READERROR : IMG_WRITEERROR;
+	    result = 0;
+	 if (!result) img_errno = IMG_READERROR;
+      } else {
+	 if (!finish_writing(pimg)) result = 0;
+	 if (pimg->fh) {
+	    if (ferror(pimg->fh)) result = 0;
+	    if (pimg->close_func && pimg->close_func(pimg->fh))
+	       result = 0;
+	 }
+	 if (pimg->zfh) {
+	    if (ferror(pimg->zfh)) result = 0;
+	    if (pimg->zclose_func && pimg->zclose_func(pimg->zfh))
+	       result = 0;
+	 }
+	 if (!result) img_errno = IMG_WRITEERROR;
       }
-      osfree(pimg->label_buf);
-      osfree(pimg->filename_opened);
-      osfree(pimg);
+      free_img(pimg);
+   }
+   return result;
+}
+
+int
+img_close_memory(img *pimg, void **p_data, size_t *p_len)
+{
+   int result;
+   SVX_ASSERT(!pimg->fRead && !pimg->fh && !pimg->zfh);
+   *p_data = NULL;
+   *p_len = 0;
+   result = finish_writing(pimg);
+   if (result) {
+      *p_data = pimg->wbuf;
+      *p_len = pimg->wbuf_len;
+      pimg->wbuf = NULL;
+   } else {
+      img_errno = IMG_OUTOFMEMORY;
    }
+   free_img(pimg);
    return result;
 }
@@ -82,6 +82,11 @@ extern "C" {
 /* File-wide flags */
 # define img_FFLAG_EXTENDED 0x80
 
+/* Flag for img_open_write_cs() and img_write_stream() to write a compressed
+ * file (which img_open() and img_read_stream() decompress transparently).
+ * This is ignored if zlib support wasn't enabled at build time. */
+# define img_FFLAG_COMPRESSED 0x100
+
 /* When writing img_XSECT, img_XFLAG_END in pimg->flags means this is the last
  * img_XSECT in this tube:
  */
@@ -167,6 +172,15 @@ typedef struct {
    size_t label_len;
    int fRead;        /* 1 for reading, 0 for writing */
    long start;
+   /* If we're reading a binary .3d file which we've mapped into memory, data
+    * is the start of the mapping, data_next the next byte to read, and
+    * data_end the end.  data_eof is set if we try to read past data_end.
+    * If the file isn't mapped, data is NULL. */
+   const unsigned char *data, *data_next, *data_end;
+   int data_eof;
+   /* If not NULL, errors reading items are stored here instead of being
+    * returned by img_error(), so chunks can be decoded in parallel. */
+   int *read_error;
    /* version of file format:
     *  -4 => CMAP .xyz file, shot format
     *  -3 => CMAP .xyz file, station format
@@ -193,16 +207,96 @@ typedef struct {
    int olddays1, olddays2;
 #endif
    int oldstyle;
+   /* Survey index - see img.c.  When writing format version 8 or later this
+    * collects the index to write after the data; when reading with a survey
+    * filter it holds the ranges of the file which we need to read. */
+   struct img_index *index;
+   /* When writing a compressed file, the stream and close function for the
+    * output (fh is then NULL, and the data is collected in wbuf until we
+    * compress it when the file is closed).  NULL otherwise. */
+   FILE *zfh;
+   int (*zclose_func)(FILE*);
+   /* When writing, the output is buffered here - see img.c. */
+   unsigned char *wbuf;
+   size_t wbuf_len, wbuf_size;
+   long wbuf_offset;
+   int wbuf_failed;
 } img;
 
-/* Which version of the file format to output (defaults to newest) */
+/* Survey data decoded in bulk by img_read_columns().
+ *
+ * Rather than returning one item at a time, each field is returned as an
+ * array (a "column") with one entry per leg, station, etc.  Labels are
+ * stored once each in the labels buffer (nul-terminated) and referred to
+ * by their offset in it, so e.g. the legs of a survey all have the same
+ * leg_survey value.
+ */
+typedef struct {
+   /* The points which legs join.  An img_MOVE or img_LINE adds a point. */
+   size_t n_points;
+   img_point *points;
+
+   /* Leg i runs from points[leg_to[i] - 1] to points[leg_to[i]]. */
+   size_t n_legs;
+   size_t *leg_to;
+   int *leg_flags;	/* img_FLAG_* */
+   int *leg_style;	/* img_STYLE_* */
+#if IMG_API_VERSION == 0
+   time_t *leg_date1, *leg_date2;
+#else /* IMG_API_VERSION == 1 */
+   int *leg_days1, *leg_days2;
+#endif
+   size_t *leg_survey;	/* offset of the survey name in labels */
+
+   size_t n_stations;
+   img_point *stn_point;
+   int *stn_flags;	/* img_SFLAG_* */
+   size_t *stn_label;	/* offset of the station name in labels */
+
+   /* Passage cross-sections, in passage order.  img_XFLAG_END is set in
+    * xsect_flags for the last cross-section in each passage. */
+   size_t n_xsects;
+   size_t *xsect_label;	/* offset of the station name in labels */
+   double *xsect_l, *xsect_r, *xsect_u, *xsect_d;
+   int *xsect_flags;
+#if IMG_API_VERSION == 0
+   time_t *xsect_date1, *xsect_date2;
+#else /* IMG_API_VERSION == 1 */
+   int *xsect_days1, *xsect_days2;
+#endif
+
+   /* Error information for traverses.  Error i is for the traverse which
+    * ends with leg error_leg[i] - 1. */
+   size_t n_errors;
+   size_t *error_leg;
+   int *error_n_legs;
+   double *error_length, *error_E, *error_H, *error_V;
+
+   char *labels;
+   size_t labels_len;
+
+   /* All other members are for internal use only: */
+   size_t points_size, legs_size, stations_size, xsects_size, errors_size;
+   size_t labels_size;
+   /* Hash table of label offsets (plus one, so 0 means an empty slot) */
+   size_t *label_hash;
+   size_t label_hash_size, n_labels;
+} img_columns;
+
+/* Which version of the file format to output (defaults to
+ * IMG_VERSION_DEFAULT) */
 extern unsigned int img_output_version;
 
 /* Minimum supported value for img_output_version: */
 #define IMG_VERSION_MIN 1
 
 /* Maximum supported value for img_output_version: */
-#define IMG_VERSION_MAX 8
+#define IMG_VERSION_MAX 9
+
+/* Default value for img_output_version.  Version 9 is version 8 split into
+ * chunks which can be decoded independently, which older readers don't
+ * understand, so we don't write it unless asked to. */
+#define IMG_VERSION_DEFAULT 8
 
 /* Open a processed survey data file for reading
  *
@@ -294,7 +388,8 @@ img *img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
  * specify a coordinate system).
  *
  * flags contains a bitwise-or of any file-wide flags - currently only one
- * is available: img_FFLAG_EXTENDED.
+ * is available: img_FFLAG_EXTENDED - plus img_FFLAG_COMPRESSED to compress
+ * the file.
  *
  * Returns pointer to an img struct or NULL for error (check img_error()
  * for details)
@@ -318,7 +413,8 @@ img *img_open_write_cs(const char *fnm, const char *title, const char * cs,
  * specify a coordinate system).
  *
  * flags contains a bitwise-or of any file-wide flags - currently only one
- * is available: img_FFLAG_EXTENDED.
+ * is available: img_FFLAG_EXTENDED - plus img_FFLAG_COMPRESSED to compress
+ * the file.
  *
  * Returns pointer to an img struct or NULL for error (check img_error()
  * for details).  Any close function specified is called on error (unless
@@ -327,6 +423,17 @@ img *img_open_write_cs(const char *fnm, const char *title, const char * cs,
 img *img_write_stream(FILE *stream, int (*close_func)(FILE*),
 		      const char *title, const char * cs, int flags);
 
+/* Write a .3d file to memory
+ *
+ * This is like img_write_stream(), except that the data is collected in
+ * memory rather than written to a stream.  img_FFLAG_COMPRESSED is ignored.
+ * Finish writing with img_close_memory() to get the data.
+ *
+ * Returns pointer to an img struct or NULL for error (check img_error()
+ * for details).
+ */
+img *img_write_memory(const char *title, const char * cs, int flags);
+
 /* Read an item from a processed survey data file
  *
  * pimg is a pointer to an img struct returned by img_open()
@@ -339,6 +446,46 @@ img *img_write_stream(FILE *stream, int (*close_func)(FILE*),
  */
 int img_read_item(img *pimg, img_point *p);
 
+/* Initialise an img_columns struct before passing it to img_read_columns() */
+void img_columns_init(img_columns *cols);
+
+/* Read items from a processed survey data file in bulk
+ *
+ * pimg is a pointer to an img struct returned by img_open()
+ *
+ * cols is a pointer to an img_columns struct initialised with
+ * img_columns_init().  Any data already in it is discarded (but the memory
+ * is reused).
+ *
+ * max_items is the maximum number of items to read, or 0 to read all the
+ * remaining items.  If data is read in several chunks, the first point in
+ * each chunk after the first is the last point of the previous chunk, so
+ * that legs which continue from it can refer to it.
+ *
+ * Returns img_STOP if the end of the data was reached, img_BAD on error
+ * (check img_error() for details), or 0 if max_items items were read.
+ */
+int img_read_columns(img *pimg, img_columns *cols, size_t max_items);
+
+/* Read all the items from a processed survey data file in bulk, using
+ * several threads if possible
+ *
+ * This is like calling img_rewind() and then img_read_columns() with
+ * max_items 0, except that format version 9 files (which are divided into
+ * chunks) are decoded using up to n_threads threads, one chunk at a time.
+ * In that case, a label which is used in more than one chunk is stored once
+ * for each chunk in cols->labels.  Otherwise (including if a survey filter
+ * is in use) the items are just read in this thread.  Either way, pimg is
+ * left rewound afterwards.
+ *
+ * Returns img_STOP if successful, or img_BAD on error (check img_error() for
+ * details).
+ */
+int img_read_columns_parallel(img *pimg, img_columns *cols, int n_threads);
+
+/* Free the memory used by an img_columns struct */
+void img_columns_free(img_columns *cols);
+
 /* Write a item to a .3d file
  *
  * pimg is a pointer to an img struct returned by img_open_write()
@@ -391,6 +538,19 @@ int img_rewind(img *pimg);
  */
 int img_close(img *pimg);
 
+/* Finish writing a .3d file to memory and close it
+ *
+ * pimg is a pointer to an img struct returned by img_write_memory()
+ *
+ * On success, *p_data is set to point to the data (which was allocated
+ *   with malloc(), so should be released with free()) and *p_len to its
+ *   length.
+ *
+ * Returns: non-zero for success, zero for error (check img_error() for
+ *   details)
+ */
+int img_close_memory(img *pimg, void **p_data, size_t *p_len);
+
 /* Codes returned by img_error */
 typedef enum {
    IMG_NONE = 0, IMG_FILENOTFOUND, IMG_OUTOFMEMORY,
@@ -22,9 +22,80 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "img.h"
 
+static int
+same_point(const img_point *a, const img_point *b)
+{
+    return a->x == b->x && a->y == b->y && a->z == b->z;
+}
+
+/* Compare the data read into a and b.  The points and labels can be stored
+ * differently (e.g. img_read_columns_parallel() interns labels separately
+ * for each chunk), so compare what the legs, stations, etc refer to.
+ * Returns NULL if they're the same, or else a description of what differs.
+ */
+static const char *
+columns_differ(const img_columns *a, const img_columns *b)
+{
+    size_t i;
+    if (a->n_legs != b->n_legs) return "number of legs";
+    for (i = 0; i < a->n_legs; i++) {
+	if (!same_point(&a->points[a->leg_to[i] - 1],
+			&b->points[b->leg_to[i] - 1]) ||
+	    !same_point(&a->points[a->leg_to[i]], &b->points[b->leg_to[i]]))
+	    return "leg positions";
+	if (a->leg_flags[i] != b->leg_flags[i]) return "leg flags";
+	if (a->leg_style[i] != b->leg_style[i]) return "leg styles";
+#if IMG_API_VERSION == 0
+	if (a->leg_date1[i] != b->leg_date1[i] ||
+	    a->leg_date2[i] != b->leg_date2[i]) return "leg dates";
+#else /* IMG_API_VERSION == 1 */
+	if (a->leg_days1[i] != b->leg_days1[i] ||
+	    a->leg_days2[i] != b->leg_days2[i]) return "leg dates";
+#endif
+	if (strcmp(a->labels + a->leg_survey[i],
+		   b->labels + b->leg_survey[i]) != 0) return "leg surveys";
+    }
+    if (a->n_stations != b->n_stations) return "number of stations";
+    for (i = 0; i < a->n_stations; i++) {
+	if (!same_point(&a->stn_point[i], &b->stn_point[i]))
+	    return "station positions";
+	if (a->stn_flags[i] != b->stn_flags[i]) return "station flags";
+	if (strcmp(a->labels + a->stn_label[i],
+		   b->labels + b->stn_label[i]) != 0) return "station names";
+    }
+    if (a->n_xsects != b->n_xsects) return "number of cross-sections";
+    for (i = 0; i < a->n_xsects; i++) {
+	if (strcmp(a->labels + a->xsect_label[i],
+		   b->labels + b->xsect_label[i]) != 0 ||
+	    a->xsect_l[i] != b->xsect_l[i] || a->xsect_r[i] != b->xsect_r[i] ||
+	    a->xsect_u[i] != b->xsect_u[i] || a->xsect_d[i] != b->xsect_d[i] ||
+	    a->xsect_flags[i] != b->xsect_flags[i])
+	    return "cross-sections";
+#if IMG_API_VERSION == 0
+	if (a->xsect_date1[i] != b->xsect_date1[i] ||
+	    a->xsect_date2[i] != b->xsect_date2[i]) return "cross-section dates";
+#else /* IMG_API_VERSION == 1 */
+	if (a->xsect_days1[i] != b->xsect_days1[i] ||
+	    a->xsect_days2[i] != b->xsect_days2[i]) return "cross-section dates";
+#endif
+    }
+    if (a->n_errors != b->n_errors) return "number of traverse errors";
+    for (i = 0; i < a->n_errors; i++) {
+	if (a->error_leg[i] != b->error_leg[i] ||
+	    a->error_n_legs[i] != b->error_n_legs[i] ||
+	    a->error_length[i] != b->error_length[i] ||
+	    a->error_E[i] != b->error_E[i] || a->error_H[i] != b->error_H[i] ||
+	    a->error_V[i] != b->error_V[i])
+	    return "traverse errors";
+    }
+    return NULL;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -73,6 +144,156 @@ main(int argc, char **argv)
 
     printf("Stations: %lu\nLegs: %lu\n", c_stations, c_legs);
 
+    /* Check img_read_columns() decodes the same data, reading in small
+     * chunks to exercise continuing from one chunk to the next. */
+    if (img_rewind(pimg)) {
+	img_columns cols;
+	unsigned long n_stations = 0;
+	unsigned long n_legs = 0;
+	int code;
+	img_columns_init(&cols);
+	do {
+	    size_t i;
+	    code = img_read_columns(pimg, &cols, 1000);
+	    if (code == img_BAD) {
+		img_columns_free(&cols);
+		img_close(pimg);
+		fprintf(stderr, "%s: img_read_columns failed (error code %d)\n",
+			argv[0], (int)img_error());
+		return 1;
+	    }
+	    for (i = 0; i < cols.n_legs; i++) {
+		if (cols.leg_to[i] == 0 || cols.leg_to[i] >= cols.n_points ||
+		    cols.leg_survey[i] >= cols.labels_len) {
+		    fprintf(stderr, "%s: bad leg %lu from img_read_columns\n",
+			    argv[0], n_legs + (unsigned long)i);
+		    return 1;
+		}
+	    }
+	    n_stations += cols.n_stations;
+	    n_legs += cols.n_legs;
+	} while (code == 0);
+	img_columns_free(&cols);
+	if (n_stations != c_stations || n_legs != c_legs) {
+	    fprintf(stderr, "%s: img_read_columns read %lu stations and %lu legs\n",
+		    argv[0], n_stations, n_legs);
+	    return 1;
+	}
+    }
+
+    /* And that img_read_columns_parallel() does too. */
+    {
+	img_columns cols;
+	size_t i;
+	img_columns_init(&cols);
+	if (img_read_columns_parallel(pimg, &cols, 4) != img_STOP) {
+	    img_columns_free(&cols);
+	    img_close(pimg);
+	    fprintf(stderr, "%s: img_read_columns_parallel failed (error code %d)\n",
+		    argv[0], (int)img_error());
+	    return 1;
+	}
+	for (i = 0; i < cols.n_legs; i++) {
+	    if (cols.leg_to[i] == 0 || cols.leg_to[i] >= cols.n_points ||
+		cols.leg_survey[i] >= cols.labels_len) {
+		fprintf(stderr, "%s: bad leg %lu from img_read_columns_parallel\n",
+			argv[0], (unsigned long)i);
+		return 1;
+	    }
+	}
+	if (cols.n_stations != c_stations || cols.n_legs != c_legs) {
+	    fprintf(stderr, "%s: img_read_columns_parallel read %lu stations and %lu legs\n",
+		    argv[0], (unsigned long)cols.n_stations,
+		    (unsigned long)cols.n_legs);
+	    return 1;
+	}
+	/* Check the chunks were merged to give exactly the same data as
+	 * reading the whole file in one go. */
+	if (img_rewind(pimg)) {
+	    img_columns all;
+	    const char *diff;
+	    img_columns_init(&all);
+	    if (img_read_columns(pimg, &all, 0) != img_STOP) {
+		fprintf(stderr, "%s: img_read_columns failed (error code %d)\n",
+			argv[0], (int)img_error());
+		return 1;
+	    }
+	    diff = columns_differ(&all, &cols);
+	    if (diff) {
+		fprintf(stderr, "%s: img_read_columns_parallel gave different %s\n",
+			argv[0], diff);
+		return 1;
+	    }
+	    img_columns_free(&all);
+	}
+	img_columns_free(&cols);
+    }
+
+    /* Check that copying the stations and legs with img_write_memory()
+     * gives data we can read back the same counts from. */
+    if (img_rewind(pimg)) {
+	img *out = img_write_memory(pimg->title, pimg->cs, 0);
+	void *data;
+	size_t len;
+	FILE *fh;
+	img *in;
+	unsigned long n_stations = 0;
+	unsigned long n_legs = 0;
+	if (!out) {
+	    img_close(pimg);
+	    fprintf(stderr, "%s: img_write_memory failed (error code %d)\n",
+		    argv[0], (int)img_error());
+	    return 1;
+	}
+	while (1) {
+	    img_point pt;
+	    int code = img_read_item(pimg, &pt);
+	    if (code == img_STOP || code == img_BAD) break;
+	    if (code == img_MOVE || code == img_LINE || code == img_LABEL)
+		img_write_item(out, code, pimg->flags, pimg->label,
+			       pt.x, pt.y, pt.z);
+	}
+	if (!img_close_memory(out, &data, &len)) {
+	    img_close(pimg);
+	    fprintf(stderr, "%s: img_close_memory failed (error code %d)\n",
+		    argv[0], (int)img_error());
+	    return 1;
+	}
+	/* There's no reader for data in memory, so read it back via a
+	 * temporary file. */
+	fh = tmpfile();
+	if (!fh || fwrite(data, len, 1, fh) != 1) {
+	    fprintf(stderr, "%s: failed to write temporary file\n", argv[0]);
+	    return 1;
+	}
+	free(data);
+	rewind(fh);
+	in = img_read_stream(fh, fclose, ".3d");
+	if (!in) {
+	    fprintf(stderr, "%s: couldn't read data from img_write_memory (error code %d)\n",
+		    argv[0], (int)img_error());
+	    return 1;
+	}
+	while (1) {
+	    img_point pt;
+	    int code = img_read_item(in, &pt);
+	    if (code == img_STOP) break;
+	    if (code == img_BAD) {
+		fprintf(stderr, "%s: bad data from img_write_memory (error code %d)\n",
+			argv[0], (int)img_error());
+		return 1;
+	    }
+	    if (code == img_LINE) n_legs++;
+	    if (code == img_LABEL) n_stations++;
+	}
+	img_close(in);
+	if (n_stations != c_stations || n_legs != c_legs) {
+	    fprintf(stderr, "%s: img_write_memory wrote %lu stations and %lu legs\n",
+		    argv[0], n_stations, n_legs);
+	    return 1;
+	}
+    }
+
     img_close(pimg);
 
     return 0;
@@ -65,6 +65,8 @@ class LabelInfo : public Point {
     wxString text;
     unsigned width;
     int flags;
+    // The id of the survey in the Model's survey tree.
+    unsigned survey = 0;
 
 public:
     wxTreeItemId tree_id;
@@ -87,6 +89,8 @@ public:
     void clear_flags(int mask) { flags &= ~mask; }
     unsigned get_width() const { return width; }
     void set_width(unsigned width_) { width = width_; }
+    unsigned get_survey() const { return survey; }
+    void set_survey(unsigned survey_) { survey = survey_; }
 
     bool IsEntrance() const { return (flags & LFLAG_ENTRANCE) != 0; }
     bool IsFixedPt() const { return (flags & LFLAG_FIXED) != 0; }
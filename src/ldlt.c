@@ -0,0 +1,420 @@
+/* ldlt.c
+ * Dense LDL' factorisation routines for solving the network matrix
+ * Copyright (C) 1993-2003,2010,2013 Olly Betts
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "debug.h"
+#include "cavern.h"
+#include "ldlt.h"
+#include "osalloc.h"
+
+/* The SIMD kernels use GCC's (also supported by clang) function attributes
+ * to compile them for instruction sets we can't assume the CPU supports, and
+ * then check which we can use at runtime.
+ */
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+# define LDLT_X86 1
+# include <immintrin.h>
+#else
+# define LDLT_X86 0
+#endif
+
+/* for M(row, col) col must be <= row, so Y <= X */
+# define M(X, Y) ((real *)M)[((((OSSIZE_T)(X)) * ((X) + 1)) >> 1) + (Y)]
+
+/* Solve MX=B for X by Choleski factorisation - modified Choleski actually
+ * since we factor into LDL' while Choleski is just LL'
+ */
+/* Note M must be symmetric positive definite */
+/* routine is entitled to scribble on M and B if it wishes */
+extern void
+choleski(real *M, real *B, long n)
+{
+   int i, j, k;
+
+   for (j = 1; j < n; j++) {
+      real V;
+      for (i = 0; i < j; i++) {
+	 V = (real)0.0;
+	 for (k = 0; k < i; k++) V += M(i,k) * M(j,k) * M(k,k);
+	 M(j,i) = (M(j,i) - V) / M(i,i);
+      }
+      V = (real)0.0;
+      for (k = 0; k < j; k++) V += M(j,k) * M(j,k) * M(k,k);
+      M(j,j) -= V; /* may be best to add M() last for numerical reasons too */
+   }
+
+   /* Multiply x by L inverse */
+   for (i = 0; i < n - 1; i++) {
+      for (j = i + 1; j < n; j++) {
+	 B[j] -= M(j,i) * B[i];
+      }
+   }
+
+   /* Multiply x by D inverse */
+   for (i = 0; i < n; i++) {
+      B[i] /= M(i,i);
+   }
+
+   /* Multiply x by (L transpose) inverse */
+   for (i = (int)(n - 1); i > 0; i--) {
+      for (j = i - 1; j >= 0; j--) {
+	 B[j] -= M(i,j) * B[i];
+      }
+   }
+
+   /* printf("\n%ld/%ld\n\n",flops,flopsTot); */
+}
+
+/* The blocked factorisation works on NB by NB tiles, each stored by rows in
+ * a contiguous block of memory.  NB needs to be a multiple of 8 for the SIMD
+ * kernels, and three tiles should fit comfortably in the L2 cache.
+ */
+#define NB 64
+
+/* Tile (I, J) of the lower triangle (J <= I) of the tiled matrix T */
+#define TILE(T, I, J) \
+   ((T) + ((((OSSIZE_T)(I) * ((I) + 1)) >> 1) + (J)) * (NB * NB))
+
+/* Element (i, j) within tile A */
+#define EL(A, i, j) (A)[(i) * NB + (j)]
+
+/* The inner kernel, which performs C -= A Bt for NB by NB tiles.  This is
+ * where nearly all the time goes for large matrices.
+ */
+typedef void (*update_fn)(real *C, const real *A, const real *Bt);
+
+static void
+update_generic(real *C, const real *A, const real *Bt)
+{
+   int i, j, k;
+   for (i = 0; i < NB; i++) {
+      real *c = C + i * NB;
+      for (k = 0; k < NB; k++) {
+	 real a = EL(A, i, k);
+	 const real *b = Bt + k * NB;
+	 for (j = 0; j < NB; j++) c[j] -= a * b[j];
+      }
+   }
+}
+
+#if LDLT_X86
+/* Work on 4 rows by 4 columns of C at a time, which needs 8 of the 16 SSE
+ * registers to accumulate into.
+ */
+__attribute__((target("sse2")))
+static void
+update_sse2(real *C, const real *A, const real *Bt)
+{
+   int i, j, k;
+   for (i = 0; i < NB; i += 4) {
+      for (j = 0; j < NB; j += 4) {
+	 real *c = C + i * NB + j;
+	 __m128d c00 = _mm_loadu_pd(c), c01 = _mm_loadu_pd(c + 2);
+	 __m128d c10 = _mm_loadu_pd(c + NB), c11 = _mm_loadu_pd(c + NB + 2);
+	 __m128d c20 = _mm_loadu_pd(c + 2 * NB);
+	 __m128d c21 = _mm_loadu_pd(c + 2 * NB + 2);
+	 __m128d c30 = _mm_loadu_pd(c + 3 * NB);
+	 __m128d c31 = _mm_loadu_pd(c + 3 * NB + 2);
+	 const real *a = A + i * NB;
+	 for (k = 0; k < NB; k++) {
+	    __m128d b0 = _mm_loadu_pd(Bt + k * NB + j);
+	    __m128d b1 = _mm_loadu_pd(Bt + k * NB + j + 2);
+	    __m128d t;
+	    t = _mm_set1_pd(a[k]);
+	    c00 = _mm_sub_pd(c00, _mm_mul_pd(t, b0));
+	    c01 = _mm_sub_pd(c01, _mm_mul_pd(t, b1));
+	    t = _mm_set1_pd(a[NB + k]);
+	    c10 = _mm_sub_pd(c10, _mm_mul_pd(t, b0));
+	    c11 = _mm_sub_pd(c11, _mm_mul_pd(t, b1));
+	    t = _mm_set1_pd(a[2 * NB + k]);
+	    c20 = _mm_sub_pd(c20, _mm_mul_pd(t, b0));
+	    c21 = _mm_sub_pd(c21, _mm_mul_pd(t, b1));
+	    t = _mm_set1_pd(a[3 * NB + k]);
+	    c30 = _mm_sub_pd(c30, _mm_mul_pd(t, b0));
+	    c31 = _mm_sub_pd(c31, _mm_mul_pd(t, b1));
+	 }
+	 _mm_storeu_pd(c, c00);
+	 _mm_storeu_pd(c + 2, c01);
+	 _mm_storeu_pd(c + NB, c10);
+	 _mm_storeu_pd(c + NB + 2, c11);
+	 _mm_storeu_pd(c + 2 * NB, c20);
+	 _mm_storeu_pd(c + 2 * NB + 2, c21);
+	 _mm_storeu_pd(c + 3 * NB, c30);
+	 _mm_storeu_pd(c + 3 * NB + 2, c31);
+      }
+   }
+}
+
+/* Work on 4 rows by 8 columns of C at a time, accumulating into 8 AVX
+ * registers using fused multiply-add.
+ */
+__attribute__((target("avx2,fma")))
+static void
+update_avx2(real *C, const real *A, const real *Bt)
+{
+   int i, j, k;
+   for (i = 0; i < NB; i += 4) {
+      for (j = 0; j < NB; j += 8) {
+	 real *c = C + i * NB + j;
+	 __m256d c00 = _mm256_loadu_pd(c), c01 = _mm256_loadu_pd(c + 4);
+	 __m256d c10 = _mm256_loadu_pd(c + NB);
+	 __m256d c11 = _mm256_loadu_pd(c + NB + 4);
+	 __m256d c20 = _mm256_loadu_pd(c + 2 * NB);
+	 __m256d c21 = _mm256_loadu_pd(c + 2 * NB + 4);
+	 __m256d c30 = _mm256_loadu_pd(c + 3 * NB);
+	 __m256d c31 = _mm256_loadu_pd(c + 3 * NB + 4);
+	 const real *a = A + i * NB;
+	 for (k = 0; k < NB; k++) {
+	    __m256d b0 = _mm256_loadu_pd(Bt + k * NB + j);
+	    __m256d b1 = _mm256_loadu_pd(Bt + k * NB + j + 4);
+	    __m256d t;
+	    t = _mm256_broadcast_sd(a + k);
+	    c00 = _mm256_fnmadd_pd(t, b0, c00);
+	    c01 = _mm256_fnmadd_pd(t, b1, c01);
+	    t = _mm256_broadcast_sd(a + NB + k);
+	    c10 = _mm256_fnmadd_pd(t, b0, c10);
+	    c11 = _mm256_fnmadd_pd(t, b1, c11);
+	    t = _mm256_broadcast_sd(a + 2 * NB + k);
+	    c20 = _mm256_fnmadd_pd(t, b0, c20);
+	    c21 = _mm256_fnmadd_pd(t, b1, c21);
+	    t = _mm256_broadcast_sd(a + 3 * NB + k);
+	    c30 = _mm256_fnmadd_pd(t, b0, c30);
+	    c31 = _mm256_fnmadd_pd(t, b1, c31);
+	 }
+	 _mm256_storeu_pd(c, c00);
+	 _mm256_storeu_pd(c + 4, c01);
+	 _mm256_storeu_pd(c + NB, c10);
+	 _mm256_storeu_pd(c + NB + 4, c11);
+	 _mm256_storeu_pd(c + 2 * NB, c20);
+	 _mm256_storeu_pd(c + 2 * NB + 4, c21);
+	 _mm256_storeu_pd(c + 3 * NB, c30);
+	 _mm256_storeu_pd(c + 3 * NB + 4, c31);
+      }
+   }
+}
+#endif
+
+extern bool
+ldlt_kernel_supported(ldlt_kernel kernel)
+{
+   switch (kernel) {
+      case LDLT_KERNEL_AUTO:
+      case LDLT_KERNEL_GENERIC:
+	 return fTrue;
+#if LDLT_X86
+      case LDLT_KERNEL_SSE2:
+	 /* The SIMD kernels assume real is double. */
+	 if (sizeof(real) != sizeof(double)) return fFalse;
+	 __builtin_cpu_init();
+	 return __builtin_cpu_supports("sse2");
+      case LDLT_KERNEL_AVX2:
+	 if (sizeof(real) != sizeof(double)) return fFalse;
+	 __builtin_cpu_init();
+	 return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+      default:
+	 return fFalse;
+   }
+}
+
+static ldlt_kernel
+resolve_kernel(ldlt_kernel kernel)
+{
+   if (kernel != LDLT_KERNEL_AUTO) return kernel;
+   if (ldlt_kernel_supported(LDLT_KERNEL_AVX2)) return LDLT_KERNEL_AVX2;
+   if (ldlt_kernel_supported(LDLT_KERNEL_SSE2)) return LDLT_KERNEL_SSE2;
+   return LDLT_KERNEL_GENERIC;
+}
+
+extern const char *
+ldlt_kernel_name(ldlt_kernel kernel)
+{
+   switch (resolve_kernel(kernel)) {
+      case LDLT_KERNEL_SSE2:
+	 return "sse2";
+      case LDLT_KERNEL_AVX2:
+	 return "avx2";
+      default:
+	 return "generic";
+   }
+}
+
+/* Factorise the diagonal tile A in place into L (below the diagonal, with
+ * an implicit unit diagonal) and D (returned in d).
+ */
+static void
+factor_diagonal_tile(real *A, real *d)
+{
+   int i, j, k;
+   for (k = 0; k < NB; k++) {
+      real dk = EL(A, k, k);
+      d[k] = dk;
+      /* Go backwards so that EL(A, j, k) for j < i hasn't been scaled yet. */
+      for (i = NB - 1; i > k; i--) {
+	 real f = EL(A, i, k) / dk;
+	 for (j = k + 1; j <= i; j++) EL(A, i, j) -= f * EL(A, j, k);
+	 EL(A, i, k) = f;
+      }
+   }
+}
+
+/* Given the factorised diagonal tile Lkk (with D in d), overwrite the tile A
+ * below it with L, and set Ut to D L' (which is what the trailing update
+ * needs).
+ */
+static void
+factor_panel_tile(real *A, const real *Lkk, const real *d, real *Ut)
+{
+   int r, j, k;
+   for (r = 0; r < NB; r++) {
+      real *a = A + r * NB;
+      /* Solve W Lkk' = A for this row of W */
+      for (j = 0; j < NB; j++) {
+	 real w = a[j];
+	 for (k = 0; k < j; k++) w -= a[k] * EL(Lkk, j, k);
+	 a[j] = w;
+	 EL(Ut, j, r) = w;
+      }
+      for (j = 0; j < NB; j++) a[j] /= d[j];
+   }
+}
+
+extern void
+ldlt_blocked(const real *M, real *B, long n, ldlt_kernel kernel)
+{
+   long nt = (n + NB - 1) / NB; /* number of tiles in each direction */
+   long n_padded = nt * NB;
+   OSSIZE_T tiles_size = (((OSSIZE_T)nt * (nt + 1)) >> 1) * NB * NB;
+   real *T, *D, *Ut, *X;
+   long i, I, J, K;
+   update_fn update;
+
+   switch (resolve_kernel(kernel)) {
+#if LDLT_X86
+      case LDLT_KERNEL_AVX2:
+	 update = update_avx2;
+	 break;
+      case LDLT_KERNEL_SSE2:
+	 update = update_sse2;
+	 break;
+#endif
+      default:
+	 update = update_generic;
+	 break;
+   }
+
+   T = osmalloc(tiles_size * ossizeof(real));
+   D = osmalloc(n_padded * ossizeof(real));
+   Ut = osmalloc((OSSIZE_T)nt * NB * NB * ossizeof(real));
+   X = osmalloc(n_padded * ossizeof(real));
+
+   /* Copy M into the tiles.  We pad the matrix out to a whole number of
+    * tiles with the identity matrix, which leaves the padding in the
+    * solution as zero.
+    */
+   memset(T, 0, tiles_size * ossizeof(real));
+   for (i = 0; i < n; i++) {
+      const real *row = M + ((((OSSIZE_T)i) * (i + 1)) >> 1);
+      for (J = 0; J <= i / NB; J++) {
+	 long len = (J == i / NB) ? i % NB + 1 : NB;
+	 memcpy(&EL(TILE(T, i / NB, J), i % NB, 0), row + J * NB,
+		len * ossizeof(real));
+      }
+      X[i] = B[i];
+   }
+   for ( ; i < n_padded; i++) {
+      EL(TILE(T, nt - 1, nt - 1), i % NB, i % NB) = (real)1.0;
+      X[i] = (real)0.0;
+   }
+
+   /* Right-looking factorisation - factorise the tile on the diagonal and
+    * the column of tiles below it, then subtract their contribution from the
+    * rest of the matrix.
+    */
+   for (K = 0; K < nt; K++) {
+      real *Lkk = TILE(T, K, K);
+      real *d = D + K * NB;
+      factor_diagonal_tile(Lkk, d);
+      for (I = K + 1; I < nt; I++) {
+	 factor_panel_tile(TILE(T, I, K), Lkk, d, Ut + I * NB * NB);
+      }
+      for (I = K + 1; I < nt; I++) {
+	 const real *Lik = TILE(T, I, K);
+	 for (J = K + 1; J <= I; J++) {
+	    update(TILE(T, I, J), Lik, Ut + J * NB * NB);
+	 }
+      }
+   }
+
+   /* Multiply x by L inverse */
+   for (I = 0; I < nt; I++) {
+      real *x = X + I * NB;
+      int r, c;
+      for (K = 0; K < I; K++) {
+	 const real *L = TILE(T, I, K);
+	 const real *y = X + K * NB;
+	 for (r = 0; r < NB; r++) {
+	    real t = x[r];
+	    for (c = 0; c < NB; c++) t -= EL(L, r, c) * y[c];
+	    x[r] = t;
+	 }
+      }
+      {
+	 const real *L = TILE(T, I, I);
+	 for (r = 1; r < NB; r++) {
+	    real t = x[r];
+	    for (c = 0; c < r; c++) t -= EL(L, r, c) * x[c];
+	    x[r] = t;
+	 }
+      }
+   }
+
+   /* Multiply x by D inverse */
+   for (i = 0; i < n_padded; i++) X[i] /= D[i];
+
+   /* Multiply x by (L transpose) inverse */
+   for (I = nt - 1; I >= 0; I--) {
+      real *x = X + I * NB;
+      int r, c;
+      {
+	 const real *L = TILE(T, I, I);
+	 for (r = NB - 1; r > 0; r--) {
+	    for (c = 0; c < r; c++) x[c] -= EL(L, r, c) * x[r];
+	 }
+      }
+      for (K = 0; K < I; K++) {
+	 const real *L = TILE(T, I, K);
+	 real *y = X + K * NB;
+	 for (r = 0; r < NB; r++) {
+	    for (c = 0; c < NB; c++) y[c] -= EL(L, r, c) * x[r];
+	 }
+      }
+   }
+
+   for (i = 0; i < n; i++) B[i] = X[i];
+
+   osfree(X);
+   osfree(Ut);
+   osfree(D);
+   osfree(T);
+}
@@ -0,0 +1,51 @@
+/* ldlt.h
+ * Dense LDL' factorisation routines for solving the network matrix
+ * Copyright (C) 1993,1994,2001 Olly Betts
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Both routines take the lower triangle of a symmetric positive definite
+ * matrix M packed by rows (so M(X, Y) is at M[X * (X + 1) / 2 + Y]), solve
+ * MX=B, and return X in B.
+ */
+
+/* Which implementation of the inner kernel of ldlt_blocked() to use -
+ * LDLT_KERNEL_AUTO picks the fastest one the CPU we're running on supports.
+ */
+typedef enum {
+   LDLT_KERNEL_AUTO, LDLT_KERNEL_GENERIC, LDLT_KERNEL_SSE2, LDLT_KERNEL_AVX2
+} ldlt_kernel;
+
+/* The simple unblocked factorisation, which is kept as the reference
+ * implementation, and is faster for small matrices.  It overwrites M.
+ */
+void choleski(real *M, real *B, long n);
+
+/* Blocked factorisation, which is much faster for large matrices.  M is
+ * copied into square tiles, so isn't modified, but this needs about as much
+ * extra memory again as M uses.
+ */
+void ldlt_blocked(const real *M, real *B, long n, ldlt_kernel kernel);
+
+/* Is kernel usable on this CPU?  (LDLT_KERNEL_AUTO always is.) */
+bool ldlt_kernel_supported(ldlt_kernel kernel);
+
+/* The name of kernel, resolving LDLT_KERNEL_AUTO to the kernel it picks. */
+const char *ldlt_kernel_name(ldlt_kernel kernel);
+
+/* ldlt_blocked() isn't worthwhile for matrices smaller than this. */
+#define LDLT_BLOCKED_MIN 256
@@ -0,0 +1,155 @@
+/* ldltbench.c */
+/* Benchmark the dense LDL' solvers on generated matrices */
+/* Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <time.h>
+
+#include "debug.h"
+#include "cavern.h"
+#include "ldlt.h"
+#include "message.h"
+#include "osalloc.h"
+
+#define PACKED_SIZE(N) ((((OSSIZE_T)(N)) * ((N) + 1)) >> 1)
+
+/* Fill the packed lower triangle of M with a random symmetric matrix, which
+ * is diagonally dominant and so positive definite.
+ */
+static void
+generate(real *M, long n)
+{
+   unsigned long seed = 42;
+   long i, j;
+   for (i = 0; i < n; i++) {
+      real *row = M + PACKED_SIZE(i);
+      for (j = 0; j < i; j++) {
+	 seed = seed * 1103515245ul + 12345ul;
+	 row[j] = (real)((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+      }
+      row[i] = (real)n;
+   }
+}
+
+/* Set B = M X */
+static void
+multiply(const real *M, const real *X, real *B, long n)
+{
+   long i, j;
+   for (i = 0; i < n; i++) B[i] = 0.0;
+   for (i = 0; i < n; i++) {
+      const real *row = M + PACKED_SIZE(i);
+      for (j = 0; j < i; j++) {
+	 B[i] += row[j] * X[j];
+	 B[j] += row[j] * X[i];
+      }
+      B[i] += row[i] * X[i];
+   }
+}
+
+/* Time solving with kernel, or with the reference implementation if
+ * blocked is false. */
+static void
+run(const real *M, long n, bool blocked, ldlt_kernel kernel)
+{
+   const char *name = blocked ? ldlt_kernel_name(kernel) : "reference";
+   real *A, *X, *B;
+   double secs, flops, err = 0.0;
+   clock_t start;
+   long i;
+
+   X = osmalloc(n * ossizeof(real));
+   B = osmalloc(n * ossizeof(real));
+   for (i = 0; i < n; i++) X[i] = (real)(1 + i % 7);
+   multiply(M, X, B, n);
+
+   if (!blocked) {
+      /* The reference implementation overwrites M. */
+      A = osmalloc(PACKED_SIZE(n) * ossizeof(real));
+      memcpy(A, M, PACKED_SIZE(n) * ossizeof(real));
+      start = clock();
+      choleski(A, B, n);
+      secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+      osfree(A);
+   } else {
+      start = clock();
+      ldlt_blocked(M, B, n, kernel);
+      secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+   }
+
+   for (i = 0; i < n; i++) {
+      double e = fabs(B[i] - X[i]);
+      if (e > err) err = e;
+   }
+
+   /* Factorising takes about n^3/3 floating point operations, and the rest
+    * is O(n^2). */
+   flops = (double)n * n * n / 3.0;
+   printf("%6ld %-10s %9.3f %9.3f %10.2e\n", n, name, secs,
+	  secs > 0 ? flops / secs * 1e-9 : 0.0, err);
+   fflush(stdout);
+
+   osfree(B);
+   osfree(X);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const char *default_sizes[] = {
+      "2000", "4000", "6000", "8000", "10000", NULL
+   };
+   const char **sizes = default_sizes;
+   const char *progname = argv[0];
+   bool reference = fTrue;
+   static const ldlt_kernel kernels[] = {
+      LDLT_KERNEL_GENERIC, LDLT_KERNEL_SSE2, LDLT_KERNEL_AVX2
+   };
+
+   msg_init(argv);
+
+   if (argc > 1 && strcmp(argv[1], "--no-reference") == 0) {
+      reference = fFalse;
+      --argc;
+      ++argv;
+   }
+   if (argc > 1) sizes = (const char **)argv + 1;
+
+   printf("%6s %-10s %9s %9s %10s\n", "n", "method", "seconds", "GFLOP/s",
+	  "max error");
+   for ( ; *sizes; sizes++) {
+      long n = atol(*sizes);
+      real *M;
+      size_t k;
+      if (n <= 0) {
+	 fprintf(stderr, "Syntax: %s [--no-reference] [N...]\n", progname);
+	 return 1;
+      }
+      M = osmalloc(PACKED_SIZE(n) * ossizeof(real));
+      generate(M, n);
+      if (reference) run(M, n, fFalse, LDLT_KERNEL_AUTO);
+      for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+	 if (ldlt_kernel_supported(kernels[k])) run(M, n, fTrue, kernels[k]);
+      }
+      osfree(M);
+   }
+   return 0;
+}
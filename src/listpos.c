@@ -92,11 +92,11 @@ check_node(prefix *p)
 #endif
 	 if ((p->min_export > 1 && p->min_export != USHRT_MAX) ||
 	     (p->min_export == 0 && p->max_export)) {
-	    char *s;
+	    const char *s;
 	    prefix *where = p->up;
 	    int msgno;
 	    SVX_ASSERT(where);
-	    s = osstrdup(sprint_prefix(where));
+	    s = sprint_prefix(where);
 	    /* Report better when station called 2.1 for example */
 	    while (!where->filename && where->up) where = where->up;
 
@@ -112,7 +112,6 @@ check_node(prefix *p)
 	       msgno = /*Reference to station “%s” from non-existent survey “%s”*/286;
 	    }
 	    compile_diagnostic_pfx(DIAG_ERR, where, msgno, sprint_prefix(p), s);
-	    osfree(s);
 	 }
       }
 
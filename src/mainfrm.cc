@@ -49,6 +49,7 @@
 # include <wx/sysopt.h>
 #endif
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <float.h>
@@ -1148,7 +1149,7 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     SetTitle(GetSurveyTitle() + " - " APP_NAME);
 
     // Sort the labels ready for filling the tree.
-    m_Labels.sort(LabelCmp(GetSeparator()));
+    SortLabels(LabelCmp(GetSeparator()));
 
     // Fill the tree of stations and prefixes.
     wxString root_name = wxFileNameFromPath(file);
@@ -1165,7 +1166,7 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     // Also sort by leaf name so that we'll tend to choose labels
     // from different surveys, rather than labels from surveys which
     // are earlier in the list.
-    m_Labels.sort(LabelPlotCmp(GetSeparator()));
+    SortLabels(LabelPlotCmp(GetSeparator()));
 
     if (!m_FindBox->GetValue().empty()) {
 	// Highlight any stations matching the current search.
@@ -1346,6 +1347,10 @@ void MainFrm::InitialiseAfterLoad(const wxString & file, const wxString & prefix
 
     m_Gfx->Initialise(same_file);
 
+    // The survey tree and the view have now forgotten the stations from any
+    // previous file.
+    ReleaseOldLabels();
+
     if (win) {
 	// FIXME: check it actually is the log window!
 	if (m_Log && m_Log != win)
@@ -2198,7 +2203,7 @@ void MainFrm::DoFind()
     wxString pattern = m_FindBox->GetValue();
     if (pattern.empty()) {
 	// Hide any search result highlights.
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
+	vector<LabelInfo*>::iterator pos = m_Labels.begin();
 	while (pos != m_Labels.end()) {
 	    LabelInfo* label = *pos++;
 	    label->clear_flags(LFLAG_HIGHLIGHTED);
@@ -2268,7 +2273,7 @@ void MainFrm::DoFind()
 
 	int found = 0;
 
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
+	vector<LabelInfo*>::iterator pos = m_Labels.begin();
 	while (pos != m_Labels.end()) {
 	    LabelInfo* label = *pos++;
 
@@ -2283,7 +2288,7 @@ void MainFrm::DoFind()
 	m_NumHighlighted = found;
 
 	// Re-sort so highlighted points get names in preference
-	if (found) m_Labels.sort(LabelPlotCmp(GetSeparator()));
+	if (found) SortLabels(LabelPlotCmp(GetSeparator()));
     }
 
     m_Gfx->UpdateBlobs();
@@ -2312,7 +2317,7 @@ void MainFrm::OnGotoFound(wxCommandEvent&)
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::iterator pos = m_Labels.begin();
+    vector<LabelInfo*>::iterator pos = m_Labels.begin();
     while (pos != m_Labels.end()) {
 	LabelInfo* label = *pos++;
 
@@ -438,12 +438,15 @@ public:
 
     int GetNumHighlightedPts() const { return m_NumHighlighted; }
 
-    const SurveyFilter* GetTreeFilter() const { return m_Tree->GetFilter(); }
+    const SurveyFilter* GetTreeFilter() const {
+	const SurveyFilter* filter = m_Tree->GetFilter();
+	if (filter) filter->Resolve(*this);
+	return filter;
+    }
 
-    // Used when the tree filters change.  FIXME: Overkill?
-    void ForceFullRedraw() {
-	m_Gfx->InvalidateAllLists();
-	m_Gfx->ForceRefresh();
+    // Used when the tree filters change.
+    void FilterChanged() {
+	m_Gfx->FilterChanged();
     }
 
 private:
@@ -27,9 +27,15 @@
 # include <config.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #include "debug.h"
 #include "cavern.h"
+#include "block3.h"
 #include "filename.h"
+#include "ldlt.h"
 #include "message.h"
 #include "netbits.h"
 #include "matrix.h"
@@ -48,8 +54,6 @@
 static void print_matrix(real *M, real *B, long n);
 #endif
 
-static void choleski(real *M, real *B, long n);
-
 #ifdef SOR
 static void sor(real *M, real *B, long n);
 #endif
@@ -59,51 +63,314 @@ static void sor(real *M, real *B, long n);
 	      /* +(Y>X?0*printf("row<col (line %d)\n",__LINE__):0) */
 /*#define M_(X, Y) ((real *)M)[((((OSSIZE_T)(Y)) * ((Y) + 1)) >> 1) + (X)]*/
 
-static int find_stn_in_tab(node *stn);
-static int add_stn_to_tab(node *stn);
-static void build_matrix(node *list);
+/* The lower triangle of a sparse symmetric matrix, stored by rows (the
+ * columns in each row are in ascending order, so the diagonal element is
+ * last), along with its LDL' factorisation.  L is stored by columns, and
+ * doesn't include the unit diagonal.
+ */
+typedef struct {
+   long n;
+   long *rowstart;
+   long *col;
+   real *val;
+   /* Elimination tree - parent[i] is -1 for a root */
+   long *parent;
+   long *Lp, *Lnz, *Li;
+   real *Lx, *D;
+   /* workspace for the numeric factorisation */
+   long *flag, *pattern;
+   real *Y;
+} sparse_matrix;
+
+/* As sparse_matrix, but with a row and column for each station, and each
+ * element a 3x3 block coupling the three unknowns for a pair of stations.
+ * This means there are a ninth as many column indices to store and follow,
+ * and the arithmetic works on small dense blocks.  D holds the inverses of
+ * the diagonal blocks of the factorisation.
+ */
+typedef struct {
+   long n;
+   long *rowstart;
+   long *col;
+   block3 *val;
+   long *parent;
+   long *Lp, *Lnz, *Li;
+   block3 *Lx, *D;
+   long *flag, *pattern;
+   block3 *Y;
+} block_matrix;
+
+/* One part of the network to solve.  This is kept in a struct rather than
+ * in static variables so that independent parts of the network can be
+ * solved at the same time by different threads.
+ */
+typedef struct {
+   node *list;
+   /* The unfixed stations in list, indexed by their row in the matrix. */
+   pos **stn_tab;
+   long n_stn_tab;
+   /* How the iterative solver got on (the most iterations and the worst
+    * residual if there's more than one system to solve). */
+   long pcg_iterations;
+   real pcg_residual;
+   bool pcg_converged;
+   bool ic_failed;
+} matrix_job;
 
-static long n_stn_tab;
+static int find_stn_in_tab(const matrix_job *J, node *stn);
+static int add_stn_to_tab(matrix_job *J, long *hash, unsigned long mask,
+			  node *stn);
+static bool prepare_matrix(matrix_job *J, node *list);
+static void solve_job(matrix_job *J);
+static void report_job(const matrix_job *J);
+static void build_matrix(matrix_job *J);
 
-static pos **stn_tab;
+static sparse_matrix *sparse_pattern(matrix_job *J, bool factorise);
+static real *sparse_entry(sparse_matrix *S, long row, long col);
+static void sparse_symbolic(sparse_matrix *S);
+static void sparse_ldlt(sparse_matrix *S, real *B);
+static void sparse_free(sparse_matrix *S);
+static void sparse_pcg(matrix_job *J, sparse_matrix *S, real *B);
+
+static block_matrix *block_pattern(matrix_job *J);
+#ifndef NO_COVARIANCES
+static real *block_entry(block_matrix *S, long row, long col);
+#endif
+static void block_ldlt(block_matrix *S, real *B);
+static void block_free(block_matrix *S);
+
+#define HASH_POS(P) \
+    ((unsigned long)(((uintptr_t)(P) / ossizeof(pos)) * 2654435761UL))
+
+solver_method solver = SOLVER_AUTO;
+
+int solver_jobs = 1;
+
+double pcg_tolerance = 1e-10;
+
+#define ITERATIVE_SOLVER (solver == SOLVER_PCG || solver == SOLVER_PCG_JACOBI)
+
+#ifdef HAVE_PTHREAD
+static void solve_in_parallel(matrix_job *jobs, long n_jobs);
+#endif
 
 extern void
-solve_matrix(node *list)
+solve_matrices(node **lists, long n_lists)
+{
+   matrix_job *jobs;
+   long n_jobs = 0;
+   long i;
+
+#ifdef HAVE_PTHREAD
+   if (solver_jobs > 1 && n_lists > 1) {
+      /* Set up all the jobs first - this reports the size of each in order,
+       * so the output doesn't depend on how the threads get scheduled. */
+      jobs = osmalloc(n_lists * ossizeof(matrix_job));
+      for (i = 0; i < n_lists; i++) {
+	 if (prepare_matrix(&jobs[n_jobs], lists[i])) n_jobs++;
+      }
+      if (n_jobs > 1) {
+	 solve_in_parallel(jobs, n_jobs);
+      } else if (n_jobs) {
+	 solve_job(&jobs[0]);
+      }
+      for (i = 0; i < n_jobs; i++) report_job(&jobs[i]);
+      osfree(jobs);
+      return;
+   }
+#endif
+
+   jobs = osnew(matrix_job);
+   for (i = 0; i < n_lists; i++) {
+      if (prepare_matrix(jobs, lists[i])) {
+	 solve_job(jobs);
+	 report_job(jobs);
+      }
+   }
+   osfree(jobs);
+}
+
+/* Build the table of unfixed stations for list, and report the number of
+ * equations to solve.  Returns fFalse if there's nothing to solve.
+ */
+static bool
+prepare_matrix(matrix_job *J, node *list)
 {
    node *stn;
    long n = 0;
+   long *hash;
+   unsigned long mask;
+
    FOR_EACH_STN(stn, list) {
       if (!fixed(stn)) n++;
    }
-   if (n == 0) return;
+   if (n == 0) return fFalse;
+
+   J->list = list;
+   J->pcg_iterations = 0;
+   J->pcg_residual = 0.0;
+   J->pcg_converged = fTrue;
+   J->ic_failed = fFalse;
 
    /* we just need n to be a reasonable estimate >= the number
     * of stations left after reduction. If memory is
     * plentiful, we can be crass.
     */
-   stn_tab = osmalloc((OSSIZE_T)(n * ossizeof(pos*)));
-   n_stn_tab = 0;
+   J->stn_tab = osmalloc((OSSIZE_T)(n * ossizeof(pos*)));
+   J->n_stn_tab = 0;
+
+   /* Several nodes can share one pos, so we use an open-addressed hash table
+    * mapping each pos to its index in stn_tab while building it.  Once a node
+    * has been added, its index is kept in its colour field, so looking up
+    * the matrix row for a node later doesn't need to search.
+    */
+   mask = 1;
+   while (mask < (unsigned long)n * 2) mask <<= 1;
+   hash = osmalloc(mask * ossizeof(long));
+   memset(hash, 0xff, mask * ossizeof(long));
+   mask--;
 
    FOR_EACH_STN(stn, list) {
-      if (!fixed(stn)) add_stn_to_tab(stn);
+      if (!fixed(stn)) stn->colour = add_stn_to_tab(J, hash, mask, stn);
    }
 
-   if (n_stn_tab < n) {
+   osfree(hash);
+
+   if (J->n_stn_tab == 0) {
+      osfree(J->stn_tab);
+      if (!fQuiet)
+	 puts(msg(/*Network solved by reduction - no simultaneous equations to solve.*/74));
+      return fFalse;
+   }
+
+   if (J->n_stn_tab < n) {
       /* release unused entries in stn_tab */
-      stn_tab = osrealloc(stn_tab, n_stn_tab * ossizeof(pos*));
+      J->stn_tab = osrealloc(J->stn_tab, J->n_stn_tab * ossizeof(pos*));
+   }
+
+   if (!fQuiet) {
+      if (J->n_stn_tab == 1)
+	 out_current_action(msg(/*Solving one equation*/78));
+      else
+	 out_current_action1(msg(/*Solving %d simultaneous equations*/75), J->n_stn_tab);
    }
+   return fTrue;
+}
 
-   build_matrix(list);
+/* Solve the job set up by prepare_matrix().  This may be called from a
+ * worker thread, so it mustn't produce any output, or use FOR_EACH_STN
+ * (which iterates using a global variable).
+ */
+static void
+solve_job(matrix_job *J)
+{
+   build_matrix(J);
 #if DEBUG_MATRIX
-   FOR_EACH_STN(stn, list) {
-      printf("(%8.2f, %8.2f, %8.2f ) ", POS(stn, 0), POS(stn, 1), POS(stn, 2));
-      print_prefix(stn->name);
-      putnl();
+   {
+      node *stn;
+      for (stn = J->list; stn; stn = stn->next) {
+	 printf("(%8.2f, %8.2f, %8.2f ) ", POS(stn, 0), POS(stn, 1), POS(stn, 2));
+	 print_prefix(stn->name);
+	 putnl();
+      }
    }
 #endif
 
-   osfree(stn_tab);
+   osfree(J->stn_tab);
+}
+
+/* Report on how the iterative solver got on with the job. */
+static void
+report_job(const matrix_job *J)
+{
+   if (!ITERATIVE_SOLVER) return;
+   if (J->ic_failed && !fQuiet) {
+      /* TRANSLATORS: The incomplete Cholesky factorisation is used to speed
+       * up the iterative solver, but it can fail for some networks. */
+      puts(msg(/*Incomplete Cholesky factorisation failed - using Jacobi preconditioner instead*/527));
+   }
+   if (!J->pcg_converged) {
+      /* TRANSLATORS: "conjugate gradient" is the name of the iterative
+       * method used to solve the network with --solver=pcg.  The residual
+       * measures how far from being solved the equations still are. */
+      warning(/*Conjugate gradient solver didn’t converge after %ld iterations (relative residual %g)*/528,
+	      J->pcg_iterations, (double)J->pcg_residual);
+   } else if (!fQuiet) {
+      printf(msg(/*Conjugate gradient solver converged after %ld iterations (relative residual %g)*/529),
+	     J->pcg_iterations, (double)J->pcg_residual);
+      putnl();
+   }
+}
+
+#ifdef HAVE_PTHREAD
+/* The jobs waiting to be solved, which worker threads take in turn. */
+typedef struct {
+   matrix_job **jobs;
+   long n_jobs;
+   long next_job;
+   pthread_mutex_t mutex;
+} job_queue;
+
+static void *
+solve_worker(void *arg)
+{
+   job_queue *q = (job_queue *)arg;
+   while (1) {
+      matrix_job *J = NULL;
+      pthread_mutex_lock(&q->mutex);
+      if (q->next_job < q->n_jobs) J = q->jobs[q->next_job++];
+      pthread_mutex_unlock(&q->mutex);
+      if (!J) return NULL;
+      solve_job(J);
+   }
+}
+
+static int
+cmp_job_size(const void *a, const void *b)
+{
+   long n_a = (*(matrix_job *const *)a)->n_stn_tab;
+   long n_b = (*(matrix_job *const *)b)->n_stn_tab;
+   /* Largest first. */
+   return (n_a < n_b) - (n_a > n_b);
+}
+
+static void
+solve_in_parallel(matrix_job *jobs, long n_jobs)
+{
+   job_queue q;
+   pthread_t *threads;
+   long n_threads, i;
+
+   /* The jobs are independent so the order we solve them in doesn't affect
+    * the results, and starting with the biggest means we're less likely to
+    * end up waiting for one thread to solve a big job on its own.
+    */
+   q.jobs = osmalloc(n_jobs * ossizeof(matrix_job *));
+   for (i = 0; i < n_jobs; i++) q.jobs[i] = &jobs[i];
+   qsort(q.jobs, n_jobs, sizeof(matrix_job *), cmp_job_size);
+
+   q.n_jobs = n_jobs;
+   q.next_job = 0;
+   pthread_mutex_init(&q.mutex, NULL);
+
+   /* This thread works on jobs too. */
+   n_threads = solver_jobs - 1;
+   if (n_threads > n_jobs - 1) n_threads = n_jobs - 1;
+   threads = osmalloc(n_threads * ossizeof(pthread_t));
+   for (i = 0; i < n_threads; i++) {
+      /* If we can't start another thread, make do with those we have. */
+      if (pthread_create(&threads[i], NULL, solve_worker, &q) != 0) break;
+   }
+   n_threads = i;
+
+   solve_worker(&q);
+
+   for (i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+   osfree(threads);
+   osfree(q.jobs);
+   pthread_mutex_destroy(&q.mutex);
 }
+#endif
 
 #ifdef NO_COVARIANCES
 # define FACTOR 1
@@ -111,28 +378,48 @@ solve_matrix(node *list)
 # define FACTOR 3
 #endif
 
+/* With SOLVER_AUTO, systems with at most this many unknowns are solved
+ * using the dense matrix code - it has less overhead, and the storage and
+ * time it needs only start to matter for larger systems.
+ */
+#define DENSE_MAX_UNKNOWNS 64
+
+#ifdef NO_COVARIANCES
+/* Each dimension is solved separately, so there are no blocks to exploit. */
+# define USE_BLOCK_SOLVER(J) 0
+#else
+# define USE_BLOCK_SOLVER(J) \
+    (solver == SOLVER_BLOCK || \
+     (solver == SOLVER_AUTO && (J)->n_stn_tab * FACTOR > DENSE_MAX_UNKNOWNS))
+#endif
+
+/* Element (X, Y) of the matrix being built (Y <= X), which is either held
+ * densely in M, or sparsely in S.
+ */
+#define MX(X, Y) (*(S ? sparse_entry(S, (X), (Y)) : &M(X, Y)))
+
 static void
-build_matrix(node *list)
+build_matrix(matrix_job *J)
 {
-   real *M;
+   real *M = NULL;
+   sparse_matrix *S = NULL;
+   block_matrix *BS = NULL;
    real *B;
    int dim;
 
-   if (n_stn_tab == 0) {
-      if (!fQuiet)
-	 puts(msg(/*Network solved by reduction - no simultaneous equations to solve.*/74));
-      return;
-   }
-   /* (OSSIZE_T) cast may be needed if n_stn_tab>=181 */
-   M = osmalloc((OSSIZE_T)((((OSSIZE_T)n_stn_tab * FACTOR * (n_stn_tab * FACTOR + 1)) >> 1)) * ossizeof(real));
-   B = osmalloc((OSSIZE_T)(n_stn_tab * FACTOR * ossizeof(real)));
-
-   if (!fQuiet) {
-      if (n_stn_tab == 1)
-	 out_current_action(msg(/*Solving one equation*/78));
-      else
-	 out_current_action1(msg(/*Solving %d simultaneous equations*/75), n_stn_tab);
+   if (ITERATIVE_SOLVER) {
+      S = sparse_pattern(J, fFalse);
+   } else if (USE_BLOCK_SOLVER(J)) {
+      BS = block_pattern(J);
+   } else if (solver == SOLVER_SPARSE || solver == SOLVER_BLOCK ||
+	      (solver == SOLVER_AUTO &&
+	       J->n_stn_tab * FACTOR > DENSE_MAX_UNKNOWNS)) {
+      S = sparse_pattern(J, fTrue);
+   } else {
+      /* (OSSIZE_T) cast may be needed if J->n_stn_tab>=181 */
+      M = osmalloc((OSSIZE_T)((((OSSIZE_T)J->n_stn_tab * FACTOR * (J->n_stn_tab * FACTOR + 1)) >> 1)) * ossizeof(real));
    }
+   B = osmalloc((OSSIZE_T)(J->n_stn_tab * FACTOR * ossizeof(real)));
 
 #ifdef NO_COVARIANCES
    dim = 2;
@@ -146,10 +433,18 @@ build_matrix(node *list)
       /* Initialise M and B to zero - zeroing "linearly" will minimise
        * paging when the matrix is large */
       {
-	 int end = n_stn_tab * FACTOR;
+	 int end = J->n_stn_tab * FACTOR;
 	 for (row = 0; row < end; row++) B[row] = (real)0.0;
-	 end = ((OSSIZE_T)n_stn_tab * FACTOR * (n_stn_tab * FACTOR + 1)) >> 1;
-	 for (row = 0; row < end; row++) M[row] = (real)0.0;
+	 if (S) {
+	    long i;
+	    for (i = S->rowstart[S->n] - 1; i >= 0; i--) S->val[i] = (real)0.0;
+	 } else if (BS) {
+	    long i;
+	    for (i = BS->rowstart[BS->n] - 1; i >= 0; i--) block3_zero(BS->val[i]);
+	 } else {
+	    end = ((OSSIZE_T)J->n_stn_tab * FACTOR * (J->n_stn_tab * FACTOR + 1)) >> 1;
+	    for (row = 0; row < end; row++) M[row] = (real)0.0;
+	 }
       }
 
       /* Construct matrix - Go thru' stn list & add all forward legs between
@@ -161,7 +456,7 @@ build_matrix(node *list)
        * from the unfixed end (if we consider them from the fixed end we'd
        * need to somehow detect when we're at a fixed point cut line and work
        * out which side we're dealing with at this time. */
-      FOR_EACH_STN(stn, list) {
+      for (stn = J->list; stn; stn = stn->next) {
 #ifdef NO_COVARIANCES
 	 real e;
 #else
@@ -191,7 +486,7 @@ build_matrix(node *list)
 #endif /* DEBUG_MATRIX_BUILD */
 
 	 if (!fixed(stn)) {
-	    f = find_stn_in_tab(stn);
+	    f = find_stn_in_tab(J, stn);
 	    for (dirn = 0; dirn <= 2 && stn->leg[dirn]; dirn++) {
 	       linkfor *leg = stn->leg[dirn];
 	       node *to = leg->l.to;
@@ -203,7 +498,7 @@ build_matrix(node *list)
 		  e = leg->v[dim];
 		  if (e != (real)0.0) {
 		     e = ((real)1.0) / e;
-		     M(f,f) += e;
+		     MX(f,f) += e;
 		     B[f] += e * POS(to, dim);
 		     if (fRev) {
 			B[f] += leg->d[dim];
@@ -221,18 +516,21 @@ build_matrix(node *list)
 			subdd(&a, &POSD(to), &leg->d);
 		     }
 		     mulsd(&b, &e, &a);
-		     for (i = 0; i < 3; i++) {
-			M(f * FACTOR + i, f * FACTOR + i) += e[i];
-			B[f * FACTOR + i] += b[i];
+		     for (i = 0; i < 3; i++) B[f * FACTOR + i] += b[i];
+		     if (BS) {
+			block3_add_sym3(block_entry(BS, f, f), e);
+		     } else {
+			for (i = 0; i < 3; i++)
+			   MX(f * FACTOR + i, f * FACTOR + i) += e[i];
+			MX(f * FACTOR + 1, f * FACTOR) += e[3];
+			MX(f * FACTOR + 2, f * FACTOR) += e[4];
+			MX(f * FACTOR + 2, f * FACTOR + 1) += e[5];
 		     }
-		     M(f * FACTOR + 1, f * FACTOR) += e[3];
-		     M(f * FACTOR + 2, f * FACTOR) += e[4];
-		     M(f * FACTOR + 2, f * FACTOR + 1) += e[5];
 		  }
 #endif
 	       } else if (data_here(leg)) {
 		  /* forward leg, unfixed -> unfixed */
-		  t = find_stn_in_tab(to);
+		  t = find_stn_in_tab(J, to);
 #if DEBUG_MATRIX
 		  printf("Leg %d to %d, var %f, delta %f\n", f, t, e,
 			 leg->d[dim]);
@@ -243,9 +541,9 @@ build_matrix(node *list)
 		  if (t != f && e != (real)0.0) {
 		     real a;
 		     e = ((real)1.0) / e;
-		     M(f,f) += e;
-		     M(t,t) += e;
-		     if (f < t) M(t,f) -= e; else M(f,t) -= e;
+		     MX(f,f) += e;
+		     MX(t,t) += e;
+		     if (f < t) MX(t,f) -= e; else MX(f,t) -= e;
 		     a = e * leg->d[dim];
 		     B[f] -= a;
 		     B[t] += a;
@@ -254,36 +552,49 @@ build_matrix(node *list)
 		  if (t != f && invert_svar(&e, &leg->v)) {
 		     int i;
 		     mulsd(&a, &e, &leg->d);
-		     for (i = 0; i < 3; i++) {
-			M(f * FACTOR + i, f * FACTOR + i) += e[i];
-			M(t * FACTOR + i, t * FACTOR + i) += e[i];
+		     if (BS) {
+			block3_add_sym3(block_entry(BS, f, f), e);
+			block3_add_sym3(block_entry(BS, t, t), e);
 			if (f < t)
-			   M(t * FACTOR + i, f * FACTOR + i) -= e[i];
+			   block3_sub_sym3(block_entry(BS, t, f), e);
 			else
-			   M(f * FACTOR + i, t * FACTOR + i) -= e[i];
-			B[f * FACTOR + i] -= a[i];
-			B[t * FACTOR + i] += a[i];
-		     }
-		     M(f * FACTOR + 1, f * FACTOR) += e[3];
-		     M(t * FACTOR + 1, t * FACTOR) += e[3];
-		     M(f * FACTOR + 2, f * FACTOR) += e[4];
-		     M(t * FACTOR + 2, t * FACTOR) += e[4];
-		     M(f * FACTOR + 2, f * FACTOR + 1) += e[5];
-		     M(t * FACTOR + 2, t * FACTOR + 1) += e[5];
-		     if (f < t) {
-			M(t * FACTOR + 1, f * FACTOR) -= e[3];
-			M(t * FACTOR, f * FACTOR + 1) -= e[3];
-			M(t * FACTOR + 2, f * FACTOR) -= e[4];
-			M(t * FACTOR, f * FACTOR + 2) -= e[4];
-			M(t * FACTOR + 2, f * FACTOR + 1) -= e[5];
-			M(t * FACTOR + 1, f * FACTOR + 2) -= e[5];
+			   block3_sub_sym3(block_entry(BS, f, t), e);
+			for (i = 0; i < 3; i++) {
+			   B[f * FACTOR + i] -= a[i];
+			   B[t * FACTOR + i] += a[i];
+			}
 		     } else {
-			M(f * FACTOR + 1, t * FACTOR) -= e[3];
-			M(f * FACTOR, t * FACTOR + 1) -= e[3];
-			M(f * FACTOR + 2, t * FACTOR) -= e[4];
-			M(f * FACTOR, t * FACTOR + 2) -= e[4];
-			M(f * FACTOR + 2, t * FACTOR + 1) -= e[5];
-			M(f * FACTOR + 1, t * FACTOR + 2) -= e[5];
+			for (i = 0; i < 3; i++) {
+			   MX(f * FACTOR + i, f * FACTOR + i) += e[i];
+			   MX(t * FACTOR + i, t * FACTOR + i) += e[i];
+			   if (f < t)
+			      MX(t * FACTOR + i, f * FACTOR + i) -= e[i];
+			   else
+			      MX(f * FACTOR + i, t * FACTOR + i) -= e[i];
+			   B[f * FACTOR + i] -= a[i];
+			   B[t * FACTOR + i] += a[i];
+			}
+			MX(f * FACTOR + 1, f * FACTOR) += e[3];
+			MX(t * FACTOR + 1, t * FACTOR) += e[3];
+			MX(f * FACTOR + 2, f * FACTOR) += e[4];
+			MX(t * FACTOR + 2, t * FACTOR) += e[4];
+			MX(f * FACTOR + 2, f * FACTOR + 1) += e[5];
+			MX(t * FACTOR + 2, t * FACTOR + 1) += e[5];
+			if (f < t) {
+			   MX(t * FACTOR + 1, f * FACTOR) -= e[3];
+			   MX(t * FACTOR, f * FACTOR + 1) -= e[3];
+			   MX(t * FACTOR + 2, f * FACTOR) -= e[4];
+			   MX(t * FACTOR, f * FACTOR + 2) -= e[4];
+			   MX(t * FACTOR + 2, f * FACTOR + 1) -= e[5];
+			   MX(t * FACTOR + 1, f * FACTOR + 2) -= e[5];
+			} else {
+			   MX(f * FACTOR + 1, t * FACTOR) -= e[3];
+			   MX(f * FACTOR, t * FACTOR + 1) -= e[3];
+			   MX(f * FACTOR + 2, t * FACTOR) -= e[4];
+			   MX(f * FACTOR, t * FACTOR + 2) -= e[4];
+			   MX(f * FACTOR + 2, t * FACTOR + 1) -= e[5];
+			   MX(f * FACTOR + 1, t * FACTOR + 2) -= e[5];
+			}
 		     }
 		  }
 #endif
@@ -292,122 +603,818 @@ build_matrix(node *list)
 	 }
       }
 
+      if (S && ITERATIVE_SOLVER) {
+	 sparse_pcg(J, S, B);
+      } else if (S) {
+	 sparse_ldlt(S, B);
+      } else if (BS) {
+	 block_ldlt(BS, B);
+      } else {
 #if PRINT_MATRICES
-      print_matrix(M, B, n_stn_tab * FACTOR); /* 'ave a look! */
+	 print_matrix(M, B, J->n_stn_tab * FACTOR); /* 'ave a look! */
 #endif
 
 #ifdef SOR
-      /* defined in network.c, may be altered by -z<letters> on command line */
-      if (optimize & BITA('i'))
-	 sor(M, B, n_stn_tab * FACTOR);
-      else
+	 /* defined in network.c, may be altered by -z<letters> on command line */
+	 if (optimize & BITA('i'))
+	    sor(M, B, J->n_stn_tab * FACTOR);
+	 else
 #endif
-	 choleski(M, B, n_stn_tab * FACTOR);
+	 if (J->n_stn_tab * FACTOR >= LDLT_BLOCKED_MIN) {
+	    ldlt_blocked(M, B, J->n_stn_tab * FACTOR, LDLT_KERNEL_AUTO);
+	 } else {
+	    choleski(M, B, J->n_stn_tab * FACTOR);
+	 }
+      }
 
       {
 	 int m;
-	 for (m = (int)(n_stn_tab - 1); m >= 0; m--) {
+	 for (m = (int)(J->n_stn_tab - 1); m >= 0; m--) {
 #ifdef NO_COVARIANCES
-	    stn_tab[m]->p[dim] = B[m];
+	    J->stn_tab[m]->p[dim] = B[m];
 	    if (dim == 0) {
-	       SVX_ASSERT2(pos_fixed(stn_tab[m]),
+	       SVX_ASSERT2(pos_fixed(J->stn_tab[m]),
 		       "setting station coordinates didn't mark pos as fixed");
 	    }
 #else
 	    int i;
 	    for (i = 0; i < 3; i++) {
-	       stn_tab[m]->p[i] = B[m * FACTOR + i];
+	       J->stn_tab[m]->p[i] = B[m * FACTOR + i];
 	    }
-	    SVX_ASSERT2(pos_fixed(stn_tab[m]),
+	    SVX_ASSERT2(pos_fixed(J->stn_tab[m]),
 		    "setting station coordinates didn't mark pos as fixed");
 #endif
 	 }
 #if EXPLICIT_FIXED_FLAG
-	 for (m = n_stn_tab - 1; m >= 0; m--) fixpos(stn_tab[m]);
+	 for (m = J->n_stn_tab - 1; m >= 0; m--) fixpos(J->stn_tab[m]);
 #endif
       }
    }
    osfree(B);
-   osfree(M);
+   if (S) {
+      sparse_free(S);
+   } else if (BS) {
+      block_free(BS);
+   } else {
+      osfree(M);
+   }
 }
 
 static int
-find_stn_in_tab(node *stn)
+find_stn_in_tab(const matrix_job *J, node *stn)
 {
-   int i = 0;
-   pos *p = stn->name->pos;
-   while (stn_tab[i] != p)
-      if (++i == n_stn_tab) {
+   long i = stn->colour;
+   if (i < 0 || i >= J->n_stn_tab || J->stn_tab[i] != stn->name->pos) {
 #if DEBUG_INVALID
-	 fputs("Station ", stderr);
-	 fprint_prefix(stderr, stn->name);
-	 fputs(" not in table\n\n", stderr);
+      fputs("Station ", stderr);
+      fprint_prefix(stderr, stn->name);
+      fputs(" not in table\n\n", stderr);
 #endif
-#if 0
-	 print_prefix(stn->name);
-	 printf(" used: %d colour %d\n",
-		(!!stn->leg[2])<<2 | (!!stn->leg[1])<<1 | (!!stn->leg[0]),
-		stn->colour);
-#endif
-	 fatalerror(/*Bug in program detected! Please report this to the authors*/11);
-      }
-   return i;
+      fatalerror(/*Bug in program detected! Please report this to the authors*/11);
+   }
+   return (int)i;
 }
 
 static int
-add_stn_to_tab(node *stn)
+add_stn_to_tab(matrix_job *J, long *hash, unsigned long mask, node *stn)
 {
-   int i;
    pos *p = stn->name->pos;
-   for (i = 0; i < n_stn_tab; i++) {
-      if (stn_tab[i] == p) return i;
+   unsigned long h = HASH_POS(p) & mask;
+   long i;
+   while ((i = hash[h]) >= 0) {
+      if (J->stn_tab[i] == p) return (int)i;
+      h = (h + 1) & mask;
    }
-   stn_tab[n_stn_tab++] = p;
-   return i;
+   hash[h] = i = J->n_stn_tab;
+   J->stn_tab[J->n_stn_tab++] = p;
+   return (int)i;
 }
 
-/* Solve MX=B for X by Choleski factorisation - modified Choleski actually
- * since we factor into LDL' while Choleski is just LL'
+static int
+cmp_long(const void *a, const void *b)
+{
+   long x = *(const long *)a;
+   long y = *(const long *)b;
+   return (x > y) - (x < y);
+}
+
+/* Calculate a minimum degree ordering of the graph with n vertices whose
+ * adjacency lists are adj[adjstart[i]] .. adj[adjstart[i + 1] - 1].
+ *
+ * On return, perm[k] is the vertex which should be eliminated k-th.
  */
-/* Note M must be symmetric positive definite */
-/* routine is entitled to scribble on M and B if it wishes */
 static void
-choleski(real *M, real *B, long n)
+min_degree_order(long n, const long *adjstart, const long *adj, long *perm)
 {
-   int i, j, k;
-
-   for (j = 1; j < n; j++) {
-      real V;
-      for (i = 0; i < j; i++) {
-	 V = (real)0.0;
-	 for (k = 0; k < i; k++) V += M(i,k) * M(j,k) * M(k,k);
-	 M(j,i) = (M(j,i) - V) / M(i,i);
+   long **nbr = osmalloc(n * ossizeof(long *));
+   long *deg = osmalloc(n * ossizeof(long));
+   long *cap = osmalloc(n * ossizeof(long));
+   long *mark = osmalloc(n * ossizeof(long));
+   /* vertices are kept in doubly linked lists bucketed by degree */
+   long *head = osmalloc(n * ossizeof(long));
+   long *next = osmalloc(n * ossizeof(long));
+   long *prev = osmalloc(n * ossizeof(long));
+   long i, k, mindeg = 0;
+
+   for (i = 0; i < n; i++) head[i] = -1;
+
+   for (i = n - 1; i >= 0; i--) {
+      long d = adjstart[i + 1] - adjstart[i];
+      deg[i] = d;
+      cap[i] = d ? d : 1;
+      nbr[i] = osmalloc(cap[i] * ossizeof(long));
+      memcpy(nbr[i], adj + adjstart[i], d * ossizeof(long));
+      mark[i] = -1;
+      prev[i] = -1;
+      next[i] = head[d];
+      if (next[i] >= 0) prev[next[i]] = i;
+      head[d] = i;
+   }
+
+#define BUCKET_REMOVE(V) BLK(\
+   if (prev[V] >= 0) next[prev[V]] = next[V]; else head[deg[V]] = next[V];\
+   if (next[V] >= 0) prev[next[V]] = prev[V];)
+
+#define BUCKET_INSERT(V) BLK(\
+   prev[V] = -1; next[V] = head[deg[V]];\
+   if (next[V] >= 0) prev[next[V]] = (V);\
+   head[deg[V]] = (V);\
+   if (deg[V] < mindeg) mindeg = deg[V];)
+
+   for (k = 0; k < n; k++) {
+      long v, j;
+      while (head[mindeg] < 0) mindeg++;
+      v = head[mindeg];
+      BUCKET_REMOVE(v);
+      perm[k] = v;
+
+      /* Remove v from the graph... */
+      for (j = 0; j < deg[v]; j++) {
+	 long a = nbr[v][j];
+	 long m;
+	 BUCKET_REMOVE(a);
+	 for (m = 0; nbr[a][m] != v; m++) { }
+	 nbr[a][m] = nbr[a][--deg[a]];
+      }
+
+      /* ...and make its neighbours into a clique. */
+      for (j = 0; j < deg[v]; j++) {
+	 long a = nbr[v][j];
+	 long m;
+	 mark[a] = a;
+	 for (m = 0; m < deg[a]; m++) mark[nbr[a][m]] = a;
+	 for (m = 0; m < deg[v]; m++) {
+	    long b = nbr[v][m];
+	    if (mark[b] == a) continue;
+	    if (deg[a] == cap[a]) {
+	       cap[a] *= 2;
+	       nbr[a] = osrealloc(nbr[a], cap[a] * ossizeof(long));
+	    }
+	    nbr[a][deg[a]++] = b;
+	 }
+	 BUCKET_INSERT(a);
+      }
+      osfree(nbr[v]);
+   }
+
+#undef BUCKET_REMOVE
+#undef BUCKET_INSERT
+
+   osfree(prev);
+   osfree(next);
+   osfree(head);
+   osfree(mark);
+   osfree(cap);
+   osfree(deg);
+   osfree(nbr);
+}
+
+/* Build the graph of couplings between the unfixed stations in J.  If
+ * reorder is true, renumber the stations in stn_tab to reduce fill-in when
+ * the matrix is factorised.
+ *
+ * On return the neighbours of station s (in the new numbering) are
+ * (*adj_p)[(*adjstart_p)[s]] .. (*adj_p)[(*adjstart_p)[s + 1] - 1], in
+ * ascending order and without duplicates.
+ */
+static void
+station_graph(matrix_job *J, bool reorder, long **adjstart_p, long **adj_p)
+{
+   node *stn;
+   long *adjstart, *adj = NULL, *perm, *iperm, *newstart, *newadj;
+   pos **new_tab;
+   long i, s, r;
+   int pass;
+
+   adjstart = osmalloc((J->n_stn_tab + 1) * ossizeof(long));
+   for (i = 0; i <= J->n_stn_tab; i++) adjstart[i] = 0;
+   for (pass = 0; pass < 2; pass++) {
+      if (pass) {
+	 for (i = 0; i < J->n_stn_tab; i++) adjstart[i + 1] += adjstart[i];
+	 adj = osmalloc((adjstart[J->n_stn_tab] + 1) * ossizeof(long));
+      }
+      for (stn = J->list; stn; stn = stn->next) {
+	 int f, dirn;
+	 if (fixed(stn)) continue;
+	 f = find_stn_in_tab(J, stn);
+	 for (dirn = 0; dirn <= 2 && stn->leg[dirn]; dirn++) {
+	    linkfor *leg = stn->leg[dirn];
+	    node *to = leg->l.to;
+	    int t;
+	    if (fixed(to) || !data_here(leg)) continue;
+	    t = find_stn_in_tab(J, to);
+	    if (t == f) continue;
+	    if (pass) {
+	       adj[adjstart[f]++] = t;
+	       adj[adjstart[t]++] = f;
+	    } else {
+	       adjstart[f + 1]++;
+	       adjstart[t + 1]++;
+	    }
+	 }
+      }
+   }
+   /* The fill loop advanced each adjstart[i] to the start of list i + 1. */
+   for (i = J->n_stn_tab; i > 0; i--) adjstart[i] = adjstart[i - 1];
+   adjstart[0] = 0;
+
+   /* Remove duplicate entries (from parallel legs) from each list. */
+   r = 0;
+   for (i = 0; i < J->n_stn_tab; i++) {
+      long p, start = r;
+      qsort(adj + adjstart[i], adjstart[i + 1] - adjstart[i], sizeof(long),
+	    cmp_long);
+      for (p = adjstart[i]; p < adjstart[i + 1]; p++) {
+	 if (r == start || adj[r - 1] != adj[p]) adj[r++] = adj[p];
+      }
+      adjstart[i] = start;
+   }
+   adjstart[J->n_stn_tab] = r;
+
+   perm = osmalloc(J->n_stn_tab * ossizeof(long));
+   if (reorder) {
+      min_degree_order(J->n_stn_tab, adjstart, adj, perm);
+   } else {
+      for (s = 0; s < J->n_stn_tab; s++) perm[s] = s;
+   }
+
+   iperm = osmalloc(J->n_stn_tab * ossizeof(long));
+   new_tab = osmalloc(J->n_stn_tab * ossizeof(pos*));
+   for (s = 0; s < J->n_stn_tab; s++) {
+      iperm[perm[s]] = s;
+      new_tab[s] = J->stn_tab[perm[s]];
+   }
+   osfree(J->stn_tab);
+   J->stn_tab = new_tab;
+   for (stn = J->list; stn; stn = stn->next) {
+      if (!fixed(stn)) stn->colour = iperm[stn->colour];
+   }
+
+   /* Renumber the graph to match. */
+   newstart = osmalloc((J->n_stn_tab + 1) * ossizeof(long));
+   newadj = osmalloc((adjstart[J->n_stn_tab] + 1) * ossizeof(long));
+   r = 0;
+   for (s = 0; s < J->n_stn_tab; s++) {
+      long old = perm[s], p;
+      newstart[s] = r;
+      for (p = adjstart[old]; p < adjstart[old + 1]; p++) {
+	 newadj[r++] = iperm[adj[p]];
+      }
+      qsort(newadj + newstart[s], r - newstart[s], sizeof(long), cmp_long);
+   }
+   newstart[J->n_stn_tab] = r;
+
+   osfree(iperm);
+   osfree(perm);
+   osfree(adj);
+   osfree(adjstart);
+   *adjstart_p = newstart;
+   *adj_p = newadj;
+}
+
+/* Set up the sparse matrix for the network.  If factorise is true, first
+ * renumber the stations in stn_tab to reduce fill-in, and then perform the
+ * symbolic factorisation.
+ */
+static sparse_matrix *
+sparse_pattern(matrix_job *J, bool factorise)
+{
+   sparse_matrix *S;
+   long *adjstart, *adj;
+   long s, r;
+
+   station_graph(J, factorise, &adjstart, &adj);
+
+   /* Now build the pattern of the lower triangle of the matrix, in which
+    * station s has unknowns s * FACTOR .. s * FACTOR + FACTOR - 1.
+    */
+   S = osnew(sparse_matrix);
+   S->n = J->n_stn_tab * FACTOR;
+   S->rowstart = osmalloc((S->n + 1) * ossizeof(long));
+   S->col = osmalloc(((adjstart[J->n_stn_tab] / 2) * FACTOR * FACTOR +
+		      J->n_stn_tab * (FACTOR * (FACTOR + 1) / 2)) * ossizeof(long));
+   r = 0;
+   S->rowstart[0] = 0;
+   for (s = 0; s < J->n_stn_tab; s++) {
+      int j;
+      for (j = 0; j < FACTOR; j++) {
+	 long base = S->rowstart[r];
+	 long p;
+	 int c;
+	 for (p = adjstart[s]; p < adjstart[s + 1] && adj[p] < s; p++) {
+	    for (c = 0; c < FACTOR; c++) {
+	       S->col[base++] = adj[p] * FACTOR + c;
+	    }
+	 }
+	 for (c = 0; c <= j; c++) S->col[base++] = s * FACTOR + c;
+	 S->rowstart[++r] = base;
+      }
+   }
+   osfree(adj);
+   osfree(adjstart);
+
+   S->val = osmalloc(S->rowstart[S->n] * ossizeof(real));
+   if (factorise) {
+      sparse_symbolic(S);
+   } else {
+      S->parent = S->Lp = S->Lnz = S->Li = NULL;
+      S->Lx = S->D = NULL;
+      S->flag = S->pattern = NULL;
+      S->Y = NULL;
+   }
+   return S;
+}
+
+/* Find the index of element (row, col) in a sparse pattern. */
+static long
+pattern_find(const long *rowstart, const long *col, long row, long c)
+{
+   long lo = rowstart[row], hi = rowstart[row + 1] - 1;
+   while (lo < hi) {
+      long mid = (lo + hi) >> 1;
+      if (col[mid] < c) lo = mid + 1; else hi = mid;
+   }
+   SVX_ASSERT2(col[lo] == c, "element not in sparse matrix pattern");
+   return lo;
+}
+
+static real *
+sparse_entry(sparse_matrix *S, long row, long col)
+{
+   return &S->val[pattern_find(S->rowstart, S->col, row, col)];
+}
+
+/* Find the elimination tree (parent) of the matrix with n rows whose lower
+ * triangle has the pattern given by rowstart and col, and the number of
+ * non-zeros in each column of L (Lnz), and set Lp to the start of each
+ * column of L.  flag is workspace.
+ */
+static void
+symbolic_analysis(long n, const long *rowstart, const long *col,
+		  long *parent, long *Lnz, long *Lp, long *flag)
+{
+   long k, p;
+
+   for (k = 0; k < n; k++) {
+      parent[k] = -1;
+      flag[k] = k;
+      Lnz[k] = 0;
+      for (p = rowstart[k]; p < rowstart[k + 1]; p++) {
+	 long i;
+	 /* Walk up the tree from i until we reach a node already marked
+	  * as being in the pattern of row k. */
+	 for (i = col[p]; flag[i] != k; i = parent[i]) {
+	    if (parent[i] == -1) parent[i] = k;
+	    Lnz[i]++;
+	    flag[i] = k;
+	 }
+      }
+   }
+
+   Lp[0] = 0;
+   for (k = 0; k < n; k++) Lp[k + 1] = Lp[k] + Lnz[k];
+}
+
+/* Find the elimination tree and the number of non-zeros in each column of
+ * L, and allocate storage for the numeric factorisation.
+ */
+static void
+sparse_symbolic(sparse_matrix *S)
+{
+   long n = S->n;
+
+   S->parent = osmalloc(n * ossizeof(long));
+   S->Lnz = osmalloc(n * ossizeof(long));
+   S->Lp = osmalloc((n + 1) * ossizeof(long));
+   S->flag = osmalloc(n * ossizeof(long));
+   S->pattern = osmalloc(n * ossizeof(long));
+   S->Y = osmalloc(n * ossizeof(real));
+   S->D = osmalloc(n * ossizeof(real));
+
+   symbolic_analysis(n, S->rowstart, S->col, S->parent, S->Lnz, S->Lp,
+		     S->flag);
+
+   S->Li = osmalloc((S->Lp[n] + 1) * ossizeof(long));
+   S->Lx = osmalloc((S->Lp[n] + 1) * ossizeof(real));
+}
+
+/* Factorise S as LDL' and then solve SX=B for X, which overwrites B.
+ * Note S must be symmetric positive definite.
+ */
+static void
+sparse_ldlt(sparse_matrix *S, real *B)
+{
+   long n = S->n;
+   long *parent = S->parent, *flag = S->flag, *pattern = S->pattern;
+   long *Lp = S->Lp, *Lnz = S->Lnz, *Li = S->Li;
+   real *Lx = S->Lx, *D = S->D, *Y = S->Y;
+   long i, j, k, p;
+
+   for (k = 0; k < n; k++) {
+      long top = n;
+      Y[k] = (real)0.0;
+      flag[k] = k;
+      Lnz[k] = 0;
+      /* Scatter row k of S into Y, and find the pattern of row k of L,
+       * which is the union of the paths up the elimination tree from each
+       * non-zero in this row of S, in topological order. */
+      for (p = S->rowstart[k]; p < S->rowstart[k + 1]; p++) {
+	 long len = 0;
+	 i = S->col[p];
+	 Y[i] += S->val[p];
+	 for ( ; flag[i] != k; i = parent[i]) {
+	    pattern[len++] = i;
+	    flag[i] = k;
+	 }
+	 while (len > 0) pattern[--top] = pattern[--len];
+      }
+      D[k] = Y[k];
+      Y[k] = (real)0.0;
+      for ( ; top < n; top++) {
+	 real yi, l_ki;
+	 long p2;
+	 i = pattern[top];
+	 yi = Y[i];
+	 Y[i] = (real)0.0;
+	 p2 = Lp[i] + Lnz[i];
+	 for (p = Lp[i]; p < p2; p++) Y[Li[p]] -= Lx[p] * yi;
+	 l_ki = yi / D[i];
+	 D[k] -= l_ki * yi;
+	 Li[p2] = k;
+	 Lx[p2] = l_ki;
+	 Lnz[i]++;
       }
-      V = (real)0.0;
-      for (k = 0; k < j; k++) V += M(j,k) * M(j,k) * M(k,k);
-      M(j,j) -= V; /* may be best to add M() last for numerical reasons too */
    }
 
    /* Multiply x by L inverse */
-   for (i = 0; i < n - 1; i++) {
-      for (j = i + 1; j < n; j++) {
-	 B[j] -= M(j,i) * B[i];
+   for (j = 0; j < n; j++) {
+      for (p = Lp[j]; p < Lp[j + 1]; p++) B[Li[p]] -= Lx[p] * B[j];
+   }
+
+   /* Multiply x by D inverse */
+   for (j = 0; j < n; j++) B[j] /= D[j];
+
+   /* Multiply x by (L transpose) inverse */
+   for (j = n - 1; j >= 0; j--) {
+      for (p = Lp[j]; p < Lp[j + 1]; p++) B[j] -= Lx[p] * B[Li[p]];
+   }
+}
+
+static void
+sparse_free(sparse_matrix *S)
+{
+   osfree(S->rowstart);
+   osfree(S->col);
+   osfree(S->val);
+   osfree(S->parent);
+   osfree(S->Lp);
+   osfree(S->Lnz);
+   osfree(S->Li);
+   osfree(S->Lx);
+   osfree(S->D);
+   osfree(S->flag);
+   osfree(S->pattern);
+   osfree(S->Y);
+   osfree(S);
+}
+
+/* Set up the block sparse matrix for the network, renumbering the stations
+ * in stn_tab to reduce fill-in, and perform the symbolic factorisation.
+ */
+static block_matrix *
+block_pattern(matrix_job *J)
+{
+   block_matrix *S;
+   long *adjstart, *adj;
+   long n, s, r;
+
+   station_graph(J, fTrue, &adjstart, &adj);
+
+   S = osnew(block_matrix);
+   S->n = n = J->n_stn_tab;
+   S->rowstart = osmalloc((n + 1) * ossizeof(long));
+   S->col = osmalloc((adjstart[n] / 2 + n) * ossizeof(long));
+   r = 0;
+   for (s = 0; s < n; s++) {
+      long p;
+      S->rowstart[s] = r;
+      for (p = adjstart[s]; p < adjstart[s + 1] && adj[p] < s; p++) {
+	 S->col[r++] = adj[p];
+      }
+      S->col[r++] = s;
+   }
+   S->rowstart[n] = r;
+   osfree(adj);
+   osfree(adjstart);
+
+   S->val = osmalloc(r * ossizeof(block3));
+   S->parent = osmalloc(n * ossizeof(long));
+   S->Lnz = osmalloc(n * ossizeof(long));
+   S->Lp = osmalloc((n + 1) * ossizeof(long));
+   S->flag = osmalloc(n * ossizeof(long));
+   S->pattern = osmalloc(n * ossizeof(long));
+   S->Y = osmalloc(n * ossizeof(block3));
+   S->D = osmalloc(n * ossizeof(block3));
+
+   symbolic_analysis(n, S->rowstart, S->col, S->parent, S->Lnz, S->Lp,
+		     S->flag);
+
+   S->Li = osmalloc((S->Lp[n] + 1) * ossizeof(long));
+   S->Lx = osmalloc((S->Lp[n] + 1) * ossizeof(block3));
+   return S;
+}
+
+#ifndef NO_COVARIANCES
+/* The block for stations (row, col) - this is the 3x3 block of unknowns
+ * row * 3 .. row * 3 + 2 by col * 3 .. col * 3 + 2, stored by rows. */
+static real *
+block_entry(block_matrix *S, long row, long col)
+{
+   return S->val[pattern_find(S->rowstart, S->col, row, col)];
+}
+#endif
+
+/* Factorise S as LDL' (where L has identity blocks on the diagonal and D is
+ * block diagonal) and then solve SX=B for X, which overwrites B.  This is
+ * sparse_ldlt() with each element replaced by a 3x3 block.
+ */
+static void
+block_ldlt(block_matrix *S, real *B)
+{
+   long n = S->n;
+   long *parent = S->parent, *flag = S->flag, *pattern = S->pattern;
+   long *Lp = S->Lp, *Lnz = S->Lnz, *Li = S->Li;
+   block3 *Lx = S->Lx, *D = S->D, *Y = S->Y;
+   long i, j, k, p;
+
+   for (k = 0; k < n; k++) {
+      block3 d;
+      long top = n;
+      block3_zero(Y[k]);
+      flag[k] = k;
+      Lnz[k] = 0;
+      for (p = S->rowstart[k]; p < S->rowstart[k + 1]; p++) {
+	 long len = 0;
+	 i = S->col[p];
+	 block3_add(Y[i], S->val[p]);
+	 for ( ; flag[i] != k; i = parent[i]) {
+	    pattern[len++] = i;
+	    flag[i] = k;
+	 }
+	 while (len > 0) pattern[--top] = pattern[--len];
+      }
+      memcpy(d, Y[k], sizeof(block3));
+      block3_zero(Y[k]);
+      for ( ; top < n; top++) {
+	 /* Y[i] is now block (k, i) of LD. */
+	 block3 w, *l;
+	 long p2;
+	 i = pattern[top];
+	 memcpy(w, Y[i], sizeof(block3));
+	 block3_zero(Y[i]);
+	 p2 = Lp[i] + Lnz[i];
+	 for (p = Lp[i]; p < p2; p++) block3_sub_mul_t(Y[Li[p]], w, Lx[p]);
+	 l = &Lx[p2];
+	 block3_mul(*l, w, D[i]);
+	 block3_sub_mul_t(d, *l, w);
+	 Li[p2] = k;
+	 Lnz[i]++;
+      }
+      if (!block3_invert_sym(D[k], d))
+	 BUG("matrix to factorise isn't positive definite");
+   }
+
+   /* Multiply x by L inverse */
+   for (j = 0; j < n; j++) {
+      for (p = Lp[j]; p < Lp[j + 1]; p++) {
+	 block3_sub_mul_vec(B + Li[p] * 3, Lx[p], B + j * 3);
       }
    }
 
    /* Multiply x by D inverse */
-   for (i = 0; i < n; i++) {
-      B[i] /= M(i,i);
+   for (j = 0; j < n; j++) {
+      real t[3];
+      memcpy(t, B + j * 3, sizeof(t));
+      block3_mul_vec(B + j * 3, D[j], t);
    }
 
    /* Multiply x by (L transpose) inverse */
-   for (i = (int)(n - 1); i > 0; i--) {
-      for (j = i - 1; j >= 0; j--) {
-	 B[j] -= M(i,j) * B[i];
+   for (j = n - 1; j >= 0; j--) {
+      for (p = Lp[j]; p < Lp[j + 1]; p++) {
+	 block3_sub_mul_t_vec(B + j * 3, Lx[p], B + Li[p] * 3);
+      }
+   }
+}
+
+static void
+block_free(block_matrix *S)
+{
+   osfree(S->rowstart);
+   osfree(S->col);
+   osfree(S->val);
+   osfree(S->parent);
+   osfree(S->Lp);
+   osfree(S->Lnz);
+   osfree(S->Li);
+   osfree(S->Lx);
+   osfree(S->D);
+   osfree(S->flag);
+   osfree(S->pattern);
+   osfree(S->Y);
+   osfree(S);
+}
+
+/* Compute the incomplete Cholesky factorisation of S, with no fill-in (so
+ * L has the same pattern as S).  Returns NULL if the factorisation breaks
+ * down.
+ */
+static real *
+sparse_ic0(const sparse_matrix *S)
+{
+   long i;
+   real *L = osmalloc((S->rowstart[S->n] ? S->rowstart[S->n] : 1) * ossizeof(real));
+   for (i = 0; i < S->n; i++) {
+      long p;
+      for (p = S->rowstart[i]; p < S->rowstart[i + 1]; p++) {
+	 long k = S->col[p];
+	 long q = S->rowstart[i];
+	 long r = S->rowstart[k];
+	 /* The last entry in each row is the diagonal. */
+	 long k_diag = S->rowstart[k + 1] - 1;
+	 real v = S->val[p];
+	 /* Subtract the dot product of rows i and k of L to the left of
+	  * column k (only the elements which are in the pattern of both). */
+	 while (q < p && r < k_diag) {
+	    if (S->col[q] == S->col[r]) {
+	       v -= L[q++] * L[r++];
+	    } else if (S->col[q] < S->col[r]) {
+	       q++;
+	    } else {
+	       r++;
+	    }
+	 }
+	 if (k < i) {
+	    L[p] = v / L[k_diag];
+	 } else if (v > (real)0.0) {
+	    L[p] = sqrt(v);
+	 } else {
+	    osfree(L);
+	    return NULL;
+	 }
+      }
+   }
+   return L;
+}
+
+/* Set Z to the preconditioner applied to R: (L L')^-1 R for incomplete
+ * Cholesky if L is non-NULL, otherwise the Jacobi preconditioner (dividing
+ * by the diagonal of S).
+ */
+static void
+sparse_precondition(const sparse_matrix *S, const real *L, const real *R,
+		    real *Z)
+{
+   long i, p;
+   if (!L) {
+      for (i = 0; i < S->n; i++) Z[i] = R[i] / S->val[S->rowstart[i + 1] - 1];
+      return;
+   }
+
+   /* Multiply by L inverse */
+   for (i = 0; i < S->n; i++) {
+      real z = R[i];
+      for (p = S->rowstart[i]; p < S->rowstart[i + 1] - 1; p++) {
+	 z -= L[p] * Z[S->col[p]];
+      }
+      Z[i] = z / L[p];
+   }
+
+   /* Multiply by (L transpose) inverse */
+   for (i = S->n - 1; i >= 0; i--) {
+      Z[i] /= L[S->rowstart[i + 1] - 1];
+      for (p = S->rowstart[i]; p < S->rowstart[i + 1] - 1; p++) {
+	 Z[S->col[p]] -= L[p] * Z[i];
       }
    }
+}
 
-   /* printf("\n%ld/%ld\n\n",flops,flopsTot); */
+/* Set Y = S X, using both triangles of the symmetric matrix S. */
+static void
+sparse_multiply(const sparse_matrix *S, const real *X, real *Y)
+{
+   long i, p;
+   for (i = 0; i < S->n; i++) Y[i] = (real)0.0;
+   for (i = 0; i < S->n; i++) {
+      real y = Y[i];
+      for (p = S->rowstart[i]; p < S->rowstart[i + 1] - 1; p++) {
+	 long j = S->col[p];
+	 y += S->val[p] * X[j];
+	 Y[j] += S->val[p] * X[i];
+      }
+      Y[i] = y + S->val[p] * X[i];
+   }
+}
+
+static real
+dot_product(const real *X, const real *Y, long n)
+{
+   real t = (real)0.0;
+   long i;
+   for (i = 0; i < n; i++) t += X[i] * Y[i];
+   return t;
+}
+
+/* Solve SX=B for X by the preconditioned conjugate gradient method, and
+ * return X in B.  Unlike factorising S, this only needs memory proportional
+ * to the number of non-zero elements in S, so it can cope with networks which
+ * are too large to solve directly.
+ */
+static void
+sparse_pcg(matrix_job *J, sparse_matrix *S, real *B)
+{
+   long n = S->n, i, it, max_it;
+   real *X, *R, *Z, *P, *Q, *L = NULL;
+   real rz, b_norm, r_norm, residual;
+
+   X = osmalloc(n * ossizeof(real));
+   R = osmalloc(n * ossizeof(real));
+   Z = osmalloc(n * ossizeof(real));
+   P = osmalloc(n * ossizeof(real));
+   Q = osmalloc(n * ossizeof(real));
+
+   if (solver == SOLVER_PCG) {
+      L = sparse_ic0(S);
+      if (!L) J->ic_failed = fTrue;
+   }
+
+   /* Start from X = 0, so the initial residual is B. */
+   for (i = 0; i < n; i++) {
+      X[i] = (real)0.0;
+      R[i] = B[i];
+   }
+   b_norm = sqrt(dot_product(B, B, n));
+
+   sparse_precondition(S, L, R, Z);
+   for (i = 0; i < n; i++) P[i] = Z[i];
+   rz = dot_product(R, Z, n);
+
+   /* In exact arithmetic CG converges in at most n iterations, but rounding
+    * errors mean that it can need more. */
+   max_it = 2 * n + 100;
+   it = 0;
+   while (1) {
+      real alpha, beta, rz_new;
+      r_norm = sqrt(dot_product(R, R, n));
+      if (r_norm <= pcg_tolerance * b_norm || it == max_it) break;
+      ++it;
+
+      sparse_multiply(S, P, Q);
+      alpha = rz / dot_product(P, Q, n);
+      for (i = 0; i < n; i++) {
+	 X[i] += alpha * P[i];
+	 R[i] -= alpha * Q[i];
+      }
+
+      sparse_precondition(S, L, R, Z);
+      rz_new = dot_product(R, Z, n);
+      beta = rz_new / rz;
+      rz = rz_new;
+      for (i = 0; i < n; i++) P[i] = Z[i] + beta * P[i];
+   }
+
+   residual = (b_norm > (real)0.0) ? r_norm / b_norm : (real)0.0;
+   if (it > J->pcg_iterations) J->pcg_iterations = it;
+   if (residual > J->pcg_residual) J->pcg_residual = residual;
+   if (r_norm > pcg_tolerance * b_norm) J->pcg_converged = fFalse;
+
+   for (i = 0; i < n; i++) B[i] = X[i];
+
+   osfree(L);
+   osfree(Q);
+   osfree(P);
+   osfree(Z);
+   osfree(R);
+   osfree(X);
 }
 
 #ifdef SOR
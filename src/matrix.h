@@ -17,4 +17,31 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-void solve_matrix(node *list);
+/* How to solve the simultaneous equations - SOLVER_AUTO picks the dense
+ * solver for tiny systems and the block sparse one otherwise (or the sparse
+ * one if there are no covariances, as then there are no blocks).
+ * SOLVER_BLOCK stores and factorises the matrix as 3x3 blocks per pair of
+ * stations.  SOLVER_PCG and SOLVER_PCG_JACOBI solve iteratively with the
+ * conjugate gradient method using an incomplete Cholesky or Jacobi
+ * preconditioner. */
+typedef enum {
+   SOLVER_AUTO, SOLVER_DENSE, SOLVER_SPARSE, SOLVER_BLOCK, SOLVER_PCG,
+   SOLVER_PCG_JACOBI
+} solver_method;
+
+/* set by cavern's --solver option */
+extern solver_method solver;
+
+/* The iterative solvers stop when the residual is reduced by this factor
+ * (set by cavern's --pcg-tolerance option) */
+extern double pcg_tolerance;
+
+/* The maximum number of threads to use to solve independent parts of the
+ * network (set by cavern's --jobs option) */
+extern int solver_jobs;
+
+/* Solve each of n_lists lists of stations, which must not be connected to
+ * each other by any unfixed stations.  If solver_jobs > 1 these may be solved
+ * in parallel.
+ */
+void solve_matrices(node **lists, long n_lists);
@@ -31,11 +31,16 @@
 #include "img_hosted.h"
 #include "useful.h"
 
+#include <wx/thread.h>
+
 #include <cfloat>
 #include <map>
 
 using namespace std;
 
+// Used to give each survey tree loaded a different serial number.
+static unsigned long survey_tree_serial = 0;
+
 const static int img2aven_tab[] = {
 #include "img2aven.h"
 };
@@ -47,7 +52,43 @@ img2aven(int flags)
     return img2aven_tab[flags];
 }
 
+static wxString
+label_to_wxstring(const char* label)
+{
+    wxString s(label, wxConvUTF8);
+    if (s.empty()) {
+	// If label isn't valid UTF-8 then this conversion will
+	// give an empty string.  In this case, assume that the
+	// label is CP1252 (the Microsoft superset of ISO8859-1).
+	static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
+	s = wxString(label, ConvCP1252);
+	if (s.empty()) {
+	    // Or if that doesn't work (ConvCP1252 doesn't like
+	    // strings with some bytes in) let's just go for
+	    // ISO8859-1.
+	    s = wxString(label, wxConvISO8859_1);
+	}
+    }
+    return s;
+}
+
 int Model::Load(const wxString& file, const wxString& prefix)
+{
+    // Load into a new Model, so that if we fail the current data is left
+    // alone - the survey tree, the selection and so on still point into it.
+    Model model;
+    int err_msg_code = model.DoLoad(file, prefix);
+    if (err_msg_code) return err_msg_code;
+
+    // Keep the current stations until the caller has stopped using them.
+    deque<LabelInfo> old_labels;
+    old_labels.swap(m_LabelStore);
+    *this = std::move(model);
+    m_OldLabelStore.swap(old_labels);
+    return 0;
+}
+
+int Model::DoLoad(const wxString& file, const wxString& prefix)
 {
     // Load the processed survey data.
     img* survey = img_read_stream_survey(wxFopen(file, wxT("rb")),
@@ -59,6 +100,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
     }
 
     m_IsExtendedElevation = survey->is_extended_elevation;
+    m_separator = survey->separator;
 
     // Create a list of all the leg vertices, counting them and finding the
     // extent of the survey at the same time.
@@ -74,9 +116,6 @@ int Model::Load(const wxString& file, const wxString& prefix)
 
     // FIXME: discard existing presentation? ask user about saving if we do!
 
-    // Delete any existing list entries.
-    m_Labels.clear();
-
     double xmin = DBL_MAX;
     double xmax = -DBL_MAX;
     double ymin = DBL_MAX;
@@ -95,6 +134,15 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	traverses[f].clear();
     }
     tubes.clear();
+    m_SurveyIds.clear();
+    m_SurveyParent.clear();
+    m_SurveyTreeSerial = ++survey_tree_serial;
+    // Id 0 is the unnamed top level.
+    (void)GetSurveyId(wxString());
+    // Stations which aren't in any survey get an id of their own with no
+    // name, so no filter can show them.  This matches how filters were
+    // applied to station names, when only an empty filter showed them.
+    m_SurveyParent.push_back(0);
 
     // Ultimately we probably want different types (subclasses perhaps?) for
     // underground and surface data, so we don't need to store LRUD for surface
@@ -102,16 +150,24 @@ int Model::Load(const wxString& file, const wxString& prefix)
     traverse * current_traverse = NULL;
     vector<XSect> * current_tube = NULL;
 
-    map<wxString, LabelInfo *> labelmap;
-    list<LabelInfo*>::const_iterator last_mapped_label = m_Labels.begin();
+    // Decode the whole file in bulk rather than an item at a time - for a
+    // file in chunks (format version 9) this uses several threads.
+    img_columns cols;
+    img_columns_init(&cols);
+    if (img_read_columns_parallel(survey, &cols,
+				  wxThread::GetCPUCount()) == img_BAD) {
+	img_columns_free(&cols);
+	img_close(survey);
+
+	return img_error2msg(img_error());
+    }
 
-    int result;
-    img_point prev_pt = {0,0,0};
     bool current_polyline_is_surface = false;
     int current_flags = 0;
     int current_style = 0;
-    string current_label;
-    bool pending_move = false;
+    const char* current_label = NULL;
+    const wxString* current_name = NULL;
+    unsigned current_survey = 0;
     // When legs within a traverse have different surface/splay/duplicate
     // flags, we split it into contiguous traverses of each flag combination,
     // but we need to track these so we can assign the error statistics to all
@@ -119,252 +175,211 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // generated for the current traverse.
     size_t n_traverses[8];
     memset(n_traverses, 0, sizeof(n_traverses));
-    do {
-#if 0
-	if (++items % 200 == 0) {
-	    long pos = ftell(survey->fh);
-	    int progress = int((double(pos) / double(file_size)) * 100.0);
-	    // SetProgress(progress);
-	}
-#endif
-
-	img_point pt;
-	result = img_read_item(survey, &pt);
-	switch (result) {
-	    case img_MOVE:
-		memset(n_traverses, 0, sizeof(n_traverses));
-		pending_move = true;
-		prev_pt = pt;
-		break;
-
-	    case img_LINE: {
-		// Update survey extents.
-		if (pt.x < xmin) xmin = pt.x;
-		if (pt.x > xmax) xmax = pt.x;
-		if (pt.y < ymin) ymin = pt.y;
-		if (pt.y > ymax) ymax = pt.y;
-		if (pt.z < zmin) zmin = pt.z;
-		if (pt.z > zmax) zmax = pt.z;
-
-		int date = survey->days1;
-		if (date != -1) {
-		    date += (survey->days2 - date) / 2;
-		    if (date < m_DateMin) m_DateMin = date;
-		    if (date > datemax) datemax = date;
-		} else {
-		    complete_dateinfo = false;
-		}
-
-		int flags = survey->flags &
-		    (img_FLAG_SURFACE|img_FLAG_SPLAY|img_FLAG_DUPLICATE);
-		bool is_surface = (flags & img_FLAG_SURFACE);
-		bool is_splay = (flags & img_FLAG_SPLAY);
-		bool is_dupe = (flags & img_FLAG_DUPLICATE);
-
-		if (!is_surface) {
-		    if (pt.z < m_DepthMin) m_DepthMin = pt.z;
-		    if (pt.z > depthmax) depthmax = pt.z;
+    size_t error = 0;
+    for (size_t leg = 0; leg <= cols.n_legs; ++leg) {
+	// Apply the error information for the traverse which ends before
+	// this leg.
+	while (error != cols.n_errors && cols.error_leg[error] == leg) {
+	    size_t e = error++;
+	    if (cols.error_E[e] == 0.0) {
+		// Currently cavern doesn't spot all articulating traverses
+		// so we assume that any traverse with no error isn't part
+		// of a loop.  FIXME: fix cavern!
+		continue;
+	    }
+	    m_HasErrorInformation = true;
+	    for (size_t f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+		vector<traverse>::reverse_iterator t = traverses[f].rbegin();
+		size_t n = n_traverses[f];
+		n_traverses[f] = 0;
+		while (n) {
+		    assert(t != traverses[f].rend());
+		    t->n_legs = cols.error_n_legs[e];
+		    t->length = cols.error_length[e];
+		    t->errors[traverse::ERROR_3D] = cols.error_E[e];
+		    t->errors[traverse::ERROR_H] = cols.error_H[e];
+		    t->errors[traverse::ERROR_V] = cols.error_V[e];
+		    --n;
+		    ++t;
 		}
-		if (is_splay)
-		    m_HasSplays = true;
-		if (is_dupe)
-		    m_HasDupes = true;
-		if (pending_move ||
-		    current_flags != flags ||
-		    current_label != survey->label ||
-		    current_style != survey->style) {
-		    if (!current_polyline_is_surface && current_traverse) {
-			//FixLRUD(*current_traverse);
-		    }
+	    }
+	}
+	if (leg == cols.n_legs) break;
+
+	// A leg which doesn't continue from the end of the previous one
+	// follows a move.
+	size_t to = cols.leg_to[leg];
+	bool pending_move = (leg == 0 || cols.leg_to[leg - 1] != to - 1);
+	if (pending_move) {
+	    memset(n_traverses, 0, sizeof(n_traverses));
+	}
+	const img_point& prev_pt = cols.points[to - 1];
+	const img_point& pt = cols.points[to];
+
+	// Update survey extents.
+	if (pt.x < xmin) xmin = pt.x;
+	if (pt.x > xmax) xmax = pt.x;
+	if (pt.y < ymin) ymin = pt.y;
+	if (pt.y > ymax) ymax = pt.y;
+	if (pt.z < zmin) zmin = pt.z;
+	if (pt.z > zmax) zmax = pt.z;
+
+	int date = cols.leg_days1[leg];
+	if (date != -1) {
+	    date += (cols.leg_days2[leg] - date) / 2;
+	    if (date < m_DateMin) m_DateMin = date;
+	    if (date > datemax) datemax = date;
+	} else {
+	    complete_dateinfo = false;
+	}
 
-		    ++n_traverses[flags];
-		    // Start new traverse (surface or underground).
-		    if (is_surface) {
-			m_HasSurfaceLegs = true;
-		    } else {
-			m_HasUndergroundLegs = true;
-			// The previous point was at a surface->ug transition.
-			if (current_polyline_is_surface) {
-			    if (prev_pt.z < m_DepthMin) m_DepthMin = prev_pt.z;
-			    if (prev_pt.z > depthmax) depthmax = prev_pt.z;
-			}
-		    }
-		    traverses[flags].push_back(traverse(survey->label));
-		    current_traverse = &traverses[flags].back();
-		    current_traverse->flags = survey->flags;
-		    current_traverse->style = survey->style;
-
-		    current_polyline_is_surface = is_surface;
-		    current_flags = flags;
-		    current_label = survey->label;
-		    current_style = survey->style;
-
-		    if (pending_move) {
-			// Update survey extents.  We only need to do this if
-			// there's a pending move, since for a surface <->
-			// underground transition, we'll already have handled
-			// this point.
-			if (prev_pt.x < xmin) xmin = prev_pt.x;
-			if (prev_pt.x > xmax) xmax = prev_pt.x;
-			if (prev_pt.y < ymin) ymin = prev_pt.y;
-			if (prev_pt.y > ymax) ymax = prev_pt.y;
-			if (prev_pt.z < zmin) zmin = prev_pt.z;
-			if (prev_pt.z > zmax) zmax = prev_pt.z;
-		    }
+	int flags = cols.leg_flags[leg] &
+	    (img_FLAG_SURFACE|img_FLAG_SPLAY|img_FLAG_DUPLICATE);
+	bool is_surface = (flags & img_FLAG_SURFACE);
+	bool is_splay = (flags & img_FLAG_SPLAY);
+	bool is_dupe = (flags & img_FLAG_DUPLICATE);
 
-		    current_traverse->push_back(PointInfo(prev_pt));
+	if (!is_surface) {
+	    if (pt.z < m_DepthMin) m_DepthMin = pt.z;
+	    if (pt.z > depthmax) depthmax = pt.z;
+	}
+	if (is_splay)
+	    m_HasSplays = true;
+	if (is_dupe)
+	    m_HasDupes = true;
+	// Survey names are interned, but a file in chunks may have a copy of
+	// a name for each chunk.
+	const char* label = cols.labels + cols.leg_survey[leg];
+	bool new_label = (label != current_label &&
+			  (!current_label || strcmp(label, current_label) != 0));
+	if (pending_move ||
+	    current_flags != flags ||
+	    new_label ||
+	    current_style != cols.leg_style[leg]) {
+	    ++n_traverses[flags];
+	    // Start new traverse (surface or underground).
+	    if (is_surface) {
+		m_HasSurfaceLegs = true;
+	    } else {
+		m_HasUndergroundLegs = true;
+		// The previous point was at a surface->ug transition.
+		if (current_polyline_is_surface) {
+		    if (prev_pt.z < m_DepthMin) m_DepthMin = prev_pt.z;
+		    if (prev_pt.z > depthmax) depthmax = prev_pt.z;
 		}
-
-		current_traverse->push_back(PointInfo(pt, date));
-
-		prev_pt = pt;
-		pending_move = false;
-		break;
 	    }
-
-	    case img_LABEL: {
-		wxString s(survey->label, wxConvUTF8);
-		if (s.empty()) {
-		    // If label isn't valid UTF-8 then this conversion will
-		    // give an empty string.  In this case, assume that the
-		    // label is CP1252 (the Microsoft superset of ISO8859-1).
-		    static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
-		    s = wxString(survey->label, ConvCP1252);
-		    if (s.empty()) {
-			// Or if that doesn't work (ConvCP1252 doesn't like
-			// strings with some bytes in) let's just go for
-			// ISO8859-1.
-			s = wxString(survey->label, wxConvISO8859_1);
-		    }
-		}
-		int flags = img2aven(survey->flags);
-		LabelInfo* label = new LabelInfo(pt, s, flags);
-		if (label->IsEntrance()) {
-		    m_NumEntrances++;
-		}
-		if (label->IsFixedPt()) {
-		    m_NumFixedPts++;
-		}
-		if (label->IsExportedPt()) {
-		    m_NumExportedPts++;
-		}
-		m_Labels.push_back(label);
-		break;
+	    if (new_label) {
+		wxString name = label_to_wxstring(label);
+		current_survey = GetSurveyId(name);
+		current_name = &m_SurveyIds.find(name)->first;
+	    }
+	    traverses[flags].push_back(traverse(current_name,
+						current_survey));
+	    current_traverse = &traverses[flags].back();
+	    current_traverse->flags = cols.leg_flags[leg];
+	    current_traverse->style = cols.leg_style[leg];
+
+	    current_polyline_is_surface = is_surface;
+	    current_flags = flags;
+	    current_label = label;
+	    current_style = cols.leg_style[leg];
+
+	    if (pending_move) {
+		// Update survey extents.  We only need to do this if
+		// there's a pending move, since for a surface <->
+		// underground transition, we'll already have handled
+		// this point.
+		if (prev_pt.x < xmin) xmin = prev_pt.x;
+		if (prev_pt.x > xmax) xmax = prev_pt.x;
+		if (prev_pt.y < ymin) ymin = prev_pt.y;
+		if (prev_pt.y > ymax) ymax = prev_pt.y;
+		if (prev_pt.z < zmin) zmin = prev_pt.z;
+		if (prev_pt.z > zmax) zmax = prev_pt.z;
 	    }
 
-	    case img_XSECT: {
-		if (!current_tube) {
-		    // Start new current_tube.
-		    tubes.push_back(vector<XSect>());
-		    current_tube = &tubes.back();
-		}
+	    current_traverse->push_back(PointInfo(prev_pt));
+	}
 
-		LabelInfo * lab;
-		wxString label(survey->label, wxConvUTF8);
-		map<wxString, LabelInfo *>::const_iterator p;
-		p = labelmap.find(label);
-		if (p != labelmap.end()) {
-		    lab = p->second;
-		} else {
-		    // Initialise labelmap lazily - we may have no
-		    // cross-sections.
-		    list<LabelInfo*>::const_iterator i;
-		    if (labelmap.empty()) {
-			i = m_Labels.begin();
-		    } else {
-			i = last_mapped_label;
-			++i;
-		    }
-		    while (i != m_Labels.end() && (*i)->GetText() != label) {
-			labelmap[(*i)->GetText()] = *i;
-			++i;
-		    }
-		    last_mapped_label = i;
-		    if (i == m_Labels.end()) {
-			// Unattached cross-section - ignore for now.
-			printf("unattached cross-section\n");
-			if (current_tube->size() <= 1)
-			    tubes.resize(tubes.size() - 1);
-			current_tube = NULL;
-			if (!m_Labels.empty())
-			    --last_mapped_label;
-			break;
-		    }
-		    lab = *i;
-		    labelmap[label] = lab;
-		}
+	current_traverse->push_back(PointInfo(pt, date));
+    }
 
-		int date = survey->days1;
-		if (date != -1) {
-		    date += (survey->days2 - date) / 2;
-		    if (date < m_DateMin) m_DateMin = date;
-		    if (date > datemax) datemax = date;
-		}
+    for (size_t i = 0; i != cols.n_stations; ++i) {
+	int flags = img2aven(cols.stn_flags[i]);
+	const char* text = cols.labels + cols.stn_label[i];
+	m_LabelStore.emplace_back(cols.stn_point[i], label_to_wxstring(text),
+				  flags);
+	LabelInfo* label = &m_LabelStore.back();
+	if (label->IsEntrance()) {
+	    m_NumEntrances++;
+	}
+	if (label->IsFixedPt()) {
+	    m_NumFixedPts++;
+	}
+	if (label->IsExportedPt()) {
+	    m_NumExportedPts++;
+	}
+	m_Labels.push_back(label);
+    }
 
-		current_tube->emplace_back(lab, date, survey->l, survey->r, survey->u, survey->d);
-		break;
-	    }
+    map<wxString, LabelInfo *> labelmap;
+    size_t n_mapped_labels = 0;
+    for (size_t i = 0; i != cols.n_xsects; ++i) {
+	if (!current_tube) {
+	    // Start new current_tube.
+	    tubes.push_back(vector<XSect>());
+	    current_tube = &tubes.back();
+	}
 
-	    case img_XSECT_END:
-		// Finish off current_tube.
-		// If there's only one cross-section in the tube, just
-		// discard it for now.  FIXME: we should handle this
-		// when we come to skinning the tubes.
-		if (current_tube && current_tube->size() <= 1)
+	LabelInfo * lab;
+	wxString label(cols.labels + cols.xsect_label[i], wxConvUTF8);
+	map<wxString, LabelInfo *>::const_iterator p;
+	p = labelmap.find(label);
+	if (p != labelmap.end()) {
+	    lab = p->second;
+	} else {
+	    // Initialise labelmap lazily - we may have no
+	    // cross-sections.
+	    size_t j = n_mapped_labels;
+	    while (j != m_Labels.size() &&
+		   m_Labels[j]->GetText() != label) {
+		labelmap[m_Labels[j]->GetText()] = m_Labels[j];
+		++j;
+	    }
+	    if (j == m_Labels.size()) {
+		// Unattached cross-section - ignore for now.
+		printf("unattached cross-section\n");
+		if (current_tube->size() <= 1)
 		    tubes.resize(tubes.size() - 1);
 		current_tube = NULL;
-		break;
-
-	    case img_ERROR_INFO: {
-		if (survey->E == 0.0) {
-		    // Currently cavern doesn't spot all articulating traverses
-		    // so we assume that any traverse with no error isn't part
-		    // of a loop.  FIXME: fix cavern!
-		    break;
-		}
-		m_HasErrorInformation = true;
-		for (size_t f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
-		    list<traverse>::reverse_iterator t = traverses[f].rbegin();
-		    size_t n = n_traverses[f];
-		    n_traverses[f] = 0;
-		    while (n) {
-			assert(t != traverses[f].rend());
-			t->n_legs = survey->n_legs;
-			t->length = survey->length;
-			t->errors[traverse::ERROR_3D] = survey->E;
-			t->errors[traverse::ERROR_H] = survey->H;
-			t->errors[traverse::ERROR_V] = survey->V;
-			--n;
-			++t;
-		    }
-		}
-		break;
-	    }
-
-	    case img_BAD: {
-		m_Labels.clear();
-
-		// FIXME: Do we need to reset all these? - Olly
-		m_NumFixedPts = 0;
-		m_NumExportedPts = 0;
-		m_NumEntrances = 0;
-		m_HasUndergroundLegs = false;
-		m_HasSplays = false;
-		m_HasSurfaceLegs = false;
-
-		img_close(survey);
-
-		return img_error2msg(img_error());
+		n_mapped_labels = j;
+		continue;
 	    }
+	    lab = m_Labels[j];
+	    labelmap[label] = lab;
+	    n_mapped_labels = j + 1;
+	}
 
-	    default:
-		break;
+	int date = cols.xsect_days1[i];
+	if (date != -1) {
+	    date += (cols.xsect_days2[i] - date) / 2;
+	    if (date < m_DateMin) m_DateMin = date;
+	    if (date > datemax) datemax = date;
 	}
-    } while (result != img_STOP);
 
-    if (!current_polyline_is_surface && current_traverse) {
-	//FixLRUD(*current_traverse);
+	current_tube->emplace_back(lab, date, cols.xsect_l[i], cols.xsect_r[i],
+				   cols.xsect_u[i], cols.xsect_d[i]);
+
+	if (cols.xsect_flags[i] & img_XFLAG_END) {
+	    // Finish off current_tube.
+	    // If there's only one cross-section in the tube, just
+	    // discard it for now.  FIXME: we should handle this
+	    // when we come to skinning the tubes.
+	    if (current_tube->size() <= 1)
+		tubes.resize(tubes.size() - 1);
+	    current_tube = NULL;
+	}
     }
+    img_columns_free(&cols);
 
     // Finish off current_tube.
     // If there's only one cross-section in the tube, just
@@ -373,7 +388,6 @@ int Model::Load(const wxString& file, const wxString& prefix)
     if (current_tube && current_tube->size() <= 1)
 	tubes.resize(tubes.size() - 1);
 
-    m_separator = survey->separator;
     m_Title = wxString(survey->title, wxConvUTF8);
     m_DateStamp_numeric = survey->datestamp_numeric;
     if (survey->cs) {
@@ -398,6 +412,57 @@ int Model::Load(const wxString& file, const wxString& prefix)
     }
     img_close(survey);
 
+    // Find which survey each station is in.  A station with the same name as
+    // a survey is put in that survey, so that filtering by that survey shows
+    // the station, as it did when filters were matched against names.
+    //
+    // First register the survey each station's name is prefixed by, so that
+    // all the surveys are known before we check for stations named after
+    // them - otherwise the result would depend on the order of the labels.
+    {
+	wxString prev_prefix;
+	unsigned prev_survey = 0;
+	for (LabelInfo& label : m_LabelStore) {
+	    const wxString& text = label.GetText();
+	    size_t sep = text.rfind(m_separator);
+	    unsigned id;
+	    if (sep == wxString::npos) {
+		id = NO_SURVEY;
+	    } else if (sep == prev_prefix.size() &&
+		       text.compare(0, sep, prev_prefix) == 0) {
+		// Stations in a survey are usually together.
+		id = prev_survey;
+	    } else {
+		prev_prefix = text.substr(0, sep);
+		prev_survey = id = GetSurveyId(prev_prefix);
+	    }
+	    label.set_survey(id);
+	}
+    }
+    for (LabelInfo& label : m_LabelStore) {
+	unsigned id;
+	if (FindSurvey(label.GetText(), &id)) label.set_survey(id);
+    }
+
+    // Index the traverses by survey, so the legs can be drawn a survey at a
+    // time.  All the survey ids are known now.
+    size_t n_surveys = GetNumSurveys();
+    for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+	vector<size_t>& start = survey_traverses_start[f];
+	start.assign(n_surveys + 1, 0);
+	for (const traverse& t : traverses[f]) {
+	    ++start[t.survey + 1];
+	}
+	for (size_t survey = 0; survey != n_surveys; ++survey) {
+	    start[survey + 1] += start[survey];
+	}
+	vector<size_t> next(start.begin(), start.end() - 1);
+	survey_traverses[f].resize(traverses[f].size());
+	for (size_t i = 0; i != traverses[f].size(); ++i) {
+	    survey_traverses[f][next[traverses[f][i].survey]++] = i;
+	}
+    }
+
     // Check we've actually loaded some legs or stations!
     if (!m_HasUndergroundLegs && !m_HasSurfaceLegs && m_Labels.empty()) {
 	return (/*No survey data in 3d file “%s”*/202);
@@ -412,14 +477,13 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	traverses[6].empty() &&
 	traverses[7].empty()) {
 	// No legs, so get survey extents from stations
-	list<LabelInfo*>::const_iterator i;
-	for (i = m_Labels.begin(); i != m_Labels.end(); ++i) {
-	    if ((*i)->GetX() < xmin) xmin = (*i)->GetX();
-	    if ((*i)->GetX() > xmax) xmax = (*i)->GetX();
-	    if ((*i)->GetY() < ymin) ymin = (*i)->GetY();
-	    if ((*i)->GetY() > ymax) ymax = (*i)->GetY();
-	    if ((*i)->GetZ() < zmin) zmin = (*i)->GetZ();
-	    if ((*i)->GetZ() > zmax) zmax = (*i)->GetZ();
+	for (const LabelInfo& label : m_LabelStore) {
+	    if (label.GetX() < xmin) xmin = label.GetX();
+	    if (label.GetX() > xmax) xmax = label.GetX();
+	    if (label.GetY() < ymin) ymin = label.GetY();
+	    if (label.GetY() > ymax) ymax = label.GetY();
+	    if (label.GetZ() < zmin) zmin = label.GetZ();
+	    if (label.GetZ() > zmax) zmax = label.GetZ();
 	}
     }
 
@@ -446,6 +510,23 @@ int Model::Load(const wxString& file, const wxString& prefix)
     return 0; // OK
 }
 
+unsigned
+Model::GetSurveyId(const wxString& name)
+{
+    auto i = m_SurveyIds.find(name);
+    if (i != m_SurveyIds.end()) return i->second;
+
+    // Add the parent first so it gets a smaller id.
+    unsigned parent = 0;
+    size_t sep = name.rfind(m_separator);
+    if (sep != wxString::npos) parent = GetSurveyId(name.substr(0, sep));
+
+    unsigned id = m_SurveyParent.size();
+    m_SurveyIds.insert(make_pair(name, id));
+    m_SurveyParent.push_back(parent);
+    return id;
+}
+
 void Model::CentreDataset(const Vector3& vmin)
 {
     // Centre the dataset around the origin.
@@ -453,7 +534,7 @@ void Model::CentreDataset(const Vector3& vmin)
     m_Offset = vmin + (m_Ext * 0.5);
 
     for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
-	list<traverse>::iterator t = traverses[f].begin();
+	vector<traverse>::iterator t = traverses[f].begin();
 	while (t != traverses[f].end()) {
 	    assert(t->size() > 1);
 	    vector<PointInfo>::iterator pos = t->begin();
@@ -465,10 +546,8 @@ void Model::CentreDataset(const Vector3& vmin)
 	}
     }
 
-    list<LabelInfo*>::iterator lpos = m_Labels.begin();
-    while (lpos != m_Labels.end()) {
-	Point & point = **lpos++;
-	point -= m_Offset;
+    for (LabelInfo& label : m_LabelStore) {
+	label -= m_Offset;
     }
 }
 
@@ -684,11 +763,13 @@ SurveyFilter::add(const wxString& name)
 	}
     }
     filters.insert(name);
+    visible_tree = 0;
 }
 
 void
 SurveyFilter::remove(const wxString& name)
 {
+    visible_tree = 0;
     if (filters.erase(name) == 0) {
 	redundant_filters.erase(name);
 	return;
@@ -717,6 +798,7 @@ SurveyFilter::SetSeparator(wxChar separator_)
     if (separator_ == separator) return;
 
     separator = separator_;
+    visible_tree = 0;
 
     if (filters.empty()) {
 	return;
@@ -736,20 +818,23 @@ SurveyFilter::SetSeparator(wxChar separator_)
     }
 }
 
-bool
-SurveyFilter::CheckVisible(const wxString& name) const
+void
+SurveyFilter::Resolve(const Model& model) const
 {
-    auto it = filters.lower_bound(name);
-    if (it == filters.end()) {
-	// There's no filter <= name so name is excluded.
-	return false;
+    if (visible_tree == model.GetSurveyTreeSerial()) return;
+
+    size_t n_surveys = model.GetNumSurveys();
+    visible.assign(n_surveys, false);
+    for (const wxString& name : filters) {
+	unsigned survey;
+	if (model.FindSurvey(name, &survey)) visible[survey] = true;
     }
-    if (*it == name) {
-	// Exact match.
-	return true;
+    // A survey is visible if its parent is, except that showing the unnamed
+    // top level doesn't show everything.  Parents have smaller ids than their
+    // children so one pass in id order suffices.
+    for (unsigned survey = 1; survey < n_surveys; ++survey) {
+	unsigned parent = model.GetSurveyParent(survey);
+	if (parent != 0 && visible[parent]) visible[survey] = true;
     }
-    // Check if a survey prefixing name is visible.
-    if (name.StartsWith(*it) && name[it->size()] == separator)
-	return true;
-    return false;
+    visible_tree = model.GetSurveyTreeSerial();
 }
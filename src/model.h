@@ -29,14 +29,18 @@
 #include "labelinfo.h"
 #include "vector3.h"
 
+#include <algorithm>
+#include <cassert>
 #include <ctime>
-#include <list>
+#include <deque>
+#include <map>
 #include <set>
 #include <vector>
 
 using namespace std;
 
 class MainFrm;
+class Model;
 
 class PointInfo : public Point {
     int date;
@@ -70,6 +74,7 @@ public:
     }
     int GetDate() const { return date; }
     const wxString& GetLabel() const { return stn->GetText(); }
+    unsigned GetSurvey() const { return stn->get_survey(); }
     const Point& GetPoint() const { return *stn; }
     double GetX() const { return stn->GetX(); }
     double GetY() const { return stn->GetY(); }
@@ -91,24 +96,16 @@ class traverse : public vector<PointInfo> {
     double length = 0.0;
     enum { ERROR_3D = 0, ERROR_H = 1, ERROR_V = 2 };
     double errors[3] = {-1, -1, -1};
-    wxString name;
-
-    explicit
-    traverse(const char* name_) : name(name_, wxConvUTF8) {
-	if (name.empty() && !name_[0]) {
-	    // If name isn't valid UTF-8 then this conversion will
-	    // give an empty string.  In this case, assume that the
-	    // label is CP1252 (the Microsoft superset of ISO8859-1).
-	    static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
-	    name = wxString(name_, ConvCP1252);
-	    if (name.empty()) {
-		// Or if that doesn't work (ConvCP1252 doesn't like
-		// strings with some bytes in) let's just go for
-		// ISO8859-1.
-		name = wxString(name_, wxConvISO8859_1);
-	    }
-	}
-    }
+    // The survey name, which is shared by all the traverses in that survey
+    // (the strings are owned by the Model).
+    const wxString* name;
+    // The id of the survey in the Model's survey tree.
+    unsigned survey;
+
+    traverse(const wxString* name_, unsigned survey_)
+	: name(name_), survey(survey_) { }
+
+    const wxString& GetName() const { return *name; }
 };
 
 class SurveyFilter {
@@ -117,6 +114,12 @@ class SurveyFilter {
     // Default to the Survex standard separator - then a filter created before
     // the survey separator is known is likely to not need rebuilding.
     wxChar separator = '.';
+    // Whether each survey in a Model's survey tree is visible, indexed by
+    // survey id.  This is worked out from filters by Resolve() so that
+    // checking visibility is just a bit test.
+    mutable vector<bool> visible;
+    // The survey tree which visible was worked out for (0 for none).
+    mutable unsigned long visible_tree = 0;
 
   public:
     SurveyFilter() {}
@@ -125,22 +128,63 @@ class SurveyFilter {
 
     void remove(const wxString& survey);
 
-    void clear() { filters.clear(); redundant_filters.clear(); }
+    void clear() {
+	filters.clear();
+	redundant_filters.clear();
+	visible_tree = 0;
+    }
 
     bool empty() const { return filters.empty(); }
 
     void SetSeparator(wxChar separator_);
 
-    bool CheckVisible(const wxString& name) const;
+    // Work out which surveys in model are visible, if we haven't already.
+    // This must be called before CheckVisible().
+    void Resolve(const Model& model) const;
+
+    bool CheckVisible(unsigned survey) const {
+	assert(survey < visible.size());
+	return visible[survey];
+    }
 };
 
 /// Cave model.
 class Model {
-    list<traverse> traverses[8];
-    mutable list<vector<XSect>> tubes;
+    vector<traverse> traverses[8];
+    // The indices in traverses[f] of the traverses in each survey, in survey
+    // id order.  Those in survey s start at survey_traverses_start[f][s] and
+    // end where those in survey s + 1 start.
+    vector<size_t> survey_traverses[8];
+    vector<size_t> survey_traverses_start[8];
+    mutable vector<vector<XSect>> tubes;
+
+    // The stations.  A deque allocates its elements in large blocks and never
+    // moves them when we append, so pointers to them (which m_Labels, the
+    // survey tree and cross-sections all hold) stay valid while the model is
+    // loaded.
+    deque<LabelInfo> m_LabelStore;
+    // The stations from the previously loaded file, which are kept until
+    // ReleaseOldLabels() is called.
+    deque<LabelInfo> m_OldLabelStore;
+
+    // The survey tree.  Each survey name (and each prefix of a survey or
+    // station name) is mapped to an id.  Id 0 is the unnamed top level, id
+    // NO_SURVEY holds stations with no survey prefix, and a survey's parent
+    // always has a smaller id than it does.  The map keys
+    // also serve as interned survey names, so each traverse only needs a
+    // pointer.
+    map<wxString, unsigned> m_SurveyIds;
+    vector<unsigned> m_SurveyParent;
+    // Identifies this survey tree, so a SurveyFilter can tell if what it has
+    // resolved against is out of date.
+    unsigned long m_SurveyTreeSerial = 0;
+
+    // Changes each time m_Labels is reordered, so anything which caches
+    // positions in it can tell it's out of date.
+    unsigned long m_LabelOrderSerial = 0;
 
   public: // FIXME
-    list<LabelInfo*> m_Labels;
+    vector<LabelInfo*> m_Labels;
 
   private:
     Vector3 m_Ext;
@@ -171,9 +215,29 @@ class Model {
 
     void CentreDataset(const Vector3& vmin);
 
+    unsigned GetSurveyId(const wxString& name);
+
+    int DoLoad(const wxString& file, const wxString& prefix);
+
   public:
+    // The survey id of stations whose names have no survey prefix.
+    static const unsigned NO_SURVEY = 1;
+
+    Model() = default;
+
+    // Moving a Model keeps the stations, traverses and survey names where
+    // they are in memory, so the pointers between them stay valid.  Copying
+    // wouldn't, so isn't allowed.
+    Model& operator=(Model&&) = default;
+
+    // Load a file, replacing the current data.  If this fails, the current
+    // data is left unchanged.  If it succeeds, the stations from the previous
+    // file are kept until ReleaseOldLabels() is called, so the caller can
+    // stop using them first.
     int Load(const wxString& file, const wxString& prefix);
 
+    void ReleaseOldLabels() { deque<LabelInfo>().swap(m_OldLabelStore); }
+
     const Vector3& GetExtent() const { return m_Ext; }
 
     const wxString& GetSurveyTitle() const { return m_Title; }
@@ -208,76 +272,120 @@ class Model {
 
     const Vector3& GetOffset() const { return m_Offset; }
 
-    list<traverse>::const_iterator
+    unsigned long GetSurveyTreeSerial() const { return m_SurveyTreeSerial; }
+
+    template<class C>
+    void SortLabels(const C& cmp) {
+	stable_sort(m_Labels.begin(), m_Labels.end(), cmp);
+	++m_LabelOrderSerial;
+    }
+
+    unsigned long GetLabelOrderSerial() const { return m_LabelOrderSerial; }
+
+    size_t GetNumSurveys() const { return m_SurveyParent.size(); }
+
+    unsigned GetSurveyParent(unsigned survey) const {
+	return m_SurveyParent[survey];
+    }
+
+    // Look up the id of survey name, returning false if there isn't one.
+    bool FindSurvey(const wxString& name, unsigned* survey) const {
+	auto i = m_SurveyIds.find(name);
+	if (i == m_SurveyIds.end()) return false;
+	*survey = i->second;
+	return true;
+    }
+
+  public:
+    vector<traverse>::const_iterator
     traverses_begin(unsigned flags, const SurveyFilter* filter) const {
 	if (flags >= sizeof(traverses)) return traverses[0].end();
 	auto it = traverses[flags].begin();
 	if (filter) {
+	    filter->Resolve(*this);
 	    while (it != traverses[flags].end() &&
-		   !filter->CheckVisible(it->name)) {
+		   !filter->CheckVisible(it->survey)) {
 		++it;
 	    }
 	}
 	return it;
     }
 
-    list<traverse>::const_iterator
+    vector<traverse>::const_iterator
     traverses_next(unsigned flags, const SurveyFilter* filter,
-		   list<traverse>::const_iterator it) const {
+		   vector<traverse>::const_iterator it) const {
 	++it;
 	if (filter) {
 	    while (it != traverses[flags].end() &&
-		   !filter->CheckVisible(it->name)) {
+		   !filter->CheckVisible(it->survey)) {
 		++it;
 	    }
 	}
 	return it;
     }
 
-    list<traverse>::const_iterator traverses_end(unsigned flags) const {
+    vector<traverse>::const_iterator traverses_end(unsigned flags) const {
 	if (flags >= sizeof(traverses)) flags = 0;
 	return traverses[flags].end();
     }
 
-    list<vector<XSect>>::const_iterator tubes_begin() const {
+    // Iterate over the traverses in survey with flags.  The iterators give
+    // indices to pass to GetTraverse().
+    vector<size_t>::const_iterator
+    survey_traverses_begin(unsigned flags, unsigned survey) const {
+	return survey_traverses[flags].begin() +
+	       survey_traverses_start[flags][survey];
+    }
+
+    vector<size_t>::const_iterator
+    survey_traverses_end(unsigned flags, unsigned survey) const {
+	return survey_traverses[flags].begin() +
+	       survey_traverses_start[flags][survey + 1];
+    }
+
+    const traverse& GetTraverse(unsigned flags, size_t i) const {
+	return traverses[flags][i];
+    }
+
+    vector<vector<XSect>>::const_iterator tubes_begin() const {
 	prepare_tubes();
 	return tubes.begin();
     }
 
-    list<vector<XSect>>::const_iterator tubes_end() const {
+    vector<vector<XSect>>::const_iterator tubes_end() const {
 	return tubes.end();
     }
 
-    list<vector<XSect>>::iterator tubes_begin() {
+    vector<vector<XSect>>::iterator tubes_begin() {
 	prepare_tubes();
 	return tubes.begin();
     }
 
-    list<vector<XSect>>::iterator tubes_end() {
+    vector<vector<XSect>>::iterator tubes_end() {
 	return tubes.end();
     }
 
-    list<LabelInfo*>::const_iterator GetLabels() const {
+    vector<LabelInfo*>::const_iterator GetLabels() const {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::const_iterator GetLabelsEnd() const {
+    vector<LabelInfo*>::const_iterator GetLabelsEnd() const {
 	return m_Labels.end();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
 	return m_Labels.rbegin();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
 	return m_Labels.rend();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNC() {
+    vector<LabelInfo*>::iterator GetLabelsNC() {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNCEnd() {
+    vector<LabelInfo*>::iterator GetLabelsNCEnd() {
 	return m_Labels.end();
     }
 
@@ -411,11 +411,23 @@ articulate(void)
    }
 
    {
-      component *comp = component_list;
+      component *comp;
+      node **lists = NULL, **listends = NULL;
+      long n_lists = 0, c;
 
 #ifdef DEBUG_ARTIC
       printf("\nDump of %d components:\n", cComponents);
 #endif
+      for (comp = component_list; comp; comp = comp->next) n_lists++;
+      if (n_lists) {
+	 lists = osmalloc(n_lists * ossizeof(node*));
+	 listends = osmalloc(n_lists * ossizeof(node*));
+      }
+
+      /* The components are independent, so we gather them all up and then
+       * solve them together, which allows them to be solved in parallel. */
+      c = 0;
+      comp = component_list;
       while (comp) {
 	 node *list = NULL, *listend = NULL;
 	 articulation *art;
@@ -458,7 +470,19 @@ articulate(void)
 	    printf(")\n");
 	 }
 #endif
-	 solve_matrix(list);
+	 lists[c] = list;
+	 listends[c] = listend;
+	 c++;
+
+	 old_comp = comp;
+	 comp = comp->next;
+	 osfree(old_comp);
+      }
+
+      solve_matrices(lists, n_lists);
+
+      for (c = 0; c < n_lists; c++) {
+	 node *list = lists[c], *listend = listends[c];
 #ifdef DEBUG_ARTIC
 	 putnl();
 	 FOR_EACH_STN(stn, list) {
@@ -470,11 +494,9 @@ articulate(void)
 	 listend->next = stnlist;
 	 if (stnlist) stnlist->prev = listend;
 	 stnlist = list;
-
-	 old_comp = comp;
-	 comp = comp->next;
-	 osfree(old_comp);
       }
+      osfree(lists);
+      osfree(listends);
 #ifdef DEBUG_ARTIC
       printf("done articulating\n");
 #endif
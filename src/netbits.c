@@ -27,9 +27,11 @@
 
 #include "debug.h"
 #include "cavern.h"
+#include "block3.h"
 #include "filename.h"
 #include "message.h"
 #include "netbits.h"
+#include "strpool.h"
 #include "datain.h" /* for compile_error */
 #include "validate.h" /* for compile_error */
 #include <math.h>
@@ -38,6 +40,60 @@
 
 node *stn_iter = NULL; /* for FOR_EACH_STN */
 
+arena prefix_arena = ARENA_INIT("prefix", prefix);
+arena node_arena = ARENA_INIT("node", node);
+arena pos_arena = ARENA_INIT("pos", pos);
+arena linkfor_arena = ARENA_INIT("linkfor", linkfor);
+arena linkrev_arena = ARENA_INIT("linkrev", linkrev);
+
+void
+free_leg(linkfor *leg)
+{
+   if (data_here(leg)) {
+      arena_delete(linkfor, leg);
+   } else {
+      arena_delete(linkrev, (linkrev*)leg);
+   }
+}
+
+void
+print_arena_stats(void)
+{
+   static const arena *arenas[] = {
+      &prefix_arena, &node_arena, &pos_arena, &linkfor_arena, &linkrev_arena
+   };
+   size_t i;
+   unsigned long total_bytes = 0;
+   unsigned long n_names, name_bytes;
+   /* TRANSLATORS: Heading for the output of cavern --memory-stats */
+   puts(msg(/*Memory used for the survey network:*/531));
+   for (i = 0; i < sizeof(arenas) / sizeof(arenas[0]); i++) {
+      const arena *a = arenas[i];
+      /* TRANSLATORS: Output for each type of object by cavern
+       * --memory-stats.  The first %s is the name of the type of
+       * object, e.g. "prefix" or "node".  The other values are the number
+       * of objects currently in use, the highest number in use at once, the
+       * size of each object in bytes, and the total number of bytes
+       * allocated for them. */
+      printf(msg(/*%-8s %lu in use, %lu at peak, %lu bytes each, %lu bytes allocated*/532),
+	     a->name, a->n_live, a->n_peak, (unsigned long)a->size,
+	     (unsigned long)a->bytes);
+      putnl();
+      total_bytes += a->bytes;
+   }
+   strpool_stats(&n_names, &name_bytes);
+   /* TRANSLATORS: Output for the pool of survey and station names by cavern
+    * --memory-stats.  The %s is "names".  The other values are the number
+    * of different names and the total number of bytes allocated for them. */
+   printf(msg(/*%-8s %lu different, %lu bytes allocated*/534),
+	  "names", n_names, name_bytes);
+   putnl();
+   total_bytes += name_bytes;
+   /* TRANSLATORS: Last line of the output of cavern --memory-stats */
+   printf(msg(/*Total: %lu bytes*/533), total_bytes);
+   putnl();
+}
+
 static struct {
    prefix * to_name;
    prefix * fr_name;
@@ -108,7 +164,7 @@ static void check_var(/*const*/ var *v) {
    if (bad) print_var(*v);
 }
 
-#define SN(V,A,B) ((*(V))[(A)==(B)?(A):2+(A)+(B)])
+#define SN(V,A,B) SYM3(*(V),A,B)
 #define S(A,B) SN(v,A,B)
 
 static void check_svar(/*const*/ svar *v) {
@@ -211,7 +267,7 @@ remove_stn_from_list(node **list, node *stn) {
    }
 }
 
-/* Create (uses osmalloc) a forward leg containing the data in leg, or
+/* Create (uses arena_new) a forward leg containing the data in leg, or
  * the reversed data in the reverse of leg, if leg doesn't hold data
  */
 linkfor *
@@ -219,7 +275,7 @@ copy_link(linkfor *leg)
 {
    linkfor *legOut;
    int d;
-   legOut = osnew(linkfor);
+   legOut = arena_new(linkfor);
    if (data_here(leg)) {
       for (d = 2; d >= 0; d--) legOut->d[d] = leg->d[d];
    } else {
@@ -277,8 +333,8 @@ addleg_(node *fr, node *to,
     * - this should be trapped by the caller */
    SVX_ASSERT(fr->name != to->name);
 
-   leg = osnew(linkfor);
-   leg2 = (linkfor*)osnew(linkrev);
+   leg = arena_new(linkfor);
+   leg2 = (linkfor*)arena_new(linkrev);
 
    i = freeleg(&fr);
    j = freeleg(&to);
@@ -424,7 +480,7 @@ replace_pfx(const prefix *pfx_replace, const prefix *pfx_with)
 #endif
 
    /* free the (now-unused) old pos */
-   osfree(pos_replace);
+   arena_delete(pos, pos_replace);
 }
 
 /* Add an equating leg between existing stations *fr and *to (whose names are
@@ -450,13 +506,12 @@ process_equate(prefix *name1, prefix *name2)
       if (pfx_fixed(name1)) {
 	 if (pfx_fixed(name2)) {
 	    /* both are fixed, but let them off iff their coordinates match */
-	    char *s = osstrdup(sprint_prefix(name1));
+	    const char *s = sprint_prefix(name1);
 	    int d;
 	    for (d = 2; d >= 0; d--) {
 	       if (name1->pos->p[d] != name2->pos->p[d]) {
 		  compile_diagnostic(DIAG_ERR, /*Tried to equate two non-equal fixed stations: “%s” and “%s”*/52,
 				     s, sprint_prefix(name2));
-		  osfree(s);
 		  return;
 	       }
 	    }
@@ -467,7 +522,6 @@ process_equate(prefix *name1, prefix *name2)
 	     * *equate a b */
 	    compile_diagnostic(DIAG_WARN, /*Equating two equal fixed points: “%s” and “%s”*/53,
 			       s, sprint_prefix(name2));
-	    osfree(s);
 	 }
 
 	 /* name1 is fixed, so replace all refs to name2's pos with name1's */
@@ -528,9 +582,9 @@ freeleg(node **stnptr)
 
    /* All legs used, so split node in two */
    oldstn = stn;
-   stn = osnew(node);
-   leg = osnew(linkfor);
-   leg2 = (linkfor*)osnew(linkrev);
+   stn = arena_new(node);
+   leg = arena_new(linkfor);
+   leg2 = (linkfor*)arena_new(linkrev);
 
    *stnptr = stn;
 
@@ -571,10 +625,10 @@ StnFromPfx(prefix *name)
 {
    node *stn;
    if (name->stn != NULL) return (name->stn);
-   stn = osnew(node);
+   stn = arena_new(node);
    stn->name = name;
    if (name->pos == NULL) {
-      name->pos = osnew(pos);
+      name->pos = arena_new(pos);
       unfix(stn);
    }
    stn->leg[0] = stn->leg[1] = stn->leg[2] = NULL;
@@ -587,60 +641,48 @@ StnFromPfx(prefix *name)
 extern void
 fprint_prefix(FILE *fh, const prefix *ptr)
 {
-   SVX_ASSERT(ptr);
-   if (TSTBIT(ptr->sflags, SFLAGS_ANON)) {
-      /* We release the stations, so ptr->stn is NULL late on, so we can't
-       * use that to print "anonymous station surveyed from somesurvey.12"
-       * here.  FIXME */
-      fputs("anonymous station", fh);
-      /* FIXME: if ident is set, show it? */
-      return;
-   }
-   if (ptr->up != NULL) {
-      fprint_prefix(fh, ptr->up);
-      if (ptr->up->up != NULL) fputc('.', fh);
-      SVX_ASSERT(ptr->ident);
-      fputs(ptr->ident, fh);
-   }
+   fputs(sprint_prefix(ptr), fh);
 }
 
-static char *buffer = NULL;
-static OSSIZE_T buffer_len = 256;
-
-static OSSIZE_T
-sprint_prefix_(const prefix *ptr)
-{
-   OSSIZE_T len = 1;
-   if (ptr->up != NULL) {
-      SVX_ASSERT(ptr->ident);
-      len = sprint_prefix_(ptr->up) + strlen(ptr->ident);
-      if (ptr->up->up != NULL) len++;
-      if (len > buffer_len) {
-	 buffer = osrealloc(buffer, len);
-	 buffer_len = len;
-      }
-      if (ptr->up->up != NULL) strcat(buffer, ".");
-      strcat(buffer, ptr->ident);
-   }
-   return len;
-}
-
-extern char *
+/* The full name of each prefix is built the first time it's needed and
+ * then kept, as we report the same prefixes over and over (e.g. the survey
+ * of every leg written to the .3d file).  Building it from the parent's
+ * cached name means we only need to append one ident each time.
+ */
+extern const char *
 sprint_prefix(const prefix *ptr)
 {
    SVX_ASSERT(ptr);
-   if (!buffer) buffer = osmalloc(buffer_len);
    if (TSTBIT(ptr->sflags, SFLAGS_ANON)) {
       /* We release the stations, so ptr->stn is NULL late on, so we can't
        * use that to print "anonymous station surveyed from somesurvey.12"
        * here.  FIXME */
-      sprintf(buffer, "anonymous station");
       /* FIXME: if ident is set, show it? */
-      return buffer;
+      return "anonymous station";
    }
-   *buffer = '\0';
-   sprint_prefix_(ptr);
-   return buffer;
+   if (!ptr->full_name) {
+      const char *name = "";
+      if (ptr->up != NULL) {
+	 SVX_ASSERT(ptr->ident);
+	 if (ptr->up->up == NULL) {
+	    /* No need to copy - just use the ident. */
+	    name = ptr->ident;
+	 } else {
+	    const char *up_name = sprint_prefix(ptr->up);
+	    size_t up_len = strlen(up_name);
+	    size_t len = strlen(ptr->ident);
+	    char *p = strpool_alloc(up_len + 1 + len + 1);
+	    memcpy(p, up_name, up_len);
+	    p[up_len] = '.';
+	    memcpy(p + up_len + 1, ptr->ident, len + 1);
+	    name = p;
+	 }
+      }
+      /* The cached name doesn't change the value of the prefix, so it's OK
+       * to set it through a const pointer. */
+      ((prefix *)ptr)->full_name = name;
+   }
+   return ptr->full_name;
 }
 
 /* r = ab ; r,a,b are variance matrices */
@@ -653,26 +695,9 @@ mulss(var *r, /*const*/ svar *a, /*const*/ svar *b)
    (*r)[1] = (*a)[1] * (*b)[1];
    (*r)[2] = (*a)[2] * (*b)[2];
 #else
-   int i, j, k;
-   real tot;
-
-#if 0
-   SVX_ASSERT((/*const*/ var *)r != a);
-   SVX_ASSERT((/*const*/ var *)r != b);
-#endif
-
    check_svar(a);
    check_svar(b);
-
-   for (i = 0; i < 3; i++) {
-      for (j = 0; j < 3; j++) {
-	 tot = 0;
-	 for (k = 0; k < 3; k++) {
-	    tot += SN(a,i,k) * SN(b,k,j);
-	 }
-	 (*r)[i][j] = tot;
-      }
-   }
+   sym3_mul(&(*r)[0][0], *a, *b);
    check_var(r);
 #endif
 }
@@ -723,18 +748,10 @@ mulsd(delta *r, /*const*/ svar *v, /*const*/ delta *b)
    (*r)[1] = (*v)[1] * (*b)[1];
    (*r)[2] = (*v)[2] * (*b)[2];
 #else
-   int i, j;
-   real tot;
-
    SVX_ASSERT((/*const*/ delta*)r != b);
    check_svar(v);
    check_d(b);
-
-   for (i = 0; i < 3; i++) {
-      tot = 0;
-      for (j = 0; j < 3; j++) tot += S(i,j) * (*b)[j];
-      (*r)[i] = tot;
-   }
+   sym3_mul_vec(*r, *v, *b);
    check_d(r);
 #endif
 }
@@ -829,37 +846,12 @@ invert_svar(svar *inv, /*const*/ svar *v)
       (*inv)[i] = 1.0 / (*v)[i];
    }
 #else
-   real det, a, b, c, d, e, f, bcff, efcd, dfbe;
-
 #if 0
    SVX_ASSERT((/*const*/ var *)inv != v);
 #endif
 
    check_svar(v);
-   /* a d e
-    * d b f
-    * e f c
-    */
-   a = (*v)[0], b = (*v)[1], c = (*v)[2];
-   d = (*v)[3], e = (*v)[4], f = (*v)[5];
-   bcff = b * c - f * f;
-   efcd = e * f - c * d;
-   dfbe = d * f - b * e;
-   det = a * bcff + d * efcd + e * dfbe;
-
-   if (det == 0.0) {
-      /* printf("det=%.20f\n", det); */
-      return 0; /* matrix is singular */
-   }
-
-   det = 1 / det;
-
-   (*inv)[0] = det * bcff;
-   (*inv)[1] = det * (c * a - e * e);
-   (*inv)[2] = det * (a * b - d * d);
-   (*inv)[3] = det * efcd;
-   (*inv)[4] = det * dfbe;
-   (*inv)[5] = det * (e * d - a * f);
+   if (!sym3_invert(*inv, *v)) return 0; /* matrix is singular */
 
 #if 0
    /* This test fires very occasionally, and there's not much point in
@@ -17,6 +17,19 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include "arena.h"
+
+/* The network data structures are allocated from these arenas. */
+extern arena prefix_arena, node_arena, pos_arena, linkfor_arena,
+	     linkrev_arena;
+
+/* Free leg, which must be connected into the network so that its
+ * FLAG_DATAHERE bit says whether it is a linkfor or a linkrev. */
+void free_leg(linkfor *leg);
+
+/* Report how much memory the arenas are using. */
+void print_arena_stats(void);
+
 void clear_last_leg(void);
 
 node *StnFromPfx(prefix *name);
@@ -66,7 +79,7 @@ extern node *stn_iter;
 
 #define print_prefix(N) fprint_prefix(stdout, (N))
 
-char *sprint_prefix(const prefix *ptr);
+const char *sprint_prefix(const prefix *ptr);
 void fprint_prefix(FILE *fh, const prefix *ptr);
 
 /* r = ab ; r,a,b are variance matrices */
@@ -262,7 +262,7 @@ concatenate_trav(node *stn, int i)
    if (fixed(stn2) || !two_node(stn2)) return;
 
    trav = osnew(stack);
-   newleg2 = (linkfor*)osnew(linkrev);
+   newleg2 = (linkfor*)arena_new(linkrev);
 
 #if PRINT_NETBITS
    printf("Concatenating trav "); print_prefix(stn->name); printf("<%p>",stn);
@@ -442,7 +442,8 @@ replace_travs(void)
    if (!pimg) {
       char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
       filename_register_output(fnm);
-      pimg = img_open_write_cs(fnm, survey_title, proj_str_out, 0);
+      pimg = img_open_write_cs(fnm, survey_title, proj_str_out,
+			       f_compress_3d ? img_FFLAG_COMPRESSED : 0);
       if (!pimg) fatalerror(img_error(), fnm);
       osfree(fnm);
    }
@@ -581,10 +582,10 @@ replace_travs(void)
 		     POS(stn1, 0), POS(stn1, 1), POS(stn1, 2));
 
       fArtic = stn1->leg[i]->l.reverse & FLAG_ARTICULATION;
-      osfree(stn1->leg[i]);
+      free_leg(stn1->leg[i]);
       stn1->leg[i] = ptr->join1; /* put old link back in */
 
-      osfree(stn2->leg[j]);
+      free_leg(stn2->leg[j]);
       stn2->leg[j] = ptr->join2; /* and the other end */
 
 #ifdef BLUNDER_DETECTION
@@ -994,8 +995,8 @@ replace_trailing_travs(void)
 		  totvert += fabs(leg->d[2]);
 	       }
 	    }
-	    osfree(leg);
-	    osfree(legRev);
+	    arena_delete(linkfor, leg);
+	    arena_delete(linkrev, (linkrev*)legRev);
 	    stn1->leg[i] = stnB->leg[iB] = NULL;
 	 }
       }
@@ -1007,7 +1008,7 @@ replace_trailing_travs(void)
    for (stn1 = stnlist; stn1; stn1 = stn2) {
       stn2 = stn1->next;
       stn1->name->stn = NULL;
-      osfree(stn1);
+      arena_delete(node, stn1);
    }
    stnlist = NULL;
 }
@@ -117,7 +117,7 @@ remove_subnets(void)
 	       dirn3 = reverse_leg_dirn(stn2->leg[dirn2]);
 
 	       trav = osnew(stackRed);
-	       newleg2 = (linkfor*)osnew(linkrev);
+	       newleg2 = (linkfor*)arena_new(linkrev);
 
 	       newleg = copy_link(stn3->leg[dirn3]);
 
@@ -249,8 +249,8 @@ remove_subnets(void)
 		    }
 #endif
 		 }
-	       osfree(newleg2);
-	       newleg2 = (linkfor*)osnew(linkrev);
+	       arena_delete(linkfor, newleg2);
+	       newleg2 = (linkfor*)arena_new(linkrev);
 
 	       addto_link(newleg, stn2->leg[dirn2]);
 	       addto_link(newleg, stn3->leg[dirn3]);
@@ -416,9 +416,9 @@ remove_subnets(void)
 		       BUG("loop of zero variance found");
 		    }
 
-		    legAZ = osnew(linkfor);
-		    legBZ = osnew(linkfor);
-		    legCZ = osnew(linkfor);
+		    legAZ = arena_new(linkfor);
+		    legBZ = arena_new(linkfor);
+		    legCZ = arena_new(linkfor);
 
 		    /* AZBZ */
 		    /* done above: addvv(&sum, &legBC->v, &legCA->v); */
@@ -452,9 +452,9 @@ remove_subnets(void)
 		    subdd(&temp, &temp, &temp2);
 		    mulsd(&legCZ->d, &sumCZAZ, &temp);
 
-		    osfree(legAB);
-		    osfree(legBC);
-		    osfree(legCA);
+		    arena_delete(linkfor, legAB);
+		    arena_delete(linkfor, legBC);
+		    arena_delete(linkfor, legCA);
 
 		    /* Now add two, subtract third, and scale by 0.5 */
 		    addss(&sum, &sumAZBZ, &sumCZAZ);
@@ -469,11 +469,12 @@ remove_subnets(void)
 		    subss(&sum, &sum, &sumAZBZ);
 		    mulsc(&legCZ->v, &sum, 0.5);
 
-		    nameZ = osnew(prefix);
-		    nameZ->pos = osnew(pos);
+		    nameZ = arena_new(prefix);
+		    nameZ->pos = arena_new(pos);
 		    nameZ->ident = NULL;
+		    nameZ->full_name = NULL;
 		    nameZ->shape = 3;
-		    stnZ = osnew(node);
+		    stnZ = arena_new(node);
 		    stnZ->name = nameZ;
 		    nameZ->stn = stnZ;
 		    nameZ->up = NULL;
@@ -486,9 +487,9 @@ remove_subnets(void)
 		    legBZ->l.reverse = 1 | FLAG_DATAHERE | FLAG_REPLACEMENTLEG;
 		    legCZ->l.to = stnZ;
 		    legCZ->l.reverse = 2 | FLAG_DATAHERE | FLAG_REPLACEMENTLEG;
-		    stnZ->leg[0] = (linkfor*)osnew(linkrev);
-		    stnZ->leg[1] = (linkfor*)osnew(linkrev);
-		    stnZ->leg[2] = (linkfor*)osnew(linkrev);
+		    stnZ->leg[0] = (linkfor*)arena_new(linkrev);
+		    stnZ->leg[1] = (linkfor*)arena_new(linkrev);
+		    stnZ->leg[2] = (linkfor*)arena_new(linkrev);
 		    stnZ->leg[0]->l.to = stn4;
 		    stnZ->leg[0]->l.reverse = dirn4;
 		    stnZ->leg[1]->l.to = stn5;
@@ -621,9 +622,9 @@ replace_subnets(void)
 	 add_stn_to_list(&stnlist, stn);
 	 add_stn_to_list(&stnlist, stn2);
 
-	 osfree(stn3->leg[dirn3]);
+	 free_leg(stn3->leg[dirn3]);
 	 stn3->leg[dirn3] = ptrRed->join1;
-	 osfree(stn4->leg[dirn4]);
+	 free_leg(stn4->leg[dirn4]);
 	 stn4->leg[dirn4] = ptrRed->join2;
       } else if (IS_PARALLEL(ptrRed)) {
 	 /* parallel legs */
@@ -690,9 +691,9 @@ replace_subnets(void)
 	 add_stn_to_list(&stnlist, stn);
 	 add_stn_to_list(&stnlist, stn2);
 
-	 osfree(stn3->leg[dirn3]);
+	 free_leg(stn3->leg[dirn3]);
 	 stn3->leg[dirn3] = ptrRed->join1;
-	 osfree(stn4->leg[dirn4]);
+	 free_leg(stn4->leg[dirn4]);
 	 stn4->leg[dirn4] = ptrRed->join2;
       } else if (IS_DELTASTAR(ptrRed)) {
 	 node *stnZ;
@@ -748,20 +749,20 @@ replace_subnets(void)
 	    }
 	    fix(stn2);
 	    add_stn_to_list(&stnlist, stn2);
-	    osfree(leg);
+	    free_leg(leg);
 	    stn[i]->leg[dirn[i]] = legs[i];
 	    /* transfer the articulation status of the radial legs */
 	    if (stnZ->leg[i]->l.reverse & FLAG_ARTICULATION) {
 	       legs[i]->l.reverse |= FLAG_ARTICULATION;
 	       reverse_leg(legs[i])->l.reverse |= FLAG_ARTICULATION;
 	    }
-	    osfree(stnZ->leg[i]);
+	    free_leg(stnZ->leg[i]);
 	    stnZ->leg[i] = NULL;
 	 }
 /*printf("---%f %f %f\n",POS(stnZ, 0), POS(stnZ, 1), POS(stnZ, 2));*/
 	 remove_stn_from_list(&stnlist, stnZ);
-	 osfree(stnZ->name);
-	 osfree(stnZ);
+	 arena_delete(prefix, stnZ->name);
+	 arena_delete(node, stnZ);
       } else {
 	 BUG("ptrRed has unknown type");
       }
@@ -31,6 +31,7 @@
 #include <wx/statbox.h>
 #include <wx/valgen.h>
 
+#include <algorithm>
 #include <vector>
 
 #include <stdio.h>
@@ -188,6 +189,52 @@ class svxPrintout : public wxPrintout {
 
     bool fBlankPage;
 
+    // Index of the legs, passage walls and labels with a bucket for each
+    // page, so each page only has to look at what might be drawn on it
+    // rather than at everything.  The coordinates are in pixels before
+    // the page offset is applied.  The index is built by the first call to
+    // OnPrintPage() and rebuilt if the layout, the survey data or the
+    // order of the labels changes (which can happen while previewing).
+    // The survey filter is applied when drawing.
+    struct PageLeg {
+	long x0, y0, x1, y1;
+	unsigned survey;
+	int flags;
+    };
+    struct PageLabel {
+	long x, y;
+	const LabelInfo* label;
+    };
+    vector<PageLeg> page_legs;
+    vector<PageLabel> page_labels;
+    // For each page, the indices in page_legs, the model's tubes and
+    // page_labels of what overlaps that page, in the order to draw them.
+    vector<vector<unsigned>> page_leg_index, page_tube_index, page_label_index;
+    struct PageIndexKey {
+	double Scale, rot, tilt, xOrg, yOrg, scX, scY;
+	int show_mask, pagesX, pagesY, width, depth;
+	// Changes if a different file is loaded.
+	unsigned long model_serial;
+	// Changes if the labels are re-sorted (e.g. by a search), which
+	// changes the order they're drawn in.
+	unsigned long label_order_serial;
+
+	bool operator==(const PageIndexKey& o) const {
+	    return model_serial == o.model_serial &&
+		   label_order_serial == o.label_order_serial &&
+		   Scale == o.Scale && rot == o.rot && tilt == o.tilt &&
+		   xOrg == o.xOrg && yOrg == o.yOrg &&
+		   scX == o.scX && scY == o.scY &&
+		   show_mask == o.show_mask &&
+		   pagesX == o.pagesX && pagesY == o.pagesY &&
+		   width == o.width && depth == o.depth;
+	}
+    } page_index_key;
+    bool page_index_valid;
+
+    void build_page_index(double SIN, double COS, double SINT, double COST);
+    void add_to_page_index(vector<vector<unsigned>> & index, unsigned item,
+			   long x_min, long y_min, long x_max, long y_max);
     int check_intersection(long x_p, long y_p);
     void draw_info_box();
     void draw_scale_bar(double x, double y, double MaxLength);
@@ -876,8 +923,8 @@ svxPrintDlg::RecalcBounds()
 		// Not showing because it's a splay.
 		continue;
 	    }
-	    list<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = mainfrm->traverses_end(f);
+	    vector<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
+	    vector<traverse>::const_iterator tend = mainfrm->traverses_end(f);
 	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, filter, trav)) {
 		vector<PointInfo>::const_iterator pos = trav->begin();
 		vector<PointInfo>::const_iterator end = trav->end();
@@ -898,8 +945,8 @@ svxPrintDlg::RecalcBounds()
 
     if ((show_mask & XSECT) &&
 	(m_layout.tilt == 0.0 || m_layout.tilt == 90.0 || m_layout.tilt == -90.0)) {
-	list<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
-	list<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
+	vector<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
+	vector<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
 	for ( ; trav != tend; ++trav) {
 	    const XSect* prev_pt_v = NULL;
 	    Vector3 last_right(1.0, 0.0, 0.0);
@@ -914,7 +961,7 @@ svxPrintDlg::RecalcBounds()
 		    Double d = pt_v.GetD();
 
 		    if (u >= 0 || d >= 0) {
-			if (filter && !filter->CheckVisible(pt_v.GetLabel()))
+			if (filter && !filter->CheckVisible(pt_v.GetSurvey()))
 			    continue;
 
 			double x = pt_v.GetX();
@@ -1003,7 +1050,7 @@ svxPrintDlg::RecalcBounds()
 		    Double r = pt_v.GetR();
 
 		    if (l >= 0 || r >= 0) {
-			if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
+			if (!filter || filter->CheckVisible(pt_v.GetSurvey())) {
 			    // Get the x and y coordinates of the survey station
 			    double pt_X = pt_v.GetX() * COS - pt_v.GetY() * SIN;
 			    double pt_Y = pt_v.GetX() * SIN + pt_v.GetY() * COS;
@@ -1051,7 +1098,7 @@ svxPrintDlg::RecalcBounds()
 	for (auto label = mainfrm->GetLabels();
 	     label != mainfrm->GetLabelsEnd();
 	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
+	    if (filter && !filter->CheckVisible((*label)->get_survey()))
 		continue;
 	    double x = (*label)->GetX();
 	    double y = (*label)->GetY();
@@ -1079,7 +1126,7 @@ static const char *fontname = "Arial", *fontname_labels = "Arial";
 svxPrintout::svxPrintout(MainFrm *mainfrm_, layout *l,
 			 wxPageSetupDialogData *data, const wxString & title)
     : wxPrintout(title), font_labels(NULL), font_default(NULL),
-      scan_for_blank_pages(false)
+      scan_for_blank_pages(false), page_index_valid(false)
 {
     mainfrm = mainfrm_;
     m_layout = l;
@@ -1534,6 +1581,18 @@ svxPrintout::OnPrintPage(int pageNum) {
     double SINT = sin(rad(l->tilt));
     double COST = cos(rad(l->tilt));
 
+    int show_mask = l->get_effective_show_mask();
+    PageIndexKey key = {
+	l->Scale, l->rot, l->tilt, l->xOrg, l->yOrg, l->scX, l->scY,
+	show_mask, l->pagesX, l->pagesY, xpPageWidth, ypPageDepth,
+	mainfrm->GetSurveyTreeSerial(), mainfrm->GetLabelOrderSerial()
+    };
+    if (!page_index_valid || !(key == page_index_key)) {
+	build_page_index(SIN, COS, SINT, COST);
+	page_index_key = key;
+	page_index_valid = true;
+    }
+
     NewPage(pageNum, l->pagesX, l->pagesY);
 
     if (l->Legend && pageNum == (l->pagesY - 1) * l->pagesX + 1) {
@@ -1543,90 +1602,57 @@ svxPrintout::OnPrintPage(int pageNum) {
 
     pdc->SetClippingRegion(x_offset, y_offset, xpPageWidth + 1, ypPageDepth + 1);
 
-    const double Sc = 1000 / l->Scale;
+    wxASSERT(pageNum >= 1 && pageNum <= l->pages);
+    unsigned page = pageNum - 1;
 
     const SurveyFilter* filter = mainfrm->GetTreeFilter();
-    int show_mask = l->get_effective_show_mask();
-    if (show_mask & (LEGS|SURF)) {
-	for (int f = 0; f != 8; ++f) {
-	    if ((show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
-		// Not showing traverse because of surface/underground status.
-		continue;
-	    }
-	    if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
-		// Not showing because it's a splay.
-		continue;
-	    }
-	    if (f & img_FLAG_SPLAY) {
+    int flags = -1;
+    for (unsigned i : page_leg_index[page]) {
+	const PageLeg & leg = page_legs[i];
+	if (filter && !filter->CheckVisible(leg.survey))
+	    continue;
+	if (leg.flags != flags) {
+	    flags = leg.flags;
+	    if (flags & img_FLAG_SPLAY) {
 		pdc->SetPen(*pen_splay);
-	    } else if (f & img_FLAG_SURFACE) {
+	    } else if (flags & img_FLAG_SURFACE) {
 		pdc->SetPen(*pen_surface_leg);
 	    } else {
 		pdc->SetPen(*pen_leg);
 	    }
-	    list<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
-	    list<traverse>::const_iterator tend = mainfrm->traverses_end(f);
-	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, filter, trav)) {
-		vector<PointInfo>::const_iterator pos = trav->begin();
-		vector<PointInfo>::const_iterator end = trav->end();
-		for ( ; pos != end; ++pos) {
-		    double x = pos->GetX();
-		    double y = pos->GetY();
-		    double z = pos->GetZ();
-		    double X = x * COS - y * SIN;
-		    double Y = z * COST - (x * SIN + y * COS) * SINT;
-		    long px = (long)((X * Sc + l->xOrg) * l->scX);
-		    long py = (long)((Y * Sc + l->yOrg) * l->scY);
-		    if (pos == trav->begin()) {
-			MoveTo(px, py);
-		    } else {
-			DrawTo(px, py);
-		    }
-		}
-	    }
 	}
+	MoveTo(leg.x0, leg.y0);
+	DrawTo(leg.x1, leg.y1);
     }
 
-    if ((show_mask & XSECT) &&
-	(l->tilt == 0.0 || l->tilt == 90.0 || l->tilt == -90.0)) {
+    if (!page_tube_index[page].empty()) {
 	pdc->SetPen(*pen_splay);
-	list<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
-	list<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
-	for ( ; trav != tend; ++trav) {
+	vector<vector<XSect>>::const_iterator tubes = mainfrm->tubes_begin();
+	for (unsigned i : page_tube_index[page]) {
 	    if (l->tilt == 0.0) {
-		PlotUD(*trav);
+		PlotUD(tubes[i]);
 	    } else {
-		// m_layout.tilt is 90.0 or -90.0 due to check above.
-		PlotLR(*trav);
+		// m_layout.tilt is 90.0 or -90.0 due to check in
+		// build_page_index().
+		PlotLR(tubes[i]);
 	    }
 	}
     }
 
     if (show_mask & (LABELS|STNS)) {
 	if (show_mask & LABELS) SetFont(font_labels);
-	for (auto label = mainfrm->GetLabels();
-	     label != mainfrm->GetLabelsEnd();
-	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
+	for (unsigned i : page_label_index[page]) {
+	    const PageLabel & label = page_labels[i];
+	    if (filter && !filter->CheckVisible(label.label->get_survey()))
 		continue;
-	    double px = (*label)->GetX();
-	    double py = (*label)->GetY();
-	    double pz = (*label)->GetZ();
-	    if ((show_mask & SURF) || (*label)->IsUnderground()) {
-		double X = px * COS - py * SIN;
-		double Y = pz * COST - (px * SIN + py * COS) * SINT;
-		long xnew, ynew;
-		xnew = (long)((X * Sc + l->xOrg) * l->scX);
-		ynew = (long)((Y * Sc + l->yOrg) * l->scY);
-		if (show_mask & STNS) {
-		    pdc->SetPen(*pen_cross);
-		    DrawCross(xnew, ynew);
-		}
-		if (show_mask & LABELS) {
-		    pdc->SetTextForeground(colour_labels);
-		    MoveTo(xnew, ynew);
-		    WriteString((*label)->GetText());
-		}
+	    if (show_mask & STNS) {
+		pdc->SetPen(*pen_cross);
+		DrawCross(label.x, label.y);
+	    }
+	    if (show_mask & LABELS) {
+		pdc->SetTextForeground(colour_labels);
+		MoveTo(label.x, label.y);
+		WriteString(label.label->GetText());
 	    }
 	}
     }
@@ -1839,6 +1865,167 @@ svxPrintout::SolidRectangle(long x, long y, long w, long h)
     pdc->DrawRectangle(X, Y - h, w, h);
 }
 
+void
+svxPrintout::add_to_page_index(vector<vector<unsigned>> & index, unsigned item,
+			       long x_min, long y_min, long x_max, long y_max)
+{
+    int pagesX = m_layout->pagesX;
+    int pagesY = m_layout->pagesY;
+    // Allow a pixel either side for rounding and because the clipping region
+    // is a pixel larger than the page.
+    double c0 = floor((x_min - 1) / double(xpPageWidth));
+    double c1 = floor((x_max + 1) / double(xpPageWidth));
+    double r0 = floor((y_min - 1) / double(ypPageDepth));
+    double r1 = floor((y_max + 1) / double(ypPageDepth));
+    if (c0 < 0) c0 = 0;
+    if (r0 < 0) r0 = 0;
+    if (c1 > pagesX - 1) c1 = pagesX - 1;
+    if (r1 > pagesY - 1) r1 = pagesY - 1;
+    if (c0 > c1 || r0 > r1) return;
+    for (int r = int(r0); r <= int(r1); ++r) {
+	for (int c = int(c0); c <= int(c1); ++c) {
+	    // Page numbers go across and then down, as in NewPage().
+	    index[c + (pagesY - 1 - r) * pagesX].push_back(item);
+	}
+    }
+}
+
+void
+svxPrintout::build_page_index(double SIN, double COS, double SINT, double COST)
+{
+    layout * l = m_layout;
+    const double Sc = 1000 / l->Scale;
+    int show_mask = l->get_effective_show_mask();
+
+    page_legs.clear();
+    page_labels.clear();
+    page_leg_index.assign(l->pages, vector<unsigned>());
+    page_tube_index.assign(l->pages, vector<unsigned>());
+    page_label_index.assign(l->pages, vector<unsigned>());
+
+    if (show_mask & (LEGS|SURF)) {
+	for (int f = 0; f != 8; ++f) {
+	    if ((show_mask & (f & img_FLAG_SURFACE) ? SURF : LEGS) == 0) {
+		// Not showing traverse because of surface/underground status.
+		continue;
+	    }
+	    if ((f & img_FLAG_SPLAY) && (show_mask & SPLAYS) == 0) {
+		// Not showing because it's a splay.
+		continue;
+	    }
+	    vector<traverse>::const_iterator trav = mainfrm->traverses_begin(f, NULL);
+	    vector<traverse>::const_iterator tend = mainfrm->traverses_end(f);
+	    for ( ; trav != tend; trav = mainfrm->traverses_next(f, NULL, trav)) {
+		long x_p = 0, y_p = 0;
+		vector<PointInfo>::const_iterator pos = trav->begin();
+		vector<PointInfo>::const_iterator end = trav->end();
+		for ( ; pos != end; ++pos) {
+		    double x = pos->GetX();
+		    double y = pos->GetY();
+		    double z = pos->GetZ();
+		    double X = x * COS - y * SIN;
+		    double Y = z * COST - (x * SIN + y * COS) * SINT;
+		    long px = (long)((X * Sc + l->xOrg) * l->scX);
+		    long py = (long)((Y * Sc + l->yOrg) * l->scY);
+		    if (pos != trav->begin()) {
+			PageLeg leg = { x_p, y_p, px, py, trav->survey, f };
+			add_to_page_index(page_leg_index, page_legs.size(),
+					  min(x_p, px), min(y_p, py),
+					  max(x_p, px), max(y_p, py));
+			page_legs.push_back(leg);
+		    }
+		    x_p = px;
+		    y_p = py;
+		}
+	    }
+	}
+    }
+
+    if ((show_mask & XSECT) &&
+	(l->tilt == 0.0 || l->tilt == 90.0 || l->tilt == -90.0)) {
+	vector<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
+	vector<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
+	for (unsigned n = 0; trav != tend; ++trav, ++n) {
+	    // Find the extent of the arrows PlotUD() or PlotLR() will draw.
+	    double x_min = HUGE_VAL, y_min = HUGE_VAL;
+	    double x_max = -HUGE_VAL, y_max = -HUGE_VAL;
+	    vector<XSect>::const_iterator pos = trav->begin();
+	    vector<XSect>::const_iterator end = trav->end();
+	    for ( ; pos != end; ++pos) {
+		double size = max(max(pos->GetL(), pos->GetR()),
+				  max(pos->GetU(), pos->GetD()));
+		if (size < 0) continue;
+		double X = pos->GetX() * COS - pos->GetY() * SIN;
+		double Y;
+		if (l->tilt == 0.0) {
+		    Y = pos->GetZ();
+		} else {
+		    Y = pos->GetX() * SIN + pos->GetY() * COS;
+		}
+		double x = X * Sc + l->xOrg;
+		double y = Y * Sc + l->yOrg;
+		double r = size * Sc;
+		x_min = min(x_min, (x - r) * l->scX);
+		x_max = max(x_max, (x + r) * l->scX);
+		// PlotUD() scales the y coordinate of the station by scX.
+		y_min = min(y_min, (y - r) * min(l->scX, l->scY));
+		y_max = max(y_max, (y + r) * max(l->scX, l->scY));
+	    }
+	    if (x_min > x_max) continue;
+	    long arrow = 2 * PWX_CROSS_SIZE;
+	    add_to_page_index(page_tube_index, n,
+			      (long)floor(x_min) - arrow,
+			      (long)floor(y_min) - arrow,
+			      (long)ceil(x_max) + arrow,
+			      (long)ceil(y_max) + arrow);
+	}
+    }
+
+    if (show_mask & (LABELS|STNS)) {
+	double xsc = 1, ysc = 1;
+	if (show_mask & LABELS) {
+	    // Measure the labels in the same way WriteString() draws them.
+	    SetFont(font_labels);
+	    pdc->GetUserScale(&xsc, &ysc);
+	    pdc->SetUserScale(xsc * font_scaling_x, ysc * font_scaling_y);
+	}
+	for (auto label = mainfrm->GetLabels();
+	     label != mainfrm->GetLabelsEnd();
+	     ++label) {
+	    if (!(show_mask & SURF) && !(*label)->IsUnderground())
+		continue;
+	    double px = (*label)->GetX();
+	    double py = (*label)->GetY();
+	    double pz = (*label)->GetZ();
+	    double X = px * COS - py * SIN;
+	    double Y = pz * COST - (px * SIN + py * COS) * SINT;
+	    long xnew, ynew;
+	    xnew = (long)((X * Sc + l->xOrg) * l->scX);
+	    ynew = (long)((Y * Sc + l->yOrg) * l->scY);
+	    long x_min = xnew - PWX_CROSS_SIZE, x_max = xnew + PWX_CROSS_SIZE;
+	    long y_min = ynew - PWX_CROSS_SIZE, y_max = ynew + PWX_CROSS_SIZE;
+	    if (show_mask & LABELS) {
+		// The text is drawn above and to the right of the station.
+		// Font metrics vary a little with the zoom when previewing, so
+		// allow the text height as slack all round.
+		int w, h;
+		pdc->GetTextExtent((*label)->GetText(), &w, &h);
+		long w_px = (long)ceil(w * font_scaling_x);
+		long h_px = (long)ceil(h * font_scaling_y);
+		x_min = min(x_min, xnew - h_px);
+		x_max = max(x_max, xnew + w_px + h_px);
+		y_min = min(y_min, ynew - h_px);
+		y_max = max(y_max, ynew + 2 * h_px);
+	    }
+	    PageLabel page_label = { xnew, ynew, *label };
+	    add_to_page_index(page_label_index, page_labels.size(),
+			      x_min, y_min, x_max, y_max);
+	    page_labels.push_back(page_label);
+	}
+	if (show_mask & LABELS) pdc->SetUserScale(xsc, ysc);
+    }
+}
+
 void
 svxPrintout::NewPage(int pg, int pagesX, int pagesY)
 {
@@ -2094,7 +2281,7 @@ svxPrintout::PlotLR(const vector<XSect> & centreline)
 	Double r = pt_v.GetR();
 
 	if (l >= 0 || r >= 0) {
-	    if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
+	    if (!filter || filter->CheckVisible(pt_v.GetSurvey())) {
 		// Get the x and y coordinates of the survey station
 		double pt_X = pt_v.GetX() * COS - pt_v.GetY() * SIN;
 		double pt_Y = pt_v.GetX() * SIN + pt_v.GetY() * COS;
@@ -2179,7 +2366,7 @@ svxPrintout::PlotUD(const vector<XSect> & centreline)
 	Double d = pt_v.GetD();
 
 	if (u >= 0 || d >= 0) {
-	    if (filter && !filter->CheckVisible(pt_v.GetLabel()))
+	    if (filter && !filter->CheckVisible(pt_v.GetSurvey()))
 		continue;
 
 	    // Get the coordinates of the survey point
@@ -34,6 +34,7 @@
 #include "netbits.h"
 #include "osalloc.h"
 #include "str.h"
+#include "strpool.h"
 
 #ifdef HAVE_SETJMP_H
 # define LONGJMP(JB) longjmp((JB), 1)
@@ -46,13 +47,15 @@ int root_depr_count = 0;
 static prefix *
 new_anon_station(void)
 {
-    prefix *name = osnew(prefix);
+    prefix *name = arena_new(prefix);
     name->pos = NULL;
     name->ident = NULL;
+    name->full_name = NULL;
     name->shape = 0;
     name->stn = NULL;
     name->up = pcs->Prefix;
     name->down = NULL;
+    name->children = NULL;
     name->filename = file.filename;
     name->line = file.line;
     name->min_export = name->max_export = 0;
@@ -63,6 +66,113 @@ new_anon_station(void)
     return name;
 }
 
+/* The children of each prefix are kept in a linked list sorted by ident, as
+ * traversals of the prefix tree need them in order.  Once a survey has more
+ * than this many children, we also index them using a treap (a binary search
+ * tree which is kept balanced on average by giving each node a random
+ * priority and maintaining heap order on the priorities) so that finding a
+ * child, or where in the list to insert a new one, doesn't need a linear
+ * search.
+ */
+#define PREFIX_INDEX_MIN 32
+
+/* Compare idents for sorting.  Idents are interned, so equal idents are
+ * the same pointer and we only need strcmp() when they differ. */
+static inline int
+ident_cmp(const char *a, const char *b)
+{
+   return a == b ? 0 : strcmp(a, b);
+}
+
+struct Prefix_index {
+   struct Prefix_index *left, *right;
+   prefix *pfx;
+   unsigned long priority;
+};
+
+static void
+index_insert(struct Prefix_index **p, struct Prefix_index *x)
+{
+   struct Prefix_index *t = *p;
+   if (!t) {
+      *p = x;
+      return;
+   }
+   if (ident_cmp(x->pfx->ident, t->pfx->ident) < 0) {
+      index_insert(&t->left, x);
+      if (t->left->priority > t->priority) {
+	 /* rotate right */
+	 *p = t->left;
+	 t->left = (*p)->right;
+	 (*p)->right = t;
+      }
+   } else {
+      index_insert(&t->right, x);
+      if (t->right->priority > t->priority) {
+	 /* rotate left */
+	 *p = t->right;
+	 t->right = (*p)->left;
+	 (*p)->left = t;
+      }
+   }
+}
+
+/* Add child pfx to the index of its parent. */
+static void
+index_add(prefix *pfx)
+{
+   static unsigned long seed = 1;
+   struct Prefix_index *x = osnew(struct Prefix_index);
+   /* The priorities only need to be "random enough", and using a fixed
+    * sequence means the shape of the tree is reproducible. */
+   seed = seed * 1103515245ul + 12345ul;
+   x->priority = (seed >> 16) & 0x7fff;
+   x->left = x->right = NULL;
+   x->pfx = pfx;
+   index_insert(&pfx->up->children, x);
+}
+
+/* Look up name in the index t.  If there's no such child, return NULL and
+ * set *prev to the child which would come before it in the sorted list (or
+ * NULL if it would be the first).
+ */
+static prefix *
+index_find(const struct Prefix_index *t, const char *name, prefix **prev)
+{
+   *prev = NULL;
+   while (t) {
+      int cmp = ident_cmp(t->pfx->ident, name);
+      if (cmp == 0) return t->pfx;
+      if (cmp < 0) {
+	 *prev = t->pfx;
+	 t = t->right;
+      } else {
+	 t = t->left;
+      }
+   }
+   return NULL;
+}
+
+static prefix *
+new_prefix(prefix *up, const char *name, bool fSuspectTypo)
+{
+   prefix *pfx = arena_new(prefix);
+   pfx->ident = name;
+   pfx->full_name = NULL;
+   pfx->right = pfx->down = NULL;
+   pfx->children = NULL;
+   pfx->pos = NULL;
+   pfx->shape = 0;
+   pfx->stn = NULL;
+   pfx->up = up;
+   pfx->filename = file.filename;
+   pfx->line = file.line;
+   pfx->min_export = pfx->max_export = 0;
+   pfx->sflags = BIT(SFLAGS_SURVEY);
+   if (fSuspectTypo) pfx->sflags |= BIT(SFLAGS_SUSPECTTYPO);
+   return pfx;
+}
+
 /* if prefix is omitted: if PFX_OPT set return NULL, otherwise use longjmp */
 extern prefix *
 read_prefix(unsigned pfx_flags)
@@ -71,8 +181,10 @@ read_prefix(unsigned pfx_flags)
    bool fSurvey = !!(pfx_flags & PFX_SURVEY);
    bool fSuspectTypo = !!(pfx_flags & PFX_SUSPECT_TYPO);
    prefix *back_ptr, *ptr;
-   char *name;
-   size_t name_len = 32;
+   /* Buffer to read each name into before interning it. */
+   static char *buf = NULL;
+   static size_t buf_len = 0;
+   const char *name;
    size_t i;
    bool fNew;
    bool fImplicitPrefix = fTrue;
@@ -166,14 +278,13 @@ anon_wall_station:
       ptr = pcs->Prefix;
    }
 
+   if (buf == NULL) {
+      buf_len = 32;
+      buf = osmalloc(buf_len);
+   }
    i = 0;
-   name = NULL;
    do {
       fNew = fFalse;
-      if (name == NULL) {
-	 /* Need a new name buffer */
-	 name = osmalloc(name_len);
-      }
       /* i==0 iff this is the first pass */
       if (i) {
 	 i = 0;
@@ -182,11 +293,11 @@ anon_wall_station:
       while (isNames(ch)) {
 	 if (i < pcs->Truncate) {
 	    /* truncate name */
-	    name[i++] = (pcs->Case == LOWER ? tolower(ch) :
-			 (pcs->Case == OFF ? ch : toupper(ch)));
-	    if (i >= name_len) {
-	       name_len = name_len + name_len;
-	       name = osrealloc(name, name_len);
+	    buf[i++] = (pcs->Case == LOWER ? tolower(ch) :
+			(pcs->Case == OFF ? ch : toupper(ch)));
+	    if (i >= buf_len) {
+	       buf_len = buf_len + buf_len;
+	       buf = osrealloc(buf, buf_len);
 	    }
 	 }
 	 nextch();
@@ -196,7 +307,6 @@ anon_wall_station:
 	 get_pos(&fp_firstsep);
       }
       if (i == 0) {
-	 osfree(name);
 	 if (!f_optional) {
 	    if (isEol(ch)) {
 	       if (fSurvey) {
@@ -213,69 +323,66 @@ anon_wall_station:
 	 return (prefix *)NULL;
       }
 
-      name[i++] = '\0';
+      buf[i] = '\0';
+      name = strpool_intern(buf, i);
 
       back_ptr = ptr;
       ptr = ptr->down;
       if (ptr == NULL) {
 	 /* Special case first time around at each level */
-	 name = osrealloc(name, i);
-	 ptr = osnew(prefix);
-	 ptr->ident = name;
-	 name = NULL;
-	 ptr->right = ptr->down = NULL;
-	 ptr->pos = NULL;
-	 ptr->shape = 0;
-	 ptr->stn = NULL;
-	 ptr->up = back_ptr;
-	 ptr->filename = file.filename;
-	 ptr->line = file.line;
-	 ptr->min_export = ptr->max_export = 0;
-	 ptr->sflags = BIT(SFLAGS_SURVEY);
-	 if (fSuspectTypo && !fImplicitPrefix)
-	    ptr->sflags |= BIT(SFLAGS_SUSPECTTYPO);
+	 ptr = new_prefix(back_ptr, name, fSuspectTypo && !fImplicitPrefix);
 	 back_ptr->down = ptr;
 	 fNew = fTrue;
+      } else if (back_ptr->children) {
+	 prefix *ptrPrev;
+	 ptr = index_find(back_ptr->children, name, &ptrPrev);
+	 if (!ptr) {
+	    ptr = new_prefix(back_ptr, name, fSuspectTypo && !fImplicitPrefix);
+	    if (ptrPrev == NULL) {
+	       ptr->right = back_ptr->down;
+	       back_ptr->down = ptr;
+	    } else {
+	       ptr->right = ptrPrev->right;
+	       ptrPrev->right = ptr;
+	    }
+	    index_add(ptr);
+	    fNew = fTrue;
+	 }
       } else {
 	 /* Use caching to speed up adding an increasing sequence to a
 	  * large survey */
 	 static prefix *cached_survey = NULL, *cached_station = NULL;
 	 prefix *ptrPrev = NULL;
 	 int cmp = 1; /* result of strcmp ( -ve for <, 0 for =, +ve for > ) */
+	 int steps = 0;
 	 if (cached_survey == back_ptr) {
-	    cmp = strcmp(cached_station->ident, name);
+	    cmp = ident_cmp(cached_station->ident, name);
 	    if (cmp <= 0) ptr = cached_station;
 	 }
-	 while (ptr && (cmp = strcmp(ptr->ident, name))<0) {
+	 while (ptr && (cmp = ident_cmp(ptr->ident, name))<0) {
 	    ptrPrev = ptr;
 	    ptr = ptr->right;
+	    ++steps;
 	 }
 	 if (cmp) {
 	    /* ie we got to one that was higher, or the end */
 	    prefix *newptr;
-	    name = osrealloc(name, i);
-	    newptr = osnew(prefix);
-	    newptr->ident = name;
-	    name = NULL;
+	    newptr = new_prefix(back_ptr, name,
+				fSuspectTypo && !fImplicitPrefix);
 	    if (ptrPrev == NULL)
 	       back_ptr->down = newptr;
 	    else
 	       ptrPrev->right = newptr;
 	    newptr->right = ptr;
-	    newptr->down = NULL;
-	    newptr->pos = NULL;
-	    newptr->shape = 0;
-	    newptr->stn = NULL;
-	    newptr->up = back_ptr;
-	    newptr->filename = file.filename;
-	    newptr->line = file.line;
-	    newptr->min_export = newptr->max_export = 0;
-	    newptr->sflags = BIT(SFLAGS_SURVEY);
-	    if (fSuspectTypo && !fImplicitPrefix)
-	       newptr->sflags |= BIT(SFLAGS_SUSPECTTYPO);
 	    ptr = newptr;
 	    fNew = fTrue;
 	 }
+	 if (steps > PREFIX_INDEX_MIN) {
+	    /* The list is long enough that searching it is getting slow, so
+	     * index it. */
+	    prefix *p;
+	    for (p = back_ptr->down; p; p = p->right) index_add(p);
+	 }
 	 cached_survey = back_ptr;
 	 cached_station = ptr;
       }
@@ -283,7 +390,6 @@ anon_wall_station:
       f_optional = fFalse; /* disallow after first level */
       if (isSep(ch)) get_pos(&fp_firstsep);
    } while (isSep(ch));
-   if (name) osfree(name);
 
    /* don't warn about a station that is referred to twice */
    if (!fNew) ptr->sflags &= ~BIT(SFLAGS_SUSPECTTYPO);
@@ -318,14 +424,14 @@ anon_wall_station:
       if (depth > ptr->max_export) ptr->max_export = depth;
    } else if (ptr->max_export < depth) {
       prefix *survey = ptr;
-      char *s;
+      const char *s;
       const char *p;
       int level;
       for (level = ptr->max_export + 1; level; level--) {
 	 survey = survey->up;
 	 SVX_ASSERT(survey);
       }
-      s = osstrdup(sprint_prefix(survey));
+      s = sprint_prefix(survey);
       p = sprint_prefix(ptr);
       if (survey->filename) {
 	 compile_diagnostic_pfx(DIAG_ERR, survey,
@@ -334,7 +440,6 @@ anon_wall_station:
       } else {
 	 compile_diagnostic(DIAG_ERR, /*Station “%s” not exported from survey “%s”*/26, p, s);
       }
-      osfree(s);
 #if 0
       printf(" *** pfx %s warning not exported enough depth %d "
 	     "ptr->max_export %d\n", sprint_prefix(ptr),
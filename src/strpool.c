@@ -0,0 +1,127 @@
+/* strpool.c
+ * Pool of strings which are never freed, with interning
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+
+#include "debug.h"
+#include "osalloc.h"
+#include "strpool.h"
+
+/* Strings are packed into blocks of this size (longer strings get a block
+ * to themselves). */
+#define BLOCK_SIZE 65536
+
+static char *block_next = NULL, *block_end = NULL;
+
+/* Open addressing hash table of the interned strings.  table_size is
+ * always a power of 2, and we grow the table when it's half full.
+ */
+typedef struct {
+   unsigned long hash;
+   const char *s;
+} strpool_entry;
+
+static strpool_entry *table = NULL;
+static unsigned long table_size = 0;
+static unsigned long n_interned = 0;
+static unsigned long pool_bytes = 0;
+
+/* FNV-1a - the hash in hash.c only gives 15 bits, which isn't enough for
+ * the number of names in a large cave system. */
+static unsigned long
+hash_bytes(const char *s, size_t len)
+{
+   unsigned long h = 2166136261ul;
+   while (len--) {
+      h ^= *(const unsigned char *)s++;
+      h = (h * 16777619ul) & 0xfffffffful;
+   }
+   return h;
+}
+
+char *
+strpool_alloc(size_t len)
+{
+   char *p;
+   if ((size_t)(block_end - block_next) < len) {
+      if (len > BLOCK_SIZE / 4) {
+	 /* Don't waste the rest of the current block. */
+	 pool_bytes += len;
+	 return osmalloc(len);
+      }
+      block_next = osmalloc(BLOCK_SIZE);
+      block_end = block_next + BLOCK_SIZE;
+      pool_bytes += BLOCK_SIZE;
+   }
+   p = block_next;
+   block_next += len;
+   return p;
+}
+
+static void
+grow_table(void)
+{
+   strpool_entry *old = table;
+   unsigned long old_size = table_size;
+   unsigned long i;
+   table_size = old_size ? old_size * 2 : 1024;
+   table = osmalloc(table_size * ossizeof(strpool_entry));
+   memset(table, 0, table_size * sizeof(strpool_entry));
+   for (i = 0; i < old_size; i++) {
+      if (old[i].s) {
+	 unsigned long j = old[i].hash & (table_size - 1);
+	 while (table[j].s) j = (j + 1) & (table_size - 1);
+	 table[j] = old[i];
+      }
+   }
+   osfree(old);
+}
+
+const char *
+strpool_intern(const char *s, size_t len)
+{
+   unsigned long h, j;
+   char *p;
+   SVX_ASSERT(s[len] == '\0');
+   if (n_interned * 2 >= table_size) grow_table();
+   h = hash_bytes(s, len);
+   j = h & (table_size - 1);
+   while (table[j].s) {
+      if (table[j].hash == h && strcmp(table[j].s, s) == 0)
+	 return table[j].s;
+      j = (j + 1) & (table_size - 1);
+   }
+   p = strpool_alloc(len + 1);
+   memcpy(p, s, len + 1);
+   table[j].hash = h;
+   table[j].s = p;
+   n_interned++;
+   return p;
+}
+
+void
+strpool_stats(unsigned long *n_strings, unsigned long *bytes)
+{
+   *n_strings = n_interned;
+   *bytes = pool_bytes + table_size * sizeof(strpool_entry);
+}
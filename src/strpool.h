@@ -0,0 +1,39 @@
+/* strpool.h
+ * Pool of strings which are never freed, with interning
+ * Copyright (C) 2026 The Survex Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stddef.h>
+
+/* Return the pooled copy of the nul-terminated string s, which is len
+ * bytes long (not counting the nul).  Equal strings always give the same
+ * pointer, so pooled strings can be compared for equality with ==.
+ */
+const char *strpool_intern(const char *s, size_t len);
+
+/* Allocate len bytes from the pool (for strings which aren't worth
+ * interning). */
+char *strpool_alloc(size_t len);
+
+/* Report the number of distinct interned strings and the total bytes
+ * used by the pool. */
+void strpool_stats(unsigned long *n_strings, unsigned long *bytes);
+
+#endif
@@ -70,7 +70,7 @@ testdir=`(cd "$testdir" && pwd)`
  skipafterbadomit passagebad badreadingdotplus badcalibrate calibrate_clino\
  badunits badbegin anonstn anonstnbad anonstnrev doubleinc reenterlots\
  cs csbad csbadsdfix csfeet cslonglat omitfixaroundsolve repeatreading\
- mixedeols utf8bom nonewlineateof suspectreadings\
+ mixedeols utf8bom nonewlineateof suspectreadings sparsegrid blockgrid multicomponent manystations pcggrid pcgjacobigrid\
 "}}
 
 # Test file stnsurvey3.svx missing: pos=fail # We exit before the error count.
@@ -115,6 +115,8 @@ for file in $TESTS ; do
   warn=
   # how many errors to expect
   error=
+  # extra options to pass to cavern
+  opts=
 
   case $file in
     *.dat)
@@ -140,6 +142,7 @@ for file in $TESTS ; do
 	  pos=*) pos=`expr "$1" : 'pos=\(.*\)'` ;;
 	  warn=*) warn=`expr "$1" : 'warn=\(.*\)'` ;;
 	  error=*) error=`expr "$1" : 'error=\(.*\)'` ;;
+	  opts=*) opts=`expr "$1" : 'opts=\(.*\)'` ;;
 	esac
       done
       ;;
@@ -159,7 +162,7 @@ for file in $TESTS ; do
   rm -f tmp.*
   pwd=`pwd`
   cd "$srcdir"
-  srcdir=. $CAVERN "$input" --output="$pwd/tmp" > "$pwd/tmp.out"
+  srcdir=. $CAVERN $opts "$input" --output="$pwd/tmp" > "$pwd/tmp.out"
   exitcode=$?
   cd "$pwd"
   test -n "$VERBOSE" && cat tmp.out
@@ -27,9 +27,10 @@ test -n "$*" && VERBOSE=1
 
 test -x "$testdir"/../src/cavern || testdir=.
 
+: ${CAVERN="$testdir"/../src/cavern}
 : ${DIFFPOS="$testdir"/../src/diffpos}
 
-: ${TESTS=${*:-"delatend addatend"}}
+: ${TESTS=${*:-"delatend addatend sorted"}}
 
 SURVEXLANG=en
 export SURVEXLANG
@@ -63,6 +64,27 @@ for file in $TESTS ; do
   rm -f diffpos.tmp
 done
 
+# sorteda.pos and sortedb.pos are sorted by station name, so should give the
+# same output when compared in one pass with --sorted.  pos.pos isn't sorted,
+# which --sorted should report as an error.
+for file in sorted ; do
+  echo "diffpos --sorted $file"
+  rm -f diffpos.tmp
+  $DIFFPOS --sorted "$srcdir/${file}a.pos" "$srcdir/${file}b.pos" > diffpos.tmp
+  if test -n "$VERBOSE" ; then
+    cat diffpos.tmp
+  fi
+  cmp diffpos.tmp "$srcdir/${file}.out" > /dev/null || exit 1
+  rm -f diffpos.tmp
+done
+echo "diffpos --sorted pos.pos"
+$DIFFPOS "$srcdir/pos.pos" "$srcdir/pos.pos" > diffpos.tmp || exit 1
+cmp diffpos.tmp /dev/null > /dev/null || exit 1
+if $DIFFPOS --sorted "$srcdir/pos.pos" "$srcdir/pos.pos" > diffpos.tmp 2>&1 ; then
+  exit 1
+fi
+rm -f diffpos.tmp
+
 for args in '' '--survey survey' '--survey survey.xyzzy' '--survey xyzzy' ; do
   echo "diffpos $args"
   rm -f diffpos.tmp
@@ -73,5 +95,24 @@ for args in '' '--survey survey' '--survey survey.xyzzy' '--survey xyzzy' ; do
   cmp diffpos.tmp /dev/null > /dev/null || exit 1
   rm -f diffpos.tmp
 done
+# surveyindex.3d has a survey index, which is used when reading with a survey
+# filter, so check we get the same stations as filtering the .pos file.
+# surveyindex9.3d is the same survey in format version 9, and
+# surveyindexz.3d is compressed (unless cavern was built without zlib).
+rm -f surveyindexz.3d surveyindexz.err
+$CAVERN --compress-3d --output=surveyindexz "$srcdir/surveyindex.svx" > /dev/null || exit 1
+for file in "$srcdir/surveyindex.3d" "$srcdir/surveyindex9.3d" surveyindexz.3d ; do
+  for survey in '' a a.b a.c ab xyzzy ; do
+    echo "diffpos --survey '$survey' $file"
+    rm -f diffpos.tmp
+    $DIFFPOS --survey "$survey" "$file" "$srcdir/surveyindex.pos" > diffpos.tmp
+    if test -n "$VERBOSE" ; then
+      cat diffpos.tmp
+    fi
+    cmp diffpos.tmp /dev/null > /dev/null || exit 1
+    rm -f diffpos.tmp
+  done
+done
+rm -f surveyindexz.3d surveyindexz.err
 test -n "$VERBOSE" && echo "Test passed"
 exit 0
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Survex micro-benchmark - time diffpos takes to compare pairs of synthetic
+# .pos files of increasing size.
+#
+# Copyright (C) 2026 The Survex Project
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Usage: diffposbench.sh [NUMBER_OF_STATIONS...]
+#
+# This isn't run by "make check" - run it by hand to look at how diffpos
+# scales with the number of stations.  In the second file of each pair about
+# 1% of the stations have been deleted, 1% have moved and 1% are new, and
+# the order of the stations is different.  Extra options can be passed to
+# diffpos by setting DIFFPOS_OPTS.
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+test -x "$testdir"/../src/diffpos || testdir=.
+
+: ${DIFFPOS="$testdir"/../src/diffpos}
+
+: ${SIZES=${*:-"10000 100000 1000000"}}
+
+LANG=C
+export LANG
+
+tmp=diffposbench.$$
+trap 'rm -f "$tmp".*' 0 1 2 15
+
+printf '%8s %8s %10s\n' stations changes seconds
+for n in $SIZES ; do
+  awk -v n="$n" -v old="$tmp.old.pos" -v new="$tmp.new.pos" 'BEGIN {
+    srand(1)
+    print "( Easting, Northing, Altitude )" > old
+    print "( Easting, Northing, Altitude )" > new
+    for (i = 0; i < n; i++) {
+      # Number the stations in a different order in each file.
+      j = (i * 7919) % n
+      name = sprintf("cave.%d.%d", int(j / 250), j % 250)
+      x = rand() * 20000 - 10000
+      y = rand() * 20000 - 10000
+      z = rand() * 1000 - 500
+      printf "(%9.2f, %9.2f, %9.2f ) %s\n", x, y, z, name > old
+      r = rand()
+      if (r < 0.01) continue
+      if (r < 0.02) x += 1
+      printf "(%9.2f, %9.2f, %9.2f ) %s\n", x, y, z, name > new
+      if (r > 0.99)
+	printf "(%9.2f, %9.2f, %9.2f ) new.%d\n", x, y, z, i > new
+    }
+  }'
+  # perl's times() reports the CPU time used by child processes.
+  secs=`perl -e 'open my $out, ">&STDOUT" or die;
+		 open STDOUT, ">", $ARGV[0] or die;
+		 shift @ARGV;
+		 system(@ARGV);
+		 my @t = times; printf $out "%.2f\n", $t[2] + $t[3]' -- \
+	"$tmp.out" $DIFFPOS $DIFFPOS_OPTS "$tmp.old.pos" "$tmp.new.pos"`
+  changes=`wc -l < "$tmp.out"`
+  printf '%8d %8d %10s\n' "$n" "$changes" "$secs"
+done
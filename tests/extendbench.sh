@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# Survex micro-benchmark - time and memory extend takes to produce an
+# extended elevation of synthetic passages of increasing length.
+#
+# Copyright (C) 2026 The Survex Project
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Usage: extendbench.sh [PASSAGE_LENGTH...]
+#
+# This isn't run by "make check" - run it by hand to look at how extend
+# scales with the length of the survey.  Each synthetic survey is a single
+# passage of the given number of legs, which is the worst case for how deep
+# extend has to go, with a short side passage every 100 legs and a loop
+# every 1000.
+#
+# The CPU time is measured with perl.  The peak memory use (in KB) is only
+# reported if GNU time is available - set GNU_TIME if it isn't installed as
+# /usr/bin/time.
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${EXTEND="$testdir"/../src/extend}
+: ${GNU_TIME=/usr/bin/time}
+
+: ${SIZES=${*:-"10000 30000 100000 300000"}}
+
+LANG=C
+export LANG
+
+tmp=extendbench.$$
+trap 'rm -f "$tmp".*' 0 1 2 15
+
+if $GNU_TIME -f %M -o "$tmp.mem" true 2>/dev/null ; then
+  have_gnu_time=yes
+else
+  have_gnu_time=no
+fi
+
+printf '%8s %10s %10s\n' legs seconds peak_KB
+for n in $SIZES ; do
+  awk -v n="$n" 'BEGIN {
+    srand(1)
+    print "*fix 0 0 0 0"
+    print "*entrance 0"
+    print "*data normal from to tape compass clino"
+    side = 0
+    for (i = 0; i < n; i++) {
+      printf "%d %d %.2f %.1f %.1f\n", i, i + 1,
+	     5 + rand() * 5, rand() * 360, rand() * 60 - 30
+      if (i % 100 == 50) {
+	side++
+	printf "%d s%d.1 %.2f %.1f %.1f\n", i, side,
+	       5 + rand() * 5, rand() * 360, rand() * 60 - 30
+	printf "s%d.1 s%d.2 %.2f %.1f %.1f\n", side, side,
+	       5 + rand() * 5, rand() * 360, rand() * 60 - 30
+      }
+      if (i % 1000 == 999)
+	printf "%d %d %.2f %.1f %.1f\n", i + 1, i - 500,
+	       5 + rand() * 5, rand() * 360, rand() * 60 - 30
+    }
+  }' > "$tmp.svx"
+  $CAVERN --quiet --output="$tmp.3d" "$tmp.svx" > /dev/null || exit 1
+  if test yes = "$have_gnu_time" ; then
+    run="$GNU_TIME -f %M -o $tmp.mem"
+  else
+    run=
+  fi
+  # perl's times() reports the CPU time used by child processes.
+  secs=`perl -e 'open my $out, ">&STDOUT" or die;
+		 open STDOUT, ">", "/dev/null" or die;
+		 system(@ARGV) == 0 or exit 1;
+		 my @t = times; printf $out "%.2f\n", $t[2] + $t[3]' -- \
+	$run $EXTEND "$tmp.3d" "$tmp.ext.3d"` || exit 1
+  if test yes = "$have_gnu_time" ; then
+    mem=`tail -n 1 "$tmp.mem"`
+  else
+    mem=-
+  fi
+  printf '%8d %10s %10s\n' "$n" "$secs" "$mem"
+done
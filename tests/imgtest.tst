@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+# Survex test suite - img library tests
+# Copyright (C) 2026 The Survex Project
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+# allow us to run tests standalone more easily
+: ${srcdir="$testdir"}
+
+# force VERBOSE if we're run on a subset of tests
+test -n "$*" && VERBOSE=1
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${IMGTEST="$testdir"/../src/imgtest}
+
+: ${TESTS=${*:-"v0 v0b v1 v2 v3 surveyindex surveyindex9 extendx eswapx eswap-breakx extend2namesx"}}
+
+vg_error=123
+vg_log=vg.log
+if [ -n "$VALGRIND" ] ; then
+  rm -f "$vg_log"
+  IMGTEST="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $IMGTEST"
+fi
+
+# imgtest reads each file with img_read_item(), img_read_columns() and
+# img_read_columns_parallel() and checks they agree, and also checks that
+# the data can be written to memory and read back.
+for file in $TESTS ; do
+  echo $file
+  rm -f imgtest.tmp
+  $IMGTEST "$srcdir/$file.3d" > imgtest.tmp
+  exitcode=$?
+  if test -n "$VERBOSE" ; then
+    cat imgtest.tmp
+  fi
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test $exitcode = 0 || exit 1
+  rm -f imgtest.tmp
+done
+
+# Format version 9 files are split into chunks which
+# img_read_columns_parallel() decodes in parallel, but a chunk holds tens of
+# thousands of items so we need to generate a large enough survey to get
+# several.  Side passages start new traverses so legs and stations both
+# span chunks, and the LRUD data makes passages which do too.  Also check
+# a compressed version, which is decoded from memory.
+if test -z "$*" ; then
+  rm -f imgtestbig.svx imgtestbig.3d imgtestbigz.3d imgtestbig.err imgtestbigz.err
+  awk 'BEGIN {
+    srand(1)
+    print "*fix 0 0 0 0"
+    print "*data normal from to tape compass clino"
+    side = 0
+    for (i = 0; i < 30000; i++) {
+      printf "%d %d %.2f %.1f %.1f\n", i, i + 1,
+	     5 + rand() * 5, rand() * 360, rand() * 60 - 30
+      if (i % 10 == 5) {
+	side++
+	printf "%d s%d %.2f %.1f %.1f\n", i, side,
+	       5 + rand() * 5, rand() * 360, rand() * 60 - 30
+      }
+      if (i % 1000 == 999)
+	printf "%d %d %.2f %.1f %.1f\n", i + 1, i - 500,
+	       5 + rand() * 5, rand() * 360, rand() * 60 - 30
+    }
+    print "*data passage station left right up down"
+    for (i = 0; i <= 30000; i++)
+      printf "%d %.1f %.1f %.1f %.1f\n", i,
+	     rand() * 3, rand() * 3, rand() * 2, rand() * 2
+  }' > imgtestbig.svx
+  $CAVERN --3d-version=9 --output=imgtestbig imgtestbig.svx > /dev/null || exit 1
+  $CAVERN --3d-version=9 --compress-3d --output=imgtestbigz imgtestbig.svx > /dev/null || exit 1
+  for file in imgtestbig.3d imgtestbigz.3d ; do
+    echo $file
+    rm -f imgtest.tmp
+    $IMGTEST "$file" > imgtest.tmp
+    exitcode=$?
+    if test -n "$VERBOSE" ; then
+      cat imgtest.tmp
+    fi
+    if [ -n "$VALGRIND" ] ; then
+      if [ $exitcode = "$vg_error" ] ; then
+	cat "$vg_log"
+	rm "$vg_log"
+	exit 1
+      fi
+      rm "$vg_log"
+    fi
+    test $exitcode = 0 || exit 1
+    rm -f imgtest.tmp
+  done
+  rm -f imgtestbig.svx imgtestbig.3d imgtestbigz.3d imgtestbig.err imgtestbigz.err
+fi
+test -n "$VERBOSE" && echo "Test passed"
+exit 0
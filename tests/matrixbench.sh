@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Survex micro-benchmark - time to assemble and solve the network matrix
+# for synthetic NxN grid surveys of increasing size.
+#
+# Copyright (C) 2026 The Survex Project
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Usage: matrixbench.sh [GRID_SIZE...]
+#
+# This isn't run by "make check" - run it by hand to look at how the time
+# cavern takes scales with the number of stations.  Extra options can be
+# passed to cavern by setting CAVERN_OPTS, e.g. CAVERN_OPTS=--solver=sparse
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+
+: ${SIZES=${*:-"10 20 40 80 120 160"}}
+
+LANG=C
+export LANG
+
+tmp=matrixbench.$$
+trap 'rm -f "$tmp".*' 0 1 2 15
+
+printf '%8s %8s %10s\n' stations legs seconds
+for n in $SIZES ; do
+  # Each station is joined to its neighbours to the east and north, with a
+  # little noise in the readings so the network has something to adjust.
+  awk -v n="$n" 'BEGIN {
+    srand(1)
+    print "*fix 0.0 0 0 0"
+    print "*data normal from to tape compass clino"
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < n; j++) {
+	if (j + 1 < n)
+	  printf "%d.%d %d.%d %.2f %.1f %.1f\n", i, j, i, j + 1,
+		 10 + rand() * .2 - .1, 89 + rand() * 2, rand() * 2 - 1
+	if (i + 1 < n)
+	  printf "%d.%d %d.%d %.2f %.1f %.1f\n", i, j, i + 1, j,
+		 10 + rand() * .2 - .1, rand() * 2 - 1, rand() * 2 - 1
+      }
+    }
+  }' > "$tmp.svx"
+  # Prefer the CPU time, but cavern only reports the elapsed time in some
+  # cases.
+  secs=`$CAVERN $CAVERN_OPTS -s --output="$tmp.3d" "$tmp.svx" |\
+    sed -n 's/.*( *\([0-9.]*\)s CPU time)$/\1/p;s/^CPU time used *\([0-9.]*\)s$/\1/p;s/^Time used *\([0-9.]*\)s$/\1/p'`
+  printf '%8d %8d %10s\n' `expr $n \* $n` `expr 2 \* $n \* \( $n - 1 \)` "$secs"
+done